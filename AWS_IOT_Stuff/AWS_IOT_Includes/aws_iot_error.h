@@ -38,6 +38,9 @@ extern "C" {
  * Values greater than 0 are specific non-error return codes
  */
 typedef enum {
+	/** Returned by a QoS1 publish whose PUBACK didn't arrive. It is kept in the in-flight
+	 *  store and sent again, with DUP set, when the client reconnects */
+			MQTT_PUBLISH_QUEUED = 7,
 	/** Returned when the Network physical layer is connected */
 			NETWORK_PHYSICAL_LAYER_CONNECTED = 6,
 	/** Returned when the Network is manually disconnected */
@@ -156,7 +159,11 @@ typedef enum {
 	/** Some limit has been exceeded, e.g. the maximum number of subscriptions has been reached */
 			LIMIT_EXCEEDED_ERROR = -51,
 	/** Invalid input topic type */
-			INVALID_TOPIC_TYPE_ERROR = -52
+			INVALID_TOPIC_TYPE_ERROR = -52,
+	/** MQTT 5: The broker refused the request with a failure reason code, see aws_iot_mqtt_get_last_reason_code */
+			MQTT_REASON_CODE_FAILURE_ERROR = -53,
+	/** MQTT 5: The broker closed the connection with a DISCONNECT packet */
+			MQTT_SERVER_DISCONNECTED_ERROR = -54
 } IoT_Error_t;
 
 #ifdef __cplusplus
@@ -59,10 +59,48 @@ extern "C" {
 
 #ifdef _ENABLE_THREAD_SUPPORT_
 #include "threads_interface.h"
+#ifdef __STDC_NO_ATOMICS__
+#error "_ENABLE_THREAD_SUPPORT_ needs C11 atomics for the client state"
+#endif
+#include <stdatomic.h>
+/** Shared between threads without a lock, see aws_iot_mqtt_set_client_state */
+#define AWS_IOT_MQTT_ATOMIC(type) _Atomic(type)
+#else
+#define AWS_IOT_MQTT_ATOMIC(type) type
 #endif
 
 #define MAX_PACKET_ID 65535
 
+#ifndef AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH
+/** Most QoS1 publishes aws_iot_mqtt_publish_async can have waiting for a PUBACK at once */
+#define AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH 8
+#endif
+
+#ifndef AWS_IOT_MQTT_INFLIGHT_STORE_LEN
+/** Bytes for copies of the topics and payloads of unacknowledged QoS1 publishes, so they
+ *  can be sent again after a reconnect. Publishes that don't fit are not retransmitted */
+#define AWS_IOT_MQTT_INFLIGHT_STORE_LEN 4096
+#endif
+
+#ifndef AWS_IOT_MQTT_TX_QUEUE_LEN
+/** Bytes of small packets, PUBACKs, PINGREQs and async publishes, collected into one
+ *  write when write coalescing is enabled, see aws_iot_mqtt_set_write_coalescing */
+#define AWS_IOT_MQTT_TX_QUEUE_LEN 512
+#endif
+
+#ifndef AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM
+/** MQTT 5 topic aliases kept in each direction. Only used when connected with MQTT_5_0 */
+#define AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM 8
+#endif
+
+#ifndef AWS_IOT_MQTT_MAX_MATCHING_HANDLERS
+/** Handlers collected per pass when delivering one message, more matches take extra passes */
+#define AWS_IOT_MQTT_MAX_MATCHING_HANDLERS 16
+#endif
+
+/** No handler / trie node, end of a list */
+#define AWS_IOT_MQTT_INDEX_NONE 0xFFFFFFFFu
+
 typedef struct _Client AWS_IoT_Client;
 
 /**
@@ -95,11 +133,13 @@ typedef struct {
 /**
  * @brief MQTT Version Type
  *
- * Defining an MQTT version type. Only 3.1.1 is supported at this time
+ * Defining an MQTT version type. 3.1.1 is the default. With 5.0 the client uses topic aliases,
+ * honours the broker's Receive Maximum and reports reason codes, nothing else of 5.0 is exposed.
  *
  */
 typedef enum {
-	MQTT_3_1_1 = 4    ///< MQTT 3.1.1 (protocol message byte = 4)
+	MQTT_3_1_1 = 4,    ///< MQTT 3.1.1 (protocol message byte = 4)
+	MQTT_5_0 = 5       ///< MQTT 5.0 (protocol message byte = 5)
 } MQTT_Ver_t;
 
 /**
@@ -178,13 +218,20 @@ typedef struct {
 #ifdef _ENABLE_THREAD_SUPPORT_
 	bool isBlockOnThreadLockEnabled;		///< Timeout for Thread blocking calls. Set to 0 to block until lock is obtained. In milliseconds
 #endif
+	/* Last, so positional initializers written before these existed still line up */
+	const unsigned char *pRootCABuffer;		///< Root CA in memory, used instead of pRootCALocation when not NULL
+	size_t rootCABufferLen;				///< Length of pRootCABuffer, for PEM including the terminating NUL
+	const unsigned char *pDeviceCertBuffer;		///< Device certificate in memory, used instead of pDeviceCertLocation when not NULL
+	size_t deviceCertBufferLen;			///< Length of pDeviceCertBuffer, for PEM including the terminating NUL
+	const unsigned char *pDevicePrivateKeyBuffer;	///< Device private key in memory, used instead of pDevicePrivateKeyLocation when not NULL
+	size_t devicePrivateKeyBufferLen;		///< Length of pDevicePrivateKeyBuffer, for PEM including the terminating NUL
 } IoT_Client_Init_Params;
 extern const IoT_Client_Init_Params iotClientInitParamsDefault;
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, true, NULL, NULL, false }
+#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, true, NULL, NULL, false, NULL, 0, NULL, 0, NULL, 0 }
 #else
-#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, true, NULL, NULL }
+#define IoT_Client_Init_Params_initializer { true, NULL, 0, NULL, NULL, NULL, 2000, 20000, 5000, true, NULL, NULL, NULL, 0, NULL, 0, NULL, 0 }
 #endif
 
 /**
@@ -220,6 +267,66 @@ typedef enum _ClientState {
 typedef void (*pApplicationHandler_t)(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
 									  IoT_Publish_Message_Params *pParams, void *pClientData);
 
+/**
+ * @brief Stream Event Type
+ *
+ * Defining a TYPE for what a call to a stream handler carries (see aws_iot_mqtt_subscribe_stream)
+ *
+ */
+typedef enum {
+	MQTT_STREAM_BEGIN = 0,		///< New message. pParams has the header, payloadLen is the total payload length, payload is NULL
+	MQTT_STREAM_FRAGMENT = 1,	///< payload/payloadLen is the next piece of the payload, starting at payloadOffset
+	MQTT_STREAM_END = 2,		///< Whole payload delivered, payloadLen is the total again
+	MQTT_STREAM_ABORTED = 3		///< Connection failed part way through, drop what was received
+} MQTTStreamEvent;
+
+/**
+ * @brief Stream Callback Handler Type
+ *
+ * Defining a TYPE for definition of streaming callback function pointers.
+ * Receives a message as it is read from the network, so payloads larger than
+ * the RX buffer can be consumed. Called while the packet is still being read:
+ * must not call any other MQTT API.
+ *
+ */
+typedef void (*pStreamHandler_t)(AWS_IoT_Client *pClient, MQTTStreamEvent event, char *pTopicName,
+								 uint16_t topicNameLen, IoT_Publish_Message_Params *pParams, size_t payloadOffset,
+								 void *pClientData);
+
+/**
+ * @brief Publish Complete Callback Handler Type
+ *
+ * Defining a TYPE for definition of publish completion callback function pointers.
+ * Called once for every publish accepted by aws_iot_mqtt_publish_async. rc is SUCCESS
+ * when the PUBACK arrives. A QoS1 publish kept in the in-flight store is sent again on
+ * every reconnect until it is acknowledged. One that didn't fit in the store completes with
+ * MQTT_REQUEST_TIMEOUT_ERROR if the PUBACK doesn't arrive within the command timeout and
+ * NETWORK_DISCONNECTED_ERROR if the connection is lost first.
+ *
+ */
+typedef void (*pPublishCompleteHandler_t)(AWS_IoT_Client *pClient, uint16_t packetId, IoT_Error_t rc,
+										  void *pCompleteHandlerData);
+
+/**
+ * @brief In-flight Publish
+ *
+ * Defining a type for a QoS1 publish that has been sent and is waiting for its PUBACK
+ *
+ */
+typedef struct _InFlightPublish {
+	bool isInUse;
+	bool isBlocking;		///< aws_iot_mqtt_publish is waiting for this PUBACK itself
+	bool isStored;			///< Topic and payload are in the in-flight store, sent again on reconnect
+	uint8_t isRetained;
+	uint16_t packetId;
+	uint16_t topicNameLen;
+	size_t payloadLen;
+	size_t storeOffset;		///< Topic followed by payload in ClientData.inFlightStore
+	Timer ackTimer;
+	pPublishCompleteHandler_t pCompleteHandler;
+	void *pCompleteHandlerData;
+} InFlightPublish;
+
 /**
  * @brief MQTT Message Handler
  *
@@ -232,9 +339,76 @@ typedef struct _MessageHandlers {
 	uint16_t topicNameLen;
 	QoS qos;
 	pApplicationHandler_t pApplicationHandler;
+	pStreamHandler_t pStreamHandler;   /* Set instead of pApplicationHandler for streaming subscriptions */
 	void *pApplicationHandlerData;
+	uint32_t trieNode;   /* Trie node a wildcard filter ends at, AWS_IOT_MQTT_INDEX_NONE for exact topics */
+	uint32_t next;       /* Next handler ending at the same trie node, or next free slot */
 } MessageHandlers;   /* Message handlers are indexed by subscription topic */
 
+/**
+ * @brief Subscription Hash Table
+ *
+ * Open addressing hash table of uint32_t indices. A slot holds index + 1,
+ * 0 for never used and SUBSCRIPTION_HASH_TOMBSTONE for deleted
+ *
+ */
+typedef struct _SubscriptionHashTable {
+	uint32_t *pSlots;
+	uint32_t size;       /* Power of two, 0 until the first insert */
+	uint32_t used;       /* Live entries plus tombstones */
+	uint32_t live;
+} SubscriptionHashTable;
+
+/**
+ * @brief Subscription Trie Node
+ *
+ * One level of one or more wildcard topic filters. Node 0 is the root.
+ * The segment can be "+" or "#", children are found through the edge hash table
+ *
+ */
+typedef struct _SubscriptionTrieNode {
+	char *pSegment;
+	uint16_t segmentLen;
+	bool isInUse;
+	uint32_t parent;         /* Or next free node when not in use */
+	uint32_t refCount;       /* Children plus handlers ending here */
+	uint32_t firstHandler;
+} SubscriptionTrieNode;
+
+/**
+ * @brief Subscription Index
+ *
+ * Finds the handlers for an incoming topic without scanning every subscription.
+ * Exact topics are looked up in one hash table, wildcard filters are walked level
+ * by level in a trie so delivery costs O(topic levels)
+ *
+ */
+typedef struct _SubscriptionIndex {
+	uint32_t firstFreeHandler;
+	uint32_t handlerCount;
+	uint32_t streamHandlerCount;
+	SubscriptionHashTable exactTopics;   /* Handler indices keyed by topic */
+	SubscriptionHashTable trieEdges;     /* Node indices keyed by parent node and segment */
+	SubscriptionTrieNode *pTrieNodes;
+	uint32_t trieNodesSize;
+	uint32_t firstFreeTrieNode;
+} SubscriptionIndex;
+
+/**
+ * @brief MQTT Subscription Parameters
+ *
+ * Defining a type for one topic in a batch subscribe (see aws_iot_mqtt_subscribe_batch)
+ * @warning pTopicName and pApplicationHandlerData need to be static in memory.
+ *
+ */
+typedef struct {
+	const char *pTopicName;				///< Topic filter to subscribe to
+	uint16_t topicNameLen;				///< Length of the topic filter
+	QoS qos;					///< Requested QoS
+	pApplicationHandler_t pApplicationHandler;	///< Handler for messages on this topic
+	void *pApplicationHandlerData;			///< Passed to the handler
+} IoT_Subscription_Params;
+
 /**
  * @brief MQTT Client Status
  *
@@ -243,11 +417,61 @@ typedef struct _MessageHandlers {
  *
  */
 typedef struct _ClientStatus {
-	ClientState clientState;
+	AWS_IOT_MQTT_ATOMIC(ClientState) clientState;
 	bool isPingOutstanding;
 	bool isAutoReconnectEnabled;
+	bool isSessionPresent;		///< Broker resumed the session of a non clean connect, subscriptions are still there
 } ClientStatus;
 
+/**
+ * @brief MQTT 5 Topic Alias
+ *
+ * One entry of a topic alias table, the alias is its index + 1.
+ *
+ */
+typedef struct {
+	char *pTopicName;		///< Copy of the topic, NULL while the alias is unused
+	uint16_t topicNameLen;		///< Length of the topic
+} TopicAlias;
+
+/**
+ * @brief MQTT 5 Session State
+ *
+ * What was agreed with the broker in CONNECT/CONNACK and the topic aliases of the
+ * connection. Reset on every connect, aliases don't outlive the network connection.
+ *
+ */
+typedef struct {
+	uint16_t receiveMaximum;	///< QoS1 publishes the broker takes without a PUBACK, 65535 if it didn't say
+	uint16_t topicAliasMaximum;	///< Highest alias the broker takes from us, 0 if none
+	uint32_t maximumPacketSize;	///< Largest packet the broker takes, 0 if it didn't say
+	uint8_t lastReasonCode;		///< Last failure reason code received, 0 if none yet
+	TopicAlias txTopicAliases[AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM];	///< Aliases we have set for our publishes
+	TopicAlias rxTopicAliases[AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM];	///< Aliases the broker has set for its publishes
+} MQTT5Session;
+
+/**
+ * @brief Oversized Packet
+ *
+ * A packet too large for the RX buffer that has only been partly read. The network
+ * can run out of data anywhere in it, the next cycle carries on from here. Its header
+ * stays at the start of the RX buffer, a streamed PUBLISH payload goes through the
+ * space behind it a piece at a time, anything else is read there and dropped.
+ *
+ */
+typedef struct {
+	size_t remainingLen;		///< Bytes of the packet still to come, 0 when none is part way
+	bool isStreaming;		///< Payload goes to the handlers below, otherwise it is dropped
+	size_t headerLen;		///< Bytes of the packet kept at the start of the RX buffer
+	size_t payloadOffset;		///< Payload bytes handed to the handlers so far
+	char *pTopicName;		///< Topic, in the RX buffer or the topic alias table
+	uint16_t topicNameLen;		///< Length of the topic
+	IoT_Publish_Message_Params params;	///< Header of the PUBLISH, payloadLen is the total
+	uint32_t streamCount;		///< Handlers of the PUBLISH, picked when it started
+	pStreamHandler_t streamHandlers[AWS_IOT_MQTT_MAX_MATCHING_HANDLERS];	///< The handlers
+	void *streamHandlerData[AWS_IOT_MQTT_MAX_MATCHING_HANDLERS];		///< Data of each handler
+} OversizedPacket;
+
 /**
  * @brief MQTT Client Data
  *
@@ -263,28 +487,61 @@ typedef struct _ClientData {
 	uint16_t keepAliveInterval;
 	uint32_t currentReconnectWaitInterval;
 	uint32_t counterNetworkDisconnected;
+	/* State changes refused because the state was not the expected one */
+	AWS_IOT_MQTT_ATOMIC(uint32_t) counterStateContention;
 
 	/* The below values are initialized with the
 	 * lengths of the TX/RX buffers and never modified
 	 * afterwards */
 	size_t writeBufSize;
 	size_t readBufSize;
+	/* Bytes received into readBuf. Can run past the current packet when the
+	 * network gives more than asked for, the rest is the start of the next one */
     size_t readBufIndex;
+	/* Length of the packet at the start of readBuf that has been handed out.
+	 * It is dropped, and what follows moved to the front, before the next read */
+	size_t readBufPacketLen;
+	/* Packet too large for readBuf, read over as many cycles as the network needs */
+	OversizedPacket rxOversized;
 	unsigned char writeBuf[AWS_IOT_MQTT_TX_BUF_LEN];
 	unsigned char readBuf[AWS_IOT_MQTT_RX_BUF_LEN];
+	/* Packets waiting to go out together, under tls_write_mutex */
+	bool isWriteCoalescingEnabled;
+	size_t txQueueLen;
+	unsigned char txQueue[AWS_IOT_MQTT_TX_QUEUE_LEN];
 
 #ifdef _ENABLE_THREAD_SUPPORT_
 	bool isBlockOnThreadLockEnabled;
-	IoT_Mutex_t state_change_mutex;
 	IoT_Mutex_t tls_read_mutex;
 	IoT_Mutex_t tls_write_mutex;
 #endif
 
 	IoT_Client_Connect_Params options;
 
-	MessageHandlers messageHandlers[AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS];
+	/* Grows from AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS as needed, a free slot has a NULL topicName */
+	MessageHandlers *messageHandlers;
+	uint32_t messageHandlersSize;
+	SubscriptionIndex subscriptionIndex;
 	iot_disconnect_handler disconnectHandler;
 
+	InFlightPublish inFlightPublishes[AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH];
+	uint16_t inFlightWindow;
+	uint16_t inFlightCount;
+	/* Stored publishes are packed in the order they were sent, which is the order they are sent again in */
+	unsigned char inFlightStore[AWS_IOT_MQTT_INFLIGHT_STORE_LEN];
+	size_t inFlightStoreUsed;
+
+	MQTT5Session mqtt5;
+
+	/* Connected under its own client ID with the same subscriptions, takes over the
+	 * connection when this one fails. NULL if there is none */
+	AWS_IoT_Client *pStandby;
+	bool isStandby;
+	uint32_t counterStandbyPromoted;
+	/* Took over the client ID, and persistent session, of its primary in a switch.
+	 * Cleared once the connection that picks that session up is gone */
+	bool isSessionInherited;
+
 	void *disconnectHandlerData;
 } ClientData;
 
@@ -301,6 +558,9 @@ struct _Client {
 	ClientStatus clientStatus;
 	ClientData clientData;
 	Network networkStack;
+	/* The network the client uses: its own networkStack, or its standby's once the
+	 * standby has been promoted, see aws_iot_mqtt_set_standby */
+	Network *pNetworkStack;
 };
 
 /**
@@ -391,6 +651,119 @@ IoT_Error_t aws_iot_mqtt_set_disconnect_handler(AWS_IoT_Client *pClient, iot_dis
  */
 IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(AWS_IoT_Client *pClient, bool newStatus);
 
+/**
+ * @brief Set the QoS1 publish window
+ *
+ * Called to set how many aws_iot_mqtt_publish_async QoS1 publishes may be waiting for
+ * their PUBACK at once. Defaults to AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH, which is also the
+ * largest window allowed. Publishes already in flight are not affected.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param window Number of publishes allowed in flight, 1 to AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH
+ *
+ * @return IoT_Error_t Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_publish_window(AWS_IoT_Client *pClient, uint16_t window);
+
+/**
+ * @brief Get count of in-flight publishes
+ *
+ * Called to get the number of QoS1 publishes still waiting for their PUBACK
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint16_t the in-flight count
+ */
+uint16_t aws_iot_mqtt_get_inflight_publish_count(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Get the last MQTT 5 failure reason code
+ *
+ * Called after an API returned MQTT_REASON_CODE_FAILURE_ERROR, MQTT_SERVER_DISCONNECTED_ERROR or a
+ * CONNACK error to see what the broker said. Always 0 with MQTT 3.1.1
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint8_t the reason code (0x80 and above), 0 if none was received
+ */
+uint8_t aws_iot_mqtt_get_last_reason_code(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Did the broker resume the previous session
+ *
+ * True after a connect with isCleanSession = false for which the broker had kept the
+ * session. Its subscriptions are still active, so reconnects skip the resubscribe, and
+ * QoS1 messages queued while the client was away are delivered by the next yields
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return true if the session of the last connect was present
+ */
+bool aws_iot_mqtt_is_session_present(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Get the socket of the network connection
+ *
+ * For callers that wait for incoming data in their own poll or epoll loop, see
+ * iot_tls_set_nonblocking. Call aws_iot_mqtt_yield with a zero timeout when it is readable
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pSocket Where to store the socket descriptor
+ *
+ * @return SUCCESS, or NETWORK_DISCONNECTED_ERROR if the network has no socket
+ */
+IoT_Error_t aws_iot_mqtt_get_network_socket(AWS_IoT_Client *pClient, int *pSocket);
+
+/**
+ * @brief Get the time until the client needs a yield for its keep alive
+ *
+ * A poll or epoll loop uses it as its timeout, so pings go out even when nothing arrives
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint32_t milliseconds until the next keep alive check, 0 if it is due
+ */
+uint32_t aws_iot_mqtt_get_keep_alive_timeout_ms(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Get the memory one client and its connection use
+ *
+ * The client struct, with its TX and RX buffers and the network, plus what the
+ * subscriptions, topic aliases and network layer have allocated. The shadow RX buffer
+ * is shared by all clients and not part of it
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return size_t bytes, 0 for a NULL pClient
+ */
+size_t aws_iot_mqtt_get_memory_usage(AWS_IoT_Client *pClient);
+
+/**
+ * @brief Collect small outgoing packets into one write
+ *
+ * When enabled PUBACKs, PINGREQs and async publishes are queued, up to
+ * AWS_IOT_MQTT_TX_QUEUE_LEN bytes, and go out in one write, so one TLS record and one
+ * syscall, when the queue is full, when yield has handled everything received, with
+ * the next packet that isn't queued, or on aws_iot_mqtt_flush. Disabled by default
+ *
+ * @param pClient Reference to the IoT Client
+ * @param isEnabled true to queue, false to send each packet as before. Disabling flushes the queue
+ *
+ * @return An IoT Error Type defining successful/failed flush
+ */
+IoT_Error_t aws_iot_mqtt_set_write_coalescing(AWS_IoT_Client *pClient, bool isEnabled);
+
+/**
+ * @brief Send the packets waiting to be coalesced now
+ *
+ * For callers that publish a burst outside of yield and don't want to wait for the next one
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed send, SUCCESS if nothing was waiting
+ */
+IoT_Error_t aws_iot_mqtt_flush(AWS_IoT_Client *pClient);
+
 /**
  * @brief Get count of Network Disconnects
  *
@@ -402,6 +775,18 @@ IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(AWS_IoT_Client *pClient, bool
  */
 uint32_t aws_iot_mqtt_get_network_disconnected_count(AWS_IoT_Client *pClient);
 
+/**
+ * @brief Get count of standby promotions
+ *
+ * Called to get the number of times the standby connection took over from a failed one,
+ * see aws_iot_mqtt_set_standby. These are not counted as network disconnects
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint32_t the promotion count
+ */
+uint32_t aws_iot_mqtt_get_standby_promoted_count(AWS_IoT_Client *pClient);
+
 /**
  * @brief Reset Network Disconnect conter
  *
@@ -411,6 +796,18 @@ uint32_t aws_iot_mqtt_get_network_disconnected_count(AWS_IoT_Client *pClient);
  */
 void aws_iot_mqtt_reset_network_disconnected_count(AWS_IoT_Client *pClient);
 
+/**
+ * @brief Get count of refused client state changes
+ *
+ * Called to get the number of times aws_iot_mqtt_set_client_state found the client in
+ * another state than the expected one, typically because another thread was using it
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return uint32_t the contention count
+ */
+uint32_t aws_iot_mqtt_get_state_contention_count(AWS_IoT_Client *pClient);
+
 #ifdef __cplusplus
 }
 #endif
@@ -69,12 +69,29 @@ typedef enum msgTypes {
 	DISCONNECT = 14
 } MessageTypes;
 
+/* Packet type cycle_read leaves in place when nothing was read */
+#define MQTT_PACKET_TYPE_NONE 0xFF
+
 /* Macros for parsing header fields from incoming MQTT frame. */
 #define MQTT_HEADER_FIELD_TYPE(_byte)	((_byte >> 4) & 0x0F)
 #define MQTT_HEADER_FIELD_DUP(_byte)	((_byte & (1 << 3)) >> 3)
 #define MQTT_HEADER_FIELD_QOS(_byte)	((_byte & (3 << 1)) >> 1)
 #define MQTT_HEADER_FIELD_RETAIN(_byte)	((_byte & (1 << 0)) >> 0)
 
+/* MQTT 5 property identifiers the client reads or writes, MQTT v5.0 Specification 2.2.2.2 */
+#define MQTT5_PROPERTY_SESSION_EXPIRY_INTERVAL 0x11
+#define MQTT5_PROPERTY_SERVER_KEEP_ALIVE 0x13
+#define MQTT5_PROPERTY_RECEIVE_MAXIMUM 0x21
+#define MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT5_PROPERTY_TOPIC_ALIAS 0x23
+#define MQTT5_PROPERTY_MAXIMUM_PACKET_SIZE 0x27
+
+/* MQTT 5 reason codes from this value up are failures, MQTT v5.0 Specification 2.4 */
+#define MQTT5_REASON_CODE_FAILURE 0x80
+
+/* Is the client connected (or connecting) with MQTT 5 */
+#define AWS_IOT_MQTT_IS_V5(pClient) (MQTT_5_0 == (pClient)->clientData.options.MQTTVersion)
+
 /**
  * Bitfields for the MQTT header byte.
  */
@@ -89,7 +106,7 @@ IoT_Error_t aws_iot_mqtt_internal_serialize_ack(unsigned char *pTxBuf, size_t tx
 												MessageTypes msgType, uint8_t dup, uint16_t packetId,
 												uint32_t *pSerializedLen);
 IoT_Error_t aws_iot_mqtt_internal_deserialize_ack(unsigned char *, unsigned char *,
-												  uint16_t *, unsigned char *, size_t);
+												  uint16_t *, uint8_t *, unsigned char *, size_t);
 
 uint32_t aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(uint32_t rem_len);
 
@@ -104,18 +121,66 @@ unsigned char aws_iot_mqtt_internal_read_char(unsigned char **pptr);
 void aws_iot_mqtt_internal_write_char(unsigned char **pptr, unsigned char c);
 void aws_iot_mqtt_internal_write_utf8_string(unsigned char **pptr, const char *string, uint16_t stringLen);
 
+uint32_t aws_iot_mqtt_internal_count_topics_that_fit(size_t txBufLen, uint32_t variableHeaderLen,
+													  uint16_t *pTopicNameLenList, uint32_t count,
+													  uint32_t perTopicOverhead);
+
 IoT_Error_t aws_iot_mqtt_internal_flushBuffers( AWS_IoT_Client *pClient );
 IoT_Error_t aws_iot_mqtt_internal_send_packet(AWS_IoT_Client *pClient, size_t length, Timer *pTimer);
+IoT_Error_t aws_iot_mqtt_internal_send_packet_with_payload(AWS_IoT_Client *pClient, size_t length,
+														   const unsigned char *pPayload, size_t payloadLen,
+														   Timer *pTimer);
+IoT_Error_t aws_iot_mqtt_internal_queue_packet(AWS_IoT_Client *pClient, size_t length,
+											   const unsigned char *pPayload, size_t payloadLen, Timer *pTimer);
+IoT_Error_t aws_iot_mqtt_internal_flush_tx_queue(AWS_IoT_Client *pClient);
 IoT_Error_t aws_iot_mqtt_internal_cycle_read(AWS_IoT_Client *pClient, Timer *pTimer, uint8_t *pPacketType);
 IoT_Error_t aws_iot_mqtt_internal_wait_for_read(AWS_IoT_Client *pClient, uint8_t packetType, Timer *pTimer);
 IoT_Error_t aws_iot_mqtt_internal_serialize_zero(unsigned char *pTxBuf, size_t txBufLen,
 												 MessageTypes packetType, size_t *pSerializedLength);
-IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
+IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(MQTT_Ver_t mqttVersion, uint8_t *dup, QoS *qos,
 													  uint8_t *retained, uint16_t *pPacketId,
 													  char **pTopicName, uint16_t *topicNameLen,
+													  uint16_t *pTopicAlias,
 													  unsigned char **payload, size_t *payloadLen,
 													  unsigned char *pRxBuf, size_t rxBufLen);
 
+IoT_Error_t aws_iot_mqtt_internal_deliver_message(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+												 IoT_Publish_Message_Params *pMessageParams);
+IoT_Error_t aws_iot_mqtt_internal_handle_puback(AWS_IoT_Client *pClient, uint8_t *pPacketType);
+void aws_iot_mqtt_internal_check_inflight_timeouts(AWS_IoT_Client *pClient);
+void aws_iot_mqtt_internal_fail_inflight_publishes(AWS_IoT_Client *pClient, IoT_Error_t rc);
+IoT_Error_t aws_iot_mqtt_internal_resend_inflight_publishes(AWS_IoT_Client *pClient, Timer *pTimer);
+
+IoT_Error_t aws_iot_mqtt_internal_reserve_handlers(AWS_IoT_Client *pClient, uint32_t count);
+IoT_Error_t aws_iot_mqtt_internal_add_handler(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+											  QoS qos, pApplicationHandler_t pApplicationHandler,
+											  pStreamHandler_t pStreamHandler, void *pApplicationHandlerData);
+uint32_t aws_iot_mqtt_internal_remove_handlers(AWS_IoT_Client *pClient, const char *pTopicFilter,
+											   uint16_t topicFilterLen);
+bool aws_iot_mqtt_internal_has_handler(AWS_IoT_Client *pClient, const char *pTopicFilter, uint16_t topicFilterLen);
+uint32_t aws_iot_mqtt_internal_match_handlers(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+											  uint32_t skip, uint32_t *pMatches, uint32_t maxMatches);
+void aws_iot_mqtt_internal_free_handlers(AWS_IoT_Client *pClient);
+
+IoT_Error_t aws_iot_mqtt_internal_mirror_subscriptions(AWS_IoT_Client *pClient);
+IoT_Error_t aws_iot_mqtt_internal_promote_standby(AWS_IoT_Client *pClient);
+
+IoT_Error_t aws_iot_mqtt_internal_read_properties_length(unsigned char **pptr, unsigned char *pEnd,
+														 uint32_t *pPropertiesLen);
+IoT_Error_t aws_iot_mqtt_internal_read_property(unsigned char **pptr, unsigned char *pEnd, uint8_t *pPropertyId,
+												uint32_t *pValue);
+IoT_Error_t aws_iot_mqtt_internal_skip_properties(unsigned char **pptr, unsigned char *pEnd);
+IoT_Error_t aws_iot_mqtt_internal_read_publish_properties(unsigned char **pptr, unsigned char *pEnd,
+														  uint16_t *pTopicAlias);
+void aws_iot_mqtt_internal_reset_mqtt5_session(AWS_IoT_Client *pClient);
+uint16_t aws_iot_mqtt_internal_find_tx_topic_alias(AWS_IoT_Client *pClient, const char *pTopicName,
+												   uint16_t topicNameLen);
+uint16_t aws_iot_mqtt_internal_next_tx_topic_alias(AWS_IoT_Client *pClient);
+IoT_Error_t aws_iot_mqtt_internal_set_tx_topic_alias(AWS_IoT_Client *pClient, uint16_t topicAlias,
+													 const char *pTopicName, uint16_t topicNameLen);
+IoT_Error_t aws_iot_mqtt_internal_apply_rx_topic_alias(AWS_IoT_Client *pClient, uint16_t topicAlias,
+													   char **ppTopicName, uint16_t *pTopicNameLen);
+
 IoT_Error_t aws_iot_mqtt_set_client_state(AWS_IoT_Client *pClient, ClientState expectedCurrentState,
 										  ClientState newState);
 
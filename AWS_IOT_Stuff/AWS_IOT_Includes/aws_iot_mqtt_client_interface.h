@@ -100,6 +100,8 @@ IoT_Error_t aws_iot_mqtt_connect(AWS_IoT_Client *pClient, IoT_Client_Connect_Par
  * @note Call is blocking.  In the case of a QoS 0 message the function returns
  * after the message was successfully passed to the TLS layer.  In the case of QoS 1
  * the function returns after the receipt of the PUBACK control packet.
+ * If the PUBACK doesn't come and the message is in the in-flight store, MQTT_PUBLISH_QUEUED
+ * is returned: it will be sent again on reconnect, the application doesn't need to retry.
  *
  * @param pClient Reference to the IoT Client
  * @param pTopicName Topic Name to publish to
@@ -111,6 +113,29 @@ IoT_Error_t aws_iot_mqtt_connect(AWS_IoT_Client *pClient, IoT_Client_Connect_Par
 IoT_Error_t aws_iot_mqtt_publish(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
 								 IoT_Publish_Message_Params *pParams);
 
+/**
+ * @brief Publish an MQTT message on a topic without waiting for the PUBACK
+ *
+ * Called to publish an MQTT message on a topic.
+ * @note Call returns once the message was passed to the TLS layer. For QoS 1 the PUBACK
+ * is picked up by a later yield (or any other blocking call) and pCompleteHandler is
+ * called then, so many publishes can be on the wire at once. For QoS 0 pCompleteHandler
+ * is called before returning. On error nothing is in flight and pCompleteHandler is not called.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters. pParams->id is set to the packet id used
+ * @param pCompleteHandler Called once the publish completes (can be NULL)
+ * @param pCompleteHandlerData Passed to pCompleteHandler
+ *
+ * @return An IoT Error Type defining successful/failed publish. LIMIT_EXCEEDED_ERROR if the
+ *         publish window is full, yield and try again
+ */
+IoT_Error_t aws_iot_mqtt_publish_async(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+									   IoT_Publish_Message_Params *pParams,
+									   pPublishCompleteHandler_t pCompleteHandler, void *pCompleteHandlerData);
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -132,6 +157,29 @@ IoT_Error_t aws_iot_mqtt_publish(AWS_IoT_Client *pClient, const char *pTopicName
 IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
 								   QoS qos, pApplicationHandler_t pApplicationHandler, void *pApplicationHandlerData);
 
+/**
+ * @brief Subscribe to an MQTT topic with a streaming handler.
+ *
+ * Like aws_iot_mqtt_subscribe, but matching messages are handed to pStreamHandler as they
+ * are read: MQTT_STREAM_BEGIN with the topic and header, MQTT_STREAM_FRAGMENT for each piece
+ * of the payload, then MQTT_STREAM_END (or MQTT_STREAM_ABORTED if the connection fails part way).
+ * Payloads larger than the RX buffer are streamed instead of dropped, only the topic and
+ * header have to fit. The handler must not call other MQTT APIs.
+ * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
+ * @warning pTopicName and pStreamHandlerData need to be static in memory.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic filter to subscribe to
+ * @param topicNameLen Length of the topic filter
+ * @param qos Requested QoS
+ * @param pStreamHandler Reference to the streaming handler for this subscription
+ * @param pStreamHandlerData Point to data passed to the callback
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t aws_iot_mqtt_subscribe_stream(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+										  QoS qos, pStreamHandler_t pStreamHandler, void *pStreamHandlerData);
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -146,6 +194,25 @@ IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicNa
  */
 IoT_Error_t aws_iot_mqtt_resubscribe(AWS_IoT_Client *pClient);
 
+/**
+ * @brief Subscribe to several MQTT topics at once.
+ *
+ * Called to send subscribe messages to the broker for a list of topics. Topics are packed
+ * into as few SUBSCRIBE packets as the TX buffer allows and all packets are sent before
+ * waiting for the SUBACKs, so the call costs about one round trip whatever the count.
+ * @note Call is blocking.  The call returns after the receipt of all SUBACK control packets.
+ * @warning pTopicName and pApplicationHandlerData of every entry need to be static in memory.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pSubscriptions Array of topics to subscribe to
+ * @param count Number of entries in pSubscriptions
+ *
+ * @return An IoT Error Type defining successful/failed subscription. FAILURE if the broker
+ *         refused any of the topics, the others are still subscribed
+ */
+IoT_Error_t aws_iot_mqtt_subscribe_batch(AWS_IoT_Client *pClient, IoT_Subscription_Params *pSubscriptions,
+										 uint32_t count);
+
 /**
  * @brief Unsubscribe to an MQTT topic.
  *
@@ -161,6 +228,25 @@ IoT_Error_t aws_iot_mqtt_resubscribe(AWS_IoT_Client *pClient);
  */
 IoT_Error_t aws_iot_mqtt_unsubscribe(AWS_IoT_Client *pClient, const char *pTopicFilter, uint16_t topicFilterLen);
 
+/**
+ * @brief Unsubscribe from several MQTT topics at once.
+ *
+ * Called to send unsubscribe messages to the broker for a list of topics, packed into as
+ * few UNSUBSCRIBE packets as the TX buffer allows. Topics the client isn't subscribed to
+ * are skipped.
+ * @note Call is blocking.  The call returns after the receipt of all UNSUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicFilterList Array of topic filters
+ * @param pTopicFilterLenList Array of topic filter lengths
+ * @param count Number of entries in the arrays
+ *
+ * @return An IoT Error Type defining successful/failed unsubscribe call. FAILURE if none of
+ *         the topics were subscribed
+ */
+IoT_Error_t aws_iot_mqtt_unsubscribe_batch(AWS_IoT_Client *pClient, const char **pTopicFilterList,
+										   uint16_t *pTopicFilterLenList, uint32_t count);
+
 /**
  * @brief Disconnect an MQTT Connection
  *
@@ -181,9 +267,12 @@ IoT_Error_t aws_iot_mqtt_disconnect(AWS_IoT_Client *pClient);
  * must be called at a rate faster than the keepalive interval.  It must also be called
  * at a rate faster than the incoming message rate as this is the only way the client receives
  * processing time to manage incoming messages.
+ * With a timeout of 0 it handles what has already arrived and returns as soon as nothing
+ * more is there, for callers that wait for the network socket themselves.
  *
  * @param pClient Reference to the IoT Client
  * @param timeout_ms Maximum number of milliseconds to pass thread execution to the client.
+ *                   0 to not wait for data at all.
  *
  * @return An IoT Error Type defining successful/failed client processing.
  *         If this call results in an error it is likely the MQTT connection has dropped.
@@ -206,6 +295,35 @@ IoT_Error_t aws_iot_mqtt_yield(AWS_IoT_Client *pClient, uint32_t timeout_ms);
  */
 IoT_Error_t aws_iot_mqtt_attempt_reconnect(AWS_IoT_Client *pClient);
 
+/**
+ * @brief Keep a second connection ready to take over from this one
+ *
+ * pStandby is a client initialized for the same endpoint and connected under its own
+ * client ID, with auto reconnect enabled. It is subscribed to whatever pClient is
+ * subscribed to, now and after every (un)subscribe on pClient, and drops what it
+ * receives. aws_iot_mqtt_yield on pClient yields the standby too.
+ * When the connection of pClient fails, keep alive or network error, the standby's
+ * connection is switched in instead of disconnecting: pClient stays connected, with its
+ * handlers, over a connection that is already subscribed, and unacknowledged QoS1
+ * publishes are sent again on it. The standby reconnects the failed network from the
+ * following yields and becomes the standby again.
+ * The standby reconnects under the client ID pClient had before the switch. If that
+ * connection uses a persistent session (isCleanSession false, the shadow's default),
+ * the broker redelivers on it the QoS1 messages the failed connection never
+ * acknowledged. These are the messages the standby dropped just before the switch, so
+ * the standby passes them, DUP flag set, to the handlers of pClient. A message pClient
+ * had handled but not yet acknowledged is delivered twice, as QoS1 allows.
+ * @note QoS0 messages the standby dropped before the switch are not delivered again.
+ * @warning pStandby must stay valid while it is set, set NULL before freeing it.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pStandby Reference to the standby IoT Client, NULL to remove the standby
+ *
+ * @return An IoT Error Type defining successful/failed subscription of the standby.
+ *         FAILURE if pStandby is pClient or already part of a pair
+ */
+IoT_Error_t aws_iot_mqtt_set_standby(AWS_IoT_Client *pClient, AWS_IoT_Client *pStandby);
+
 #ifdef __cplusplus
 }
 #endif
@@ -73,6 +73,8 @@ typedef struct {
 	char *pMqttClientId; ///< Currently the Shadow uses MQTT to connect and it is important to ensure we have unique client id
 	uint16_t mqttClientIdLen; ///< Currently the Shadow uses MQTT to connect and it is important to ensure we have unique client id
 	pApplicationHandler_t deleteActionHandler;	///< Callback to be invoked when Thing shadow for this device is deleted
+	bool isPersistentSession;	///< Connect without clean session so the broker keeps subscriptions and queued deltas across reconnects
+	MQTT_Ver_t MQTTVersion;	///< MQTT_5_0 lets the long shadow topics go out as topic aliases
 } ShadowConnectParameters_t;
 
 /*!
@@ -42,6 +42,16 @@ extern "C" {
  */
 typedef struct Network Network;
 
+/**
+ * @brief Network I/O Vector
+ *
+ * One piece of a message handed to the vectored write, see writev below.
+ */
+typedef struct {
+	const unsigned char *pBase;    ///< Start of the piece
+	size_t len;                    ///< Length of the piece in bytes
+} NetworkIOVec;
+
 /**
  * @brief TLS Connection Parameters
  *
@@ -52,10 +62,19 @@ typedef struct {
 	char *pRootCALocation;                ///< Pointer to string containing the filename (including path) of the root CA file.
 	char *pDeviceCertLocation;            ///< Pointer to string containing the filename (including path) of the device certificate.
 	char *pDevicePrivateKeyLocation;    ///< Pointer to string containing the filename (including path) of the device private key file.
+	const unsigned char *pRootCABuffer;    ///< Root CA in memory, PEM or DER. Used instead of pRootCALocation when not NULL.
+	size_t rootCABufferLen;                ///< Length of pRootCABuffer, for PEM including the terminating NUL.
+	const unsigned char *pDeviceCertBuffer;    ///< Device certificate in memory. Used instead of pDeviceCertLocation when not NULL.
+	size_t deviceCertBufferLen;            ///< Length of pDeviceCertBuffer, for PEM including the terminating NUL.
+	const unsigned char *pDevicePrivateKeyBuffer;    ///< Device private key in memory. Used instead of pDevicePrivateKeyLocation when not NULL.
+	size_t devicePrivateKeyBufferLen;    ///< Length of pDevicePrivateKeyBuffer, for PEM including the terminating NUL.
 	char *pDestinationURL;                ///< Pointer to string containing the endpoint of the MQTT service.
 	uint16_t DestinationPort;            ///< Integer defining the connection port of the MQTT service.
 	uint32_t timeout_ms;                ///< Unsigned integer defining the TLS handshake timeout value in milliseconds.
 	bool ServerVerificationFlag;        ///< Boolean.  True = perform server certificate hostname validation.  False = skip validation \b NOT recommended.
+	bool isNonBlocking;                ///< Boolean.  True = reads return NETWORK_SSL_NOTHING_TO_READ right away instead of waiting for data.
+	bool isKernelTLS;                ///< Boolean.  True = hand record encryption to the kernel after the handshake where supported.
+	uint16_t maxFragmentLen;            ///< Largest TLS record payload asked of the broker with the max_fragment_length extension, 0 = don't ask.
 } TLSConnectParams;
 
 /**
@@ -67,10 +86,13 @@ struct Network {
 	IoT_Error_t (*connect)(Network *, TLSConnectParams *);
 
 	IoT_Error_t (*read)(Network *, unsigned char *, size_t, Timer *, size_t *);    ///< Function pointer pointing to the network function to read from the network
+	IoT_Error_t (*readAvailable)(Network *, unsigned char *, size_t, Timer *, size_t *);    ///< Function pointer pointing to the network function to read whatever has arrived, up to a maximum. Can be NULL, read is used instead
 	IoT_Error_t (*write)(Network *, unsigned char *, size_t, Timer *, size_t *);    ///< Function pointer pointing to the network function to write to the network
+	IoT_Error_t (*writev)(Network *, const NetworkIOVec *, size_t, Timer *, size_t *);    ///< Function pointer pointing to the network function to write a list of buffers in order. Can be NULL, write is used instead
 	IoT_Error_t (*disconnect)(Network *);    ///< Function pointer pointing to the network function to disconnect from the network
 	IoT_Error_t (*isConnected)(Network *);    ///< Function pointer pointing to the network function to check if TLS is connected
 	IoT_Error_t (*destroy)(Network *);        ///< Function pointer pointing to the network function to destroy the network object
+	IoT_Error_t (*getSocket)(Network *, int *);    ///< Function pointer pointing to the network function to get the socket to poll. Can be NULL
 
 	TLSConnectParams tlsConnectParams;        ///< TLSConnect params structure containing the common connection parameters
 	TLSDataParams tlsDataParams;            ///< TLSData params structure containing the connection data parameters that are specific to the library being used
@@ -98,13 +120,107 @@ IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDevice
 						 char *pDevicePrivateKeyLocation, char *pDestinationURL,
 						 uint16_t DestinationPort, uint32_t timeout_ms, bool ServerVerificationFlag);
 
+/**
+ * @brief Use credentials from memory
+ *
+ * Any credential given here is used instead of the file at its location. The buffers
+ * are read on the next connect and must stay valid until then.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param pRootCABuffer - Root CA, PEM or DER. NULL to read it from its file
+ * @param rootCABufferLen - Length of the Root CA, for PEM including the terminating NUL
+ * @param pDeviceCertBuffer - Device certificate. NULL to read it from its file
+ * @param deviceCertBufferLen - Length of the device certificate
+ * @param pDevicePrivateKeyBuffer - Device private key. NULL to read it from its file
+ * @param devicePrivateKeyBufferLen - Length of the device private key
+ *
+ * @return IoT_Error_t - successful update or NULL_VALUE_ERROR
+ */
+IoT_Error_t iot_tls_set_credential_buffers(Network *pNetwork, const unsigned char *pRootCABuffer,
+										   size_t rootCABufferLen, const unsigned char *pDeviceCertBuffer,
+										   size_t deviceCertBufferLen, const unsigned char *pDevicePrivateKeyBuffer,
+										   size_t devicePrivateKeyBufferLen);
+
+/**
+ * @brief Switch the connection to non-blocking reads
+ *
+ * Takes effect on the next connect. The handshake still blocks, after it reads
+ * return what the TLS layer has without waiting, so the caller can wait for the
+ * socket from iot_tls_get_socket in its own poll or epoll loop and yield with a
+ * zero timeout when it is readable. Writes wait for room in the socket, bounded by
+ * their timer.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param isNonBlocking - true for non-blocking reads
+ *
+ * @return IoT_Error_t - successful update or NULL_VALUE_ERROR
+ */
+IoT_Error_t iot_tls_set_nonblocking(Network *pNetwork, bool isNonBlocking);
+
+/**
+ * @brief Hand record encryption to the kernel after the handshake
+ *
+ * Takes effect on the next connect. Only TLS 1.2 AES-GCM sessions are offloaded,
+ * anything else stays in mbedTLS. Once offloaded the socket from iot_tls_get_socket
+ * can be used with sendfile. Needs a build with _ENABLE_KTLS_SUPPORT_.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param isKernelTLS - true to use kernel TLS when possible
+ *
+ * @return IoT_Error_t - SUCCESS, NULL_VALUE_ERROR or FAILURE if kernel TLS is not built in
+ */
+IoT_Error_t iot_tls_set_kernel_tls(Network *pNetwork, bool isKernelTLS);
+
+/**
+ * @brief Ask the broker for smaller TLS records
+ *
+ * Takes effect on the next connect. The broker is asked, with the max_fragment_length
+ * extension, to send records of at most maxFragmentLen bytes, so record buffers can be
+ * that small instead of 16 KiB. They only shrink when mbedTLS is built with smaller
+ * MBEDTLS_SSL_IN_CONTENT_LEN/MBEDTLS_SSL_OUT_CONTENT_LEN or with
+ * MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH. Brokers that ignore the extension keep sending
+ * full size records, which then fail with small buffers.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param maxFragmentLen - 512, 1024, 2048, 4096, or 0 to not ask
+ *
+ * @return IoT_Error_t - SUCCESS, NULL_VALUE_ERROR or FAILURE for a length that can't be used
+ */
+IoT_Error_t iot_tls_set_max_fragment_len(Network *pNetwork, uint16_t maxFragmentLen);
+
+/**
+ * @brief Get the memory the connection holds outside the Network struct
+ *
+ * Record buffers, certificates and whatever else the network layer allocated for
+ * this connection. Together with sizeof(Network) it is the cost of one connection.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ *
+ * @return size_t - bytes, 0 for a NULL pNetwork
+ */
+size_t iot_tls_get_memory_usage(Network *pNetwork);
+
+/**
+ * @brief Get the socket of the connection
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param pSocket - Where to store the socket descriptor
+ *
+ * @return IoT_Error_t - SUCCESS or NETWORK_DISCONNECTED_ERROR if there is no socket
+ */
+IoT_Error_t iot_tls_get_socket(Network *pNetwork, int *pSocket);
+
 /**
  * @brief Create a TLS socket and open the connection
  *
  * Creates an open socket connection including TLS handshake.
+ * The parsed credentials, the seeded random number generator and the resolved
+ * endpoint address are kept from the first connect, later ones only do the handshake.
  *
  * @param pNetwork - Pointer to a Network struct defining the network interface.
- * @param TLSParams - TLSConnectParams defines the properties of the TLS connection.
+ * @param TLSParams - TLSConnectParams defines the properties of the TLS connection, credential
+ *                    buffers included. NULL to connect with what iot_tls_init and
+ *                    iot_tls_set_credential_buffers set.
  * @return IoT_Error_t - successful connection or TLS error
  */
 IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *TLSParams);
@@ -121,6 +237,20 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *TLSParams);
  */
 IoT_Error_t iot_tls_write(Network *, unsigned char *, size_t, Timer *, size_t *);
 
+/**
+ * @brief Write a list of buffers to the network socket
+ *
+ * Writes the buffers in order as one stream, straight from where they are,
+ * so a caller doesn't have to copy the pieces of a message together first.
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param NetworkIOVec pointer - buffers to write
+ * @param size_t - number of buffers
+ * @param Timer * - operation timer
+ * @param size_t - pointer to store number of bytes written in total
+ * @return IoT_Error_t - successful write or TLS error code
+ */
+IoT_Error_t iot_tls_writev(Network *, const NetworkIOVec *, size_t, Timer *, size_t *);
+
 /**
  * @brief Read bytes from the network socket
  *
@@ -133,6 +263,21 @@ IoT_Error_t iot_tls_write(Network *, unsigned char *, size_t, Timer *, size_t *)
  */
 IoT_Error_t iot_tls_read(Network *, unsigned char *, size_t, Timer *, size_t *);
 
+/**
+ * @brief Read what has arrived from the TLS network buffer
+ *
+ * Unlike iot_tls_read this doesn't wait for the buffer to be filled. It waits for
+ * the first data, then returns it together with anything else the TLS layer has
+ * already decrypted, up to the size of the buffer.
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param unsigned char pointer - pointer to buffer where read data should be copied
+ * @param size_t - size of the buffer, the most that is read
+ * @param Timer * - operation timer
+ * @param size_t - pointer to store number of bytes read
+ * @return IoT_Error_t - successful read, NETWORK_SSL_NOTHING_TO_READ or TLS error code
+ */
+IoT_Error_t iot_tls_read_available(Network *, unsigned char *, size_t, Timer *, size_t *);
+
 /**
  * @brief Disconnect from network socket
  *
@@ -145,12 +290,23 @@ IoT_Error_t iot_tls_disconnect(Network *pNetwork);
  * @brief Perform any tear-down or cleanup of TLS layer
  *
  * Called to cleanup any resources required for the TLS layer.
+ * What is kept for the next connect stays, see iot_tls_free.
  *
  * @param Network - Pointer to a Network struct defining the network interface
  * @return IoT_Error_t - successful cleanup or TLS error code
  */
 IoT_Error_t iot_tls_destroy(Network *pNetwork);
 
+/**
+ * @brief Release what the TLS layer keeps across connections
+ *
+ * Called once the network won't be connected again, after iot_tls_destroy.
+ *
+ * @param Network - Pointer to a Network struct defining the network interface
+ * @return IoT_Error_t - successful release or NULL_VALUE_ERROR
+ */
+IoT_Error_t iot_tls_free(Network *pNetwork);
+
 /**
  * @brief Check if TLS layer is still connected
  *
@@ -43,6 +43,7 @@ extern "C" {
 
 #include "aws_iot_log.h"
 #include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_mqtt_client_common_internal.h"
 #include "aws_iot_version.h"
 
 #if !DISABLE_METRICS
@@ -103,9 +104,6 @@ IoT_Error_t aws_iot_mqtt_client_unlock_mutex(AWS_IoT_Client *pClient, IoT_Mutex_
 IoT_Error_t aws_iot_mqtt_set_client_state(AWS_IoT_Client *pClient, ClientState expectedCurrentState,
 										  ClientState newState) {
 	IoT_Error_t rc;
-#ifdef _ENABLE_THREAD_SUPPORT_
-	IoT_Error_t threadRc = FAILURE;
-#endif
 
 	FUNC_ENTRY;
 	if(NULL == pClient) {
@@ -113,23 +111,21 @@ IoT_Error_t aws_iot_mqtt_set_client_state(AWS_IoT_Client *pClient, ClientState e
 	}
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pClient->clientData.state_change_mutex));
-	if(SUCCESS != rc) {
-		return rc;
+	/* Single word, a compare-exchange does what a mutex around check and set would */
+	if(atomic_compare_exchange_strong(&(pClient->clientStatus.clientState), &expectedCurrentState, newState)) {
+		rc = SUCCESS;
+	} else {
+		atomic_fetch_add_explicit(&(pClient->clientData.counterStateContention), 1, memory_order_relaxed);
+		rc = MQTT_UNEXPECTED_CLIENT_STATE_ERROR;
 	}
-#endif
+#else
 	if(expectedCurrentState == aws_iot_mqtt_get_client_state(pClient)) {
 		pClient->clientStatus.clientState = newState;
 		rc = SUCCESS;
 	} else {
+		pClient->clientData.counterStateContention++;
 		rc = MQTT_UNEXPECTED_CLIENT_STATE_ERROR;
 	}
-
-#ifdef _ENABLE_THREAD_SUPPORT_
-	threadRc = aws_iot_mqtt_client_unlock_mutex(pClient, &(pClient->clientData.state_change_mutex));
-	if(SUCCESS == rc && SUCCESS != threadRc) {
-		rc = threadRc;
-	}
 #endif
 
 	FUNC_EXIT_RC(rc);
@@ -177,18 +173,12 @@ IoT_Error_t aws_iot_mqtt_free(AWS_IoT_Client *pClient)
         rc = NULL_VALUE_ERROR;
     }else
 	{
-	#ifdef _ENABLE_THREAD_SUPPORT_
-		if (rc == SUCCESS)
-		{
-			rc = aws_iot_thread_mutex_destroy(&(pClient->clientData.state_change_mutex));
-		}
+		aws_iot_mqtt_internal_free_handlers(pClient);
+		aws_iot_mqtt_internal_reset_mqtt5_session(pClient);
+		(void)iot_tls_free(pClient->pNetworkStack);
 
-		if (rc == SUCCESS)
-		{
-			rc = aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_read_mutex));
-		}else{
-			(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_read_mutex));
-		}
+	#ifdef _ENABLE_THREAD_SUPPORT_
+		rc = aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_read_mutex));
 
 		if (rc == SUCCESS)
 		{
@@ -209,28 +199,51 @@ IoT_Error_t aws_iot_mqtt_init(AWS_IoT_Client *pClient, IoT_Client_Init_Params *p
 
 	FUNC_ENTRY;
 
-	if(NULL == pClient || NULL == pInitParams || NULL == pInitParams->pHostURL || 0 == pInitParams->port ||
-	   NULL == pInitParams->pRootCALocation || NULL == pInitParams->pDevicePrivateKeyLocation ||
-	   NULL == pInitParams->pDeviceCertLocation) {
+	if(NULL == pClient || NULL == pInitParams || NULL == pInitParams->pHostURL || 0 == pInitParams->port) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	for(i = 0; i < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		pClient->clientData.messageHandlers[i].topicName = NULL;
-		pClient->clientData.messageHandlers[i].pApplicationHandler = NULL;
-		pClient->clientData.messageHandlers[i].pApplicationHandlerData = NULL;
-		pClient->clientData.messageHandlers[i].qos = QOS0;
+#if !defined(IOT_NETWORK_PLAIN_TCP) && !defined(IOT_NETWORK_LOOPBACK)
+	if((NULL == pInitParams->pRootCALocation && NULL == pInitParams->pRootCABuffer) ||
+	   (NULL == pInitParams->pDevicePrivateKeyLocation && NULL == pInitParams->pDevicePrivateKeyBuffer) ||
+	   (NULL == pInitParams->pDeviceCertLocation && NULL == pInitParams->pDeviceCertBuffer)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
+#endif
+
+	/* Handler table is allocated on the first subscribe */
+	pClient->clientData.messageHandlers = NULL;
+	pClient->clientData.messageHandlersSize = 0;
+	memset(&(pClient->clientData.subscriptionIndex), 0, sizeof(SubscriptionIndex));
+	pClient->clientData.subscriptionIndex.firstFreeHandler = AWS_IOT_MQTT_INDEX_NONE;
+	pClient->clientData.subscriptionIndex.firstFreeTrieNode = AWS_IOT_MQTT_INDEX_NONE;
 
 	pClient->clientData.packetTimeoutMs = pInitParams->mqttPacketTimeout_ms;
 	pClient->clientData.commandTimeoutMs = pInitParams->mqttCommandTimeout_ms;
 	pClient->clientData.writeBufSize = AWS_IOT_MQTT_TX_BUF_LEN;
 	pClient->clientData.readBufSize = AWS_IOT_MQTT_RX_BUF_LEN;
+	pClient->clientData.isWriteCoalescingEnabled = false;
+	pClient->clientData.txQueueLen = 0;
 	pClient->clientData.counterNetworkDisconnected = 0;
+	pClient->clientData.counterStateContention = 0;
 	pClient->clientData.disconnectHandler = pInitParams->disconnectHandler;
 	pClient->clientData.disconnectHandlerData = pInitParams->disconnectHandlerData;
 	pClient->clientData.nextPacketId = 1;
 
+	for(i = 0; i < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; ++i) {
+		pClient->clientData.inFlightPublishes[i].isInUse = false;
+	}
+	pClient->clientData.inFlightWindow = AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH;
+	pClient->clientData.inFlightCount = 0;
+	pClient->clientData.inFlightStoreUsed = 0;
+
+	memset(&(pClient->clientData.mqtt5), 0, sizeof(MQTT5Session));
+	memset(&(pClient->clientData.rxOversized), 0, sizeof(OversizedPacket));
+	pClient->clientData.pStandby = NULL;
+	pClient->clientData.isStandby = false;
+	pClient->clientData.isSessionInherited = false;
+	pClient->clientData.counterStandbyPromoted = 0;
+
 	/* Initialize default connection options */
 	rc = aws_iot_mqtt_set_connect_params(pClient, &default_options);
 	if(SUCCESS != rc) {
@@ -239,34 +252,35 @@ IoT_Error_t aws_iot_mqtt_init(AWS_IoT_Client *pClient, IoT_Client_Init_Params *p
 
 #ifdef _ENABLE_THREAD_SUPPORT_
 	pClient->clientData.isBlockOnThreadLockEnabled = pInitParams->isBlockOnThreadLockEnabled;
-	rc = aws_iot_thread_mutex_init(&(pClient->clientData.state_change_mutex));
-	if(SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
-	}
 	rc = aws_iot_thread_mutex_init(&(pClient->clientData.tls_read_mutex));
 	if(SUCCESS != rc) {
-		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.state_change_mutex));
 		FUNC_EXIT_RC(rc);
 	}
 	rc = aws_iot_thread_mutex_init(&(pClient->clientData.tls_write_mutex));
 	if(SUCCESS != rc) {
 		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_read_mutex));
-		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.state_change_mutex));
 		FUNC_EXIT_RC(rc);
 	}
 #endif
 
 	pClient->clientStatus.isPingOutstanding = 0;
 	pClient->clientStatus.isAutoReconnectEnabled = pInitParams->enableAutoReconnect;
+	pClient->clientStatus.isSessionPresent = false;
 
-	rc = iot_tls_init(&(pClient->networkStack), pInitParams->pRootCALocation, pInitParams->pDeviceCertLocation,
+	pClient->pNetworkStack = &(pClient->networkStack);
+	rc = iot_tls_init(pClient->pNetworkStack, pInitParams->pRootCALocation, pInitParams->pDeviceCertLocation,
 					  pInitParams->pDevicePrivateKeyLocation, pInitParams->pHostURL, pInitParams->port,
 					  pInitParams->tlsHandshakeTimeout_ms, pInitParams->isSSLHostnameVerify);
+	if(SUCCESS == rc) {
+		rc = iot_tls_set_credential_buffers(pClient->pNetworkStack, pInitParams->pRootCABuffer,
+											pInitParams->rootCABufferLen, pInitParams->pDeviceCertBuffer,
+											pInitParams->deviceCertBufferLen, pInitParams->pDevicePrivateKeyBuffer,
+											pInitParams->devicePrivateKeyBufferLen);
+	}
 
 	if(SUCCESS != rc) {
 		#ifdef _ENABLE_THREAD_SUPPORT_
 		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_read_mutex));
-		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.state_change_mutex));
 		(void)aws_iot_thread_mutex_destroy(&(pClient->clientData.tls_write_mutex));
 		#endif
 		pClient->clientStatus.clientState = CLIENT_STATE_INVALID;
@@ -354,6 +368,113 @@ IoT_Error_t aws_iot_mqtt_set_disconnect_handler(AWS_IoT_Client *pClient, iot_dis
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+IoT_Error_t aws_iot_mqtt_set_publish_window(AWS_IoT_Client *pClient, uint16_t window) {
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(0 == window || AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH < window) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+
+	pClient->clientData.inFlightWindow = window;
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+uint16_t aws_iot_mqtt_get_inflight_publish_count(AWS_IoT_Client *pClient) {
+	return pClient->clientData.inFlightCount;
+}
+
+uint8_t aws_iot_mqtt_get_last_reason_code(AWS_IoT_Client *pClient) {
+	return pClient->clientData.mqtt5.lastReasonCode;
+}
+
+bool aws_iot_mqtt_is_session_present(AWS_IoT_Client *pClient) {
+	return pClient->clientStatus.isSessionPresent;
+}
+
+IoT_Error_t aws_iot_mqtt_get_network_socket(AWS_IoT_Client *pClient, int *pSocket) {
+	if(NULL == pClient || NULL == pSocket) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(NULL == pClient->pNetworkStack->getSocket) {
+		return NETWORK_DISCONNECTED_ERROR;
+	}
+
+	return pClient->pNetworkStack->getSocket(pClient->pNetworkStack, pSocket);
+}
+
+uint32_t aws_iot_mqtt_get_keep_alive_timeout_ms(AWS_IoT_Client *pClient) {
+	if(has_timer_expired(&(pClient->pingTimer))) {
+		return 0;
+	}
+
+	return left_ms(&(pClient->pingTimer));
+}
+
+size_t aws_iot_mqtt_get_memory_usage(AWS_IoT_Client *pClient) {
+	SubscriptionIndex *pIndex;
+	size_t bytes;
+	uint32_t i;
+
+	if(NULL == pClient) {
+		return 0;
+	}
+
+	pIndex = &(pClient->clientData.subscriptionIndex);
+
+	bytes = sizeof(AWS_IoT_Client);
+	bytes += pClient->clientData.messageHandlersSize * sizeof(MessageHandlers);
+	bytes += pIndex->trieNodesSize * sizeof(SubscriptionTrieNode);
+	for(i = 0; i < pIndex->trieNodesSize; i++) {
+		if(pIndex->pTrieNodes[i].isInUse && NULL != pIndex->pTrieNodes[i].pSegment) {
+			bytes += (size_t) pIndex->pTrieNodes[i].segmentLen + 1;
+		}
+	}
+	for(i = 0; i < AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM; i++) {
+		if(NULL != pClient->clientData.mqtt5.txTopicAliases[i].pTopicName) {
+			bytes += pClient->clientData.mqtt5.txTopicAliases[i].topicNameLen;
+		}
+		if(NULL != pClient->clientData.mqtt5.rxTopicAliases[i].pTopicName) {
+			bytes += pClient->clientData.mqtt5.rxTopicAliases[i].topicNameLen;
+		}
+	}
+	bytes += iot_tls_get_memory_usage(pClient->pNetworkStack);
+
+	return bytes;
+}
+
+IoT_Error_t aws_iot_mqtt_set_write_coalescing(AWS_IoT_Client *pClient, bool isEnabled) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pClient->clientData.isWriteCoalescingEnabled = isEnabled;
+	rc = SUCCESS;
+	if(!isEnabled) {
+		rc = aws_iot_mqtt_internal_flush_tx_queue(pClient);
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_flush(AWS_IoT_Client *pClient) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	rc = aws_iot_mqtt_internal_flush_tx_queue(pClient);
+	FUNC_EXIT_RC(rc);
+}
+
 uint32_t aws_iot_mqtt_get_network_disconnected_count(AWS_IoT_Client *pClient) {
 	return pClient->clientData.counterNetworkDisconnected;
 }
@@ -362,6 +483,10 @@ void aws_iot_mqtt_reset_network_disconnected_count(AWS_IoT_Client *pClient) {
 	pClient->clientData.counterNetworkDisconnected = 0;
 }
 
+uint32_t aws_iot_mqtt_get_state_contention_count(AWS_IoT_Client *pClient) {
+	return pClient->clientData.counterStateContention;
+}
+
 #ifdef __cplusplus
 }
 #endif
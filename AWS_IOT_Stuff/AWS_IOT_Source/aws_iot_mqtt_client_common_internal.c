@@ -265,86 +265,346 @@ IoT_Error_t aws_iot_mqtt_internal_init_header(MQTTHeader *pHeader, MessageTypes
 }
 
 IoT_Error_t aws_iot_mqtt_internal_send_packet(AWS_IoT_Client *pClient, size_t length, Timer *pTimer) {
+	return aws_iot_mqtt_internal_send_packet_with_payload(pClient, length, NULL, 0, pTimer);
+}
 
-	size_t sentLen, sent;
+/**
+ * @brief Write a header followed by a payload to the network
+ *
+ * Called with the write mutex held. Short writes are continued until the timer expires.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pHeader Start of the packet
+ * @param headerLen Length of the packet up to the payload
+ * @param pPayload Payload, can be NULL if payloadLen is 0
+ * @param payloadLen Length of the payload
+ * @param pTimer Timer for the write
+ *
+ * @return An IoT Error Type defining successful/failed write
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_write(AWS_IoT_Client *pClient, const unsigned char *pHeader,
+												size_t headerLen, const unsigned char *pPayload, size_t payloadLen,
+												Timer *pTimer) {
+	NetworkIOVec iov[2];
+	size_t iovCount, sentLen, sent, total;
 	IoT_Error_t rc;
 
+	sentLen = 0;
+	sent = 0;
+	total = headerLen + payloadLen;
+	rc = SUCCESS;
+
+	while(sent < total && !has_timer_expired(pTimer)) {
+		/* What is left, after a short write */
+		if(sent < headerLen) {
+			iov[0].pBase = &pHeader[sent];
+			iov[0].len = headerLen - sent;
+			iov[1].pBase = pPayload;
+			iov[1].len = payloadLen;
+			iovCount = (0 != payloadLen) ? 2 : 1;
+		} else {
+			iov[0].pBase = &pPayload[sent - headerLen];
+			iov[0].len = total - sent;
+			iovCount = 1;
+		}
+
+		if(NULL != pClient->pNetworkStack->writev) {
+			rc = pClient->pNetworkStack->writev(pClient->pNetworkStack, iov, iovCount, pTimer, &sentLen);
+		} else {
+			rc = pClient->pNetworkStack->write(pClient->pNetworkStack, (unsigned char *) iov[0].pBase, iov[0].len,
+											 pTimer, &sentLen);
+		}
+		if(SUCCESS != rc) {
+			/* there was an error writing the data */
+			return rc;
+		}
+		sent += sentLen;
+	}
+
+	if(sent == total) {
+		return SUCCESS;
+	}
+
+	return (SUCCESS != rc) ? rc : NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+}
+
+/**
+ * @brief Send the packet in writeBuf followed by a payload
+ *
+ * The payload is written from the caller's memory using the network's vectored
+ * write, so it isn't copied into writeBuf and its size isn't limited by it.
+ * Networks without writev get the payload copied behind the header if it fits,
+ * as before, or written separately if it doesn't.
+ * Packets waiting in the TX queue go first, in the same write when the packet
+ * fits behind them.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param length Length of the packet (up to the payload) in writeBuf
+ * @param pPayload Payload, can be NULL if payloadLen is 0
+ * @param payloadLen Length of the payload
+ * @param pTimer Timer for the write
+ *
+ * @return An IoT Error Type defining successful/failed send
+ */
+IoT_Error_t aws_iot_mqtt_internal_send_packet_with_payload(AWS_IoT_Client *pClient, size_t length,
+														   const unsigned char *pPayload, size_t payloadLen,
+														   Timer *pTimer) {
+	ClientData *pData;
+	IoT_Error_t rc, unlockRc;
+
 	FUNC_ENTRY;
 
-	if(NULL == pClient || NULL == pTimer) {
+	if(NULL == pClient || NULL == pTimer || (NULL == pPayload && 0 != payloadLen)) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
-	if(length >= pClient->clientData.writeBufSize) {
+	pData = &(pClient->clientData);
+
+	if(length >= pData->writeBufSize) {
 		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
 	}
 
+	if(NULL == pClient->pNetworkStack->writev && 0 != payloadLen &&
+	   length + payloadLen < pData->writeBufSize) {
+		memcpy(&pData->writeBuf[length], pPayload, payloadLen);
+		length += payloadLen;
+		payloadLen = 0;
+	}
+
 #ifdef _ENABLE_THREAD_SUPPORT_
-	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
+	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pData->tls_write_mutex));
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 #endif
 
-	sentLen = 0;
-	sent = 0;
-
-	while(sent < length && !has_timer_expired(pTimer)) {
-		rc = pClient->networkStack.write(&(pClient->networkStack),
-						 &pClient->clientData.writeBuf[sent],
-						 (length - sent),
-						 pTimer,
-						 &sentLen);
-		if(SUCCESS != rc) {
-			/* there was an error writing the data */
-			break;
+	rc = SUCCESS;
+	if(0 != pData->txQueueLen && pData->txQueueLen + length + payloadLen <= AWS_IOT_MQTT_TX_QUEUE_LEN) {
+		/* One write, and one TLS record, for everything */
+		memcpy(&pData->txQueue[pData->txQueueLen], pData->writeBuf, length);
+		if(0 != payloadLen) {
+			memcpy(&pData->txQueue[pData->txQueueLen + length], pPayload, payloadLen);
+		}
+		rc = _aws_iot_mqtt_internal_write(pClient, pData->txQueue, pData->txQueueLen + length + payloadLen, NULL, 0,
+										  pTimer);
+		pData->txQueueLen = 0;
+	} else {
+		if(0 != pData->txQueueLen) {
+			/* Whatever happens the queue is gone, a failed write means the connection is too */
+			rc = _aws_iot_mqtt_internal_write(pClient, pData->txQueue, pData->txQueueLen, NULL, 0, pTimer);
+			pData->txQueueLen = 0;
+		}
+		if(SUCCESS == rc) {
+			rc = _aws_iot_mqtt_internal_write(pClient, pData->writeBuf, length, pPayload, payloadLen, pTimer);
 		}
-		sent += sentLen;
 	}
 
 #ifdef _ENABLE_THREAD_SUPPORT_
-	rc = aws_iot_mqtt_client_unlock_mutex(pClient, &(pClient->clientData.tls_write_mutex));
+	unlockRc = aws_iot_mqtt_client_unlock_mutex(pClient, &(pData->tls_write_mutex));
+	if(SUCCESS != unlockRc) {
+		FUNC_EXIT_RC(unlockRc);
+	}
+#else
+	(void) unlockRc;
+#endif
+
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Queue the packet in writeBuf, with its payload, to go out with the next ones
+ *
+ * Used for packets nobody waits on, PUBACK, PINGREQ and async publishes. With write
+ * coalescing off, or when the packet doesn't fit in the queue, it is sent right away.
+ * The queue is sent when the next packet doesn't fit behind it, with the next packet
+ * that is sent directly, at the end of a burst in yield, or on aws_iot_mqtt_flush.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param length Length of the packet (up to the payload) in writeBuf
+ * @param pPayload Payload, can be NULL if payloadLen is 0
+ * @param payloadLen Length of the payload
+ * @param pTimer Timer for a write, if one is needed
+ *
+ * @return An IoT Error Type defining successful/failed queueing or send
+ */
+IoT_Error_t aws_iot_mqtt_internal_queue_packet(AWS_IoT_Client *pClient, size_t length,
+											   const unsigned char *pPayload, size_t payloadLen, Timer *pTimer) {
+	ClientData *pData;
+	IoT_Error_t rc, unlockRc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pTimer || (NULL == pPayload && 0 != payloadLen)) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pData = &(pClient->clientData);
+
+	if(!pData->isWriteCoalescingEnabled || length + payloadLen > AWS_IOT_MQTT_TX_QUEUE_LEN) {
+		rc = aws_iot_mqtt_internal_send_packet_with_payload(pClient, length, pPayload, payloadLen, pTimer);
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(length >= pData->writeBufSize) {
+		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pData->tls_write_mutex));
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 #endif
 
-	if(sent == length) {
-		/* record the fact that we have successfully sent the packet */
-		//countdown_sec(&c->pingTimer, c->clientData.keepAliveInterval);
+	rc = SUCCESS;
+	if(pData->txQueueLen + length + payloadLen > AWS_IOT_MQTT_TX_QUEUE_LEN) {
+		rc = _aws_iot_mqtt_internal_write(pClient, pData->txQueue, pData->txQueueLen, NULL, 0, pTimer);
+		pData->txQueueLen = 0;
+	}
+	if(SUCCESS == rc) {
+		memcpy(&pData->txQueue[pData->txQueueLen], pData->writeBuf, length);
+		/* PUBACK, PINGREQ and the like come without a payload */
+		if(0 != payloadLen) {
+			memcpy(&pData->txQueue[pData->txQueueLen + length], pPayload, payloadLen);
+		}
+		pData->txQueueLen += length + payloadLen;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	unlockRc = aws_iot_mqtt_client_unlock_mutex(pClient, &(pData->tls_write_mutex));
+	if(SUCCESS != unlockRc) {
+		FUNC_EXIT_RC(unlockRc);
+	}
+#else
+	(void) unlockRc;
+#endif
+
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Send the packets waiting in the TX queue
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed send, SUCCESS if nothing was queued
+ */
+IoT_Error_t aws_iot_mqtt_internal_flush_tx_queue(AWS_IoT_Client *pClient) {
+	ClientData *pData;
+	IoT_Error_t rc, unlockRc;
+	Timer timer;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pData = &(pClient->clientData);
+
+	if(0 == pData->txQueueLen) {
 		FUNC_EXIT_RC(SUCCESS);
 	}
 
-	FUNC_EXIT_RC(rc) 
+	init_timer(&timer);
+	countdown_ms(&timer, pData->commandTimeoutMs);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	rc = aws_iot_mqtt_client_lock_mutex(pClient, &(pData->tls_write_mutex));
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+#endif
+
+	rc = SUCCESS;
+	if(0 != pData->txQueueLen) {
+		rc = _aws_iot_mqtt_internal_write(pClient, pData->txQueue, pData->txQueueLen, NULL, 0, &timer);
+		pData->txQueueLen = 0;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	unlockRc = aws_iot_mqtt_client_unlock_mutex(pClient, &(pData->tls_write_mutex));
+	if(SUCCESS != unlockRc) {
+		FUNC_EXIT_RC(unlockRc);
+	}
+#else
+	(void) unlockRc;
+#endif
+
+	FUNC_EXIT_RC(rc);
 }
 
+/**
+ * @brief Make sure bytes offset to offset + size of the current packet are in the RX buffer
+ *
+ * Bytes already received are used as they are. Otherwise the network is asked for
+ * whatever it has, up to the free space in the RX buffer, so a burst of small packets
+ * comes in with one read and the following cycles decode them without touching the
+ * network. Networks without readAvailable are asked for exactly the missing bytes.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param offset Where the wanted bytes start in the packet
+ * @param size Number of bytes wanted
+ * @param pTimer Timer for the read
+ * @param read_len Number of the wanted bytes that are in the buffer
+ *
+ * @return SUCCESS if all are there, otherwise the network error
+ */
 static IoT_Error_t _aws_iot_mqtt_internal_readWrapper( AWS_IoT_Client *pClient, size_t offset, size_t size, Timer *pTimer, size_t * read_len ) {
-    IoT_Error_t rc;
-    int byteToRead;
-    size_t byteRead = 0;
+    IoT_Error_t rc = SUCCESS;
+    size_t needed = offset + size;
+    size_t byteRead;
 
-    byteToRead = ( offset + size ) - pClient->clientData.readBufIndex;
+    if ( needed > pClient->clientData.readBufSize )
+    {
+        *read_len = 0;
+        return MQTT_RX_BUFFER_TOO_SHORT_ERROR;
+    }
 
-    if ( byteToRead > 0 )
+    while ( pClient->clientData.readBufIndex < needed )
     {
-        rc = pClient->networkStack.read( &( pClient->networkStack ),
-            pClient->clientData.readBuf + pClient->clientData.readBufIndex,
-            (size_t)byteToRead,
-            pTimer,
-            &byteRead );
+        byteRead = 0;
+        if ( NULL != pClient->pNetworkStack->readAvailable )
+        {
+            rc = pClient->pNetworkStack->readAvailable( pClient->pNetworkStack,
+                pClient->clientData.readBuf + pClient->clientData.readBufIndex,
+                pClient->clientData.readBufSize - pClient->clientData.readBufIndex,
+                pTimer,
+                &byteRead );
+        }
+        else
+        {
+            rc = pClient->pNetworkStack->read( pClient->pNetworkStack,
+                pClient->clientData.readBuf + pClient->clientData.readBufIndex,
+                needed - pClient->clientData.readBufIndex,
+                pTimer,
+                &byteRead );
+        }
         pClient->clientData.readBufIndex += byteRead;
 
-        /* refresh byte to read */
-        byteToRead = ( offset + size ) - ((int)pClient->clientData.readBufIndex);
-        *read_len = size - (size_t)byteToRead;
+        if ( SUCCESS != rc )
+        {
+            break;
+        }
+        if ( pClient->clientData.readBufIndex < needed && has_timer_expired( pTimer ) )
+        {
+            rc = NETWORK_SSL_READ_TIMEOUT_ERROR;
+            break;
+        }
     }
-    else
+
+    if ( pClient->clientData.readBufIndex >= needed )
     {
         *read_len = size;
-        rc = SUCCESS;
     }
-
- 
+    else if ( pClient->clientData.readBufIndex > offset )
+    {
+        *read_len = pClient->clientData.readBufIndex - offset;
+    }
+    else
+    {
+        *read_len = 0;
+    }
 
     return rc;
 }
@@ -378,8 +638,311 @@ static IoT_Error_t _aws_iot_mqtt_internal_decode_packet_remaining_len(AWS_IoT_Cl
 	FUNC_EXIT_RC(rc);
 }
 
+/**
+ * @brief Did the network run out of data in the middle of a packet
+ *
+ * What arrived stays in the RX buffer and the packet is picked up again by the
+ * next cycle, so a non-blocking network never has to wait for the rest of it.
+ *
+ * @param rc Result of reading the packet
+ *
+ * @return true if the packet can be resumed
+ */
+static bool _aws_iot_mqtt_internal_is_partial_read(IoT_Error_t rc) {
+	return NETWORK_SSL_NOTHING_TO_READ == rc || NETWORK_SSL_READ_TIMEOUT_ERROR == rc;
+}
+
+static void _aws_iot_mqtt_internal_notify_streams(AWS_IoT_Client *pClient, uint32_t count,
+												  pStreamHandler_t *pHandlers, void **pHandlerData,
+												  MQTTStreamEvent event, char *pTopicName, uint16_t topicNameLen,
+												  IoT_Publish_Message_Params *pParams, size_t payloadOffset) {
+	uint32_t itr;
+
+	for(itr = 0; itr < count; ++itr) {
+		pHandlers[itr](pClient, event, pTopicName, topicNameLen, pParams, payloadOffset, pHandlerData[itr]);
+	}
+}
+
+/**
+ * @brief Read what has arrived of the oversized packet in progress
+ *
+ * A streamed payload goes to its handlers as it arrives, anything else is dropped.
+ * When the network runs out of data the packet is left part way for the next cycle,
+ * so the rest of it is never taken for the start of a new packet.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return SUCCESS once a streamed PUBLISH is complete and acknowledged,
+ *         MQTT_RX_BUFFER_TOO_SHORT_ERROR once a dropped packet is complete,
+ *         MQTT_NOTHING_TO_READ if more of it has yet to arrive, or the network error
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_read_oversized(AWS_IoT_Client *pClient) {
+	OversizedPacket *pPacket = &(pClient->clientData.rxOversized);
+	IoT_Publish_Message_Params msg;
+	unsigned char *pChunk;
+	size_t chunkLen, chunkMax, read_len;
+	uint32_t serializedLen;
+	Timer packetTimer;
+	IoT_Error_t rc;
+
+	/* Payload goes in the part of the RX buffer after the header */
+	pChunk = pClient->clientData.readBuf + pPacket->headerLen;
+	chunkMax = pClient->clientData.readBufSize - pPacket->headerLen;
+
+	while(0 != pPacket->remainingLen) {
+		chunkLen = (pPacket->remainingLen < chunkMax) ? pPacket->remainingLen : chunkMax;
+
+		/* A large payload can take longer than the cycle, give each piece its own timeout */
+		init_timer(&packetTimer);
+		countdown_ms(&packetTimer, pClient->clientData.packetTimeoutMs);
+		read_len = 0;
+		rc = pClient->pNetworkStack->read(pClient->pNetworkStack, pChunk, chunkLen, &packetTimer, &read_len);
+
+		/* The bytes of a short read are gone from the network, use them */
+		if(0 != read_len) {
+			if(pPacket->isStreaming) {
+				msg = pPacket->params;
+				msg.payload = pChunk;
+				msg.payloadLen = read_len;
+				_aws_iot_mqtt_internal_notify_streams(pClient, pPacket->streamCount, pPacket->streamHandlers,
+													  pPacket->streamHandlerData, MQTT_STREAM_FRAGMENT,
+													  pPacket->pTopicName, pPacket->topicNameLen, &msg,
+													  pPacket->payloadOffset);
+				pPacket->payloadOffset += read_len;
+			}
+			pPacket->remainingLen -= read_len;
+		}
+
+		if(SUCCESS != rc && 0 != pPacket->remainingLen) {
+			if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+				return MQTT_NOTHING_TO_READ;
+			}
+			/* The connection is gone, the flush tells the streaming handlers */
+			aws_iot_mqtt_internal_flushBuffers(pClient);
+			return rc;
+		}
+	}
+
+	if(!pPacket->isStreaming) {
+		aws_iot_mqtt_internal_flushBuffers(pClient);
+		return MQTT_RX_BUFFER_TOO_SHORT_ERROR;
+	}
+
+	msg = pPacket->params;
+	msg.payload = NULL;
+	_aws_iot_mqtt_internal_notify_streams(pClient, pPacket->streamCount, pPacket->streamHandlers,
+										  pPacket->streamHandlerData, MQTT_STREAM_END, pPacket->pTopicName,
+										  pPacket->topicNameLen, &msg, msg.payloadLen);
+
+	/* Nothing of it is left in the RX buffer for cycle_read */
+	aws_iot_mqtt_internal_flushBuffers(pClient);
+
+	if(QOS0 == msg.qos) {
+		return SUCCESS;
+	}
+
+	/* Message assumed to be QoS1 since we do not support QoS2 at this time */
+	rc = aws_iot_mqtt_internal_serialize_ack(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+											 PUBACK, 0, msg.id, &serializedLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	init_timer(&packetTimer);
+	countdown_ms(&packetTimer, pClient->clientData.packetTimeoutMs);
+	return aws_iot_mqtt_internal_send_packet(pClient, serializedLen, &packetTimer);
+}
+
+/**
+ * @brief Drop a packet that doesn't fit in the RX buffer
+ *
+ * Such a packet is at least as long as the buffer, so everything in the buffer is
+ * part of it.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param packetLen Total length of the packet
+ *
+ * @return MQTT_RX_BUFFER_TOO_SHORT_ERROR once the packet is dropped, MQTT_NOTHING_TO_READ
+ *         if the rest of it has yet to arrive, or the network error
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_discard(AWS_IoT_Client *pClient, size_t packetLen) {
+	OversizedPacket *pPacket = &(pClient->clientData.rxOversized);
+
+	pPacket->remainingLen = packetLen - pClient->clientData.readBufIndex;
+	pPacket->isStreaming = false;
+	pPacket->headerLen = 0;
+
+	return _aws_iot_mqtt_internal_read_oversized(pClient);
+}
+
+/**
+ * @brief Stream a PUBLISH that doesn't fit in the RX buffer to its streaming handlers
+ *
+ * The fixed header has been read. Reads the topic and packet id into the RX buffer
+ * and then the payload in pieces into the space left behind them, calling the
+ * streaming handlers as each piece arrives. Normal handlers for the topic don't get
+ * the message, same as before. QoS1 messages are acknowledged once fully read.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param offset Length of the fixed header already in the RX buffer
+ * @param rem_len Remaining length of the packet
+ * @param pTimer Timer of the current cycle
+ *
+ * @return SUCCESS if streamed, MQTT_RX_BUFFER_TOO_SHORT_ERROR if dropped,
+ *         MQTT_NOTHING_TO_READ if the rest of it has yet to arrive, or the network error
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_stream_publish(AWS_IoT_Client *pClient, size_t offset, size_t rem_len,
+														 Timer *pTimer) {
+	OversizedPacket *pPacket = &(pClient->clientData.rxOversized);
+	uint32_t matches[AWS_IOT_MQTT_MAX_MATCHING_HANDLERS];
+	uint32_t itr, total, count;
+	size_t headerLen, read_len;
+	unsigned char *pCur;
+	char *pTopicName;
+	uint16_t topicNameLen, topicAlias;
+	uint32_t propertiesLen, multiplier;
+	size_t propertiesLenLen;
+	unsigned char c;
+	IoT_Publish_Message_Params msg;
+	MQTTHeader header = {0};
+	IoT_Error_t rc;
+
+	header.byte = pClient->clientData.readBuf[0];
+	msg.qos = (QoS) MQTT_HEADER_FIELD_QOS(header.byte);
+	msg.isDup = (uint8_t) MQTT_HEADER_FIELD_DUP(header.byte);
+	msg.isRetained = (uint8_t) MQTT_HEADER_FIELD_RETAIN(header.byte);
+	msg.id = 0;
+
+	/* Topic length, then topic and packet id. These have to fit, and until they are all
+	 * here the packet is decoded again from the start of the RX buffer every cycle */
+	rc = _aws_iot_mqtt_internal_readWrapper(pClient, offset, 2, pTimer, &read_len);
+	if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+		return MQTT_NOTHING_TO_READ;
+	} else if(SUCCESS != rc || 2 != read_len) {
+		return FAILURE;
+	}
+	pCur = pClient->clientData.readBuf + offset;
+	topicNameLen = aws_iot_mqtt_internal_read_uint16_t(&pCur);
+
+	headerLen = 2 + (size_t) topicNameLen + ((QOS0 != msg.qos) ? 2 : 0);
+	if(headerLen > rem_len || offset + headerLen >= pClient->clientData.readBufSize) {
+		return _aws_iot_mqtt_internal_discard(pClient, offset + rem_len);
+	}
+
+	rc = _aws_iot_mqtt_internal_readWrapper(pClient, offset + 2, headerLen - 2, pTimer, &read_len);
+	if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+		return MQTT_NOTHING_TO_READ;
+	} else if(SUCCESS != rc || headerLen - 2 != read_len) {
+		return FAILURE;
+	}
+	pTopicName = (char *) pCur;
+	pCur += topicNameLen;
+	if(QOS0 != msg.qos) {
+		msg.id = aws_iot_mqtt_internal_read_uint16_t(&pCur);
+	}
+
+	if(AWS_IOT_MQTT_IS_V5(pClient)) {
+		/* Properties length is a variable byte integer, read it a byte at a time */
+		propertiesLen = 0;
+		propertiesLenLen = 0;
+		multiplier = 1;
+		do {
+			if(4 <= propertiesLenLen || headerLen + propertiesLenLen >= rem_len) {
+				return FAILURE;
+			}
+			rc = _aws_iot_mqtt_internal_readWrapper(pClient, offset + headerLen + propertiesLenLen, 1, pTimer,
+													&read_len);
+			if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+				return MQTT_NOTHING_TO_READ;
+			} else if(SUCCESS != rc || 1 != read_len) {
+				return FAILURE;
+			}
+			c = pClient->clientData.readBuf[offset + headerLen + propertiesLenLen];
+			propertiesLen += (c & 127) * multiplier;
+			multiplier *= 128;
+			propertiesLenLen++;
+		} while(0 != (c & 128));
+
+		if(headerLen + propertiesLenLen + propertiesLen > rem_len ||
+		   offset + headerLen + propertiesLenLen + propertiesLen >= pClient->clientData.readBufSize) {
+			return _aws_iot_mqtt_internal_discard(pClient, offset + rem_len);
+		}
+
+		if(0 < propertiesLen) {
+			rc = _aws_iot_mqtt_internal_readWrapper(pClient, offset + headerLen + propertiesLenLen, propertiesLen,
+													pTimer, &read_len);
+			if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+				return MQTT_NOTHING_TO_READ;
+			} else if(SUCCESS != rc || propertiesLen != read_len) {
+				return FAILURE;
+			}
+		}
+
+		pCur = pClient->clientData.readBuf + offset + headerLen;
+		rc = aws_iot_mqtt_internal_read_publish_properties(&pCur, pCur + propertiesLenLen + propertiesLen,
+														   &topicAlias);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		headerLen += propertiesLenLen + propertiesLen;
+
+		if(0 != topicAlias) {
+			rc = aws_iot_mqtt_internal_apply_rx_topic_alias(pClient, topicAlias, &pTopicName, &topicNameLen);
+			if(SUCCESS != rc) {
+				return rc;
+			}
+		}
+	}
+
+	/* Handlers are picked once, they can't (un)subscribe while the packet is being read */
+	total = aws_iot_mqtt_internal_match_handlers(pClient, pTopicName, topicNameLen, 0, matches,
+												 AWS_IOT_MQTT_MAX_MATCHING_HANDLERS);
+	count = (total > AWS_IOT_MQTT_MAX_MATCHING_HANDLERS) ? AWS_IOT_MQTT_MAX_MATCHING_HANDLERS : total;
+	pPacket->streamCount = 0;
+	for(itr = 0; itr < count; ++itr) {
+		if(NULL != pClient->clientData.messageHandlers[matches[itr]].pStreamHandler) {
+			pPacket->streamHandlers[pPacket->streamCount] =
+				pClient->clientData.messageHandlers[matches[itr]].pStreamHandler;
+			pPacket->streamHandlerData[pPacket->streamCount] =
+				pClient->clientData.messageHandlers[matches[itr]].pApplicationHandlerData;
+			pPacket->streamCount++;
+		}
+	}
+
+	if(0 == pPacket->streamCount) {
+		return _aws_iot_mqtt_internal_discard(pClient, offset + rem_len);
+	}
+
+	/* From here on the packet is read across cycles if it has to be */
+	pPacket->remainingLen = offset + rem_len - pClient->clientData.readBufIndex;
+	pPacket->isStreaming = true;
+	pPacket->headerLen = offset + headerLen;
+	pPacket->payloadOffset = 0;
+	pPacket->pTopicName = pTopicName;
+	pPacket->topicNameLen = topicNameLen;
+	msg.payload = NULL;
+	msg.payloadLen = rem_len - headerLen;
+	pPacket->params = msg;
+
+	_aws_iot_mqtt_internal_notify_streams(pClient, pPacket->streamCount, pPacket->streamHandlers,
+										  pPacket->streamHandlerData, MQTT_STREAM_BEGIN, pTopicName, topicNameLen,
+										  &msg, 0);
+
+	/* The start of the payload may have been read ahead with the topic */
+	if(pClient->clientData.readBufIndex > pPacket->headerLen) {
+		msg.payload = pClient->clientData.readBuf + pPacket->headerLen;
+		msg.payloadLen = pClient->clientData.readBufIndex - pPacket->headerLen;
+		_aws_iot_mqtt_internal_notify_streams(pClient, pPacket->streamCount, pPacket->streamHandlers,
+											  pPacket->streamHandlerData, MQTT_STREAM_FRAGMENT, pTopicName,
+											  topicNameLen, &msg, 0);
+		pPacket->payloadOffset = msg.payloadLen;
+	}
+
+	return _aws_iot_mqtt_internal_read_oversized(pClient);
+}
+
 static IoT_Error_t _aws_iot_mqtt_internal_read_packet(AWS_IoT_Client *pClient, Timer *pTimer, uint8_t *pPacketType) {
-	size_t rem_len, total_bytes_read, bytes_to_be_read, read_len;
+	size_t rem_len, read_len;
 	IoT_Error_t rc;
     size_t offset = 0;
 	MQTTHeader header = {0};
@@ -388,10 +951,26 @@ static IoT_Error_t _aws_iot_mqtt_internal_read_packet(AWS_IoT_Client *pClient, T
 	countdown_ms(&packetTimer, pClient->clientData.packetTimeoutMs);
 
 	rem_len = 0;
-	total_bytes_read = 0;
-	bytes_to_be_read = 0;
 	read_len = 0;
 
+	/* Carry on with a packet too large for the RX buffer */
+	if(0 != pClient->clientData.rxOversized.remainingLen) {
+		rc = _aws_iot_mqtt_internal_read_oversized(pClient);
+		if(SUCCESS == rc) {
+			/* Streamed to its handlers and acknowledged, nothing left for cycle_read */
+			*pPacketType = 0;
+		}
+		return rc;
+	}
+
+	/* Drop the packet handed out last time, keeping what was read ahead of it */
+	if(0 != pClient->clientData.readBufPacketLen) {
+		pClient->clientData.readBufIndex -= pClient->clientData.readBufPacketLen;
+		memmove(pClient->clientData.readBuf, pClient->clientData.readBuf + pClient->clientData.readBufPacketLen,
+				pClient->clientData.readBufIndex);
+		pClient->clientData.readBufPacketLen = 0;
+	}
+
     rc = _aws_iot_mqtt_internal_readWrapper( pClient, offset, 1, pTimer, &read_len );
 	/* 1. read the header byte.  This has the packet type in it */
 	if(NETWORK_SSL_NOTHING_TO_READ == rc) {
@@ -402,97 +981,66 @@ static IoT_Error_t _aws_iot_mqtt_internal_read_packet(AWS_IoT_Client *pClient, T
 
 	/* 2. read the remaining length.  This is variable in itself */
 	rc = _aws_iot_mqtt_internal_decode_packet_remaining_len(pClient, &offset, &rem_len, pTimer);
-	if(SUCCESS != rc) {
+	if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+		return MQTT_NOTHING_TO_READ;
+	} else if(SUCCESS != rc) {
 		return rc;
 	} 
      
-	/* if the buffer is too short then the message will be dropped silently */
+	/* if the buffer is too short then the message will be dropped silently,
+	 * unless it is a PUBLISH for a streaming subscription */
 	if((rem_len + offset) >= pClient->clientData.readBufSize) {
-		bytes_to_be_read = pClient->clientData.readBufSize;
-		do {
-			rc = pClient->networkStack.read(&(pClient->networkStack), pClient->clientData.readBuf, bytes_to_be_read,
-											pTimer, &read_len);
+		header.byte = pClient->clientData.readBuf[0];
+		if(PUBLISH == MQTT_HEADER_FIELD_TYPE(header.byte) &&
+		   0 < pClient->clientData.subscriptionIndex.streamHandlerCount) {
+			rc = _aws_iot_mqtt_internal_stream_publish(pClient, offset, rem_len, pTimer);
 			if(SUCCESS == rc) {
-				total_bytes_read += read_len;
-				if((rem_len - total_bytes_read) >= pClient->clientData.readBufSize) {
-					bytes_to_be_read = pClient->clientData.readBufSize;
-				} else {
-					bytes_to_be_read = rem_len - total_bytes_read;
-				}
+				/* Already delivered and acknowledged, nothing left for cycle_read */
+				*pPacketType = 0;
 			}
-		} while(total_bytes_read < rem_len && SUCCESS == rc);
+			return rc;
+		}
 
-        /* Check buffer was correctly emptied, otherwise, return error message. */
-        if ( total_bytes_read == rem_len )
-        {
-            aws_iot_mqtt_internal_flushBuffers( pClient );
-            return MQTT_RX_BUFFER_TOO_SHORT_ERROR;
-        }
-        else
-        {
-            return rc;
-        }
+		return _aws_iot_mqtt_internal_discard(pClient, offset + rem_len);
 	}
 
 	/* 3. read the rest of the buffer using a callback to supply the rest of the data */
 	if(rem_len > 0) {
         rc = _aws_iot_mqtt_internal_readWrapper( pClient, offset, rem_len, pTimer, &read_len );
-		if(SUCCESS != rc || read_len != rem_len) {
+		if(_aws_iot_mqtt_internal_is_partial_read(rc)) {
+			return MQTT_NOTHING_TO_READ;
+		} else if(SUCCESS != rc || read_len != rem_len) {
 			return FAILURE;
 		}
 	}
 
-    /* Pack has been received, we can flush the buffers for next call. */
-    aws_iot_mqtt_internal_flushBuffers( pClient );
+    /* Packet has been received, it is dropped from the buffer on the next call */
+    pClient->clientData.readBufPacketLen = offset + rem_len;
 	header.byte = pClient->clientData.readBuf[0];
 	*pPacketType = MQTT_HEADER_FIELD_TYPE(header.byte);
 
 	FUNC_EXIT_RC(rc);
 }
 
-// assume topic filter and name is in correct format
-// # can only be at end
-// + and # can only be next to separator
-static bool _aws_iot_mqtt_internal_is_topic_matched(char *pTopicFilter, char *pTopicName, uint16_t topicNameLen) {
+static void _aws_iot_mqtt_internal_deliver_as_stream(AWS_IoT_Client *pClient, pStreamHandler_t pStreamHandler,
+													 void *pStreamHandlerData, char *pTopicName,
+													 uint16_t topicNameLen, IoT_Publish_Message_Params *pParams) {
+	IoT_Publish_Message_Params msg = *pParams;
 
-	char *curf, *curn, *curn_end;
-
-	if(NULL == pTopicFilter || NULL == pTopicName) {
-		return false;
+	msg.payload = NULL;
+	pStreamHandler(pClient, MQTT_STREAM_BEGIN, pTopicName, topicNameLen, &msg, 0, pStreamHandlerData);
+	if(0 < pParams->payloadLen) {
+		pStreamHandler(pClient, MQTT_STREAM_FRAGMENT, pTopicName, topicNameLen, pParams, 0, pStreamHandlerData);
 	}
-
-	curf = pTopicFilter;
-	curn = pTopicName;
-	curn_end = curn + topicNameLen;
-
-	while(*curf && (curn < curn_end)) {
-		if(*curn == '/' && *curf != '/') {
-			break;
-		}
-		if(*curf != '+' && *curf != '#' && *curf != *curn) {
-			break;
-		}
-		if(*curf == '+') {
-			/* skip until we meet the next separator, or end of string */
-			char *nextpos = curn + 1;
-			while(nextpos < curn_end && *nextpos != '/')
-				nextpos = ++curn + 1;
-		} else if(*curf == '#') {
-			/* skip until end of string */
-			curn = curn_end - 1;
-		}
-
-		curf++;
-		curn++;
-	};
-
-	return (curn == curn_end) && (*curf == '\0');
+	pStreamHandler(pClient, MQTT_STREAM_END, pTopicName, topicNameLen, &msg, pParams->payloadLen,
+				   pStreamHandlerData);
 }
 
-static IoT_Error_t _aws_iot_mqtt_internal_deliver_message(AWS_IoT_Client *pClient, char *pTopicName,
-														  uint16_t topicNameLen,
-														  IoT_Publish_Message_Params *pMessageParams) {
-	uint32_t itr;
+IoT_Error_t aws_iot_mqtt_internal_deliver_message(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+												 IoT_Publish_Message_Params *pMessageParams) {
+	uint32_t matches[AWS_IOT_MQTT_MAX_MATCHING_HANDLERS];
+	uint32_t itr, total, delivered, count;
+	MessageHandlers *pHandler;
 	IoT_Error_t rc;
 	ClientState clientState;
 
@@ -508,22 +1056,36 @@ static IoT_Error_t _aws_iot_mqtt_internal_deliver_message(AWS_IoT_Client *pClien
 	clientState = aws_iot_mqtt_get_client_state(pClient);
 	aws_iot_mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN);
 
-	/* Find the right message handler - indexed by topic */
-	for(itr = 0; itr < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; ++itr) {
-		if(NULL != pClient->clientData.messageHandlers[itr].topicName) {
-			if(((topicNameLen == pClient->clientData.messageHandlers[itr].topicNameLen)
-				&&
-				(strncmp(pTopicName, (char *) pClient->clientData.messageHandlers[itr].topicName, topicNameLen) == 0))
-			   || _aws_iot_mqtt_internal_is_topic_matched((char *) pClient->clientData.messageHandlers[itr].topicName,
-														  pTopicName, topicNameLen)) {
-				if(NULL != pClient->clientData.messageHandlers[itr].pApplicationHandler) {
-					pClient->clientData.messageHandlers[itr].pApplicationHandler(pClient, pTopicName, topicNameLen,
-																				 pMessageParams,
-																				 pClient->clientData.messageHandlers[itr].pApplicationHandlerData);
-				}
+	/* Find the right message handlers - indexed by topic.
+	 * Collect first, then call: a handler may (un)subscribe and change the index */
+	delivered = 0;
+	do {
+		total = aws_iot_mqtt_internal_match_handlers(pClient, pTopicName, topicNameLen, delivered, matches,
+													 AWS_IOT_MQTT_MAX_MATCHING_HANDLERS);
+		count = (total > delivered) ? total - delivered : 0;
+		if(count > AWS_IOT_MQTT_MAX_MATCHING_HANDLERS) {
+			count = AWS_IOT_MQTT_MAX_MATCHING_HANDLERS;
+		}
+
+		for(itr = 0; itr < count; ++itr) {
+			pHandler = &pClient->clientData.messageHandlers[matches[itr]];
+			/* Still subscribed? */
+			if(NULL == pHandler->topicName) {
+				continue;
+			}
+			if(NULL != pHandler->pApplicationHandler) {
+				pHandler->pApplicationHandler(pClient, pTopicName, topicNameLen, pMessageParams,
+											  pHandler->pApplicationHandlerData);
+			} else if(NULL != pHandler->pStreamHandler) {
+				/* Whole message is here, hand it over as a single fragment */
+				_aws_iot_mqtt_internal_deliver_as_stream(pClient, pHandler->pStreamHandler,
+														 pHandler->pApplicationHandlerData, pTopicName,
+														 topicNameLen, pMessageParams);
 			}
 		}
-	}
+		delivered += count;
+	} while(delivered < total);
+
 	rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN, clientState);
 
 	FUNC_EXIT_RC(rc);
@@ -531,10 +1093,11 @@ static IoT_Error_t _aws_iot_mqtt_internal_deliver_message(AWS_IoT_Client *pClien
 
 static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(AWS_IoT_Client *pClient, Timer *pTimer) {
 	char *topicName;
-	uint16_t topicNameLen;
+	uint16_t topicNameLen, topicAlias;
 	uint32_t len;
 	IoT_Error_t rc;
 	IoT_Publish_Message_Params msg;
+	Timer ackTimer;
 
 	FUNC_ENTRY;
 
@@ -542,8 +1105,8 @@ static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(AWS_IoT_Client *pClient
 	topicNameLen = 0;
 	len = 0;
 
-	rc = aws_iot_mqtt_internal_deserialize_publish(&msg.isDup, &msg.qos, &msg.isRetained,
-												   &msg.id, &topicName, &topicNameLen,
+	rc = aws_iot_mqtt_internal_deserialize_publish(pClient->clientData.options.MQTTVersion, &msg.isDup, &msg.qos,
+												   &msg.isRetained, &msg.id, &topicName, &topicNameLen, &topicAlias,
 												   (unsigned char **) &msg.payload, &msg.payloadLen,
 												   pClient->clientData.readBuf,
 												   pClient->clientData.readBufSize);
@@ -552,7 +1115,14 @@ static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(AWS_IoT_Client *pClient
 		FUNC_EXIT_RC(rc);
 	}
 
-	rc = _aws_iot_mqtt_internal_deliver_message(pClient, topicName, topicNameLen, &msg);
+	if(0 != topicAlias) {
+		rc = aws_iot_mqtt_internal_apply_rx_topic_alias(pClient, topicAlias, &topicName, &topicNameLen);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+
+	rc = aws_iot_mqtt_internal_deliver_message(pClient, topicName, topicNameLen, &msg);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
@@ -570,7 +1140,14 @@ static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(AWS_IoT_Client *pClient
 		FUNC_EXIT_RC(rc);
 	}
 
-	rc = aws_iot_mqtt_internal_send_packet(pClient, len, pTimer);
+	/* A zero timeout yield has no time left by now, the PUBACK still has to go out */
+	if(has_timer_expired(pTimer)) {
+		init_timer(&ackTimer);
+		countdown_ms(&ackTimer, pClient->clientData.commandTimeoutMs);
+		pTimer = &ackTimer;
+	}
+
+	rc = aws_iot_mqtt_internal_queue_packet(pClient, len, NULL, 0, pTimer);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
@@ -578,6 +1155,34 @@ static IoT_Error_t _aws_iot_mqtt_internal_handle_publish(AWS_IoT_Client *pClient
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+/**
+ * @brief Handle a DISCONNECT sent by an MQTT 5 broker
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return MQTT_SERVER_DISCONNECTED_ERROR, the reason code is kept for aws_iot_mqtt_get_last_reason_code
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_handle_server_disconnect(AWS_IoT_Client *pClient) {
+	unsigned char *pCur;
+	uint32_t decodedLen = 0;
+	uint32_t readBytesLen = 0;
+	uint8_t reasonCode;
+	IoT_Error_t rc;
+
+	rc = aws_iot_mqtt_internal_decode_remaining_length_from_buffer(pClient->clientData.readBuf + 1, &decodedLen,
+																	&readBytesLen);
+	if(SUCCESS == rc && 0 < decodedLen) {
+		pCur = pClient->clientData.readBuf + 1 + readBytesLen;
+		reasonCode = aws_iot_mqtt_internal_read_char(&pCur);
+		if(MQTT5_REASON_CODE_FAILURE <= reasonCode) {
+			pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+		}
+		IOT_WARN("Server disconnected, reason code 0x%02X", reasonCode);
+	}
+
+	return MQTT_SERVER_DISCONNECTED_ERROR;
+}
+
 IoT_Error_t aws_iot_mqtt_internal_cycle_read(AWS_IoT_Client *pClient, Timer *pTimer, uint8_t *pPacketType) {
 	IoT_Error_t rc;
 
@@ -614,8 +1219,14 @@ IoT_Error_t aws_iot_mqtt_internal_cycle_read(AWS_IoT_Client *pClient, Timer *pTi
 	}
 
 	switch(*pPacketType) {
-		case CONNACK:
+		case 0:
+			/* PUBLISH streamed to its handlers while it was read, already acknowledged */
+			break;
 		case PUBACK:
+			/* Async publishes are completed here, anything else goes to the blocking caller */
+			rc = aws_iot_mqtt_internal_handle_puback(pClient, pPacketType);
+			break;
+		case CONNACK:
 		case SUBACK:
 		case UNSUBACK:
 			/* SDK is blocking, these responses will be forwarded to calling function to process */
@@ -633,6 +1244,11 @@ IoT_Error_t aws_iot_mqtt_internal_cycle_read(AWS_IoT_Client *pClient, Timer *pTi
 			countdown_sec(&pClient->pingTimer, pClient->clientData.keepAliveInterval);
 			break;
 		}
+		case DISCONNECT: {
+			/* MQTT 5 brokers say why they are closing the connection */
+			rc = _aws_iot_mqtt_internal_handle_server_disconnect(pClient);
+			break;
+		}
 		default: {
 			/* Either unknown packet type or Failure occurred
              * Should not happen */
@@ -644,8 +1260,51 @@ IoT_Error_t aws_iot_mqtt_internal_cycle_read(AWS_IoT_Client *pClient, Timer *pTi
 	return rc;
 }
 
+/**
+ * @brief How many topics of a (UN)SUBSCRIBE fit in one packet
+ *
+ * @param txBufLen Size of the TX buffer
+ * @param variableHeaderLen Length of the variable header: packet id, and properties with MQTT 5
+ * @param pTopicNameLenList Lengths of the topics, in the order they will be packed
+ * @param count Number of topics left to pack
+ * @param perTopicOverhead Bytes on top of the topic itself (length field, requested QoS)
+ *
+ * @return Number of topics from the start of the list that fit, 0 if not even the first one does
+ */
+uint32_t aws_iot_mqtt_internal_count_topics_that_fit(size_t txBufLen, uint32_t variableHeaderLen,
+													  uint16_t *pTopicNameLenList, uint32_t count,
+													  uint32_t perTopicOverhead) {
+	uint32_t itr;
+	uint32_t rem_len = variableHeaderLen;
+
+	for(itr = 0; itr < count; ++itr) {
+		rem_len += (uint32_t) pTopicNameLenList[itr] + perTopicOverhead;
+		/* send_packet needs the packet to be strictly shorter than the buffer */
+		if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(rem_len) >= txBufLen) {
+			break;
+		}
+	}
+
+	return itr;
+}
+
 IoT_Error_t aws_iot_mqtt_internal_flushBuffers( AWS_IoT_Client *pClient ) {
+	OversizedPacket *pPacket = &(pClient->clientData.rxOversized);
+	IoT_Publish_Message_Params msg;
+
+	/* The rest of a streamed PUBLISH isn't coming any more */
+	if(0 != pPacket->remainingLen && pPacket->isStreaming) {
+		msg = pPacket->params;
+		msg.payload = NULL;
+		_aws_iot_mqtt_internal_notify_streams(pClient, pPacket->streamCount, pPacket->streamHandlers,
+											  pPacket->streamHandlerData, MQTT_STREAM_ABORTED, pPacket->pTopicName,
+											  pPacket->topicNameLen, &msg, pPacket->payloadOffset);
+	}
+	pPacket->remainingLen = 0;
+	pPacket->isStreaming = false;
+
     pClient->clientData.readBufIndex = 0;
+    pClient->clientData.readBufPacketLen = 0;
     return SUCCESS;
 }
 
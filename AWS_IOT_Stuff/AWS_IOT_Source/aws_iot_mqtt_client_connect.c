@@ -102,9 +102,35 @@ typedef enum {
 	CONNACK_IDENTIFIER_REJECTED_ERROR = 2,
 	CONNACK_SERVER_UNAVAILABLE_ERROR = 3,
 	CONNACK_BAD_USERDATA_ERROR = 4,
-	CONNACK_NOT_AUTHORIZED_ERROR = 5
+	CONNACK_NOT_AUTHORIZED_ERROR = 5,
+	/* MQTT 5 reason codes, MQTT v5.0 Specification 3.2.2.2 */
+	CONNACK5_UNSUPPORTED_PROTOCOL_VERSION = 0x84,
+	CONNACK5_CLIENT_IDENTIFIER_NOT_VALID = 0x85,
+	CONNACK5_BAD_USER_NAME_OR_PASSWORD = 0x86,
+	CONNACK5_NOT_AUTHORIZED = 0x87,
+	CONNACK5_SERVER_UNAVAILABLE = 0x88,
+	CONNACK5_SERVER_BUSY = 0x89
 } MQTT_Connack_Return_Codes;    /**< Connect request response codes from server */
 
+/* Session Expiry Interval asked for when the session isn't clean: the broker's maximum */
+#define CONNECT5_SESSION_EXPIRY_MAXIMUM 0xFFFFFFFFu
+
+/**
+  * Length of the MQTT 5 CONNECT properties: Topic Alias Maximum, and a Session
+  * Expiry Interval when the session should be kept (3.1.1 clean session = false).
+  * @param options the options to be used to build the connect packet
+  * @return the length of the properties, without their length field
+  */
+static uint32_t _aws_iot_get_connect_properties_length(IoT_Client_Connect_Params *pConnectParams) {
+	uint32_t len = 1 + 2; /* Topic Alias Maximum */
+
+	if(!pConnectParams->isCleanSession) {
+		len += 1 + 4;
+	}
+
+	return len;
+}
+
 
 /**
   * Determines the length of the MQTT connect packet that would be produced using the supplied connect options.
@@ -124,6 +150,13 @@ static uint32_t _aws_iot_get_connect_packet_length(IoT_Client_Connect_Params *pC
 	FUNC_ENTRY;
 
 	len = 10; // Len = 10 for MQTT_3_1_1
+	if(MQTT_5_0 == pConnectParams->MQTTVersion) {
+		/* Properties, less than 128 bytes so a one byte length */
+		len += 1 + _aws_iot_get_connect_properties_length(pConnectParams);
+		if(pConnectParams->isWillMsgPresent) {
+			len += 1; /* empty will properties */
+		}
+	}
 	len = len + pConnectParams->clientIDLen + 2;
 
 	if(pConnectParams->isWillMsgPresent) {
@@ -169,6 +202,7 @@ static IoT_Error_t _aws_iot_mqtt_serialize_connect(unsigned char *pTxBuf, size_t
 	/* Check needed here before we start writing to the Tx buffer */
 	switch(pConnectParams->MQTTVersion) {
 		case MQTT_3_1_1:
+		case MQTT_5_0:
 			break;
 		default:
 			return MQTT_CONNACK_UNACCEPTABLE_PROTOCOL_VERSION_ERROR;
@@ -219,6 +253,17 @@ static IoT_Error_t _aws_iot_mqtt_serialize_connect(unsigned char *pTxBuf, size_t
 	aws_iot_mqtt_internal_write_char(&ptr, flags.all);
 	aws_iot_mqtt_internal_write_uint_16(&ptr, pConnectParams->keepAliveIntervalInSec);
 
+	if(MQTT_5_0 == pConnectParams->MQTTVersion) {
+		aws_iot_mqtt_internal_write_char(&ptr, (unsigned char) _aws_iot_get_connect_properties_length(pConnectParams));
+		aws_iot_mqtt_internal_write_char(&ptr, MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+		aws_iot_mqtt_internal_write_uint_16(&ptr, AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM);
+		if(!pConnectParams->isCleanSession) {
+			aws_iot_mqtt_internal_write_char(&ptr, MQTT5_PROPERTY_SESSION_EXPIRY_INTERVAL);
+			aws_iot_mqtt_internal_write_uint_16(&ptr, (uint16_t) (CONNECT5_SESSION_EXPIRY_MAXIMUM >> 16));
+			aws_iot_mqtt_internal_write_uint_16(&ptr, (uint16_t) (CONNECT5_SESSION_EXPIRY_MAXIMUM & 0xFFFF));
+		}
+	}
+
 	/* If the code have passed the check for incorrect values above, no client id was passed as argument */
 	if(NULL == pConnectParams->pClientID) {
 		aws_iot_mqtt_internal_write_uint_16(&ptr, 0);
@@ -227,6 +272,9 @@ static IoT_Error_t _aws_iot_mqtt_serialize_connect(unsigned char *pTxBuf, size_t
 	}
 
 	if(pConnectParams->isWillMsgPresent) {
+		if(MQTT_5_0 == pConnectParams->MQTTVersion) {
+			aws_iot_mqtt_internal_write_char(&ptr, 0); /* no will properties */
+		}
 		aws_iot_mqtt_internal_write_utf8_string(&ptr, pConnectParams->will.pTopicName,
 												pConnectParams->will.topicNameLen);
 		aws_iot_mqtt_internal_write_utf8_string(&ptr, pConnectParams->will.pMessage, pConnectParams->will.msgLen);
@@ -245,16 +293,70 @@ static IoT_Error_t _aws_iot_mqtt_serialize_connect(unsigned char *pTxBuf, size_t
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+/**
+  * Reads the MQTT 5 CONNACK properties into the client: the broker's limits and keep alive
+  * @param pClient Reference to the IoT Client
+  * @param pptr position of the properties
+  * @param pEnd end of the packet
+  * @return IoT_Error_t indicating function execution status
+  */
+static IoT_Error_t _aws_iot_mqtt_deserialize_connack_properties(AWS_IoT_Client *pClient, unsigned char **pptr,
+																unsigned char *pEnd) {
+	unsigned char *pPropertiesEnd;
+	uint32_t propertiesLen, value;
+	uint8_t propertyId;
+	IoT_Error_t rc;
+
+	rc = aws_iot_mqtt_internal_read_properties_length(pptr, pEnd, &propertiesLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	pPropertiesEnd = *pptr + propertiesLen;
+	while(*pptr < pPropertiesEnd) {
+		rc = aws_iot_mqtt_internal_read_property(pptr, pPropertiesEnd, &propertyId, &value);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+
+		switch(propertyId) {
+			case MQTT5_PROPERTY_RECEIVE_MAXIMUM:
+				if(0 == value) {
+					/* Protocol error, keep the default */
+					break;
+				}
+				pClient->clientData.mqtt5.receiveMaximum = (uint16_t) value;
+				break;
+			case MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM:
+				pClient->clientData.mqtt5.topicAliasMaximum = (uint16_t) value;
+				break;
+			case MQTT5_PROPERTY_MAXIMUM_PACKET_SIZE:
+				pClient->clientData.mqtt5.maximumPacketSize = value;
+				break;
+			case MQTT5_PROPERTY_SERVER_KEEP_ALIVE:
+				/* The broker's keep alive overrides ours */
+				pClient->clientData.keepAliveInterval = (uint16_t) value;
+				break;
+			default:
+				break;
+		}
+	}
+
+	return SUCCESS;
+}
+
 /**
   * Deserializes the supplied (wire) buffer into connack data - return code
-  * @param sessionPresent the session present flag returned (only for MQTT 3.1.1)
+  * @param pClient Reference to the IoT Client, gets the MQTT 5 properties
+  * @param pSessionPresent the session present flag returned
   * @param connack_rc returned integer value of the connack return code
   * @param buf the raw buffer data, of the correct length determined by the remaining length field
   * @param buflen the length in bytes of the data in the supplied buffer
   * @return IoT_Error_t indicating function execution status
   */
-static IoT_Error_t _aws_iot_mqtt_deserialize_connack(unsigned char *pSessionPresent, IoT_Error_t *pConnackRc,
-													 unsigned char *pRxBuf, size_t rxBufLen) {
+static IoT_Error_t _aws_iot_mqtt_deserialize_connack(AWS_IoT_Client *pClient, unsigned char *pSessionPresent,
+													 IoT_Error_t *pConnackRc, unsigned char *pRxBuf,
+													 size_t rxBufLen) {
 	unsigned char *curdata, *enddata;
 	unsigned char connack_rc_char;
 	uint32_t decodedLen, readBytesLen;
@@ -291,33 +393,41 @@ static IoT_Error_t _aws_iot_mqtt_deserialize_connack(unsigned char *pSessionPres
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* CONNACK remaining length should always be 2 as per MQTT 3.1.1 spec */
+	/* CONNACK remaining length should always be 2 as per MQTT 3.1.1 spec,
+	 * MQTT 5 adds properties. A 3.1.1 broker refusing MQTT 5 answers with 2 */
 	curdata += (readBytesLen);
 	enddata = curdata + decodedLen;
-	if(2 != (enddata - curdata)) {
+	if(2 != (enddata - curdata) && (!AWS_IOT_MQTT_IS_V5(pClient) || 2 > (enddata - curdata))) {
 		FUNC_EXIT_RC(MQTT_DECODE_REMAINING_LENGTH_ERROR);
 	}
 
 	flags.all = aws_iot_mqtt_internal_read_char(&curdata);
-	*pSessionPresent = flags.bits.sessionpresent;
+	/* Bit 0 of the acknowledge flags. Not through the bit field, its layout depends on the compiler */
+	*pSessionPresent = (unsigned char) (flags.all & 0x01);
 	connack_rc_char = aws_iot_mqtt_internal_read_char(&curdata);
 	switch(connack_rc_char) {
 		case CONNACK_CONNECTION_ACCEPTED:
 			*pConnackRc = MQTT_CONNACK_CONNECTION_ACCEPTED;
 			break;
 		case CONNACK_UNACCEPTABLE_PROTOCOL_VERSION_ERROR:
+		case CONNACK5_UNSUPPORTED_PROTOCOL_VERSION:
 			*pConnackRc = MQTT_CONNACK_UNACCEPTABLE_PROTOCOL_VERSION_ERROR;
 			break;
 		case CONNACK_IDENTIFIER_REJECTED_ERROR:
+		case CONNACK5_CLIENT_IDENTIFIER_NOT_VALID:
 			*pConnackRc = MQTT_CONNACK_IDENTIFIER_REJECTED_ERROR;
 			break;
 		case CONNACK_SERVER_UNAVAILABLE_ERROR:
+		case CONNACK5_SERVER_UNAVAILABLE:
+		case CONNACK5_SERVER_BUSY:
 			*pConnackRc = MQTT_CONNACK_SERVER_UNAVAILABLE_ERROR;
 			break;
 		case CONNACK_BAD_USERDATA_ERROR:
+		case CONNACK5_BAD_USER_NAME_OR_PASSWORD:
 			*pConnackRc = MQTT_CONNACK_BAD_USERDATA_ERROR;
 			break;
 		case CONNACK_NOT_AUTHORIZED_ERROR:
+		case CONNACK5_NOT_AUTHORIZED:
 			*pConnackRc = MQTT_CONNACK_NOT_AUTHORIZED_ERROR;
 			break;
 		default:
@@ -325,6 +435,17 @@ static IoT_Error_t _aws_iot_mqtt_deserialize_connack(unsigned char *pSessionPres
 			break;
 	}
 
+	if(MQTT5_REASON_CODE_FAILURE <= connack_rc_char) {
+		pClient->clientData.mqtt5.lastReasonCode = connack_rc_char;
+	}
+
+	if(AWS_IOT_MQTT_IS_V5(pClient) && curdata < enddata) {
+		rc = _aws_iot_mqtt_deserialize_connack_properties(pClient, &curdata, enddata);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+	}
+
 	FUNC_EXIT_RC(SUCCESS);
 }
 
@@ -398,7 +519,7 @@ static IoT_Error_t _aws_iot_mqtt_internal_connect(AWS_IoT_Client *pClient, IoT_C
 		}
 	}
 
-	rc = pClient->networkStack.connect(&(pClient->networkStack), NULL);
+	rc = pClient->pNetworkStack->connect(pClient->pNetworkStack, NULL);
 	if(SUCCESS != rc) {
 		/* TLS Connect failed, return error */
 		FUNC_EXIT_RC(rc);
@@ -408,12 +529,16 @@ static IoT_Error_t _aws_iot_mqtt_internal_connect(AWS_IoT_Client *pClient, IoT_C
 	countdown_ms(&connect_timer, pClient->clientData.commandTimeoutMs);
 
 	pClient->clientData.keepAliveInterval = pClient->clientData.options.keepAliveIntervalInSec;
+	aws_iot_mqtt_internal_reset_mqtt5_session(pClient);
 	rc = _aws_iot_mqtt_serialize_connect(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
 										 &(pClient->clientData.options), &len);
 	if(SUCCESS != rc || 0 >= len) {
 		FUNC_EXIT_RC(rc);
 	}
 
+	/* Packets queued for the old connection must not go out before the CONNECT */
+	pClient->clientData.txQueueLen = 0;
+
 	/* send the connect packet */
 	rc = aws_iot_mqtt_internal_send_packet(pClient, len, &connect_timer);
 	if(SUCCESS != rc) {
@@ -427,8 +552,8 @@ static IoT_Error_t _aws_iot_mqtt_internal_connect(AWS_IoT_Client *pClient, IoT_C
 	}
 
 	/* Received CONNACK, check the return code */
-	rc = _aws_iot_mqtt_deserialize_connack((unsigned char *) &sessionPresent, &connack_rc, pClient->clientData.readBuf,
-										   pClient->clientData.readBufSize);
+	rc = _aws_iot_mqtt_deserialize_connack(pClient, (unsigned char *) &sessionPresent, &connack_rc,
+										   pClient->clientData.readBuf, pClient->clientData.readBufSize);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
@@ -437,9 +562,17 @@ static IoT_Error_t _aws_iot_mqtt_internal_connect(AWS_IoT_Client *pClient, IoT_C
 		FUNC_EXIT_RC(connack_rc);
 	}
 
+	/* A clean session is never present, whatever the broker says */
+	pClient->clientStatus.isSessionPresent = (0 != sessionPresent) && !pClient->clientData.options.isCleanSession;
 	pClient->clientStatus.isPingOutstanding = false;
 	countdown_sec(&pClient->pingTimer, pClient->clientData.keepAliveInterval);
 
+	/* QoS1 publishes still waiting for a PUBACK from the last connection */
+	rc = aws_iot_mqtt_internal_resend_inflight_publishes(pClient, &connect_timer);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
 	FUNC_EXIT_RC(SUCCESS);
 }
 
@@ -477,8 +610,8 @@ IoT_Error_t aws_iot_mqtt_connect(AWS_IoT_Client *pClient, IoT_Client_Connect_Par
 	rc = _aws_iot_mqtt_internal_connect(pClient, pConnectParams);
 
 	if(SUCCESS != rc) {
-		pClient->networkStack.disconnect(&(pClient->networkStack));
-		disconRc = pClient->networkStack.destroy(&(pClient->networkStack));
+		pClient->pNetworkStack->disconnect(pClient->pNetworkStack);
+		disconRc = pClient->pNetworkStack->destroy(pClient->pNetworkStack);
 		if (SUCCESS != disconRc) {
 			FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
 		}
@@ -525,8 +658,13 @@ IoT_Error_t _aws_iot_mqtt_internal_disconnect(AWS_IoT_Client *pClient) {
 	}
 
 	/* Clean network stack */
-	pClient->networkStack.disconnect(&(pClient->networkStack));
-	rc = pClient->networkStack.destroy(&(pClient->networkStack));
+	pClient->pNetworkStack->disconnect(pClient->pNetworkStack);
+	rc = pClient->pNetworkStack->destroy(pClient->pNetworkStack);
+
+	/* No PUBACKs will be coming for these now, nor the rest of a packet part way */
+	aws_iot_mqtt_internal_fail_inflight_publishes(pClient, NETWORK_DISCONNECTED_ERROR);
+	aws_iot_mqtt_internal_flushBuffers(pClient);
+	pClient->clientData.isSessionInherited = false;
 	if(0 != rc) {
 		/* TLS Destroy failed, return error */
 		FUNC_EXIT_RC(FAILURE);
@@ -614,9 +752,12 @@ IoT_Error_t aws_iot_mqtt_attempt_reconnect(AWS_IoT_Client *pClient) {
 		FUNC_EXIT_RC(NETWORK_ATTEMPTING_RECONNECT);
 	}
 
-	rc = aws_iot_mqtt_resubscribe(pClient);
-	if(SUCCESS != rc) {
-		FUNC_EXIT_RC(rc);
+	/* The broker kept our subscriptions, and queued QoS1 messages for them */
+	if(!pClient->clientStatus.isSessionPresent) {
+		rc = aws_iot_mqtt_resubscribe(pClient);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
 	}
 
 	FUNC_EXIT_RC(NETWORK_RECONNECTED);
@@ -0,0 +1,384 @@
+/*
+* Copyright 2015-2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*
+* http://aws.amazon.com/apache2.0
+*
+* or in the "license" file accompanying this file. This file is distributed
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied. See the License for the specific language governing
+* permissions and limitations under the License.
+*/
+
+/**
+ * @file aws_iot_mqtt_client_mqtt5.c
+ * @brief MQTT 5 properties and topic aliases
+ *
+ * Only what the client uses is decoded: the CONNACK limits, the topic alias of
+ * incoming publishes and the reason codes of acks. Other properties are skipped.
+ * Topic aliases are kept per connection in two small tables, one per direction,
+ * holding a copy of each topic.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#include "aws_iot_mqtt_client_common_internal.h"
+
+/* Receive Maximum when the broker doesn't send one, MQTT v5.0 Specification 3.2.2.3.3 */
+#define MQTT5_DEFAULT_RECEIVE_MAXIMUM 65535
+
+static IoT_Error_t _aws_iot_mqtt_internal_read_variable_byte_integer(unsigned char **pptr, unsigned char *pEnd,
+																	 uint32_t *pValue) {
+	unsigned char encodedByte;
+	uint32_t multiplier, len;
+
+	multiplier = 1;
+	len = 0;
+	*pValue = 0;
+
+	do {
+		if(*pptr >= pEnd || ++len > 4) {
+			return MQTT_DECODE_REMAINING_LENGTH_ERROR;
+		}
+		encodedByte = aws_iot_mqtt_internal_read_char(pptr);
+		*pValue += (encodedByte & 127) * multiplier;
+		multiplier *= 128;
+	} while((encodedByte & 128) != 0);
+
+	return SUCCESS;
+}
+
+/**
+ * @brief Read the length that starts a property list
+ *
+ * @param pptr Position in the packet, moved past the length
+ * @param pEnd End of the packet
+ * @param pPropertiesLen Returned length of the properties that follow
+ *
+ * @return SUCCESS, or FAILURE if the properties run past the packet
+ */
+IoT_Error_t aws_iot_mqtt_internal_read_properties_length(unsigned char **pptr, unsigned char *pEnd,
+														 uint32_t *pPropertiesLen) {
+	IoT_Error_t rc;
+
+	rc = _aws_iot_mqtt_internal_read_variable_byte_integer(pptr, pEnd, pPropertiesLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	if(*pPropertiesLen > (uint32_t) (pEnd - *pptr)) {
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * @brief Read one property
+ *
+ * Integer properties are returned in pValue. Strings, binary data and user
+ * properties are skipped and return 0.
+ *
+ * @param pptr Position in the property list, moved past the property
+ * @param pEnd End of the property list
+ * @param pPropertyId Returned property identifier
+ * @param pValue Returned value
+ *
+ * @return SUCCESS, or FAILURE for an unknown or truncated property
+ */
+IoT_Error_t aws_iot_mqtt_internal_read_property(unsigned char **pptr, unsigned char *pEnd, uint8_t *pPropertyId,
+												uint32_t *pValue) {
+	uint32_t skipLen, strings;
+
+	if(*pptr >= pEnd) {
+		return FAILURE;
+	}
+
+	*pPropertyId = aws_iot_mqtt_internal_read_char(pptr);
+	*pValue = 0;
+
+	switch(*pPropertyId) {
+		/* Byte */
+		case 0x01:
+		case 0x17:
+		case 0x19:
+		case 0x24:
+		case 0x25:
+		case 0x28:
+		case 0x29:
+		case 0x2A:
+			if(pEnd - *pptr < 1) {
+				return FAILURE;
+			}
+			*pValue = aws_iot_mqtt_internal_read_char(pptr);
+			return SUCCESS;
+		/* Two Byte Integer */
+		case MQTT5_PROPERTY_SERVER_KEEP_ALIVE:
+		case MQTT5_PROPERTY_RECEIVE_MAXIMUM:
+		case MQTT5_PROPERTY_TOPIC_ALIAS_MAXIMUM:
+		case MQTT5_PROPERTY_TOPIC_ALIAS:
+			if(pEnd - *pptr < 2) {
+				return FAILURE;
+			}
+			*pValue = aws_iot_mqtt_internal_read_uint16_t(pptr);
+			return SUCCESS;
+		/* Four Byte Integer */
+		case 0x02:
+		case MQTT5_PROPERTY_SESSION_EXPIRY_INTERVAL:
+		case 0x18:
+		case MQTT5_PROPERTY_MAXIMUM_PACKET_SIZE:
+			if(pEnd - *pptr < 4) {
+				return FAILURE;
+			}
+			*pValue = (uint32_t) aws_iot_mqtt_internal_read_uint16_t(pptr) << 16;
+			*pValue |= aws_iot_mqtt_internal_read_uint16_t(pptr);
+			return SUCCESS;
+		/* Variable Byte Integer */
+		case 0x0B:
+			return _aws_iot_mqtt_internal_read_variable_byte_integer(pptr, pEnd, pValue);
+		/* UTF-8 String or Binary Data */
+		case 0x03:
+		case 0x08:
+		case 0x09:
+		case 0x12:
+		case 0x15:
+		case 0x16:
+		case 0x1A:
+		case 0x1C:
+		case 0x1F:
+			strings = 1;
+			break;
+		/* User Property, a string pair */
+		case 0x26:
+			strings = 2;
+			break;
+		default:
+			return FAILURE;
+	}
+
+	while(strings-- > 0) {
+		if(pEnd - *pptr < 2) {
+			return FAILURE;
+		}
+		skipLen = aws_iot_mqtt_internal_read_uint16_t(pptr);
+		if(skipLen > (uint32_t) (pEnd - *pptr)) {
+			return FAILURE;
+		}
+		*pptr += skipLen;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * @brief Skip a property list
+ *
+ * @param pptr Position of the property length, moved past the properties
+ * @param pEnd End of the packet
+ *
+ * @return SUCCESS, or FAILURE if the properties run past the packet
+ */
+IoT_Error_t aws_iot_mqtt_internal_skip_properties(unsigned char **pptr, unsigned char *pEnd) {
+	uint32_t propertiesLen;
+	IoT_Error_t rc;
+
+	rc = aws_iot_mqtt_internal_read_properties_length(pptr, pEnd, &propertiesLen);
+	if(SUCCESS == rc) {
+		*pptr += propertiesLen;
+	}
+
+	return rc;
+}
+
+/**
+ * @brief Read the properties of an incoming PUBLISH
+ *
+ * @param pptr Position of the property length, moved past the properties
+ * @param pEnd End of the packet
+ * @param pTopicAlias Returned topic alias, 0 if there is none
+ *
+ * @return SUCCESS, or FAILURE for malformed properties
+ */
+IoT_Error_t aws_iot_mqtt_internal_read_publish_properties(unsigned char **pptr, unsigned char *pEnd,
+														  uint16_t *pTopicAlias) {
+	unsigned char *pPropertiesEnd;
+	uint32_t propertiesLen, value;
+	uint8_t propertyId;
+	IoT_Error_t rc;
+
+	*pTopicAlias = 0;
+
+	rc = aws_iot_mqtt_internal_read_properties_length(pptr, pEnd, &propertiesLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	pPropertiesEnd = *pptr + propertiesLen;
+	while(*pptr < pPropertiesEnd) {
+		rc = aws_iot_mqtt_internal_read_property(pptr, pPropertiesEnd, &propertyId, &value);
+		if(SUCCESS != rc) {
+			return rc;
+		}
+		if(MQTT5_PROPERTY_TOPIC_ALIAS == propertyId) {
+			*pTopicAlias = (uint16_t) value;
+		}
+	}
+
+	return SUCCESS;
+}
+
+static void _aws_iot_mqtt_internal_clear_topic_aliases(TopicAlias *pTable) {
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM; ++itr) {
+		free(pTable[itr].pTopicName);
+		pTable[itr].pTopicName = NULL;
+		pTable[itr].topicNameLen = 0;
+	}
+}
+
+static IoT_Error_t _aws_iot_mqtt_internal_set_topic_alias(TopicAlias *pAlias, const char *pTopicName,
+														  uint16_t topicNameLen) {
+	char *pCopy;
+
+	if(NULL != pAlias->pTopicName && topicNameLen == pAlias->topicNameLen &&
+	   0 == memcmp(pAlias->pTopicName, pTopicName, topicNameLen)) {
+		return SUCCESS;
+	}
+
+	pCopy = (char *) malloc(topicNameLen);
+	if(NULL == pCopy) {
+		return FAILURE;
+	}
+	memcpy(pCopy, pTopicName, topicNameLen);
+
+	free(pAlias->pTopicName);
+	pAlias->pTopicName = pCopy;
+	pAlias->topicNameLen = topicNameLen;
+
+	return SUCCESS;
+}
+
+/**
+ * @brief Forget what was agreed with the broker
+ *
+ * Called before every connect, and when the client is freed.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void aws_iot_mqtt_internal_reset_mqtt5_session(AWS_IoT_Client *pClient) {
+	MQTT5Session *pSession = &(pClient->clientData.mqtt5);
+
+	_aws_iot_mqtt_internal_clear_topic_aliases(pSession->txTopicAliases);
+	_aws_iot_mqtt_internal_clear_topic_aliases(pSession->rxTopicAliases);
+	pSession->receiveMaximum = MQTT5_DEFAULT_RECEIVE_MAXIMUM;
+	pSession->topicAliasMaximum = 0;
+	pSession->maximumPacketSize = 0;
+	pSession->lastReasonCode = 0;
+}
+
+/**
+ * @brief Find the alias the broker already knows for a topic we publish to
+ *
+ * @return The alias, 0 if there is none
+ */
+uint16_t aws_iot_mqtt_internal_find_tx_topic_alias(AWS_IoT_Client *pClient, const char *pTopicName,
+												   uint16_t topicNameLen) {
+	TopicAlias *pTable = pClient->clientData.mqtt5.txTopicAliases;
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM; ++itr) {
+		if(NULL != pTable[itr].pTopicName && topicNameLen == pTable[itr].topicNameLen &&
+		   0 == memcmp(pTable[itr].pTopicName, pTopicName, topicNameLen)) {
+			return (uint16_t) (itr + 1);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Alias a topic we haven't aliased yet would get
+ *
+ * Aliases are handed out first come first served and never reassigned, so the
+ * first topics published on a connection keep theirs.
+ *
+ * @return The alias, 0 if the broker takes no more
+ */
+uint16_t aws_iot_mqtt_internal_next_tx_topic_alias(AWS_IoT_Client *pClient) {
+	TopicAlias *pTable = pClient->clientData.mqtt5.txTopicAliases;
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM && itr < pClient->clientData.mqtt5.topicAliasMaximum; ++itr) {
+		if(NULL == pTable[itr].pTopicName) {
+			return (uint16_t) (itr + 1);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Remember an alias sent to the broker
+ *
+ * Called once the PUBLISH that set it has gone out.
+ *
+ * @return SUCCESS, or FAILURE if the topic couldn't be copied
+ */
+IoT_Error_t aws_iot_mqtt_internal_set_tx_topic_alias(AWS_IoT_Client *pClient, uint16_t topicAlias,
+													 const char *pTopicName, uint16_t topicNameLen) {
+	if(0 == topicAlias || AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM < topicAlias) {
+		return FAILURE;
+	}
+
+	return _aws_iot_mqtt_internal_set_topic_alias(&(pClient->clientData.mqtt5.txTopicAliases[topicAlias - 1]),
+												  pTopicName, topicNameLen);
+}
+
+/**
+ * @brief Apply the topic alias of an incoming PUBLISH
+ *
+ * A PUBLISH with a topic sets the alias, one without a topic uses it.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param topicAlias Alias from the PUBLISH properties, not 0
+ * @param ppTopicName In: topic of the PUBLISH. Out: the topic to deliver to
+ * @param pTopicNameLen In: length of the topic of the PUBLISH, can be 0. Out: length of the topic to deliver to
+ *
+ * @return SUCCESS, or FAILURE for an alias we didn't allow or haven't been told about
+ */
+IoT_Error_t aws_iot_mqtt_internal_apply_rx_topic_alias(AWS_IoT_Client *pClient, uint16_t topicAlias,
+													   char **ppTopicName, uint16_t *pTopicNameLen) {
+	TopicAlias *pAlias;
+
+	if(0 == topicAlias || AWS_IOT_MQTT_TOPIC_ALIAS_MAXIMUM < topicAlias) {
+		IOT_ERROR("Topic alias %u out of range", topicAlias);
+		return FAILURE;
+	}
+
+	pAlias = &(pClient->clientData.mqtt5.rxTopicAliases[topicAlias - 1]);
+	if(0 != *pTopicNameLen) {
+		return _aws_iot_mqtt_internal_set_topic_alias(pAlias, *ppTopicName, *pTopicNameLen);
+	}
+
+	if(NULL == pAlias->pTopicName) {
+		IOT_ERROR("Topic alias %u used before it was set", topicAlias);
+		return FAILURE;
+	}
+
+	*ppTopicName = pAlias->pTopicName;
+	*pTopicNameLen = pAlias->topicNameLen;
+
+	return SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
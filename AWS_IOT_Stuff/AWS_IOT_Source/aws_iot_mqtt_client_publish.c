@@ -42,6 +42,9 @@ extern "C" {
 
 #include "aws_iot_mqtt_client_common_internal.h"
 
+/* Largest value the MQTT remaining length field can encode */
+#define MAX_REMAINING_LENGTH 268435455u
+
 /**
  * @param stringVar pointer to the String into which the data is to be read
  * @param stringLen pointer to variable which has the length of the string
@@ -69,28 +72,34 @@ static IoT_Error_t _aws_iot_mqtt_read_string_with_len(char **stringVar, uint16_t
 }
 
 /**
-  * Serializes the supplied publish data into the supplied buffer, ready for sending
+  * Serializes the fixed and variable header of a publish into the supplied buffer.
+  * The payload isn't copied, it is sent from the caller's memory after the header
+  * (see aws_iot_mqtt_internal_send_packet_with_payload), so only the header has to fit.
   * @param pTxBuf the buffer into which the packet will be serialized
   * @param txBufLen the length in bytes of the supplied buffer
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 adds properties
   * @param dup uint8_t - the MQTT dup flag
   * @param qos QoS - the MQTT QoS value
   * @param retained uint8_t - the MQTT retained flag
   * @param packetId uint16_t - the MQTT packet identifier
   * @param pTopicName char * - the MQTT topic in the publish
-  * @param topicNameLen uint16_t - the length of the Topic Name
+  * @param topicNameLen uint16_t - the length of the Topic Name, 0 when sent by alias only
+  * @param topicAlias uint16_t - MQTT 5 topic alias, 0 for none
   * @param pPayload byte buffer - the MQTT publish payload
   * @param payloadLen size_t - the length of the MQTT payload
-  * @param pSerializedLen uint32_t - pointer to the variable that stores serialized len
+  * @param pSerializedLen uint32_t - pointer to the variable that stores serialized len, without the payload
   *
   * @return An IoT Error Type defining successful/failed call
   */
-static IoT_Error_t _aws_iot_mqtt_internal_serialize_publish(unsigned char *pTxBuf, size_t txBufLen, uint8_t dup,
+static IoT_Error_t _aws_iot_mqtt_internal_serialize_publish(unsigned char *pTxBuf, size_t txBufLen,
+															MQTT_Ver_t mqttVersion, uint8_t dup,
 															QoS qos, uint8_t retained, uint16_t packetId,
 															const char *pTopicName, uint16_t topicNameLen,
+															uint16_t topicAlias,
 															const unsigned char *pPayload, size_t payloadLen,
 															uint32_t *pSerializedLen) {
 	unsigned char *ptr;
-	uint32_t rem_len;
+	uint32_t rem_len, propertiesLen;
 	IoT_Error_t rc;
 	MQTTHeader header = {0};
 
@@ -100,13 +109,22 @@ static IoT_Error_t _aws_iot_mqtt_internal_serialize_publish(unsigned char *pTxBu
 	}
 
 	ptr = pTxBuf;
-	rem_len = 0;
+	propertiesLen = (0 != topicAlias) ? 3 : 0;
 
-	rem_len += (uint32_t) (topicNameLen + payloadLen + 2);
+	rem_len = (uint32_t) topicNameLen + 2;
 	if(qos > 0) {
 		rem_len += 2; /* packetId */
 	}
-	if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(rem_len) > txBufLen) {
+	if(MQTT_5_0 == mqttVersion) {
+		rem_len += 1 + propertiesLen;
+	}
+
+	if(payloadLen > MAX_REMAINING_LENGTH - rem_len) {
+		FUNC_EXIT_RC(MAX_SIZE_ERROR);
+	}
+	rem_len += (uint32_t) payloadLen;
+
+	if(aws_iot_mqtt_internal_get_final_packet_length_from_remaining_length(rem_len) - payloadLen > txBufLen) {
 		FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
 	}
 
@@ -124,14 +142,105 @@ static IoT_Error_t _aws_iot_mqtt_internal_serialize_publish(unsigned char *pTxBu
 		aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
 	}
 
-	memcpy(ptr, pPayload, payloadLen);
-	ptr += payloadLen;
+	if(MQTT_5_0 == mqttVersion) {
+		aws_iot_mqtt_internal_write_char(&ptr, (unsigned char) propertiesLen);
+		if(0 != topicAlias) {
+			aws_iot_mqtt_internal_write_char(&ptr, MQTT5_PROPERTY_TOPIC_ALIAS);
+			aws_iot_mqtt_internal_write_uint_16(&ptr, topicAlias);
+		}
+	}
 
 	*pSerializedLen = (uint32_t) (ptr - pTxBuf);
 
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+/**
+ * @brief Serialize a publish of this client into writeBuf
+ *
+ * With MQTT 5 the topic is replaced by its alias once the broker knows it, and
+ * the first publish to a topic sets an alias for it while the broker takes more.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters, with the packet id set
+ * @param pSerializedLen Returned length of the packet in writeBuf, without the payload
+ * @param pNewTopicAlias Returned alias to remember with aws_iot_mqtt_internal_set_tx_topic_alias
+ *        once the packet is sent, 0 for none
+ *
+ * @return An IoT Error Type defining successful/failed call
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_serialize_client_publish(AWS_IoT_Client *pClient, const char *pTopicName,
+																   uint16_t topicNameLen,
+																   IoT_Publish_Message_Params *pParams,
+																   uint32_t *pSerializedLen,
+																   uint16_t *pNewTopicAlias) {
+	uint16_t topicAlias = 0;
+	uint16_t sentTopicNameLen = topicNameLen;
+	IoT_Error_t rc;
+
+	*pNewTopicAlias = 0;
+
+	if(AWS_IOT_MQTT_IS_V5(pClient)) {
+		topicAlias = aws_iot_mqtt_internal_find_tx_topic_alias(pClient, pTopicName, topicNameLen);
+		if(0 != topicAlias) {
+			sentTopicNameLen = 0;
+		} else {
+			topicAlias = aws_iot_mqtt_internal_next_tx_topic_alias(pClient);
+			*pNewTopicAlias = topicAlias;
+		}
+	}
+
+	rc = _aws_iot_mqtt_internal_serialize_publish(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+												  pClient->clientData.options.MQTTVersion, 0, pParams->qos,
+												  pParams->isRetained, pParams->id, pTopicName, sentTopicNameLen,
+												  topicAlias, (unsigned char *) pParams->payload,
+												  pParams->payloadLen, pSerializedLen);
+	if(SUCCESS != rc) {
+		return rc;
+	}
+
+	if(0 != pClient->clientData.mqtt5.maximumPacketSize && AWS_IOT_MQTT_IS_V5(pClient) &&
+	   (size_t) *pSerializedLen + pParams->payloadLen > pClient->clientData.mqtt5.maximumPacketSize) {
+		return MAX_SIZE_ERROR;
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * @brief Is there room for one more QoS1 publish in the broker's MQTT 5 Receive Maximum
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return true if it can be sent
+ */
+static bool _aws_iot_mqtt_internal_is_below_receive_maximum(AWS_IoT_Client *pClient) {
+	if(!AWS_IOT_MQTT_IS_V5(pClient)) {
+		return true;
+	}
+
+	return pClient->clientData.inFlightCount < pClient->clientData.mqtt5.receiveMaximum;
+}
+
+/**
+ * @brief Check the reason code of a PUBACK
+ *
+ * @param pClient Reference to the IoT Client
+ * @param reasonCode Reason code of the PUBACK, 0 if it had none
+ *
+ * @return SUCCESS, or MQTT_REASON_CODE_FAILURE_ERROR if the broker refused the publish
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_check_puback_reason(AWS_IoT_Client *pClient, uint8_t reasonCode) {
+	if(MQTT5_REASON_CODE_FAILURE > reasonCode) {
+		return SUCCESS;
+	}
+
+	pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+	return MQTT_REASON_CODE_FAILURE_ERROR;
+}
+
 /**
   * Serializes the ack packet into the supplied buffer.
   * @param pTxBuf the buffer into which the packet will be serialized
@@ -177,13 +286,157 @@ IoT_Error_t aws_iot_mqtt_internal_serialize_ack(unsigned char *pTxBuf, size_t tx
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+static InFlightPublish *_aws_iot_mqtt_internal_find_inflight(AWS_IoT_Client *pClient, uint16_t packetId) {
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; ++itr) {
+		if(pClient->clientData.inFlightPublishes[itr].isInUse &&
+		   packetId == pClient->clientData.inFlightPublishes[itr].packetId) {
+			return &(pClient->clientData.inFlightPublishes[itr]);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Take an in-flight slot for a QoS1 publish
+ *
+ * Also picks the packet id, one that no other in-flight publish uses.
+ * The topic and payload are copied into the in-flight store if they fit.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters, the packet id is set
+ *
+ * @return The slot, NULL if the window is full
+ */
+static InFlightPublish *_aws_iot_mqtt_internal_add_inflight(AWS_IoT_Client *pClient, const char *pTopicName,
+															uint16_t topicNameLen,
+															IoT_Publish_Message_Params *pParams) {
+	InFlightPublish *pInFlight = NULL;
+	unsigned char *pStore;
+	uint32_t itr;
+
+	if(pClient->clientData.inFlightCount >= pClient->clientData.inFlightWindow) {
+		return NULL;
+	}
+
+	for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; ++itr) {
+		if(!pClient->clientData.inFlightPublishes[itr].isInUse) {
+			pInFlight = &(pClient->clientData.inFlightPublishes[itr]);
+			break;
+		}
+	}
+	if(NULL == pInFlight) {
+		return NULL;
+	}
+
+	/* Packet ids wrap, don't reuse one that is still waiting for its PUBACK */
+	do {
+		pParams->id = aws_iot_mqtt_get_next_packet_id(pClient);
+	} while(NULL != _aws_iot_mqtt_internal_find_inflight(pClient, pParams->id));
+
+	pInFlight->isInUse = true;
+	pInFlight->isBlocking = false;
+	pInFlight->isStored = false;
+	pInFlight->isRetained = pParams->isRetained;
+	pInFlight->packetId = pParams->id;
+	pInFlight->topicNameLen = topicNameLen;
+	pInFlight->payloadLen = pParams->payloadLen;
+	pInFlight->pCompleteHandler = NULL;
+	pInFlight->pCompleteHandlerData = NULL;
+	init_timer(&(pInFlight->ackTimer));
+	countdown_ms(&(pInFlight->ackTimer), pClient->clientData.commandTimeoutMs);
+	pClient->clientData.inFlightCount++;
+
+	if(pParams->payloadLen <= AWS_IOT_MQTT_INFLIGHT_STORE_LEN - pClient->clientData.inFlightStoreUsed &&
+	   topicNameLen <= AWS_IOT_MQTT_INFLIGHT_STORE_LEN - pClient->clientData.inFlightStoreUsed - pParams->payloadLen) {
+		pInFlight->storeOffset = pClient->clientData.inFlightStoreUsed;
+		pStore = &(pClient->clientData.inFlightStore[pInFlight->storeOffset]);
+		memcpy(pStore, pTopicName, topicNameLen);
+		memcpy(pStore + topicNameLen, pParams->payload, pParams->payloadLen);
+		pClient->clientData.inFlightStoreUsed += (size_t) topicNameLen + pParams->payloadLen;
+		pInFlight->isStored = true;
+	}
+
+	return pInFlight;
+}
+
+/**
+ * @brief Free an in-flight slot and its part of the in-flight store
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pInFlight The in-flight publish
+ */
+static void _aws_iot_mqtt_internal_remove_inflight(AWS_IoT_Client *pClient, InFlightPublish *pInFlight) {
+	size_t storedLen, storeEnd;
+	uint32_t itr;
+
+	if(pInFlight->isStored) {
+		/* Keep the store packed, the order of what is left doesn't change */
+		storedLen = (size_t) pInFlight->topicNameLen + pInFlight->payloadLen;
+		storeEnd = pInFlight->storeOffset + storedLen;
+		memmove(&(pClient->clientData.inFlightStore[pInFlight->storeOffset]),
+				&(pClient->clientData.inFlightStore[storeEnd]), pClient->clientData.inFlightStoreUsed - storeEnd);
+		pClient->clientData.inFlightStoreUsed -= storedLen;
+
+		for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; ++itr) {
+			if(pClient->clientData.inFlightPublishes[itr].isInUse &&
+			   pClient->clientData.inFlightPublishes[itr].isStored &&
+			   pClient->clientData.inFlightPublishes[itr].storeOffset > pInFlight->storeOffset) {
+				pClient->clientData.inFlightPublishes[itr].storeOffset -= storedLen;
+			}
+		}
+		pInFlight->isStored = false;
+	}
+
+	pInFlight->isInUse = false;
+	pClient->clientData.inFlightCount--;
+}
+
+/**
+ * Frees the in-flight slot and lets the application know how the publish went.
+ * The slot is freed first so the handler can publish again straight away.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pInFlight The in-flight publish that completed
+ * @param rc How it completed
+ * @param isCallbackStateNeeded Switch to CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN around the handler
+ *        (same as subscription callbacks) so it may call the publish APIs
+ */
+static void _aws_iot_mqtt_internal_complete_inflight(AWS_IoT_Client *pClient, InFlightPublish *pInFlight,
+													 IoT_Error_t rc, bool isCallbackStateNeeded) {
+	pPublishCompleteHandler_t pCompleteHandler = pInFlight->pCompleteHandler;
+	void *pCompleteHandlerData = pInFlight->pCompleteHandlerData;
+	uint16_t packetId = pInFlight->packetId;
+	ClientState clientState;
+
+	_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
+
+	if(NULL == pCompleteHandler) {
+		return;
+	}
+
+	if(isCallbackStateNeeded) {
+		clientState = aws_iot_mqtt_get_client_state(pClient);
+		aws_iot_mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN);
+		pCompleteHandler(pClient, packetId, rc, pCompleteHandlerData);
+		aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN, clientState);
+	} else {
+		pCompleteHandler(pClient, packetId, rc, pCompleteHandlerData);
+	}
+}
+
 /**
  * @brief Publish an MQTT message on a topic
  *
  * Called to publish an MQTT message on a topic.
  * @note Call is blocking.  In the case of a QoS 0 message the function returns
  * after the message was successfully passed to the TLS layer.  In the case of QoS 1
- * the function returns after the receipt of the PUBACK control packet.
+ * the function returns after the receipt of the PUBACK control packet, or with
+ * MQTT_PUBLISH_QUEUED if it gives up waiting on a publish kept in the in-flight store.
  * This is the internal function which is called by the publish API to perform the operation.
  * Not meant to be called directly as it doesn't do validations or client state changes
  *
@@ -198,8 +451,10 @@ static IoT_Error_t _aws_iot_mqtt_internal_publish(AWS_IoT_Client *pClient, const
 												  uint16_t topicNameLen, IoT_Publish_Message_Params *pParams) {
 	Timer timer;
 	uint32_t len = 0;
-	uint16_t packet_id;
+	uint16_t packet_id, newTopicAlias;
 	unsigned char dup, type;
+	uint8_t reasonCode;
+	InFlightPublish *pInFlight = NULL;
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
@@ -208,35 +463,74 @@ static IoT_Error_t _aws_iot_mqtt_internal_publish(AWS_IoT_Client *pClient, const
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
 	if(QOS1 == pParams->qos) {
-		pParams->id = aws_iot_mqtt_get_next_packet_id(pClient);
+		if(!_aws_iot_mqtt_internal_is_below_receive_maximum(pClient)) {
+			FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+		}
+
+		/* Only worth a slot if it can be sent again after a reconnect */
+		pInFlight = _aws_iot_mqtt_internal_add_inflight(pClient, pTopicName, topicNameLen, pParams);
+		if(NULL != pInFlight && !pInFlight->isStored) {
+			_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
+			pInFlight = NULL;
+		}
+		if(NULL != pInFlight) {
+			pInFlight->isBlocking = true;
+		} else {
+			pParams->id = aws_iot_mqtt_get_next_packet_id(pClient);
+		}
 	}
 
-	rc = _aws_iot_mqtt_internal_serialize_publish(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-												  pParams->qos, pParams->isRetained, pParams->id, pTopicName,
-												  topicNameLen, (unsigned char *) pParams->payload,
-												  pParams->payloadLen, &len);
+	rc = _aws_iot_mqtt_internal_serialize_client_publish(pClient, pTopicName, topicNameLen, pParams, &len,
+														 &newTopicAlias);
 	if(SUCCESS != rc) {
+		if(NULL != pInFlight) {
+			_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
+		}
 		FUNC_EXIT_RC(rc);
 	}
 
 	/* send the publish packet */
-	rc = aws_iot_mqtt_internal_send_packet(pClient, len, &timer);
+	rc = aws_iot_mqtt_internal_send_packet_with_payload(pClient, len, (unsigned char *) pParams->payload,
+														pParams->payloadLen, &timer);
 	if(SUCCESS != rc) {
+		if(NULL != pInFlight) {
+			pInFlight->isBlocking = false;
+			FUNC_EXIT_RC(MQTT_PUBLISH_QUEUED);
+		}
 		FUNC_EXIT_RC(rc);
 	}
 
+	if(0 != newTopicAlias) {
+		/* If the copy fails the topic is just sent in full again next time */
+		(void) aws_iot_mqtt_internal_set_tx_topic_alias(pClient, newTopicAlias, pTopicName, topicNameLen);
+	}
+
 	/* Wait for ack if QoS1 */
 	if(QOS1 == pParams->qos) {
-		rc = aws_iot_mqtt_internal_wait_for_read(pClient, PUBACK, &timer);
-		if(SUCCESS != rc) {
-			FUNC_EXIT_RC(rc);
+		/* PUBACKs for async publishes are consumed in cycle_read, but a late one for an
+		 * async publish that already timed out can still show up here */
+		do {
+			rc = aws_iot_mqtt_internal_wait_for_read(pClient, PUBACK, &timer);
+			if(SUCCESS == rc) {
+				rc = aws_iot_mqtt_internal_deserialize_ack(&type, &dup, &packet_id, &reasonCode,
+														   pClient->clientData.readBuf,
+														   pClient->clientData.readBufSize);
+			}
+			if(SUCCESS != rc) {
+				if(NULL != pInFlight) {
+					/* Its PUBACK is handled like an async one from now on */
+					pInFlight->isBlocking = false;
+					FUNC_EXIT_RC(MQTT_PUBLISH_QUEUED);
+				}
+				FUNC_EXIT_RC(rc);
+			}
+		} while(packet_id != pParams->id);
+
+		if(NULL != pInFlight) {
+			_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
 		}
 
-		rc = aws_iot_mqtt_internal_deserialize_ack(&type, &dup, &packet_id, pClient->clientData.readBuf,
-												   pClient->clientData.readBufSize);
-		if(SUCCESS != rc) {
-			FUNC_EXIT_RC(rc);
-		}
+		FUNC_EXIT_RC(_aws_iot_mqtt_internal_check_puback_reason(pClient, reasonCode));
 	}
 
 	FUNC_EXIT_RC(SUCCESS);
@@ -294,14 +588,296 @@ IoT_Error_t aws_iot_mqtt_publish(AWS_IoT_Client *pClient, const char *pTopicName
 	FUNC_EXIT_RC(pubRc);
 }
 
+/**
+ * @brief Match a received PUBACK against the in-flight publishes
+ *
+ * Called from cycle_read with the PUBACK in the read buffer. If it belongs to an async
+ * publish the publish is completed and *pPacketType is cleared, so a blocking call waiting
+ * for its own PUBACK doesn't mistake it for one.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pPacketType Type of the packet just read, cleared if the PUBACK was consumed
+ *
+ * @return An IoT Error Type defining successful/failed call
+ */
+IoT_Error_t aws_iot_mqtt_internal_handle_puback(AWS_IoT_Client *pClient, uint8_t *pPacketType) {
+	unsigned char type, dup;
+	uint16_t packetId;
+	uint8_t reasonCode;
+	InFlightPublish *pInFlight;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(0 == pClient->clientData.inFlightCount) {
+		/* Must be for a blocking publish */
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	rc = aws_iot_mqtt_internal_deserialize_ack(&type, &dup, &packetId, &reasonCode, pClient->clientData.readBuf,
+											   pClient->clientData.readBufSize);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	pInFlight = _aws_iot_mqtt_internal_find_inflight(pClient, packetId);
+	if(NULL != pInFlight && !pInFlight->isBlocking) {
+		*pPacketType = 0;
+		_aws_iot_mqtt_internal_complete_inflight(pClient, pInFlight,
+												 _aws_iot_mqtt_internal_check_puback_reason(pClient, reasonCode),
+												 true);
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Give up on in-flight publishes whose PUBACK is overdue
+ *
+ * Called every yield cycle. Completes them with MQTT_REQUEST_TIMEOUT_ERROR.
+ * Stored publishes wait for as long as it takes: a connection that stopped
+ * working is caught by the keep alive and they are sent again on reconnect.
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void aws_iot_mqtt_internal_check_inflight_timeouts(AWS_IoT_Client *pClient) {
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH && 0 < pClient->clientData.inFlightCount; ++itr) {
+		if(pClient->clientData.inFlightPublishes[itr].isInUse &&
+		   !pClient->clientData.inFlightPublishes[itr].isStored &&
+		   has_timer_expired(&(pClient->clientData.inFlightPublishes[itr].ackTimer))) {
+			IOT_WARN("No PUBACK for packet id %u", pClient->clientData.inFlightPublishes[itr].packetId);
+			_aws_iot_mqtt_internal_complete_inflight(pClient, &(pClient->clientData.inFlightPublishes[itr]),
+													 MQTT_REQUEST_TIMEOUT_ERROR, true);
+		}
+	}
+}
+
+/**
+ * @brief Fail every in-flight publish that can't be sent again
+ *
+ * Called when the connection goes away, a PUBACK can't arrive any more.
+ * Publishes in the in-flight store are kept for aws_iot_mqtt_internal_resend_inflight_publishes.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param rc Error to complete the publishes with
+ */
+void aws_iot_mqtt_internal_fail_inflight_publishes(AWS_IoT_Client *pClient, IoT_Error_t rc) {
+	uint32_t itr;
+
+	for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH && 0 < pClient->clientData.inFlightCount; ++itr) {
+		if(pClient->clientData.inFlightPublishes[itr].isInUse &&
+		   !pClient->clientData.inFlightPublishes[itr].isStored) {
+			_aws_iot_mqtt_internal_complete_inflight(pClient, &(pClient->clientData.inFlightPublishes[itr]), rc,
+													 false);
+		}
+	}
+}
+
+/**
+ * @brief Send the stored in-flight publishes again
+ *
+ * Called once a new connection is accepted. They go out with DUP set and their
+ * original packet ids, in the order they were first sent. Topic aliases belong to
+ * the old connection, the full topic is sent.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTimer Timer for the sends
+ *
+ * @return An IoT Error Type defining successful/failed send
+ */
+IoT_Error_t aws_iot_mqtt_internal_resend_inflight_publishes(AWS_IoT_Client *pClient, Timer *pTimer) {
+	InFlightPublish *pInFlight, *pNext;
+	unsigned char *pStore;
+	size_t nextOffset;
+	uint32_t itr, len;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	nextOffset = 0;
+	do {
+		/* Store order is send order */
+		pNext = NULL;
+		for(itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; ++itr) {
+			pInFlight = &(pClient->clientData.inFlightPublishes[itr]);
+			if(pInFlight->isInUse && pInFlight->isStored && pInFlight->storeOffset >= nextOffset &&
+			   (NULL == pNext || pInFlight->storeOffset < pNext->storeOffset)) {
+				pNext = pInFlight;
+			}
+		}
+		if(NULL == pNext) {
+			break;
+		}
+
+		pStore = &(pClient->clientData.inFlightStore[pNext->storeOffset]);
+		rc = _aws_iot_mqtt_internal_serialize_publish(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+													  pClient->clientData.options.MQTTVersion, 1, QOS1,
+													  pNext->isRetained, pNext->packetId, (const char *) pStore,
+													  pNext->topicNameLen, 0, pStore + pNext->topicNameLen,
+													  pNext->payloadLen, &len);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+
+		rc = aws_iot_mqtt_internal_send_packet_with_payload(pClient, len, pStore + pNext->topicNameLen,
+															pNext->payloadLen, pTimer);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+
+		IOT_DEBUG("Sent packet id %u again", pNext->packetId);
+		countdown_ms(&(pNext->ackTimer), pClient->clientData.commandTimeoutMs);
+		nextOffset = pNext->storeOffset + pNext->topicNameLen + pNext->payloadLen;
+	} while(nextOffset < pClient->clientData.inFlightStoreUsed);
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Publish an MQTT message on a topic without waiting for the PUBACK
+ *
+ * This is the internal function which is called by the async publish API to perform the operation.
+ * Not meant to be called directly as it doesn't do validations or client state changes
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters
+ * @param pCompleteHandler Called once the publish completes
+ * @param pCompleteHandlerData Passed to pCompleteHandler
+ *
+ * @return An IoT Error Type defining successful/failed publish
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_publish_async(AWS_IoT_Client *pClient, const char *pTopicName,
+														uint16_t topicNameLen, IoT_Publish_Message_Params *pParams,
+														pPublishCompleteHandler_t pCompleteHandler,
+														void *pCompleteHandlerData) {
+	Timer timer;
+	uint32_t len = 0;
+	uint16_t newTopicAlias;
+	InFlightPublish *pInFlight = NULL;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(QOS1 == pParams->qos) {
+		if(!_aws_iot_mqtt_internal_is_below_receive_maximum(pClient)) {
+			FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+		}
+
+		/* Tracked before sending, the PUBACK can beat us back on another thread's yield */
+		pInFlight = _aws_iot_mqtt_internal_add_inflight(pClient, pTopicName, topicNameLen, pParams);
+		if(NULL == pInFlight) {
+			FUNC_EXIT_RC(LIMIT_EXCEEDED_ERROR);
+		}
+	}
+
+	init_timer(&timer);
+	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+
+	rc = _aws_iot_mqtt_internal_serialize_client_publish(pClient, pTopicName, topicNameLen, pParams, &len,
+														 &newTopicAlias);
+	if(SUCCESS != rc) {
+		if(NULL != pInFlight) {
+			_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
+		}
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(NULL != pInFlight) {
+		pInFlight->pCompleteHandler = pCompleteHandler;
+		pInFlight->pCompleteHandlerData = pCompleteHandlerData;
+	}
+
+	/* Nobody waits on it, it can go out with the next packets when write coalescing is on */
+	rc = aws_iot_mqtt_internal_queue_packet(pClient, len, (unsigned char *) pParams->payload, pParams->payloadLen,
+											&timer);
+	if(SUCCESS != rc) {
+		if(NULL != pInFlight && pInFlight->isInUse && pInFlight->packetId == pParams->id) {
+			if(pInFlight->isStored) {
+				/* Accepted, it goes out again on reconnect and completes through the handler */
+				FUNC_EXIT_RC(SUCCESS);
+			}
+			_aws_iot_mqtt_internal_remove_inflight(pClient, pInFlight);
+		}
+		FUNC_EXIT_RC(rc);
+	}
+
+	if(0 != newTopicAlias) {
+		(void) aws_iot_mqtt_internal_set_tx_topic_alias(pClient, newTopicAlias, pTopicName, topicNameLen);
+	}
+
+	if(QOS0 == pParams->qos && NULL != pCompleteHandler) {
+		pCompleteHandler(pClient, pParams->id, SUCCESS, pCompleteHandlerData);
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Publish an MQTT message on a topic without waiting for the PUBACK
+ *
+ * This is the outer function which does the validations and calls the internal async publish
+ * above to perform the actual operation. It is also responsible for client state changes
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to
+ * @param topicNameLen Length of the topic name
+ * @param pParams Pointer to Publish Message parameters
+ * @param pCompleteHandler Called once the publish completes (can be NULL)
+ * @param pCompleteHandlerData Passed to pCompleteHandler
+ *
+ * @return An IoT Error Type defining successful/failed publish
+ */
+IoT_Error_t aws_iot_mqtt_publish_async(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+									   IoT_Publish_Message_Params *pParams,
+									   pPublishCompleteHandler_t pCompleteHandler, void *pCompleteHandlerData) {
+	IoT_Error_t rc, pubRc;
+	ClientState clientState;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pTopicName || 0 == topicNameLen || NULL == pParams) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pClient)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	clientState = aws_iot_mqtt_get_client_state(pClient);
+	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
+	rc = aws_iot_mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_PUBLISH_IN_PROGRESS);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	pubRc = _aws_iot_mqtt_internal_publish_async(pClient, pTopicName, topicNameLen, pParams, pCompleteHandler,
+												 pCompleteHandlerData);
+
+	rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_PUBLISH_IN_PROGRESS, clientState);
+	if(SUCCESS == pubRc && SUCCESS != rc) {
+		pubRc = rc;
+	}
+
+	FUNC_EXIT_RC(pubRc);
+}
+
 /**
   * Deserializes the supplied (wire) buffer into publish data
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 has properties after the packet id
   * @param dup returned uint8_t - the MQTT dup flag
   * @param qos returned QoS type - the MQTT QoS value
   * @param retained returned uint8_t - the MQTT retained flag
   * @param pPacketId returned uint16_t - the MQTT packet identifier
   * @param pTopicName returned String - the MQTT topic in the publish
   * @param topicNameLen returned uint16_t - the length of the MQTT topic in the publish
+  * @param pTopicAlias returned uint16_t - the MQTT 5 topic alias, 0 if none
   * @param payload returned byte buffer - the MQTT publish payload
   * @param payloadlen returned size_t - the length of the MQTT payload
   * @param pRxBuf the raw buffer data, of the correct length determined by the remaining length field
@@ -309,9 +885,10 @@ IoT_Error_t aws_iot_mqtt_publish(AWS_IoT_Client *pClient, const char *pTopicName
   *
   * @return An IoT Error Type defining successful/failed call
   */
-IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
+IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(MQTT_Ver_t mqttVersion, uint8_t *dup, QoS *qos,
 													  uint8_t *retained, uint16_t *pPacketId,
 													  char **pTopicName, uint16_t *topicNameLen,
+													  uint16_t *pTopicAlias,
 													  unsigned char **payload, size_t *payloadLen,
 													  unsigned char *pRxBuf, size_t rxBufLen) {
 	unsigned char *curData = pRxBuf;
@@ -323,9 +900,10 @@ IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
 
 	FUNC_ENTRY;
 
-	if(NULL == dup || NULL == qos || NULL == retained || NULL == pPacketId) {
+	if(NULL == dup || NULL == qos || NULL == retained || NULL == pPacketId || NULL == pTopicAlias) {
 		FUNC_EXIT_RC(FAILURE);
 	}
+	*pTopicAlias = 0;
 
 	/* Publish header size is at least four bytes.
 	 * Fixed header is two bytes.
@@ -364,6 +942,13 @@ IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
 		*pPacketId = aws_iot_mqtt_internal_read_uint16_t(&curData);
 	}
 
+	if(MQTT_5_0 == mqttVersion) {
+		rc = aws_iot_mqtt_internal_read_publish_properties(&curData, endData, pTopicAlias);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(FAILURE);
+		}
+	}
+
 	*payloadLen = (size_t) (endData - curData);
 	*payload = curData;
 
@@ -375,14 +960,16 @@ IoT_Error_t aws_iot_mqtt_internal_deserialize_publish(uint8_t *dup, QoS *qos,
   * @param pPacketType returned integer - the MQTT packet type
   * @param dup returned integer - the MQTT dup flag
   * @param pPacketId returned integer - the MQTT packet identifier
+  * @param pReasonCode returned uint8_t - the MQTT 5 reason code that follows the packet id
+  *        in a PUBACK, 0 if there is none (always with MQTT 3.1.1)
   * @param pRxBuf the raw buffer data, of the correct length determined by the remaining length field
   * @param rxBuflen the length in bytes of the data in the supplied buffer
   *
   * @return An IoT Error Type defining successful/failed call
   */
 IoT_Error_t aws_iot_mqtt_internal_deserialize_ack(unsigned char *pPacketType, unsigned char *dup,
-												  uint16_t *pPacketId, unsigned char *pRxBuf,
-												  size_t rxBuflen) {
+												  uint16_t *pPacketId, uint8_t *pReasonCode,
+												  unsigned char *pRxBuf, size_t rxBuflen) {
 	IoT_Error_t rc = FAILURE;
 	unsigned char *curdata = pRxBuf;
 	unsigned char *enddata = NULL;
@@ -392,7 +979,7 @@ IoT_Error_t aws_iot_mqtt_internal_deserialize_ack(unsigned char *pPacketType, un
 
 	FUNC_ENTRY;
 
-	if(NULL == pPacketType || NULL == dup || NULL == pPacketId || NULL == pRxBuf) {
+	if(NULL == pPacketType || NULL == dup || NULL == pPacketId || NULL == pReasonCode || NULL == pRxBuf) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
@@ -420,6 +1007,11 @@ IoT_Error_t aws_iot_mqtt_internal_deserialize_ack(unsigned char *pPacketType, un
 
 	*pPacketId = aws_iot_mqtt_internal_read_uint16_t(&curdata);
 
+	*pReasonCode = 0;
+	if(PUBACK == *pPacketType && curdata < enddata) {
+		*pReasonCode = aws_iot_mqtt_internal_read_char(&curdata);
+	}
+
 	FUNC_EXIT_RC(SUCCESS);
 }
 
@@ -0,0 +1,293 @@
+/*
+* Copyright 2015-2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*
+* http://aws.amazon.com/apache2.0
+*
+* or in the "license" file accompanying this file. This file is distributed
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied. See the License for the specific language governing
+* permissions and limitations under the License.
+*/
+
+/**
+ * @file aws_iot_mqtt_client_standby.c
+ * @brief Hot standby connection
+ *
+ * A second client, connected under its own client ID, holds the same subscriptions
+ * as the primary and drops what it receives. When the primary connection fails the
+ * two clients exchange networks and connection state, so the primary carries on over
+ * the standby's connection with no handshake and no resubscribe, and the standby
+ * reconnects the failed network in the background.
+ *
+ * The standby reconnects under the primary's old client ID. With a persistent session
+ * the broker then sends it again what it had sent the failed connection without an
+ * acknowledgement. The standby had dropped its own copy of those before the switch,
+ * so it hands these redeliveries to the primary's handlers.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "aws_iot_mqtt_client_common_internal.h"
+
+/**
+ * @brief Message handler of the standby's subscriptions
+ *
+ * The primary delivers these messages, the standby only keeps the subscriptions alive.
+ * The exception is a redelivery on the session the standby took over from the primary:
+ * the primary may never have handled it, so it goes to the primary's handlers.
+ * QoS1 messages are acknowledged by the standby's yield either way.
+ *
+ * @param pClientData The primary IoT Client
+ */
+static void _aws_iot_mqtt_standby_handler(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+										  IoT_Publish_Message_Params *pParams, void *pClientData) {
+	AWS_IoT_Client *pPrimary = (AWS_IoT_Client *) pClientData;
+
+	/* A message sent for the first time went to the primary's own session as well */
+	if(!pClient->clientData.isSessionInherited || 0 == pParams->isDup) {
+		return;
+	}
+
+	if(NULL == pPrimary || pPrimary->clientData.pStandby != pClient) {
+		return;
+	}
+
+	(void) aws_iot_mqtt_internal_deliver_message(pPrimary, pTopicName, topicNameLen, pParams);
+}
+
+/**
+ * @brief Give the standby the subscriptions the primary has, and only those
+ *
+ * Topics are subscribed in one batch, unsubscribes are one call each. A standby that
+ * isn't connected only has its handlers updated, its reconnect subscribes them.
+ *
+ * @param pClient Reference to the primary IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed mirroring, SUCCESS without a standby
+ */
+IoT_Error_t aws_iot_mqtt_internal_mirror_subscriptions(AWS_IoT_Client *pClient) {
+	IoT_Subscription_Params subscriptions[AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS];
+	AWS_IoT_Client *pStandby;
+	MessageHandlers *pHandler;
+	uint32_t itr, count;
+	bool isConnected;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	pStandby = pClient->clientData.pStandby;
+	if(NULL == pStandby) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	isConnected = aws_iot_mqtt_is_client_connected(pStandby);
+	rc = SUCCESS;
+
+	/* Unsubscribed on the primary. The slot is cleared, the index can move on */
+	for(itr = 0; itr < pStandby->clientData.messageHandlersSize && SUCCESS == rc; itr++) {
+		pHandler = &(pStandby->clientData.messageHandlers[itr]);
+		if(NULL == pHandler->topicName ||
+		   aws_iot_mqtt_internal_has_handler(pClient, pHandler->topicName, pHandler->topicNameLen)) {
+			continue;
+		}
+		if(isConnected) {
+			rc = aws_iot_mqtt_unsubscribe(pStandby, pHandler->topicName, pHandler->topicNameLen);
+		} else {
+			(void) aws_iot_mqtt_internal_remove_handlers(pStandby, pHandler->topicName, pHandler->topicNameLen);
+		}
+	}
+
+	/* Subscribed on the primary */
+	count = 0;
+	for(itr = 0; itr < pClient->clientData.messageHandlersSize && SUCCESS == rc; itr++) {
+		pHandler = &(pClient->clientData.messageHandlers[itr]);
+		if(NULL == pHandler->topicName ||
+		   aws_iot_mqtt_internal_has_handler(pStandby, pHandler->topicName, pHandler->topicNameLen)) {
+			continue;
+		}
+		if(!isConnected) {
+			rc = aws_iot_mqtt_internal_add_handler(pStandby, pHandler->topicName, pHandler->topicNameLen,
+												   pHandler->qos, _aws_iot_mqtt_standby_handler, NULL, pClient);
+			continue;
+		}
+		subscriptions[count].pTopicName = pHandler->topicName;
+		subscriptions[count].topicNameLen = pHandler->topicNameLen;
+		subscriptions[count].qos = pHandler->qos;
+		subscriptions[count].pApplicationHandler = _aws_iot_mqtt_standby_handler;
+		subscriptions[count].pApplicationHandlerData = pClient;
+		count++;
+		if(AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS == count) {
+			rc = aws_iot_mqtt_subscribe_batch(pStandby, subscriptions, count);
+			count = 0;
+		}
+	}
+
+	if(SUCCESS == rc && 0 != count) {
+		rc = aws_iot_mqtt_subscribe_batch(pStandby, subscriptions, count);
+	}
+
+	FUNC_EXIT_RC(rc);
+}
+
+/**
+ * @brief Hand the primary's failed connection over to the standby's working one
+ *
+ * Called instead of the disconnect when the primary's connection fails. The clients
+ * exchange networks, connect options, keep alive and MQTT 5 session, so each keeps
+ * using the client ID its network connected with. What the standby had received and
+ * not yet handled moves over with its connection. The primary's QoS1 publishes that
+ * weren't acknowledged are sent again, the others fail as on a disconnect. The standby
+ * is left disconnected, its next yield reconnects it if auto reconnect is enabled, under
+ * the primary's old client ID and session, whose redeliveries it hands to the primary.
+ *
+ * @param pClient Reference to the primary IoT Client
+ *
+ * @return SUCCESS if the standby took over, an error if the primary has to disconnect
+ */
+IoT_Error_t aws_iot_mqtt_internal_promote_standby(AWS_IoT_Client *pClient) {
+	IoT_Client_Connect_Params options;
+	MQTT5Session mqtt5;
+	AWS_IoT_Client *pStandby;
+	Network *pNetwork;
+	char *pTopicName;
+	Timer timer;
+	uint16_t keepAliveInterval;
+	bool isSessionPresent;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	pStandby = pClient->clientData.pStandby;
+	if(NULL == pStandby || CLIENT_STATE_CONNECTED_IDLE != aws_iot_mqtt_get_client_state(pStandby)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	/* Anything the standby is missing costs a round trip now rather than messages later */
+	rc = aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+	if(SUCCESS == rc) {
+		/* PUBACKs queued by the standby belong to its connection */
+		rc = aws_iot_mqtt_internal_flush_tx_queue(pStandby);
+	}
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	IOT_WARN("Connection lost, switching to the standby connection");
+
+	/* The failed connection goes to the standby */
+	pClient->pNetworkStack->disconnect(pClient->pNetworkStack);
+	(void) pClient->pNetworkStack->destroy(pClient->pNetworkStack);
+	pNetwork = pClient->pNetworkStack;
+	pClient->pNetworkStack = pStandby->pNetworkStack;
+	pStandby->pNetworkStack = pNetwork;
+
+	options = pClient->clientData.options;
+	pClient->clientData.options = pStandby->clientData.options;
+	pStandby->clientData.options = options;
+
+	mqtt5 = pClient->clientData.mqtt5;
+	pClient->clientData.mqtt5 = pStandby->clientData.mqtt5;
+	pStandby->clientData.mqtt5 = mqtt5;
+
+	keepAliveInterval = pClient->clientData.keepAliveInterval;
+	pClient->clientData.keepAliveInterval = pStandby->clientData.keepAliveInterval;
+	pStandby->clientData.keepAliveInterval = keepAliveInterval;
+
+	isSessionPresent = pClient->clientStatus.isSessionPresent;
+	pClient->clientStatus.isSessionPresent = pStandby->clientStatus.isSessionPresent;
+	pStandby->clientStatus.isSessionPresent = isSessionPresent;
+
+	pClient->pingTimer = pStandby->pingTimer;
+	pClient->clientStatus.isPingOutstanding = pStandby->clientStatus.isPingOutstanding;
+
+	/* Whatever the old network was part way through is lost with it */
+	aws_iot_mqtt_internal_flushBuffers(pClient);
+	memcpy(pClient->clientData.readBuf, pStandby->clientData.readBuf, pStandby->clientData.readBufIndex);
+	pClient->clientData.readBufIndex = pStandby->clientData.readBufIndex;
+	pClient->clientData.readBufPacketLen = pStandby->clientData.readBufPacketLen;
+	/* Carry on with a packet the standby was part way through, its topic moves with the buffer */
+	pClient->clientData.rxOversized = pStandby->clientData.rxOversized;
+	pTopicName = pStandby->clientData.rxOversized.pTopicName;
+	if(pTopicName >= (char *) pStandby->clientData.readBuf &&
+	   pTopicName < (char *) pStandby->clientData.readBuf + pStandby->clientData.readBufIndex) {
+		pClient->clientData.rxOversized.pTopicName =
+			(char *) pClient->clientData.readBuf + (pTopicName - (char *) pStandby->clientData.readBuf);
+	}
+	pStandby->clientData.rxOversized.remainingLen = 0;
+	pClient->clientData.txQueueLen = 0;
+
+	/* The standby now holds a dead network, it reconnects it from its own yield */
+	aws_iot_mqtt_internal_flushBuffers(pStandby);
+	pStandby->clientStatus.isPingOutstanding = false;
+	pStandby->clientStatus.clientState = CLIENT_STATE_DISCONNECTED_ERROR;
+	pStandby->clientData.counterNetworkDisconnected++;
+	pStandby->clientData.isSessionInherited = !pStandby->clientData.options.isCleanSession;
+	pClient->clientData.isSessionInherited = false;
+	if(pStandby->clientStatus.isAutoReconnectEnabled) {
+		pStandby->clientStatus.clientState = CLIENT_STATE_PENDING_RECONNECT;
+		pStandby->clientData.currentReconnectWaitInterval = AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL;
+		countdown_ms(&(pStandby->reconnectDelayTimer), pStandby->clientData.currentReconnectWaitInterval);
+	}
+
+	pClient->clientData.counterStandbyPromoted++;
+
+	/* No PUBACKs will come for these from the old session, the stored ones go out again */
+	aws_iot_mqtt_internal_fail_inflight_publishes(pClient, NETWORK_DISCONNECTED_ERROR);
+	init_timer(&timer);
+	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+	rc = aws_iot_mqtt_internal_resend_inflight_publishes(pClient, &timer);
+
+	FUNC_EXIT_RC(rc);
+}
+
+IoT_Error_t aws_iot_mqtt_set_standby(AWS_IoT_Client *pClient, AWS_IoT_Client *pStandby) {
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	if(NULL != pClient->clientData.pStandby) {
+		pClient->clientData.pStandby->clientData.isStandby = false;
+		pClient->clientData.pStandby = NULL;
+	}
+
+	if(NULL == pStandby) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	/* One standby per client, and a standby doesn't have one of its own */
+	if(pStandby == pClient || pStandby->clientData.isStandby || NULL != pStandby->clientData.pStandby ||
+	   pClient->clientData.isStandby) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	pClient->clientData.pStandby = pStandby;
+	pStandby->clientData.isStandby = true;
+
+	rc = aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+
+	FUNC_EXIT_RC(rc);
+}
+
+uint32_t aws_iot_mqtt_get_standby_promoted_count(AWS_IoT_Client *pClient) {
+	return pClient->clientData.counterStandbyPromoted;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -41,10 +41,17 @@ extern "C" {
 
 #include "aws_iot_mqtt_client_common_internal.h"
 
+/* Return code in a SUBACK for a topic the broker refused, MQTT v3.1.1 Specification 3.9.3 */
+#define SUBACK_FAILURE_RETURN_CODE 0x80
+
+/* Topics per _aws_iot_mqtt_internal_subscribe_list call, bounds its stack use */
+#define SUBSCRIBE_LIST_MAX_TOPICS AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+
 /**
   * Serializes the supplied subscribe data into the supplied buffer, ready for sending
   * @param pTxBuf the buffer into which the packet will be serialized
   * @param txBufLen the length in bytes of the supplied buffer
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 adds an empty property list
   * @param dup unsigned char - the MQTT dup flag
   * @param packetId uint16_t - the MQTT packet identifier
   * @param topicCount - number of members in the topicFilters and reqQos arrays
@@ -56,7 +63,8 @@ extern "C" {
   * @return An IoT Error Type defining successful/failed operation
   */
 static IoT_Error_t _aws_iot_mqtt_serialize_subscribe(unsigned char *pTxBuf, size_t txBufLen,
-													 unsigned char dup, uint16_t packetId, uint32_t topicCount,
+													 MQTT_Ver_t mqttVersion, unsigned char dup,
+													 uint16_t packetId, uint32_t topicCount,
 													 const char **pTopicNameList, uint16_t *pTopicNameLenList,
 													 QoS *pRequestedQoSs, uint32_t *pSerializedLen) {
 	unsigned char *ptr;
@@ -71,6 +79,9 @@ static IoT_Error_t _aws_iot_mqtt_serialize_subscribe(unsigned char *pTxBuf, size
 
 	ptr = pTxBuf;
 	rem_len = 2; /* packetId */
+	if(MQTT_5_0 == mqttVersion) {
+		rem_len += 1; /* property length */
+	}
 
 	for(itr = 0; itr < topicCount; ++itr) {
 		rem_len += (uint32_t) (pTopicNameLenList[itr] + 2 + 1); /* topic + length + req_qos */
@@ -92,6 +103,11 @@ static IoT_Error_t _aws_iot_mqtt_serialize_subscribe(unsigned char *pTxBuf, size
 
 	aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
 
+	if(MQTT_5_0 == mqttVersion) {
+		/* No properties */
+		aws_iot_mqtt_internal_write_char(&ptr, 0);
+	}
+
 	for(itr = 0; itr < topicCount; ++itr) {
 		aws_iot_mqtt_internal_write_utf8_string(&ptr, pTopicNameList[itr], pTopicNameLenList[itr]);
 		aws_iot_mqtt_internal_write_char(&ptr, (unsigned char) pRequestedQoSs[itr]);
@@ -104,25 +120,31 @@ static IoT_Error_t _aws_iot_mqtt_serialize_subscribe(unsigned char *pTxBuf, size
 
 /**
   * Deserializes the supplied (wire) buffer into suback data
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 has properties after the packet id
   * @param pPacketId returned integer - the MQTT packet identifier
   * @param maxExpectedQoSCount - the maximum number of members allowed in the grantedQoSs array
   * @param pGrantedQoSCount returned uint32_t - number of members in the grantedQoSs array
-  * @param pGrantedQoSs returned array of QoS type - the granted qualities of service
+  * @param pGrantedQoSs returned array of QoS type - the granted qualities of service,
+  *        any MQTT 5 failure reason is returned as SUBACK_FAILURE_RETURN_CODE
+  * @param pReasonCode returned uint8_t - the first failure reason code, 0 if every topic was granted
   * @param pRxBuf the raw buffer data, of the correct length determined by the remaining length field
   * @param rxBufLen the length in bytes of the data in the supplied buffer
   *
   * @return An IoT Error Type defining successful/failed operation
   */
-static IoT_Error_t _aws_iot_mqtt_deserialize_suback(uint16_t *pPacketId, uint32_t maxExpectedQoSCount,
+static IoT_Error_t _aws_iot_mqtt_deserialize_suback(MQTT_Ver_t mqttVersion, uint16_t *pPacketId,
+													uint32_t maxExpectedQoSCount,
 													uint32_t *pGrantedQoSCount, QoS *pGrantedQoSs,
+													uint8_t *pReasonCode,
 													unsigned char *pRxBuf, size_t rxBufLen) {
 	unsigned char *curData, *endData;
 	uint32_t decodedLen, readBytesLen;
+	uint8_t code;
 	IoT_Error_t decodeRc;
 	MQTTHeader header = {0};
 
 	FUNC_ENTRY;
-	if(NULL == pPacketId || NULL == pGrantedQoSCount || NULL == pGrantedQoSs) {
+	if(NULL == pPacketId || NULL == pGrantedQoSCount || NULL == pGrantedQoSs || NULL == pReasonCode) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
@@ -158,30 +180,30 @@ static IoT_Error_t _aws_iot_mqtt_deserialize_suback(uint16_t *pPacketId, uint32_
 
 	*pPacketId = aws_iot_mqtt_internal_read_uint16_t(&curData);
 
-	*pGrantedQoSCount = 0;
-	while(curData < endData) {
-		if(*pGrantedQoSCount > maxExpectedQoSCount) {
+	if(MQTT_5_0 == mqttVersion) {
+		decodeRc = aws_iot_mqtt_internal_skip_properties(&curData, endData);
+		if(SUCCESS != decodeRc) {
 			FUNC_EXIT_RC(FAILURE);
 		}
-		pGrantedQoSs[(*pGrantedQoSCount)++] = (QoS) aws_iot_mqtt_internal_read_char(&curData);
 	}
 
-	FUNC_EXIT_RC(SUCCESS);
-}
-
-/* Returns MAX_MESSAGE_HANDLERS value if no free index is available */
-static uint32_t _aws_iot_mqtt_get_free_message_handler_index(AWS_IoT_Client *pClient) {
-	uint32_t itr;
-
-	FUNC_ENTRY;
-
-	for(itr = 0; itr < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; itr++) {
-		if(pClient->clientData.messageHandlers[itr].topicName == NULL) {
-			break;
+	*pReasonCode = 0;
+	*pGrantedQoSCount = 0;
+	while(curData < endData) {
+		if(*pGrantedQoSCount >= maxExpectedQoSCount) {
+			FUNC_EXIT_RC(FAILURE);
 		}
+		code = aws_iot_mqtt_internal_read_char(&curData);
+		if(SUBACK_FAILURE_RETURN_CODE <= code) {
+			if(0 == *pReasonCode) {
+				*pReasonCode = code;
+			}
+			code = SUBACK_FAILURE_RETURN_CODE;
+		}
+		pGrantedQoSs[(*pGrantedQoSCount)++] = (QoS) code;
 	}
 
-	FUNC_EXIT_RC(itr);
+	FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
@@ -195,21 +217,24 @@ static uint32_t _aws_iot_mqtt_get_free_message_handler_index(AWS_IoT_Client *pCl
  * @warning pTopicName and pApplicationHandlerData need to be static in memory.
  *
  * @param pClient Reference to the IoT Client
- * @param pTopicName Topic Name to publish to. pTopicName needs to be static in memory since 
- *     no malloc are performed by the SDK
+ * @param pTopicName Topic Name to publish to. pTopicName needs to be static in memory since
+ *     the SDK only keeps the pointer
  * @param topicNameLen Length of the topic name
  * @param pApplicationHandler_t Reference to the handler function for this subscription
+ * @param pStreamHandler Reference to the streaming handler, used instead of pApplicationHandler if not NULL
  * @param pApplicationHandlerData Point to data passed to the callback. 
- *    pApplicationHandlerData also needs to be static in memory  since no malloc are performed by the SDK
+ *    pApplicationHandlerData also needs to be static in memory since the SDK only keeps the pointer
  *
  * @return An IoT Error Type defining successful/failed subscription
  */
 static IoT_Error_t _aws_iot_mqtt_internal_subscribe(AWS_IoT_Client *pClient, const char *pTopicName,
 													uint16_t topicNameLen, QoS qos,
 													pApplicationHandler_t pApplicationHandler,
+													pStreamHandler_t pStreamHandler,
 													void *pApplicationHandlerData) {
 	uint16_t txPacketId, rxPacketId;
-	uint32_t serializedLen, indexOfFreeMessageHandler, count;
+	uint32_t serializedLen, count;
+	uint8_t reasonCode;
 	IoT_Error_t rc;
 	Timer timer;
 	QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
@@ -223,15 +248,17 @@ static IoT_Error_t _aws_iot_mqtt_internal_subscribe(AWS_IoT_Client *pClient, con
 	txPacketId = aws_iot_mqtt_get_next_packet_id(pClient);
 	rxPacketId = 0;
 
-	rc = _aws_iot_mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-										   txPacketId, 1, &pTopicName, &topicNameLen, &qos, &serializedLen);
+	rc = _aws_iot_mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+										   pClient->clientData.options.MQTTVersion, 0, txPacketId, 1, &pTopicName,
+										   &topicNameLen, &qos, &serializedLen);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	indexOfFreeMessageHandler = _aws_iot_mqtt_get_free_message_handler_index(pClient);
-	if(AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS <= indexOfFreeMessageHandler) {
-		FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+	/* Make sure the handler will have somewhere to go before asking the broker */
+	rc = aws_iot_mqtt_internal_reserve_handlers(pClient, 1);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
 	}
 
 	/* send the subscribe packet */
@@ -247,12 +274,19 @@ static IoT_Error_t _aws_iot_mqtt_internal_subscribe(AWS_IoT_Client *pClient, con
 	}
 
 	/* Granted QoS can be 0, 1 or 2 */
-	rc = _aws_iot_mqtt_deserialize_suback(&rxPacketId, 1, &count, grantedQoS, pClient->clientData.readBuf,
+	rc = _aws_iot_mqtt_deserialize_suback(pClient->clientData.options.MQTTVersion, &rxPacketId, 1, &count,
+										  grantedQoS, &reasonCode, pClient->clientData.readBuf,
 										  pClient->clientData.readBufSize);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
+	/* MQTT 5 brokers say why, report it. 3.1.1 keeps the handler as it always has */
+	if(0 != reasonCode && AWS_IOT_MQTT_IS_V5(pClient)) {
+		pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+		FUNC_EXIT_RC(MQTT_REASON_CODE_FAILURE_ERROR);
+	}
+
 	/* TODO : Figure out how to test this before activating this check */
 	//if(txPacketId != rxPacketId) {
 	/* Different SUBACK received than expected. Return error
@@ -260,47 +294,30 @@ static IoT_Error_t _aws_iot_mqtt_internal_subscribe(AWS_IoT_Client *pClient, con
 	//	return RX_MESSAGE_INVALID_ERROR;
 	//}
 
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].topicName =
-			pTopicName;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].topicNameLen =
-			topicNameLen;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].pApplicationHandler =
-			pApplicationHandler;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].pApplicationHandlerData =
-			pApplicationHandlerData;
-	pClient->clientData.messageHandlers[indexOfFreeMessageHandler].qos = qos;
+	rc = aws_iot_mqtt_internal_add_handler(pClient, pTopicName, topicNameLen, qos, pApplicationHandler,
+										   pStreamHandler, pApplicationHandlerData);
 
-	FUNC_EXIT_RC(SUCCESS);
+	FUNC_EXIT_RC(rc);
 }
 
 /**
  * @brief Subscribe to an MQTT topic.
  *
- * Called to send a subscribe message to the broker requesting a subscription
- * to an MQTT topic. This is the outer function which does the validations and
- * calls the internal subscribe above to perform the actual operation.
- * It is also responsible for client state changes
- * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
- * @warning pTopicName and pApplicationHandlerData need to be static in memory.
- *
- * @param pClient Reference to the IoT Client
- * @param pTopicName Topic Name to publish to. pTopicName needs to be static in memory since 
- *     no malloc are performed by the SDK
- * @param topicNameLen Length of the topic name
- * @param pApplicationHandler_t Reference to the handler function for this subscription
- * @param pApplicationHandlerData Point to data passed to the callback. 
- *    pApplicationHandlerData also needs to be static in memory  since no malloc are performed by the SDK
+ * Does the validations and client state changes for aws_iot_mqtt_subscribe and
+ * aws_iot_mqtt_subscribe_stream and calls the internal subscribe above to perform
+ * the actual operation. Exactly one of the handlers is set.
  *
  * @return An IoT Error Type defining successful/failed subscription
  */
-IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
-								   QoS qos, pApplicationHandler_t pApplicationHandler, void *pApplicationHandlerData) {
+static IoT_Error_t _aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+										   QoS qos, pApplicationHandler_t pApplicationHandler,
+										   pStreamHandler_t pStreamHandler, void *pApplicationHandlerData) {
 	ClientState clientState;
 	IoT_Error_t rc, subRc;
 
 	FUNC_ENTRY;
 
-	if(NULL == pClient || NULL == pTopicName || NULL == pApplicationHandler) {
+	if(NULL == pClient || NULL == pTopicName || (NULL == pApplicationHandler && NULL == pStreamHandler)) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
@@ -319,13 +336,16 @@ IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicNa
 	}
 
 	subRc = _aws_iot_mqtt_internal_subscribe(pClient, pTopicName, topicNameLen, qos,
-											 pApplicationHandler, pApplicationHandlerData);
+											 pApplicationHandler, pStreamHandler, pApplicationHandlerData);
 
 	rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_SUBSCRIBE_IN_PROGRESS, clientState);
 	if(SUCCESS == subRc && SUCCESS != rc) {
 		subRc = rc;
 	}
 
+	/* Best effort, a promotion catches the standby up on anything it missed */
+	(void) aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+
 	FUNC_EXIT_RC(subRc);
 }
 
@@ -333,42 +353,127 @@ IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicNa
  * @brief Subscribe to an MQTT topic.
  *
  * Called to send a subscribe message to the broker requesting a subscription
- * to an MQTT topic.
- * This is the internal function which is called by the resubscribe API to perform the operation.
- * Not meant to be called directly as it doesn't do validations or client state changes
+ * to an MQTT topic. This is the outer function which does the validations and
+ * calls the internal subscribe above to perform the actual operation.
+ * It is also responsible for client state changes
  * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
+ * @warning pTopicName and pApplicationHandlerData need to be static in memory.
  *
  * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic Name to publish to. pTopicName needs to be static in memory since
+ *     the SDK only keeps the pointer
+ * @param topicNameLen Length of the topic name
+ * @param pApplicationHandler_t Reference to the handler function for this subscription
+ * @param pApplicationHandlerData Point to data passed to the callback. 
+ *    pApplicationHandlerData also needs to be static in memory since the SDK only keeps the pointer
  *
  * @return An IoT Error Type defining successful/failed subscription
  */
-static IoT_Error_t _aws_iot_mqtt_internal_resubscribe(AWS_IoT_Client *pClient) {
-	uint16_t packetId;
-	uint32_t len, count, existingSubCount, itr;
+IoT_Error_t aws_iot_mqtt_subscribe(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+								   QoS qos, pApplicationHandler_t pApplicationHandler, void *pApplicationHandlerData) {
+	FUNC_ENTRY;
+
+	if(NULL == pApplicationHandler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	FUNC_EXIT_RC(_aws_iot_mqtt_subscribe(pClient, pTopicName, topicNameLen, qos, pApplicationHandler, NULL,
+										 pApplicationHandlerData));
+}
+
+/**
+ * @brief Subscribe to an MQTT topic with a streaming handler.
+ *
+ * Same as aws_iot_mqtt_subscribe, but matching messages are handed over as they are
+ * read from the network: MQTT_STREAM_BEGIN with the topic and header, one or more
+ * MQTT_STREAM_FRAGMENT with the payload, then MQTT_STREAM_END (or MQTT_STREAM_ABORTED).
+ * Payloads larger than the RX buffer are delivered in RX buffer sized fragments
+ * instead of being dropped. Only the topic and header need to fit in the RX buffer.
+ * @note Call is blocking.  The call returns after the receipt of the SUBACK control packet.
+ * @warning pTopicName and pStreamHandlerData need to be static in memory.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic filter to subscribe to
+ * @param topicNameLen Length of the topic filter
+ * @param qos Requested QoS
+ * @param pStreamHandler Reference to the streaming handler for this subscription
+ * @param pStreamHandlerData Point to data passed to the callback
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t aws_iot_mqtt_subscribe_stream(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+										  QoS qos, pStreamHandler_t pStreamHandler, void *pStreamHandlerData) {
+	FUNC_ENTRY;
+
+	if(NULL == pStreamHandler) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	FUNC_EXIT_RC(_aws_iot_mqtt_subscribe(pClient, pTopicName, topicNameLen, qos, NULL, pStreamHandler,
+										 pStreamHandlerData));
+}
+
+/**
+ * @brief Subscribe to a list of MQTT topics.
+ *
+ * Packs the topics into as few SUBSCRIBE packets as the TX buffer allows and sends them
+ * all before collecting the SUBACKs, so the whole list costs about one round trip.
+ * Doesn't touch the message handlers.
+ * Not meant to be called directly as it doesn't do validations or client state changes
+ * @note Call is blocking.  The call returns after the receipt of all SUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param count Number of topics, at most SUBSCRIBE_LIST_MAX_TOPICS
+ * @param pTopicNameList Array of topic filters
+ * @param pTopicNameLenList Array of topic filter lengths
+ * @param pQoSList Array of requested QoS
+ * @param pGrantedQoSList Returned granted QoS per topic, SUBACK_FAILURE_RETURN_CODE if refused
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_subscribe_list(AWS_IoT_Client *pClient, uint32_t count,
+														 const char **pTopicNameList, uint16_t *pTopicNameLenList,
+														 QoS *pQoSList, QoS *pGrantedQoSList) {
+	uint16_t packetIds[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint32_t firstTopic[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint32_t topicCount[SUBSCRIBE_LIST_MAX_TOPICS];
+	bool isAcked[SUBSCRIBE_LIST_MAX_TOPICS];
+	QoS grantedQoS[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint32_t itr, next, packetCount, ackedCount, grantedCount, fit, len;
+	uint16_t rxPacketId;
+	uint8_t reasonCode;
 	IoT_Error_t rc;
 	Timer timer;
-	QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
 
 	FUNC_ENTRY;
 
-	packetId = 0;
-	len = 0;
-	count = 0;
-	existingSubCount = _aws_iot_mqtt_get_free_message_handler_index(pClient);
+	if(SUBSCRIBE_LIST_MAX_TOPICS < count) {
+		FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+	}
 
-	for(itr = 0; itr < existingSubCount; itr++) {
-		if(pClient->clientData.messageHandlers[itr].topicName == NULL) {
-			continue;
-		}
+	init_timer(&timer);
+	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+
+	for(itr = 0; itr < count; itr++) {
+		pGrantedQoSList[itr] = (QoS) SUBACK_FAILURE_RETURN_CODE;
+	}
 
-		init_timer(&timer);
-		countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+	/* Send everything first */
+	next = 0;
+	packetCount = 0;
+	while(next < count) {
+		fit = aws_iot_mqtt_internal_count_topics_that_fit(pClient->clientData.writeBufSize,
+														   AWS_IOT_MQTT_IS_V5(pClient) ? 3 : 2,
+														   &pTopicNameLenList[next], count - next, 2 + 1);
+		if(0 == fit) {
+			FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+		}
 
-		rc = _aws_iot_mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
-											   aws_iot_mqtt_get_next_packet_id(pClient), 1,
-											   &(pClient->clientData.messageHandlers[itr].topicName),
-											   &(pClient->clientData.messageHandlers[itr].topicNameLen),
-											   &(pClient->clientData.messageHandlers[itr].qos), &len);
+		packetIds[packetCount] = aws_iot_mqtt_get_next_packet_id(pClient);
+		rc = _aws_iot_mqtt_serialize_subscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+											   pClient->clientData.options.MQTTVersion, 0, packetIds[packetCount],
+											   fit, &pTopicNameList[next], &pTopicNameLenList[next],
+											   &pQoSList[next], &len);
 		if(SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
@@ -379,23 +484,233 @@ static IoT_Error_t _aws_iot_mqtt_internal_resubscribe(AWS_IoT_Client *pClient) {
 			FUNC_EXIT_RC(rc);
 		}
 
-		/* wait for suback */
+		firstTopic[packetCount] = next;
+		topicCount[packetCount] = fit;
+		isAcked[packetCount] = false;
+		packetCount++;
+		next += fit;
+	}
+
+	/* Then collect the SUBACKs */
+	ackedCount = 0;
+	while(ackedCount < packetCount) {
 		rc = aws_iot_mqtt_internal_wait_for_read(pClient, SUBACK, &timer);
 		if(SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
 
 		/* Granted QoS can be 0, 1 or 2 */
-		rc = _aws_iot_mqtt_deserialize_suback(&packetId, 1, &count, grantedQoS, pClient->clientData.readBuf,
-											  pClient->clientData.readBufSize);
+		rc = _aws_iot_mqtt_deserialize_suback(pClient->clientData.options.MQTTVersion, &rxPacketId,
+											  SUBSCRIBE_LIST_MAX_TOPICS, &grantedCount, grantedQoS, &reasonCode,
+											  pClient->clientData.readBuf, pClient->clientData.readBufSize);
 		if(SUCCESS != rc) {
 			FUNC_EXIT_RC(rc);
 		}
+		if(0 != reasonCode) {
+			pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+		}
+
+		for(itr = 0; itr < packetCount; itr++) {
+			if(!isAcked[itr] && rxPacketId == packetIds[itr]) {
+				break;
+			}
+		}
+		if(itr == packetCount) {
+			/* Left over from an earlier call that timed out */
+			continue;
+		}
+
+		if(grantedCount > topicCount[itr]) {
+			grantedCount = topicCount[itr];
+		}
+		memcpy(&pGrantedQoSList[firstTopic[itr]], grantedQoS, grantedCount * sizeof(QoS));
+		isAcked[itr] = true;
+		ackedCount++;
 	}
 
 	FUNC_EXIT_RC(SUCCESS);
 }
 
+/**
+ * @brief Subscribe to several MQTT topics at once.
+ *
+ * This is the internal function which is called by the batch subscribe API to perform the operation.
+ * Not meant to be called directly as it doesn't do validations or client state changes
+ * @note Call is blocking.  The call returns after the receipt of all SUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pSubscriptions Array of topics to subscribe to
+ * @param count Number of entries in pSubscriptions
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_subscribe_batch(AWS_IoT_Client *pClient,
+														  IoT_Subscription_Params *pSubscriptions, uint32_t count) {
+	const char *topicNames[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint16_t topicNameLens[SUBSCRIBE_LIST_MAX_TOPICS];
+	QoS requestedQoS[SUBSCRIBE_LIST_MAX_TOPICS];
+	QoS grantedQoS[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint32_t itr, first, chunk;
+	IoT_Subscription_Params *pSub;
+	IoT_Error_t rc;
+	bool isAnyRefused = false;
+
+	FUNC_ENTRY;
+
+	/* Make sure all of them will have somewhere to go before asking the broker */
+	rc = aws_iot_mqtt_internal_reserve_handlers(pClient, count);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	for(first = 0; first < count; first += chunk) {
+		chunk = (count - first < SUBSCRIBE_LIST_MAX_TOPICS) ? count - first : SUBSCRIBE_LIST_MAX_TOPICS;
+
+		for(itr = 0; itr < chunk; itr++) {
+			topicNames[itr] = pSubscriptions[first + itr].pTopicName;
+			topicNameLens[itr] = pSubscriptions[first + itr].topicNameLen;
+			requestedQoS[itr] = pSubscriptions[first + itr].qos;
+		}
+
+		rc = _aws_iot_mqtt_internal_subscribe_list(pClient, chunk, topicNames, topicNameLens, requestedQoS,
+												   grantedQoS);
+		if(SUCCESS != rc) {
+			FUNC_EXIT_RC(rc);
+		}
+
+		for(itr = 0; itr < chunk; itr++) {
+			pSub = &pSubscriptions[first + itr];
+			if(SUBACK_FAILURE_RETURN_CODE == (unsigned) grantedQoS[itr]) {
+				IOT_WARN("Subscription to %.*s refused", pSub->topicNameLen, pSub->pTopicName);
+				isAnyRefused = true;
+				continue;
+			}
+
+			rc = aws_iot_mqtt_internal_add_handler(pClient, pSub->pTopicName, pSub->topicNameLen, pSub->qos,
+												   pSub->pApplicationHandler, NULL, pSub->pApplicationHandlerData);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+		}
+	}
+
+	FUNC_EXIT_RC(isAnyRefused ? FAILURE : SUCCESS);
+}
+
+/**
+ * @brief Subscribe to several MQTT topics at once.
+ *
+ * This is the outer function which does the validations and calls the internal batch subscribe
+ * above to perform the actual operation. It is also responsible for client state changes
+ * @note Call is blocking.  The call returns after the receipt of all SUBACK control packets.
+ * @warning pTopicName and pApplicationHandlerData of every entry need to be static in memory.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pSubscriptions Array of topics to subscribe to
+ * @param count Number of entries in pSubscriptions
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+IoT_Error_t aws_iot_mqtt_subscribe_batch(AWS_IoT_Client *pClient, IoT_Subscription_Params *pSubscriptions,
+										 uint32_t count) {
+	ClientState clientState;
+	IoT_Error_t rc, subRc;
+	uint32_t itr;
+
+	FUNC_ENTRY;
+
+	if(NULL == pClient || NULL == pSubscriptions || 0 == count) {
+		FUNC_EXIT_RC(NULL_VALUE_ERROR);
+	}
+
+	for(itr = 0; itr < count; itr++) {
+		if(NULL == pSubscriptions[itr].pTopicName || NULL == pSubscriptions[itr].pApplicationHandler) {
+			FUNC_EXIT_RC(NULL_VALUE_ERROR);
+		}
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pClient)) {
+		FUNC_EXIT_RC(NETWORK_DISCONNECTED_ERROR);
+	}
+
+	clientState = aws_iot_mqtt_get_client_state(pClient);
+	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
+		FUNC_EXIT_RC(MQTT_CLIENT_NOT_IDLE_ERROR);
+	}
+
+	rc = aws_iot_mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_SUBSCRIBE_IN_PROGRESS);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	subRc = _aws_iot_mqtt_internal_subscribe_batch(pClient, pSubscriptions, count);
+
+	rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_SUBSCRIBE_IN_PROGRESS, clientState);
+	if(SUCCESS == subRc && SUCCESS != rc) {
+		subRc = rc;
+	}
+
+	/* Best effort, a promotion catches the standby up on anything it missed */
+	(void) aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+
+	FUNC_EXIT_RC(subRc);
+}
+
+/**
+ * @brief Subscribe to an MQTT topic.
+ *
+ * Called to send a subscribe message to the broker requesting a subscription
+ * to an MQTT topic.
+ * This is the internal function which is called by the resubscribe API to perform the operation.
+ * Not meant to be called directly as it doesn't do validations or client state changes
+ * All active subscriptions are sent together, see _aws_iot_mqtt_internal_subscribe_list
+ * @note Call is blocking.  The call returns after the receipt of all SUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ *
+ * @return An IoT Error Type defining successful/failed subscription
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_resubscribe(AWS_IoT_Client *pClient) {
+	const char *topicNames[SUBSCRIBE_LIST_MAX_TOPICS];
+	uint16_t topicNameLens[SUBSCRIBE_LIST_MAX_TOPICS];
+	QoS requestedQoS[SUBSCRIBE_LIST_MAX_TOPICS];
+	QoS grantedQoS[SUBSCRIBE_LIST_MAX_TOPICS];
+	MessageHandlers *pHandler;
+	uint32_t count, itr;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	count = 0;
+	for(itr = 0; itr < pClient->clientData.messageHandlersSize; itr++) {
+		pHandler = &pClient->clientData.messageHandlers[itr];
+		if(pHandler->topicName == NULL) {
+			continue;
+		}
+		topicNames[count] = pHandler->topicName;
+		topicNameLens[count] = pHandler->topicNameLen;
+		requestedQoS[count] = pHandler->qos;
+		count++;
+
+		if(SUBSCRIBE_LIST_MAX_TOPICS == count) {
+			rc = _aws_iot_mqtt_internal_subscribe_list(pClient, count, topicNames, topicNameLens, requestedQoS,
+													   grantedQoS);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+			count = 0;
+		}
+	}
+
+	if(0 == count) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	rc = _aws_iot_mqtt_internal_subscribe_list(pClient, count, topicNames, topicNameLens, requestedQoS, grantedQoS);
+
+	FUNC_EXIT_RC(rc);
+}
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
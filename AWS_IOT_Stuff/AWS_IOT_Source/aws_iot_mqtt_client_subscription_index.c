@@ -0,0 +1,771 @@
+/*
+* Copyright 2015-2016 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License").
+* You may not use this file except in compliance with the License.
+* A copy of the License is located at
+*
+* http://aws.amazon.com/apache2.0
+*
+* or in the "license" file accompanying this file. This file is distributed
+* on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+* express or implied. See the License for the specific language governing
+* permissions and limitations under the License.
+*/
+
+/**
+ * @file aws_iot_mqtt_client_subscription_index.c
+ * @brief MQTT client subscription table and the index used to dispatch incoming messages
+ *
+ * The handler table grows on demand. Filters without wildcards are kept in a hash
+ * table keyed by the topic. Filters with '+' or '#' are stored in a trie with one
+ * node per level; the edges of the trie are kept in a second hash table keyed by
+ * (parent node, segment), so following an edge costs the same no matter how many
+ * siblings a node has.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#include "aws_iot_mqtt_client_common_internal.h"
+
+#define SUBSCRIPTION_HASH_EMPTY 0u
+#define SUBSCRIPTION_HASH_TOMBSTONE 0xFFFFFFFFu
+#define SUBSCRIPTION_HASH_MIN_SIZE 16u
+#define SUBSCRIPTION_TRIE_MIN_NODES 16u
+#define SUBSCRIPTION_TRIE_ROOT 0u
+
+#define FNV32_OFFSET 2166136261u
+#define FNV32_PRIME 16777619u
+
+typedef struct _SubscriptionMatch {
+	uint32_t skip;
+	uint32_t total;
+	uint32_t *pMatches;
+	uint32_t maxMatches;
+} SubscriptionMatch;
+
+/* Compares the entry stored in a hash slot with the key being looked up */
+typedef bool (*_subscription_key_matches_t)(AWS_IoT_Client *pClient, uint32_t value, const void *pKey);
+/* Hash of an entry already in the table, used when growing */
+typedef uint32_t (*_subscription_hash_of_t)(AWS_IoT_Client *pClient, uint32_t value);
+
+typedef struct _SubscriptionEdgeKey {
+	uint32_t parent;
+	const char *pSegment;
+	uint16_t segmentLen;
+} SubscriptionEdgeKey;
+
+typedef struct _SubscriptionTopicKey {
+	const char *pTopic;
+	uint16_t topicLen;
+} SubscriptionTopicKey;
+
+static uint32_t _aws_iot_mqtt_internal_hash(uint32_t hash, const void *pData, size_t len) {
+	const unsigned char *pBytes = (const unsigned char *) pData;
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		hash ^= pBytes[i];
+		hash *= FNV32_PRIME;
+	}
+
+	return hash;
+}
+
+static uint32_t _aws_iot_mqtt_internal_edge_hash(uint32_t parent, const char *pSegment, uint16_t segmentLen) {
+	return _aws_iot_mqtt_internal_hash(_aws_iot_mqtt_internal_hash(FNV32_OFFSET, &parent, sizeof(parent)),
+									   pSegment, segmentLen);
+}
+
+static bool _aws_iot_mqtt_internal_is_wildcard_filter(const char *pTopicFilter, uint16_t topicFilterLen) {
+	return NULL != memchr(pTopicFilter, '+', topicFilterLen) || NULL != memchr(pTopicFilter, '#', topicFilterLen);
+}
+
+/*
+ * Hash table
+ */
+
+static uint32_t _aws_iot_mqtt_internal_topic_hash_of(AWS_IoT_Client *pClient, uint32_t value) {
+	MessageHandlers *pHandler = &pClient->clientData.messageHandlers[value];
+	return _aws_iot_mqtt_internal_hash(FNV32_OFFSET, pHandler->topicName, pHandler->topicNameLen);
+}
+
+static bool _aws_iot_mqtt_internal_topic_matches(AWS_IoT_Client *pClient, uint32_t value, const void *pKey) {
+	const SubscriptionTopicKey *pTopicKey = (const SubscriptionTopicKey *) pKey;
+	MessageHandlers *pHandler = &pClient->clientData.messageHandlers[value];
+
+	return pHandler->topicNameLen == pTopicKey->topicLen &&
+		   0 == memcmp(pHandler->topicName, pTopicKey->pTopic, pTopicKey->topicLen);
+}
+
+static uint32_t _aws_iot_mqtt_internal_edge_hash_of(AWS_IoT_Client *pClient, uint32_t value) {
+	SubscriptionTrieNode *pNode = &pClient->clientData.subscriptionIndex.pTrieNodes[value];
+	return _aws_iot_mqtt_internal_edge_hash(pNode->parent, pNode->pSegment, pNode->segmentLen);
+}
+
+static bool _aws_iot_mqtt_internal_edge_matches(AWS_IoT_Client *pClient, uint32_t value, const void *pKey) {
+	const SubscriptionEdgeKey *pEdgeKey = (const SubscriptionEdgeKey *) pKey;
+	SubscriptionTrieNode *pNode = &pClient->clientData.subscriptionIndex.pTrieNodes[value];
+
+	return pNode->parent == pEdgeKey->parent && pNode->segmentLen == pEdgeKey->segmentLen &&
+		   0 == memcmp(pNode->pSegment, pEdgeKey->pSegment, pEdgeKey->segmentLen);
+}
+
+/**
+ * @brief Find the next slot holding a matching entry
+ *
+ * @param pTable Hash table
+ * @param hash Hash of the key
+ * @param pProbe In: probe to start from (0 for the first call). Out: probe to continue from
+ *
+ * @return Slot index, or AWS_IOT_MQTT_INDEX_NONE once an empty slot ends the probe sequence
+ */
+static uint32_t _aws_iot_mqtt_internal_hash_find(AWS_IoT_Client *pClient, SubscriptionHashTable *pTable,
+												 uint32_t hash, _subscription_key_matches_t keyMatches,
+												 const void *pKey, uint32_t *pProbe) {
+	uint32_t mask, slot;
+
+	if(0 == pTable->size) {
+		return AWS_IOT_MQTT_INDEX_NONE;
+	}
+
+	mask = pTable->size - 1;
+	for(; *pProbe < pTable->size; (*pProbe)++) {
+		slot = (hash + *pProbe) & mask;
+		if(SUBSCRIPTION_HASH_EMPTY == pTable->pSlots[slot]) {
+			break;
+		}
+		if(SUBSCRIPTION_HASH_TOMBSTONE != pTable->pSlots[slot] &&
+		   keyMatches(pClient, pTable->pSlots[slot] - 1, pKey)) {
+			(*pProbe)++;
+			return slot;
+		}
+	}
+
+	return AWS_IOT_MQTT_INDEX_NONE;
+}
+
+static void _aws_iot_mqtt_internal_hash_place(SubscriptionHashTable *pTable, uint32_t hash, uint32_t value) {
+	uint32_t mask = pTable->size - 1;
+	uint32_t slot = hash & mask;
+
+	while(SUBSCRIPTION_HASH_EMPTY != pTable->pSlots[slot] && SUBSCRIPTION_HASH_TOMBSTONE != pTable->pSlots[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	if(SUBSCRIPTION_HASH_EMPTY == pTable->pSlots[slot]) {
+		pTable->used++;
+	}
+	pTable->pSlots[slot] = value + 1;
+	pTable->live++;
+}
+
+static void _aws_iot_mqtt_internal_hash_remove(SubscriptionHashTable *pTable, uint32_t slot) {
+	pTable->pSlots[slot] = SUBSCRIPTION_HASH_TOMBSTONE;
+	pTable->live--;
+}
+
+static IoT_Error_t _aws_iot_mqtt_internal_hash_insert(AWS_IoT_Client *pClient, SubscriptionHashTable *pTable,
+													  uint32_t hash, uint32_t value, _subscription_hash_of_t hashOf) {
+	SubscriptionHashTable grown;
+	uint32_t i;
+
+	/* Keep the load (tombstones included) under 3/4. Rebuilding drops the tombstones,
+	 * so only grow when the live entries need it */
+	if((pTable->used + 1) * 4 > pTable->size * 3) {
+		grown.size = SUBSCRIPTION_HASH_MIN_SIZE;
+		while((pTable->live + 1) * 2 > grown.size) {
+			grown.size *= 2;
+		}
+		grown.used = 0;
+		grown.live = 0;
+		grown.pSlots = (uint32_t *) calloc(grown.size, sizeof(uint32_t));
+		if(NULL == grown.pSlots) {
+			return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
+		}
+		for(i = 0; i < pTable->size; i++) {
+			if(SUBSCRIPTION_HASH_EMPTY != pTable->pSlots[i] && SUBSCRIPTION_HASH_TOMBSTONE != pTable->pSlots[i]) {
+				_aws_iot_mqtt_internal_hash_place(&grown, hashOf(pClient, pTable->pSlots[i] - 1),
+												  pTable->pSlots[i] - 1);
+			}
+		}
+		free(pTable->pSlots);
+		*pTable = grown;
+	}
+
+	_aws_iot_mqtt_internal_hash_place(pTable, hash, value);
+	return SUCCESS;
+}
+
+static void _aws_iot_mqtt_internal_hash_free(SubscriptionHashTable *pTable) {
+	free(pTable->pSlots);
+	pTable->pSlots = NULL;
+	pTable->size = 0;
+	pTable->used = 0;
+	pTable->live = 0;
+}
+
+/*
+ * Trie
+ */
+
+static uint32_t _aws_iot_mqtt_internal_trie_child(AWS_IoT_Client *pClient, uint32_t parent, const char *pSegment,
+												  uint16_t segmentLen) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionEdgeKey key;
+	uint32_t probe = 0;
+	uint32_t slot;
+
+	key.parent = parent;
+	key.pSegment = pSegment;
+	key.segmentLen = segmentLen;
+
+	slot = _aws_iot_mqtt_internal_hash_find(pClient, &pIndex->trieEdges,
+											_aws_iot_mqtt_internal_edge_hash(parent, pSegment, segmentLen),
+											_aws_iot_mqtt_internal_edge_matches, &key, &probe);
+	if(AWS_IOT_MQTT_INDEX_NONE == slot) {
+		return AWS_IOT_MQTT_INDEX_NONE;
+	}
+
+	return pIndex->trieEdges.pSlots[slot] - 1;
+}
+
+static uint32_t _aws_iot_mqtt_internal_trie_new_node(AWS_IoT_Client *pClient) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionTrieNode *pNodes;
+	uint32_t newSize, i, node;
+
+	if(AWS_IOT_MQTT_INDEX_NONE == pIndex->firstFreeTrieNode) {
+		newSize = (0 == pIndex->trieNodesSize) ? SUBSCRIPTION_TRIE_MIN_NODES : pIndex->trieNodesSize * 2;
+		pNodes = (SubscriptionTrieNode *) realloc(pIndex->pTrieNodes, newSize * sizeof(SubscriptionTrieNode));
+		if(NULL == pNodes) {
+			return AWS_IOT_MQTT_INDEX_NONE;
+		}
+		for(i = pIndex->trieNodesSize; i < newSize; i++) {
+			pNodes[i].isInUse = false;
+			pNodes[i].pSegment = NULL;
+			pNodes[i].parent = (i + 1 < newSize) ? i + 1 : AWS_IOT_MQTT_INDEX_NONE;
+		}
+		pIndex->firstFreeTrieNode = pIndex->trieNodesSize;
+		pIndex->pTrieNodes = pNodes;
+		pIndex->trieNodesSize = newSize;
+	}
+
+	node = pIndex->firstFreeTrieNode;
+	pIndex->firstFreeTrieNode = pIndex->pTrieNodes[node].parent;
+
+	pIndex->pTrieNodes[node].isInUse = true;
+	pIndex->pTrieNodes[node].pSegment = NULL;
+	pIndex->pTrieNodes[node].segmentLen = 0;
+	pIndex->pTrieNodes[node].parent = AWS_IOT_MQTT_INDEX_NONE;
+	pIndex->pTrieNodes[node].refCount = 0;
+	pIndex->pTrieNodes[node].firstHandler = AWS_IOT_MQTT_INDEX_NONE;
+
+	return node;
+}
+
+static void _aws_iot_mqtt_internal_trie_release_node(AWS_IoT_Client *pClient, uint32_t node) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionTrieNode *pNode = &pIndex->pTrieNodes[node];
+
+	free(pNode->pSegment);
+	pNode->pSegment = NULL;
+	pNode->isInUse = false;
+	pNode->parent = pIndex->firstFreeTrieNode;
+	pIndex->firstFreeTrieNode = node;
+}
+
+/**
+ * @brief Find or create the child of parent for this segment
+ *
+ * @return Node index, AWS_IOT_MQTT_INDEX_NONE if out of memory
+ */
+static uint32_t _aws_iot_mqtt_internal_trie_add_child(AWS_IoT_Client *pClient, uint32_t parent,
+													  const char *pSegment, uint16_t segmentLen) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	uint32_t child;
+	char *pCopy;
+
+	child = _aws_iot_mqtt_internal_trie_child(pClient, parent, pSegment, segmentLen);
+	if(AWS_IOT_MQTT_INDEX_NONE != child) {
+		return child;
+	}
+
+	/* Own copy, the filter that created the node may be unsubscribed before the node goes */
+	pCopy = (char *) malloc((size_t) segmentLen + 1);
+	if(NULL == pCopy) {
+		return AWS_IOT_MQTT_INDEX_NONE;
+	}
+	memcpy(pCopy, pSegment, segmentLen);
+	pCopy[segmentLen] = '\0';
+
+	child = _aws_iot_mqtt_internal_trie_new_node(pClient);
+	if(AWS_IOT_MQTT_INDEX_NONE == child) {
+		free(pCopy);
+		return AWS_IOT_MQTT_INDEX_NONE;
+	}
+
+	pIndex->pTrieNodes[child].pSegment = pCopy;
+	pIndex->pTrieNodes[child].segmentLen = segmentLen;
+	pIndex->pTrieNodes[child].parent = parent;
+
+	if(SUCCESS != _aws_iot_mqtt_internal_hash_insert(pClient, &pIndex->trieEdges,
+													 _aws_iot_mqtt_internal_edge_hash(parent, pSegment, segmentLen),
+													 child, _aws_iot_mqtt_internal_edge_hash_of)) {
+		_aws_iot_mqtt_internal_trie_release_node(pClient, child);
+		return AWS_IOT_MQTT_INDEX_NONE;
+	}
+	pIndex->pTrieNodes[parent].refCount++;
+
+	return child;
+}
+
+/* Remove nodes that no longer lead to any handler, from node up to (not including) the root */
+static void _aws_iot_mqtt_internal_trie_prune(AWS_IoT_Client *pClient, uint32_t node) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionTrieNode *pNode;
+	SubscriptionEdgeKey key;
+	uint32_t parent, slot, probe;
+
+	while(SUBSCRIPTION_TRIE_ROOT != node && 0 == pIndex->pTrieNodes[node].refCount) {
+		pNode = &pIndex->pTrieNodes[node];
+		parent = pNode->parent;
+
+		key.parent = parent;
+		key.pSegment = pNode->pSegment;
+		key.segmentLen = pNode->segmentLen;
+		probe = 0;
+		slot = _aws_iot_mqtt_internal_hash_find(pClient, &pIndex->trieEdges,
+												_aws_iot_mqtt_internal_edge_hash(parent, pNode->pSegment,
+																				 pNode->segmentLen),
+												_aws_iot_mqtt_internal_edge_matches, &key, &probe);
+		if(AWS_IOT_MQTT_INDEX_NONE != slot) {
+			_aws_iot_mqtt_internal_hash_remove(&pIndex->trieEdges, slot);
+		}
+
+		_aws_iot_mqtt_internal_trie_release_node(pClient, node);
+		pIndex->pTrieNodes[parent].refCount--;
+		node = parent;
+	}
+}
+
+/**
+ * @brief Walk the trie along the levels of a wildcard filter
+ *
+ * @param isCreate Create missing nodes
+ *
+ * @return Node the filter ends at, AWS_IOT_MQTT_INDEX_NONE if it doesn't exist (or out of memory)
+ */
+static uint32_t _aws_iot_mqtt_internal_trie_walk(AWS_IoT_Client *pClient, const char *pTopicFilter,
+												 uint16_t topicFilterLen, bool isCreate) {
+	const char *pLevel = pTopicFilter;
+	const char *pEnd = pTopicFilter + topicFilterLen;
+	const char *pSep;
+	uint32_t node = SUBSCRIPTION_TRIE_ROOT;
+	uint32_t child;
+
+	for(;;) {
+		pSep = (const char *) memchr(pLevel, '/', (size_t) (pEnd - pLevel));
+		if(NULL == pSep) {
+			pSep = pEnd;
+		}
+
+		if(isCreate) {
+			child = _aws_iot_mqtt_internal_trie_add_child(pClient, node, pLevel, (uint16_t) (pSep - pLevel));
+			if(AWS_IOT_MQTT_INDEX_NONE == child) {
+				/* Don't leave a half built branch behind */
+				_aws_iot_mqtt_internal_trie_prune(pClient, node);
+			}
+		} else {
+			child = _aws_iot_mqtt_internal_trie_child(pClient, node, pLevel, (uint16_t) (pSep - pLevel));
+		}
+		if(AWS_IOT_MQTT_INDEX_NONE == child) {
+			return AWS_IOT_MQTT_INDEX_NONE;
+		}
+		node = child;
+
+		if(pSep == pEnd) {
+			return node;
+		}
+		pLevel = pSep + 1;
+	}
+}
+
+static void _aws_iot_mqtt_internal_match_add_node(AWS_IoT_Client *pClient, uint32_t node,
+												  SubscriptionMatch *pMatch) {
+	uint32_t handler = pClient->clientData.subscriptionIndex.pTrieNodes[node].firstHandler;
+
+	for(; AWS_IOT_MQTT_INDEX_NONE != handler; handler = pClient->clientData.messageHandlers[handler].next) {
+		if(pMatch->total >= pMatch->skip && pMatch->total - pMatch->skip < pMatch->maxMatches) {
+			pMatch->pMatches[pMatch->total - pMatch->skip] = handler;
+		}
+		pMatch->total++;
+	}
+}
+
+/**
+ * @brief Collect the handlers of wildcard filters matching the rest of a topic
+ *
+ * @param node Trie node reached so far
+ * @param pLevel Start of the next topic level, NULL once every level is consumed
+ * @param pEnd End of the topic
+ */
+static void _aws_iot_mqtt_internal_trie_match(AWS_IoT_Client *pClient, uint32_t node, const char *pLevel,
+											  const char *pEnd, SubscriptionMatch *pMatch) {
+	const char *pSep, *pNext;
+	uint32_t child;
+
+	/* '#' also matches the parent level, "a/#" gets "a" */
+	child = _aws_iot_mqtt_internal_trie_child(pClient, node, "#", 1);
+	if(AWS_IOT_MQTT_INDEX_NONE != child) {
+		_aws_iot_mqtt_internal_match_add_node(pClient, child, pMatch);
+	}
+
+	if(NULL == pLevel) {
+		_aws_iot_mqtt_internal_match_add_node(pClient, node, pMatch);
+		return;
+	}
+
+	pSep = (const char *) memchr(pLevel, '/', (size_t) (pEnd - pLevel));
+	if(NULL == pSep) {
+		pSep = pEnd;
+		pNext = NULL;
+	} else {
+		pNext = pSep + 1;
+	}
+
+	child = _aws_iot_mqtt_internal_trie_child(pClient, node, pLevel, (uint16_t) (pSep - pLevel));
+	if(AWS_IOT_MQTT_INDEX_NONE != child) {
+		_aws_iot_mqtt_internal_trie_match(pClient, child, pNext, pEnd, pMatch);
+	}
+
+	child = _aws_iot_mqtt_internal_trie_child(pClient, node, "+", 1);
+	if(AWS_IOT_MQTT_INDEX_NONE != child) {
+		_aws_iot_mqtt_internal_trie_match(pClient, child, pNext, pEnd, pMatch);
+	}
+}
+
+/*
+ * Handler table
+ */
+
+/**
+ * @brief Make sure count more handlers can be added
+ *
+ * Grows the handler table (starting at AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS) so that a
+ * subscription acknowledged by the broker always has somewhere to go.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param count Number of handlers about to be added
+ *
+ * @return SUCCESS, or MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR if the table can't grow
+ */
+IoT_Error_t aws_iot_mqtt_internal_reserve_handlers(AWS_IoT_Client *pClient, uint32_t count) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	MessageHandlers *pHandlers;
+	uint32_t newSize, i;
+
+	FUNC_ENTRY;
+
+	if(pClient->clientData.messageHandlersSize - pIndex->handlerCount >= count) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
+	newSize = (0 == pClient->clientData.messageHandlersSize) ? AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+															 : pClient->clientData.messageHandlersSize;
+	while(newSize - pIndex->handlerCount < count) {
+		if(newSize > (AWS_IOT_MQTT_INDEX_NONE - 1) / 2) {
+			FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+		}
+		newSize *= 2;
+	}
+
+	pHandlers = (MessageHandlers *) realloc(pClient->clientData.messageHandlers, newSize * sizeof(MessageHandlers));
+	if(NULL == pHandlers) {
+		FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+	}
+
+	/* New slots go on the front of the free list */
+	for(i = pClient->clientData.messageHandlersSize; i < newSize; i++) {
+		pHandlers[i].topicName = NULL;
+		pHandlers[i].topicNameLen = 0;
+		pHandlers[i].pApplicationHandler = NULL;
+		pHandlers[i].pStreamHandler = NULL;
+		pHandlers[i].pApplicationHandlerData = NULL;
+		pHandlers[i].qos = QOS0;
+		pHandlers[i].trieNode = AWS_IOT_MQTT_INDEX_NONE;
+		pHandlers[i].next = (i + 1 < newSize) ? i + 1 : pIndex->firstFreeHandler;
+	}
+	pIndex->firstFreeHandler = pClient->clientData.messageHandlersSize;
+	pClient->clientData.messageHandlers = pHandlers;
+	pClient->clientData.messageHandlersSize = newSize;
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Add a message handler and index it
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic filter, needs to be static in memory
+ * @param topicNameLen Length of the topic filter
+ * @param qos QoS the subscription was requested with
+ * @param pApplicationHandler Handler called for matching messages
+ * @param pStreamHandler Streaming handler, used instead of pApplicationHandler when not NULL
+ * @param pApplicationHandlerData Data passed to the handler
+ *
+ * @return An IoT Error Type, MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR if out of memory
+ */
+IoT_Error_t aws_iot_mqtt_internal_add_handler(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+											  QoS qos, pApplicationHandler_t pApplicationHandler,
+											  pStreamHandler_t pStreamHandler, void *pApplicationHandlerData) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	MessageHandlers *pHandler;
+	uint32_t handler, node;
+	IoT_Error_t rc;
+
+	FUNC_ENTRY;
+
+	rc = aws_iot_mqtt_internal_reserve_handlers(pClient, 1);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+
+	handler = pIndex->firstFreeHandler;
+	pHandler = &pClient->clientData.messageHandlers[handler];
+	pHandler->topicName = pTopicName;
+	pHandler->topicNameLen = topicNameLen;
+	pHandler->trieNode = AWS_IOT_MQTT_INDEX_NONE;
+
+	if(!_aws_iot_mqtt_internal_is_wildcard_filter(pTopicName, topicNameLen)) {
+		rc = _aws_iot_mqtt_internal_hash_insert(pClient, &pIndex->exactTopics,
+												_aws_iot_mqtt_internal_hash(FNV32_OFFSET, pTopicName, topicNameLen),
+												handler, _aws_iot_mqtt_internal_topic_hash_of);
+		if(SUCCESS != rc) {
+			pHandler->topicName = NULL;
+			FUNC_EXIT_RC(rc);
+		}
+		pIndex->firstFreeHandler = pHandler->next;
+		pHandler->next = AWS_IOT_MQTT_INDEX_NONE;
+	} else {
+		if(0 == pIndex->trieNodesSize) {
+			/* First wildcard filter, node 0 becomes the root */
+			if(SUBSCRIPTION_TRIE_ROOT != _aws_iot_mqtt_internal_trie_new_node(pClient)) {
+				pHandler->topicName = NULL;
+				FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+			}
+		}
+		node = _aws_iot_mqtt_internal_trie_walk(pClient, pTopicName, topicNameLen, true);
+		if(AWS_IOT_MQTT_INDEX_NONE == node) {
+			pHandler->topicName = NULL;
+			FUNC_EXIT_RC(MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR);
+		}
+		pIndex->firstFreeHandler = pHandler->next;
+		pHandler->trieNode = node;
+		pHandler->next = pIndex->pTrieNodes[node].firstHandler;
+		pIndex->pTrieNodes[node].firstHandler = handler;
+		pIndex->pTrieNodes[node].refCount++;
+	}
+
+	pHandler->qos = qos;
+	pHandler->pApplicationHandler = pApplicationHandler;
+	pHandler->pStreamHandler = pStreamHandler;
+	pHandler->pApplicationHandlerData = pApplicationHandlerData;
+	pIndex->handlerCount++;
+	if(NULL != pStreamHandler) {
+		pIndex->streamHandlerCount++;
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+static void _aws_iot_mqtt_internal_free_handler(AWS_IoT_Client *pClient, uint32_t handler) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	MessageHandlers *pHandler = &pClient->clientData.messageHandlers[handler];
+
+	if(NULL != pHandler->pStreamHandler) {
+		pIndex->streamHandlerCount--;
+	}
+	pHandler->topicName = NULL;
+	pHandler->pApplicationHandler = NULL;
+	pHandler->pStreamHandler = NULL;
+	pHandler->pApplicationHandlerData = NULL;
+	pHandler->trieNode = AWS_IOT_MQTT_INDEX_NONE;
+	pHandler->next = pIndex->firstFreeHandler;
+	pIndex->firstFreeHandler = handler;
+	pIndex->handlerCount--;
+}
+
+/**
+ * @brief Remove every message handler registered for a topic filter
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicFilter Topic filter as subscribed, not necessarily NUL terminated
+ * @param topicFilterLen Length of the topic filter
+ *
+ * @return Number of handlers removed
+ */
+uint32_t aws_iot_mqtt_internal_remove_handlers(AWS_IoT_Client *pClient, const char *pTopicFilter,
+											   uint16_t topicFilterLen) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionTopicKey key;
+	uint32_t removed = 0;
+	uint32_t probe, slot, hash, node, handler;
+	uint32_t *pLink;
+
+	if(!_aws_iot_mqtt_internal_is_wildcard_filter(pTopicFilter, topicFilterLen)) {
+		key.pTopic = pTopicFilter;
+		key.topicLen = topicFilterLen;
+		hash = _aws_iot_mqtt_internal_hash(FNV32_OFFSET, pTopicFilter, topicFilterLen);
+		probe = 0;
+		/* Same topic can be registered with 2 callbacks. Unlikely scenario */
+		while(AWS_IOT_MQTT_INDEX_NONE != (slot = _aws_iot_mqtt_internal_hash_find(pClient, &pIndex->exactTopics, hash,
+																				  _aws_iot_mqtt_internal_topic_matches,
+																				  &key, &probe))) {
+			_aws_iot_mqtt_internal_free_handler(pClient, pIndex->exactTopics.pSlots[slot] - 1);
+			_aws_iot_mqtt_internal_hash_remove(&pIndex->exactTopics, slot);
+			removed++;
+		}
+		return removed;
+	}
+
+	if(0 == pIndex->trieNodesSize) {
+		return 0;
+	}
+
+	node = _aws_iot_mqtt_internal_trie_walk(pClient, pTopicFilter, topicFilterLen, false);
+	if(AWS_IOT_MQTT_INDEX_NONE == node) {
+		return 0;
+	}
+
+	/* Every handler ending at this node was subscribed with this same filter */
+	pLink = &pIndex->pTrieNodes[node].firstHandler;
+	while(AWS_IOT_MQTT_INDEX_NONE != *pLink) {
+		handler = *pLink;
+		*pLink = pClient->clientData.messageHandlers[handler].next;
+		_aws_iot_mqtt_internal_free_handler(pClient, handler);
+		pIndex->pTrieNodes[node].refCount--;
+		removed++;
+	}
+
+	_aws_iot_mqtt_internal_trie_prune(pClient, node);
+
+	return removed;
+}
+
+/**
+ * @brief Is at least one message handler registered for a topic filter
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicFilter Topic filter as subscribed, not necessarily NUL terminated
+ * @param topicFilterLen Length of the topic filter
+ *
+ * @return true if subscribed
+ */
+bool aws_iot_mqtt_internal_has_handler(AWS_IoT_Client *pClient, const char *pTopicFilter, uint16_t topicFilterLen) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionTopicKey key;
+	uint32_t probe = 0;
+	uint32_t node;
+
+	if(!_aws_iot_mqtt_internal_is_wildcard_filter(pTopicFilter, topicFilterLen)) {
+		key.pTopic = pTopicFilter;
+		key.topicLen = topicFilterLen;
+		return AWS_IOT_MQTT_INDEX_NONE !=
+			   _aws_iot_mqtt_internal_hash_find(pClient, &pIndex->exactTopics,
+												_aws_iot_mqtt_internal_hash(FNV32_OFFSET, pTopicFilter, topicFilterLen),
+												_aws_iot_mqtt_internal_topic_matches, &key, &probe);
+	}
+
+	if(0 == pIndex->trieNodesSize) {
+		return false;
+	}
+
+	node = _aws_iot_mqtt_internal_trie_walk(pClient, pTopicFilter, topicFilterLen, false);
+	return AWS_IOT_MQTT_INDEX_NONE != node && AWS_IOT_MQTT_INDEX_NONE != pIndex->pTrieNodes[node].firstHandler;
+}
+
+/**
+ * @brief Find the message handlers for an incoming topic
+ *
+ * Cost is one hash lookup for the exact topic plus up to three per topic level for
+ * wildcard filters, independent of how many subscriptions there are.
+ * Matches are returned in a stable order as long as the subscriptions don't change,
+ * so a caller with a small buffer can fetch them in passes using skip.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicName Topic of the incoming message
+ * @param topicNameLen Length of the topic
+ * @param skip Number of matches to leave out at the start
+ * @param pMatches Returned handler indices
+ * @param maxMatches Size of pMatches
+ *
+ * @return Total number of matching handlers (including the skipped ones)
+ */
+uint32_t aws_iot_mqtt_internal_match_handlers(AWS_IoT_Client *pClient, const char *pTopicName, uint16_t topicNameLen,
+											  uint32_t skip, uint32_t *pMatches, uint32_t maxMatches) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	SubscriptionMatch match;
+	SubscriptionTopicKey key;
+	uint32_t probe = 0;
+	uint32_t hash, slot;
+
+	match.skip = skip;
+	match.total = 0;
+	match.pMatches = pMatches;
+	match.maxMatches = maxMatches;
+
+	key.pTopic = pTopicName;
+	key.topicLen = topicNameLen;
+	hash = _aws_iot_mqtt_internal_hash(FNV32_OFFSET, pTopicName, topicNameLen);
+	while(AWS_IOT_MQTT_INDEX_NONE != (slot = _aws_iot_mqtt_internal_hash_find(pClient, &pIndex->exactTopics, hash,
+																			  _aws_iot_mqtt_internal_topic_matches,
+																			  &key, &probe))) {
+		if(match.total >= skip && match.total - skip < maxMatches) {
+			pMatches[match.total - skip] = pIndex->exactTopics.pSlots[slot] - 1;
+		}
+		match.total++;
+	}
+
+	if(0 != pIndex->trieNodesSize) {
+		_aws_iot_mqtt_internal_trie_match(pClient, SUBSCRIPTION_TRIE_ROOT, pTopicName, pTopicName + topicNameLen,
+										  &match);
+	}
+
+	return match.total;
+}
+
+/**
+ * @brief Release the handler table and the index
+ *
+ * @param pClient Reference to the IoT Client
+ */
+void aws_iot_mqtt_internal_free_handlers(AWS_IoT_Client *pClient) {
+	SubscriptionIndex *pIndex = &pClient->clientData.subscriptionIndex;
+	uint32_t i;
+
+	for(i = 0; i < pIndex->trieNodesSize; i++) {
+		free(pIndex->pTrieNodes[i].pSegment);
+	}
+	free(pIndex->pTrieNodes);
+	pIndex->pTrieNodes = NULL;
+	pIndex->trieNodesSize = 0;
+	pIndex->firstFreeTrieNode = AWS_IOT_MQTT_INDEX_NONE;
+
+	_aws_iot_mqtt_internal_hash_free(&pIndex->exactTopics);
+	_aws_iot_mqtt_internal_hash_free(&pIndex->trieEdges);
+
+	free(pClient->clientData.messageHandlers);
+	pClient->clientData.messageHandlers = NULL;
+	pClient->clientData.messageHandlersSize = 0;
+	pIndex->firstFreeHandler = AWS_IOT_MQTT_INDEX_NONE;
+	pIndex->handlerCount = 0;
+	pIndex->streamHandlerCount = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -41,10 +41,14 @@ extern "C" {
 
 #include "aws_iot_mqtt_client_common_internal.h"
 
+/* Topics per _aws_iot_mqtt_internal_unsubscribe_batch round, bounds its stack use */
+#define UNSUBSCRIBE_LIST_MAX_TOPICS AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+
 /**
   * Serializes the supplied unsubscribe data into the supplied buffer, ready for sending
   * @param pTxBuf the raw buffer data, of the correct length determined by the remaining length field
   * @param txBufLen the length in bytes of the data in the supplied buffer
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 adds an empty property list
   * @param dup integer - the MQTT dup flag
   * @param packetId integer - the MQTT packet identifier
   * @param count - number of members in the topicFilters array
@@ -54,7 +58,7 @@ extern "C" {
   * @return IoT_Error_t indicating function execution status
   */
 static IoT_Error_t _aws_iot_mqtt_serialize_unsubscribe(unsigned char *pTxBuf, size_t txBufLen,
-													   uint8_t dup, uint16_t packetId,
+													   MQTT_Ver_t mqttVersion, uint8_t dup, uint16_t packetId,
 													   uint32_t count, const char **pTopicNameList,
 													   uint16_t *pTopicNameLenList, uint32_t *pSerializedLen) {
 	unsigned char *ptr = pTxBuf;
@@ -65,6 +69,10 @@ static IoT_Error_t _aws_iot_mqtt_serialize_unsubscribe(unsigned char *pTxBuf, si
 
 	FUNC_ENTRY;
 
+	if(MQTT_5_0 == mqttVersion) {
+		rem_len += 1; /* property length */
+	}
+
 	for(i = 0; i < count; ++i) {
 		rem_len += (uint32_t) (pTopicNameLenList[i] + 2); /* topic + length */
 	}
@@ -83,6 +91,11 @@ static IoT_Error_t _aws_iot_mqtt_serialize_unsubscribe(unsigned char *pTxBuf, si
 
 	aws_iot_mqtt_internal_write_uint_16(&ptr, packetId);
 
+	if(MQTT_5_0 == mqttVersion) {
+		/* No properties */
+		aws_iot_mqtt_internal_write_char(&ptr, 0);
+	}
+
 	for(i = 0; i < count; ++i) {
 		aws_iot_mqtt_internal_write_utf8_string(&ptr, pTopicNameList[i], pTopicNameLenList[i]);
 	}
@@ -95,24 +108,55 @@ static IoT_Error_t _aws_iot_mqtt_serialize_unsubscribe(unsigned char *pTxBuf, si
 
 /**
   * Deserializes the supplied (wire) buffer into unsuback data
+  * @param mqttVersion MQTT_Ver_t - protocol version, MQTT 5 adds properties and reason codes
   * @param pPacketId returned integer - the MQTT packet identifier
+  * @param pReasonCode returned uint8_t - the first MQTT 5 failure reason code, 0 if there is none
   * @param pRxBuf the raw buffer data, of the correct length determined by the remaining length field
   * @param rxBufLen the length in bytes of the data in the supplied buffer
   * @return IoT_Error_t indicating function execution status
   */
-static IoT_Error_t _aws_iot_mqtt_deserialize_unsuback(uint16_t *pPacketId, unsigned char *pRxBuf, size_t rxBufLen) {
+static IoT_Error_t _aws_iot_mqtt_deserialize_unsuback(MQTT_Ver_t mqttVersion, uint16_t *pPacketId,
+													  uint8_t *pReasonCode, unsigned char *pRxBuf, size_t rxBufLen) {
 	unsigned char type = 0;
 	unsigned char dup = 0;
+	unsigned char *curData, *endData;
+	uint32_t decodedLen = 0;
+	uint32_t readBytesLen = 0;
+	uint8_t code;
 	IoT_Error_t rc;
 
 	FUNC_ENTRY;
 
-	rc = aws_iot_mqtt_internal_deserialize_ack(&type, &dup, pPacketId, pRxBuf, rxBufLen);
+	*pReasonCode = 0;
+	rc = aws_iot_mqtt_internal_deserialize_ack(&type, &dup, pPacketId, &code, pRxBuf, rxBufLen);
 	if(SUCCESS == rc && UNSUBACK != type) {
 		rc = FAILURE;
 	}
+	if(SUCCESS != rc || MQTT_5_0 != mqttVersion) {
+		FUNC_EXIT_RC(rc);
+	}
 
-	FUNC_EXIT_RC(rc);
+	/* One reason code per topic filter follows the properties */
+	rc = aws_iot_mqtt_internal_decode_remaining_length_from_buffer(pRxBuf + 1, &decodedLen, &readBytesLen);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(rc);
+	}
+	curData = pRxBuf + 1 + readBytesLen + 2;
+	endData = pRxBuf + 1 + readBytesLen + decodedLen;
+
+	rc = aws_iot_mqtt_internal_skip_properties(&curData, endData);
+	if(SUCCESS != rc) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	while(curData < endData) {
+		code = aws_iot_mqtt_internal_read_char(&curData);
+		if(MQTT5_REASON_CODE_FAILURE <= code && 0 == *pReasonCode) {
+			*pReasonCode = code;
+		}
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
 }
 
 /**
@@ -138,29 +182,20 @@ static IoT_Error_t _aws_iot_mqtt_internal_unsubscribe(AWS_IoT_Client *pClient, c
 
 	uint16_t packet_id;
 	uint32_t serializedLen = 0;
-	uint32_t i = 0;
+	uint8_t reasonCode;
 	IoT_Error_t rc;
-	bool subscriptionExists = false;
 
 	FUNC_ENTRY;
 
-	/* Remove from message handler array */
-	for(i = 0; i < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		if(pClient->clientData.messageHandlers[i].topicName != NULL &&
-		   (strcmp(pClient->clientData.messageHandlers[i].topicName, pTopicFilter) == 0)) {
-			subscriptionExists = true;
-            break;
-		}
-	}
-
-	if(false == subscriptionExists) {
+	if(!aws_iot_mqtt_internal_has_handler(pClient, pTopicFilter, topicFilterLen)) {
 		FUNC_EXIT_RC(FAILURE);
 	}
 
 	init_timer(&timer);
 	countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
 
-	rc = _aws_iot_mqtt_serialize_unsubscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize, 0,
+	rc = _aws_iot_mqtt_serialize_unsubscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+											 pClient->clientData.options.MQTTVersion, 0,
 											 aws_iot_mqtt_get_next_packet_id(pClient), 1, &pTopicFilter,
 											 &topicFilterLen, &serializedLen);
 	if(SUCCESS != rc) {
@@ -178,21 +213,22 @@ static IoT_Error_t _aws_iot_mqtt_internal_unsubscribe(AWS_IoT_Client *pClient, c
 		FUNC_EXIT_RC(rc);
 	}
 
-	rc = _aws_iot_mqtt_deserialize_unsuback(&packet_id, pClient->clientData.readBuf, pClient->clientData.readBufSize);
+	rc = _aws_iot_mqtt_deserialize_unsuback(pClient->clientData.options.MQTTVersion, &packet_id, &reasonCode,
+											pClient->clientData.readBuf, pClient->clientData.readBufSize);
 	if(SUCCESS != rc) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* Remove from message handler array */
-	for(i = 0; i < AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS; ++i) {
-		if(pClient->clientData.messageHandlers[i].topicName != NULL &&
-		   (strcmp(pClient->clientData.messageHandlers[i].topicName, pTopicFilter) == 0)) {
-			pClient->clientData.messageHandlers[i].topicName = NULL;
-			/* We don't want to break here, in case the same topic is registered
-             * with 2 callbacks. Unlikely scenario */
-		}
+	/* Refused by an MQTT 5 broker, the subscription is still there */
+	if(0 != reasonCode) {
+		pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+		FUNC_EXIT_RC(MQTT_REASON_CODE_FAILURE_ERROR);
 	}
 
+	/* Remove from message handler table, all of them in case the same topic is
+	 * registered with 2 callbacks. Unlikely scenario */
+	(void) aws_iot_mqtt_internal_remove_handlers(pClient, pTopicFilter, topicFilterLen);
+
 	FUNC_EXIT_RC(SUCCESS);
 }
 
@@ -241,6 +277,189 @@ IoT_Error_t aws_iot_mqtt_unsubscribe(AWS_IoT_Client *pClient, const char *pTopic
 		unsubRc = rc;
 	}
 
+	/* Best effort, a promotion catches the standby up on anything it missed */
+	(void) aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+
+	return unsubRc;
+}
+
+/**
+ * @brief Unsubscribe from several MQTT topics at once.
+ *
+ * This is the internal function which is called by the batch unsubscribe API to perform the operation.
+ * Filters without a subscription are skipped, the rest are packed into as few UNSUBSCRIBE packets
+ * as the TX buffer allows and the packets of a round (up to UNSUBSCRIBE_LIST_MAX_TOPICS filters)
+ * are all sent before collecting the UNSUBACKs.
+ * Not meant to be called directly as it doesn't do validations or client state changes
+ * @note Call is blocking.  The call returns after the receipt of all UNSUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicFilterList Array of topic filters
+ * @param pTopicFilterLenList Array of topic filter lengths
+ * @param count Number of topic filters
+ *
+ * @return An IoT Error Type defining successful/failed unsubscription
+ */
+static IoT_Error_t _aws_iot_mqtt_internal_unsubscribe_batch(AWS_IoT_Client *pClient, const char **pTopicFilterList,
+															uint16_t *pTopicFilterLenList, uint32_t count) {
+	const char *topicFilters[UNSUBSCRIBE_LIST_MAX_TOPICS];
+	uint16_t topicFilterLens[UNSUBSCRIBE_LIST_MAX_TOPICS];
+	uint16_t packetIds[UNSUBSCRIBE_LIST_MAX_TOPICS];
+	bool isAcked[UNSUBSCRIBE_LIST_MAX_TOPICS];
+	uint32_t i, j, found, next, fit, packetCount, ackedCount;
+	uint32_t serializedLen = 0;
+	uint16_t packet_id;
+	uint8_t reasonCode;
+	bool isAnyFound = false;
+	IoT_Error_t rc;
+	Timer timer;
+
+	FUNC_ENTRY;
+
+	i = 0;
+	while(i < count) {
+		/* Only ask the broker about what we are actually subscribed to */
+		found = 0;
+		for(; i < count && found < UNSUBSCRIBE_LIST_MAX_TOPICS; ++i) {
+			if(aws_iot_mqtt_internal_has_handler(pClient, pTopicFilterList[i], pTopicFilterLenList[i])) {
+				topicFilters[found] = pTopicFilterList[i];
+				topicFilterLens[found] = pTopicFilterLenList[i];
+				found++;
+			}
+		}
+
+		if(0 == found) {
+			break;
+		}
+		isAnyFound = true;
+
+		init_timer(&timer);
+		countdown_ms(&timer, pClient->clientData.commandTimeoutMs);
+
+		next = 0;
+		packetCount = 0;
+		while(next < found) {
+			fit = aws_iot_mqtt_internal_count_topics_that_fit(pClient->clientData.writeBufSize,
+															   AWS_IOT_MQTT_IS_V5(pClient) ? 3 : 2,
+															   &topicFilterLens[next], found - next, 2);
+			if(0 == fit) {
+				FUNC_EXIT_RC(MQTT_TX_BUFFER_TOO_SHORT_ERROR);
+			}
+
+			packetIds[packetCount] = aws_iot_mqtt_get_next_packet_id(pClient);
+			rc = _aws_iot_mqtt_serialize_unsubscribe(pClient->clientData.writeBuf, pClient->clientData.writeBufSize,
+													 pClient->clientData.options.MQTTVersion, 0,
+													 packetIds[packetCount], fit, &topicFilters[next],
+													 &topicFilterLens[next], &serializedLen);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+
+			/* send the unsubscribe packet */
+			rc = aws_iot_mqtt_internal_send_packet(pClient, serializedLen, &timer);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+
+			isAcked[packetCount] = false;
+			packetCount++;
+			next += fit;
+		}
+
+		ackedCount = 0;
+		while(ackedCount < packetCount) {
+			rc = aws_iot_mqtt_internal_wait_for_read(pClient, UNSUBACK, &timer);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+
+			rc = _aws_iot_mqtt_deserialize_unsuback(pClient->clientData.options.MQTTVersion, &packet_id,
+													&reasonCode, pClient->clientData.readBuf,
+													pClient->clientData.readBufSize);
+			if(SUCCESS != rc) {
+				FUNC_EXIT_RC(rc);
+			}
+			if(0 != reasonCode) {
+				pClient->clientData.mqtt5.lastReasonCode = reasonCode;
+			}
+
+			for(j = 0; j < packetCount; ++j) {
+				if(!isAcked[j] && packet_id == packetIds[j]) {
+					isAcked[j] = true;
+					ackedCount++;
+					break;
+				}
+			}
+		}
+
+		/* Remove from message handler table */
+		for(j = 0; j < found; ++j) {
+			(void) aws_iot_mqtt_internal_remove_handlers(pClient, topicFilters[j], topicFilterLens[j]);
+		}
+	}
+
+	if(!isAnyFound) {
+		FUNC_EXIT_RC(FAILURE);
+	}
+
+	FUNC_EXIT_RC(SUCCESS);
+}
+
+/**
+ * @brief Unsubscribe from several MQTT topics at once.
+ *
+ * This is the outer function which does the validations and calls the internal batch unsubscribe
+ * above to perform the actual operation. It is also responsible for client state changes
+ * @note Call is blocking.  The call returns after the receipt of all UNSUBACK control packets.
+ *
+ * @param pClient Reference to the IoT Client
+ * @param pTopicFilterList Array of topic filters
+ * @param pTopicFilterLenList Array of topic filter lengths
+ * @param count Number of topic filters
+ *
+ * @return An IoT Error Type defining successful/failed unsubscription
+ */
+IoT_Error_t aws_iot_mqtt_unsubscribe_batch(AWS_IoT_Client *pClient, const char **pTopicFilterList,
+										   uint16_t *pTopicFilterLenList, uint32_t count) {
+	IoT_Error_t rc, unsubRc;
+	ClientState clientState;
+	uint32_t i;
+
+	if(NULL == pClient || NULL == pTopicFilterList || NULL == pTopicFilterLenList || 0 == count) {
+		return NULL_VALUE_ERROR;
+	}
+
+	for(i = 0; i < count; ++i) {
+		if(NULL == pTopicFilterList[i]) {
+			return NULL_VALUE_ERROR;
+		}
+	}
+
+	if(!aws_iot_mqtt_is_client_connected(pClient)) {
+		return NETWORK_DISCONNECTED_ERROR;
+	}
+
+	clientState = aws_iot_mqtt_get_client_state(pClient);
+	if(CLIENT_STATE_CONNECTED_IDLE != clientState && CLIENT_STATE_CONNECTED_WAIT_FOR_CB_RETURN != clientState) {
+		return MQTT_CLIENT_NOT_IDLE_ERROR;
+	}
+
+	rc = aws_iot_mqtt_set_client_state(pClient, clientState, CLIENT_STATE_CONNECTED_UNSUBSCRIBE_IN_PROGRESS);
+	if(SUCCESS != rc) {
+		rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_UNSUBSCRIBE_IN_PROGRESS, clientState);
+		return rc;
+	}
+
+	unsubRc = _aws_iot_mqtt_internal_unsubscribe_batch(pClient, pTopicFilterList, pTopicFilterLenList, count);
+
+	rc = aws_iot_mqtt_set_client_state(pClient, CLIENT_STATE_CONNECTED_UNSUBSCRIBE_IN_PROGRESS, clientState);
+	if(SUCCESS == unsubRc && SUCCESS != rc) {
+		unsubRc = rc;
+	}
+
+	/* Best effort, a promotion catches the standby up on anything it missed */
+	(void) aws_iot_mqtt_internal_mirror_subscriptions(pClient);
+
 	return unsubRc;
 }
 
@@ -46,8 +46,11 @@ extern "C" {
   */
 static void _aws_iot_mqtt_force_client_disconnect(AWS_IoT_Client *pClient) {
 	pClient->clientStatus.clientState = CLIENT_STATE_DISCONNECTED_ERROR;
-	pClient->networkStack.disconnect(&(pClient->networkStack));
-	pClient->networkStack.destroy(&(pClient->networkStack));
+	pClient->pNetworkStack->disconnect(pClient->pNetworkStack);
+	pClient->pNetworkStack->destroy(pClient->pNetworkStack);
+	aws_iot_mqtt_internal_fail_inflight_publishes(pClient, NETWORK_DISCONNECTED_ERROR);
+	aws_iot_mqtt_internal_flushBuffers(pClient);
+	pClient->clientData.isSessionInherited = false;
 }
 
 static IoT_Error_t _aws_iot_mqtt_handle_disconnect(AWS_IoT_Client *pClient) {
@@ -55,6 +58,11 @@ static IoT_Error_t _aws_iot_mqtt_handle_disconnect(AWS_IoT_Client *pClient) {
 
 	FUNC_ENTRY;
 
+	/* A standby connection takes over and the client stays connected */
+	if(SUCCESS == aws_iot_mqtt_internal_promote_standby(pClient)) {
+		FUNC_EXIT_RC(SUCCESS);
+	}
+
 	rc = aws_iot_mqtt_disconnect(pClient);
 	if(rc != SUCCESS) {
 		// If the aws_iot_mqtt_internal_send_packet prevents us from sending a disconnect packet then we have to clean the stack
@@ -83,8 +91,8 @@ static IoT_Error_t _aws_iot_mqtt_handle_reconnect(AWS_IoT_Client *pClient) {
 	}
 
 	rc = NETWORK_PHYSICAL_LAYER_DISCONNECTED;
-	if(NULL != pClient->networkStack.isConnected) {
-		rc = pClient->networkStack.isConnected(&(pClient->networkStack));
+	if(NULL != pClient->pNetworkStack->isConnected) {
+		rc = pClient->pNetworkStack->isConnected(pClient->pNetworkStack);
 	}
 
 	if(NETWORK_PHYSICAL_LAYER_CONNECTED == rc) {
@@ -143,8 +151,8 @@ static IoT_Error_t _aws_iot_mqtt_keep_alive(AWS_IoT_Client *pClient) {
 		FUNC_EXIT_RC(rc);
 	}
 
-	/* send the ping packet */
-	rc = aws_iot_mqtt_internal_send_packet(pClient, serialized_len, &timer);
+	/* send the ping packet, with any PUBACKs waiting to be coalesced */
+	rc = aws_iot_mqtt_internal_queue_packet(pClient, serialized_len, NULL, 0, &timer);
 	if(SUCCESS != rc) {
 		//If sending a PING fails we can no longer determine if we are connected.  In this case we decide we are disconnected and begin reconnection attempts
 		rc = _aws_iot_mqtt_handle_disconnect(pClient);
@@ -172,6 +180,7 @@ static IoT_Error_t _aws_iot_mqtt_keep_alive(AWS_IoT_Client *pClient) {
  *
  * @param pClient Reference to the IoT Client
  * @param timeout_ms Maximum number of milliseconds to pass thread execution to the client.
+ *                   0 to handle what has arrived and return once nothing more is there.
  *
  * @return An IoT Error Type defining successful/failed client processing.
  *         If this call results in an error it is likely the MQTT connection has dropped.
@@ -182,6 +191,7 @@ static IoT_Error_t _aws_iot_mqtt_internal_yield(AWS_IoT_Client *pClient, uint32_
 	IoT_Error_t yieldRc = SUCCESS;
 
 	uint8_t packet_type;
+	bool isPacketRead;
 	ClientState clientState;
 	Timer timer;
 	init_timer(&timer);
@@ -191,6 +201,7 @@ static IoT_Error_t _aws_iot_mqtt_internal_yield(AWS_IoT_Client *pClient, uint32_
 
 	// evaluate timeout at the end of the loop to make sure the actual yield runs at least once
 	do {
+		isPacketRead = false;
 		clientState = aws_iot_mqtt_get_client_state(pClient);
 		if(CLIENT_STATE_PENDING_RECONNECT == clientState) {
 			if(AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL < pClient->clientData.currentReconnectWaitInterval) {
@@ -203,12 +214,27 @@ static IoT_Error_t _aws_iot_mqtt_internal_yield(AWS_IoT_Client *pClient, uint32_
 			continue;
 		}
 
+		/* Left alone when there was nothing to read */
+		packet_type = MQTT_PACKET_TYPE_NONE;
 		yieldRc = aws_iot_mqtt_internal_cycle_read(pClient, &timer, &packet_type);
+		isPacketRead = (MQTT_PACKET_TYPE_NONE != packet_type);
 		if(SUCCESS == yieldRc) {
+			aws_iot_mqtt_internal_check_inflight_timeouts(pClient);
 			yieldRc = _aws_iot_mqtt_keep_alive(pClient);
+			/* Queued packets go out at the end of a burst, once nothing more received is
+			 * waiting to be handled, or when this yield is about to return */
+			if(SUCCESS == yieldRc &&
+			   (!isPacketRead || pClient->clientData.readBufIndex <= pClient->clientData.readBufPacketLen ||
+				(0 != timeout_ms && has_timer_expired(&timer)))) {
+				if(SUCCESS != aws_iot_mqtt_internal_flush_tx_queue(pClient)) {
+					yieldRc = _aws_iot_mqtt_handle_disconnect(pClient);
+				}
+			}
 		} else {
 			// SSL read and write errors are terminal, connection must be closed and retried
-			if(NETWORK_SSL_READ_ERROR == yieldRc || NETWORK_SSL_WRITE_ERROR == yieldRc || NETWORK_SSL_WRITE_TIMEOUT_ERROR == yieldRc) {
+			// So is a DISCONNECT from an MQTT 5 broker
+			if(NETWORK_SSL_READ_ERROR == yieldRc || NETWORK_SSL_WRITE_ERROR == yieldRc || NETWORK_SSL_WRITE_TIMEOUT_ERROR == yieldRc ||
+			   MQTT_SERVER_DISCONNECTED_ERROR == yieldRc) {
 				yieldRc = _aws_iot_mqtt_handle_disconnect(pClient);
 			}
 		}
@@ -234,7 +260,7 @@ static IoT_Error_t _aws_iot_mqtt_internal_yield(AWS_IoT_Client *pClient, uint32_
 		} else if(SUCCESS != yieldRc) {
 			break;
 		}
-	} while(!has_timer_expired(&timer));
+	} while(!has_timer_expired(&timer) || (0 == timeout_ms && isPacketRead));
 
 	FUNC_EXIT_RC(yieldRc);
 }
@@ -253,6 +279,7 @@ static IoT_Error_t _aws_iot_mqtt_internal_yield(AWS_IoT_Client *pClient, uint32_
  *
  * @param pClient Reference to the IoT Client
  * @param timeout_ms Maximum number of milliseconds to pass thread execution to the client.
+ *                   0 to handle what has arrived and return once nothing more is there.
  *
  * @return An IoT Error Type defining successful/failed client processing.
  *         If this call results in an error it is likely the MQTT connection has dropped.
@@ -262,10 +289,15 @@ IoT_Error_t aws_iot_mqtt_yield(AWS_IoT_Client *pClient, uint32_t timeout_ms) {
 	IoT_Error_t rc, yieldRc;
 	ClientState clientState;
 
-	if(NULL == pClient || 0 == timeout_ms) {
+	if(NULL == pClient) {
 		FUNC_EXIT_RC(NULL_VALUE_ERROR);
 	}
 
+	/* The standby needs its keep alive and reconnects too, it has no yield of its own */
+	if(NULL != pClient->clientData.pStandby) {
+		(void) aws_iot_mqtt_yield(pClient->clientData.pStandby, 0);
+	}
+
 	clientState = aws_iot_mqtt_get_client_state(pClient);
 	/* Check if network was manually disconnected */
 	if(CLIENT_STATE_DISCONNECTED_MANUALLY == clientState) {
@@ -36,7 +36,7 @@ const ShadowInitParameters_t ShadowInitParametersDefault = {(char *) AWS_IOT_MQT
 															NULL, false, NULL};
 
 const ShadowConnectParameters_t ShadowConnectParametersDefault = {(char *) AWS_IOT_MY_THING_NAME,
-								  (char *) AWS_IOT_MQTT_CLIENT_ID, 0, NULL};
+								  (char *) AWS_IOT_MQTT_CLIENT_ID, 0, NULL, true, MQTT_3_1_1};
 
 static char deleteAcceptedTopic[MAX_SHADOW_TOPIC_LENGTH_BYTES];
 
@@ -118,8 +118,8 @@ IoT_Error_t aws_iot_shadow_connect(AWS_IoT_Client *pClient, ShadowConnectParamet
 	snprintf(mqttClientID, MAX_SIZE_OF_UNIQUE_CLIENT_ID_BYTES, "%s", pParams->pMqttClientId);
 
 	ConnectParams.keepAliveIntervalInSec = 600; // NOTE: Temporary fix
-	ConnectParams.MQTTVersion = MQTT_3_1_1;
-	ConnectParams.isCleanSession = true;
+	ConnectParams.MQTTVersion = pParams->MQTTVersion;
+	ConnectParams.isCleanSession = !pParams->isPersistentSession;
 	ConnectParams.isWillMsgPresent = false;
 	ConnectParams.pClientID = pParams->pMqttClientId;
 	ConnectParams.clientIDLen = pParams->mqttClientIdLen;
@@ -111,7 +111,8 @@ IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct) {
 
 	if(!deltaTopicSubscribedFlag) {
 		snprintf(shadowDeltaTopic, MAX_SHADOW_TOPIC_LENGTH_BYTES, "$aws/things/%s/shadow/update/delta", myThingName);
-		rc = aws_iot_mqtt_subscribe(pMqttClient, shadowDeltaTopic, (uint16_t) strlen(shadowDeltaTopic), QOS0,
+		/* QoS1 so deltas published while we are disconnected are queued in a persistent session */
+		rc = aws_iot_mqtt_subscribe(pMqttClient, shadowDeltaTopic, (uint16_t) strlen(shadowDeltaTopic), QOS1,
 									shadow_delta_callback, NULL);
 		deltaTopicSubscribedFlag = true;
 	}
@@ -413,12 +414,17 @@ IoT_Error_t publishToShadowAction(const char *pThingName, ShadowActions_t action
 
 	topicNameFromThingAndAction(TemporaryTopicName, pThingName, action, SHADOW_ACTION);
 
-	msgParams.qos = QOS0;
+	msgParams.qos = QOS1;
 	msgParams.isRetained = 0;
 	msgParams.payloadLen = strlen(pJsonDocumentToBeSent);
 	msgParams.payload = (char *) pJsonDocumentToBeSent;
 	ret_val = aws_iot_mqtt_publish(pMqttClient, TemporaryTopicName, (uint16_t) strlen(TemporaryTopicName), &msgParams);
 
+	/* Kept by the client and sent again on reconnect, publishing it again would duplicate it */
+	if(MQTT_PUBLISH_QUEUED == ret_val) {
+		ret_val = SUCCESS;
+	}
+
 	return ret_val;
 }
 
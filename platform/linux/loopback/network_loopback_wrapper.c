@@ -0,0 +1,645 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * In-process implementation of network_interface.h. The client end reads and
+ * writes two rings inside the Network, the broker end is scripted through the
+ * iot_loopback_* functions. Nothing waits and nothing is allocated, so the
+ * same calls always take the same path, which is what measuring the MQTT
+ * layer needs. Build it instead of platform/linux/mbedtls, with this
+ * directory on the include path and IOT_NETWORK_BACKEND_LOOPBACK defined.
+ * Without the define the file is empty, so it can sit in a source tree that
+ * builds another backend.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef IOT_NETWORK_BACKEND_LOOPBACK
+
+#include <stdbool.h>
+#include <string.h>
+#include <timer_platform.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+#include "network_platform.h"
+
+/* Control packet types the broker end answers, see MessageTypes */
+#define IOT_LOOPBACK_CONNECT 1
+#define IOT_LOOPBACK_PUBLISH 3
+#define IOT_LOOPBACK_SUBSCRIBE 8
+#define IOT_LOOPBACK_UNSUBSCRIBE 10
+#define IOT_LOOPBACK_PINGREQ 12
+
+/* Largest SUBSCRIBE or UNSUBSCRIBE answered, in topics */
+#define IOT_LOOPBACK_MAX_ACK_TOPICS 32
+
+static void _iot_loopback_ring_reset(IoT_Loopback_Ring *pRing) {
+	pRing->head = 0;
+	pRing->used = 0;
+}
+
+/*
+ * Append up to len bytes, returns how many fit
+ */
+static size_t _iot_loopback_ring_put(IoT_Loopback_Ring *pRing, const unsigned char *pData, size_t len) {
+	size_t tail, chunk;
+
+	if(len > IOT_LOOPBACK_RING_LEN - pRing->used) {
+		len = IOT_LOOPBACK_RING_LEN - pRing->used;
+	}
+	if(0 == len) {
+		return 0;
+	}
+
+	tail = (pRing->head + pRing->used) % IOT_LOOPBACK_RING_LEN;
+	chunk = IOT_LOOPBACK_RING_LEN - tail;
+	if(chunk > len) {
+		chunk = len;
+	}
+	memcpy(&(pRing->buf[tail]), pData, chunk);
+	memcpy(pRing->buf, pData + chunk, len - chunk);
+	pRing->used += len;
+
+	return len;
+}
+
+/*
+ * Remove up to len bytes, copying them to pData unless it is NULL. Returns how many were removed
+ */
+static size_t _iot_loopback_ring_get(IoT_Loopback_Ring *pRing, unsigned char *pData, size_t len) {
+	size_t chunk;
+
+	if(len > pRing->used) {
+		len = pRing->used;
+	}
+
+	if(NULL != pData) {
+		chunk = IOT_LOOPBACK_RING_LEN - pRing->head;
+		if(chunk > len) {
+			chunk = len;
+		}
+		memcpy(pData, &(pRing->buf[pRing->head]), chunk);
+		memcpy(pData + chunk, pRing->buf, len - chunk);
+	}
+	pRing->head = (pRing->head + len) % IOT_LOOPBACK_RING_LEN;
+	pRing->used -= len;
+
+	/* Keeps short packets in one piece */
+	if(0 == pRing->used) {
+		pRing->head = 0;
+	}
+
+	return len;
+}
+
+static unsigned char _iot_loopback_ring_peek(const IoT_Loopback_Ring *pRing, size_t offset) {
+	return pRing->buf[(pRing->head + offset) % IOT_LOOPBACK_RING_LEN];
+}
+
+static uint16_t _iot_loopback_ring_peek16(const IoT_Loopback_Ring *pRing, size_t offset) {
+	return (uint16_t) ((_iot_loopback_ring_peek(pRing, offset) << 8) | _iot_loopback_ring_peek(pRing, offset + 1));
+}
+
+/*
+ * Decode a variable byte integer at offset, returns its length in bytes or 0 if it isn't all there yet
+ */
+static size_t _iot_loopback_ring_peek_varint(const IoT_Loopback_Ring *pRing, size_t offset, size_t *pValue) {
+	size_t multiplier = 1;
+	size_t len = 0;
+	unsigned char encodedByte;
+
+	*pValue = 0;
+	do {
+		if(offset + len >= pRing->used || len >= 4) {
+			return 0;
+		}
+		encodedByte = _iot_loopback_ring_peek(pRing, offset + len);
+		*pValue += (encodedByte & 127) * multiplier;
+		multiplier *= 128;
+		len++;
+	} while((encodedByte & 128) != 0);
+
+	return len;
+}
+
+/*
+ * Encode a fixed header into pFixedHeader, which has room for 5 bytes. Returns its length, 0 if too long
+ */
+static size_t _iot_loopback_encode_fixed_header(unsigned char *pFixedHeader, unsigned char header,
+												size_t remainingLen) {
+	size_t headerLen = 1;
+
+	pFixedHeader[0] = header;
+	do {
+		if(headerLen > 4) {
+			return 0;
+		}
+		pFixedHeader[headerLen] = (unsigned char) (remainingLen % 128);
+		remainingLen /= 128;
+		if(remainingLen > 0) {
+			pFixedHeader[headerLen] |= 128;
+		}
+		headerLen++;
+	} while(remainingLen > 0);
+
+	return headerLen;
+}
+
+/*
+ * Queue a packet for the client, all of it or nothing
+ */
+static IoT_Error_t _iot_loopback_send_to_client(Network *pNetwork, unsigned char header, const unsigned char *pVar,
+												size_t varLen, const void *pPayload, size_t payloadLen) {
+	IoT_Loopback_Ring *pRing = &(pNetwork->tlsDataParams.toClient);
+	unsigned char fixedHeader[5];
+	size_t headerLen;
+
+	headerLen = _iot_loopback_encode_fixed_header(fixedHeader, header, varLen + payloadLen);
+	if(0 == headerLen || headerLen + varLen + payloadLen > IOT_LOOPBACK_RING_LEN - pRing->used) {
+		return FAILURE;
+	}
+
+	(void) _iot_loopback_ring_put(pRing, fixedHeader, headerLen);
+	(void) _iot_loopback_ring_put(pRing, pVar, varLen);
+	(void) _iot_loopback_ring_put(pRing, (const unsigned char *) pPayload, payloadLen);
+
+	return SUCCESS;
+}
+
+/*
+ * Count the topics of a SUBSCRIBE or UNSUBSCRIBE and collect the QoS each one asks for
+ */
+static size_t _iot_loopback_collect_topics(const IoT_Loopback_Ring *pRing, size_t offset, size_t end,
+										   bool hasOptions, unsigned char *pCodes) {
+	size_t count = 0;
+	uint8_t qos;
+
+	while(offset + 2 <= end && count < IOT_LOOPBACK_MAX_ACK_TOPICS) {
+		offset += 2 + _iot_loopback_ring_peek16(pRing, offset);
+		qos = 0;
+		if(hasOptions) {
+			/* Only QoS 0 and 1 are granted */
+			qos = (_iot_loopback_ring_peek(pRing, offset) & 3) ? 1 : 0;
+			offset++;
+		}
+		pCodes[count++] = qos;
+	}
+
+	return count;
+}
+
+/*
+ * Answer one whole packet from the client, which starts at the head of toBroker
+ */
+static void _iot_loopback_answer(Network *pNetwork, uint8_t type, size_t varOffset, size_t packetLen) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	IoT_Loopback_Ring *pRing = &(tlsDataParams->toBroker);
+	unsigned char var[4 + IOT_LOOPBACK_MAX_ACK_TOPICS];
+	size_t varLen, propLen, count;
+	size_t offset = varOffset;
+
+	switch(type) {
+		case IOT_LOOPBACK_CONNECT:
+			/* Protocol level follows the "MQTT" protocol name */
+			tlsDataParams->isMqtt5 = (5 == _iot_loopback_ring_peek(pRing, varOffset + 6));
+			(void) iot_loopback_inject_connack(pNetwork, false, 0);
+			break;
+		case IOT_LOOPBACK_PUBLISH:
+			if(0 != (_iot_loopback_ring_peek(pRing, 0) & 0x06)) {
+				offset += 2 + _iot_loopback_ring_peek16(pRing, offset);
+				(void) iot_loopback_inject_puback(pNetwork, _iot_loopback_ring_peek16(pRing, offset));
+			}
+			break;
+		case IOT_LOOPBACK_SUBSCRIBE:
+		case IOT_LOOPBACK_UNSUBSCRIBE:
+			var[0] = _iot_loopback_ring_peek(pRing, offset);
+			var[1] = _iot_loopback_ring_peek(pRing, offset + 1);
+			offset += 2;
+			varLen = 2;
+			if(tlsDataParams->isMqtt5) {
+				offset += _iot_loopback_ring_peek_varint(pRing, offset, &propLen);
+				offset += propLen;
+				var[varLen++] = 0;
+			}
+			count = _iot_loopback_collect_topics(pRing, offset, packetLen, IOT_LOOPBACK_SUBSCRIBE == type,
+												 &var[varLen]);
+			if(IOT_LOOPBACK_SUBSCRIBE == type || tlsDataParams->isMqtt5) {
+				varLen += count;
+			}
+			(void) _iot_loopback_send_to_client(pNetwork, (unsigned char) ((type + 1) << 4), var, varLen, NULL, 0);
+			break;
+		case IOT_LOOPBACK_PINGREQ:
+			(void) _iot_loopback_send_to_client(pNetwork, 0xD0, NULL, 0, NULL, 0);
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Take every whole packet the client has written and answer it
+ */
+static void _iot_loopback_auto_reply(Network *pNetwork) {
+	IoT_Loopback_Ring *pRing = &(pNetwork->tlsDataParams.toBroker);
+	size_t headerLen, remainingLen;
+	uint8_t type;
+
+	for(;;) {
+		headerLen = _iot_loopback_ring_peek_varint(pRing, 1, &remainingLen);
+		if(0 == headerLen || 1 + headerLen + remainingLen > pRing->used) {
+			break;
+		}
+		type = (uint8_t) (_iot_loopback_ring_peek(pRing, 0) >> 4);
+		pNetwork->tlsDataParams.receivedCount[type]++;
+		_iot_loopback_answer(pNetwork, type, 1 + headerLen, 1 + headerLen + remainingLen);
+		(void) _iot_loopback_ring_get(pRing, NULL, 1 + headerLen + remainingLen);
+	}
+}
+
+void _iot_tls_set_connect_params(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+								 char *pDevicePrivateKeyLocation, char *pDestinationURL,
+								 uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag) {
+	pNetwork->tlsConnectParams.DestinationPort = destinationPort;
+	pNetwork->tlsConnectParams.pDestinationURL = pDestinationURL;
+	pNetwork->tlsConnectParams.pDeviceCertLocation = pDeviceCertLocation;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyLocation = pDevicePrivateKeyLocation;
+	pNetwork->tlsConnectParams.pRootCALocation = pRootCALocation;
+	pNetwork->tlsConnectParams.timeout_ms = timeout_ms;
+	pNetwork->tlsConnectParams.ServerVerificationFlag = ServerVerificationFlag;
+}
+
+IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+						 char *pDevicePrivateKeyLocation, char *pDestinationURL,
+						 uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag) {
+	_iot_tls_set_connect_params(pNetwork, pRootCALocation, pDeviceCertLocation, pDevicePrivateKeyLocation,
+								pDestinationURL, destinationPort, timeout_ms, ServerVerificationFlag);
+
+	pNetwork->connect = iot_tls_connect;
+	pNetwork->read = iot_tls_read;
+	pNetwork->readAvailable = iot_tls_read_available;
+	pNetwork->write = iot_tls_write;
+	pNetwork->writev = iot_tls_writev;
+	pNetwork->disconnect = iot_tls_disconnect;
+	pNetwork->isConnected = iot_tls_is_connected;
+	pNetwork->destroy = iot_tls_destroy;
+	/* There is no socket to wait for */
+	pNetwork->getSocket = NULL;
+
+	pNetwork->tlsConnectParams.pRootCABuffer = NULL;
+	pNetwork->tlsConnectParams.rootCABufferLen = 0;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = NULL;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = 0;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = NULL;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = 0;
+	pNetwork->tlsConnectParams.isNonBlocking = false;
+	pNetwork->tlsConnectParams.isKernelTLS = false;
+	pNetwork->tlsConnectParams.maxFragmentLen = 0;
+
+	_iot_loopback_ring_reset(&(pNetwork->tlsDataParams.toBroker));
+	_iot_loopback_ring_reset(&(pNetwork->tlsDataParams.toClient));
+	pNetwork->tlsDataParams.isConnected = false;
+	pNetwork->tlsDataParams.isAutoReply = false;
+	pNetwork->tlsDataParams.isMqtt5 = false;
+	memset(pNetwork->tlsDataParams.receivedCount, 0, sizeof(pNetwork->tlsDataParams.receivedCount));
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_credential_buffers(Network *pNetwork, const unsigned char *pRootCABuffer,
+										   size_t rootCABufferLen, const unsigned char *pDeviceCertBuffer,
+										   size_t deviceCertBufferLen, const unsigned char *pDevicePrivateKeyBuffer,
+										   size_t devicePrivateKeyBufferLen) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Kept so the parameters look the same as with TLS, never used */
+	pNetwork->tlsConnectParams.pRootCABuffer = pRootCABuffer;
+	pNetwork->tlsConnectParams.rootCABufferLen = rootCABufferLen;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = pDeviceCertBuffer;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = deviceCertBufferLen;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = pDevicePrivateKeyBuffer;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = devicePrivateKeyBufferLen;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_nonblocking(Network *pNetwork, bool isNonBlocking) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Reads never wait anyway, this only changes what a partial read returns */
+	pNetwork->tlsConnectParams.isNonBlocking = isNonBlocking;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_kernel_tls(Network *pNetwork, bool isKernelTLS) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(isKernelTLS) {
+		return FAILURE;
+	}
+
+	pNetwork->tlsConnectParams.isKernelTLS = false;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_max_fragment_len(Network *pNetwork, uint16_t maxFragmentLen) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* There are no records to make smaller */
+	if(0 != maxFragmentLen) {
+		return FAILURE;
+	}
+
+	pNetwork->tlsConnectParams.maxFragmentLen = 0;
+
+	return SUCCESS;
+}
+
+size_t iot_tls_get_memory_usage(Network *pNetwork) {
+	/* Both rings are inside the Network struct */
+	return 0;
+}
+
+IoT_Error_t iot_tls_get_socket(Network *pNetwork, int *pSocket) {
+	if(NULL == pNetwork || NULL == pSocket) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return NETWORK_DISCONNECTED_ERROR;
+}
+
+IoT_Error_t iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return NETWORK_PHYSICAL_LAYER_CONNECTED;
+}
+
+IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(NULL != params) {
+		_iot_tls_set_connect_params(pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
+									params->pDevicePrivateKeyLocation, params->pDestinationURL,
+									params->DestinationPort, params->timeout_ms, params->ServerVerificationFlag);
+	}
+
+	/* What was injected before connecting, a scripted CONNACK for one, stays for the client */
+	pNetwork->tlsDataParams.isConnected = true;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_writev(Network *pNetwork, const NetworkIOVec *pIov, size_t iovCount, Timer *timer,
+						   size_t *written_len) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	size_t i, written;
+
+	*written_len = 0;
+
+	if(!tlsDataParams->isConnected) {
+		return NETWORK_SSL_WRITE_ERROR;
+	}
+
+	for(i = 0; i < iovCount; i++) {
+		written = _iot_loopback_ring_put(&(tlsDataParams->toBroker), pIov[i].pBase, pIov[i].len);
+		*written_len += written;
+		if(tlsDataParams->isAutoReply) {
+			_iot_loopback_auto_reply(pNetwork);
+		}
+		if(written != pIov[i].len) {
+			/* Nobody is going to make room while we wait */
+			return NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+		}
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *written_len) {
+	NetworkIOVec iov;
+
+	iov.pBase = pMsg;
+	iov.len = len;
+
+	return iot_tls_writev(pNetwork, &iov, 1, timer, written_len);
+}
+
+IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+
+	if(!tlsDataParams->isConnected) {
+		*read_len = 0;
+		return NETWORK_SSL_READ_ERROR;
+	}
+
+	*read_len = _iot_loopback_ring_get(&(tlsDataParams->toClient), pMsg, len);
+
+	if(*read_len == len) {
+		return SUCCESS;
+	}
+
+	if(0 == *read_len || pNetwork->tlsConnectParams.isNonBlocking) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	} else {
+		return NETWORK_SSL_READ_TIMEOUT_ERROR;
+	}
+}
+
+IoT_Error_t iot_tls_read_available(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+								   size_t *read_len) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+
+	if(!tlsDataParams->isConnected) {
+		*read_len = 0;
+		return NETWORK_SSL_READ_ERROR;
+	}
+
+	*read_len = _iot_loopback_ring_get(&(tlsDataParams->toClient), pMsg, len);
+
+	if(0 == *read_len) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_disconnect(Network *pNetwork) {
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_destroy(Network *pNetwork) {
+	/* Nothing survives the connection */
+	_iot_loopback_ring_reset(&(pNetwork->tlsDataParams.toBroker));
+	_iot_loopback_ring_reset(&(pNetwork->tlsDataParams.toClient));
+	pNetwork->tlsDataParams.isConnected = false;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_free(Network *pNetwork) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_loopback_set_auto_reply(Network *pNetwork, bool isAutoReply) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pNetwork->tlsDataParams.isAutoReply = isAutoReply;
+	if(isAutoReply) {
+		/* Answer what is already waiting */
+		_iot_loopback_auto_reply(pNetwork);
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_loopback_inject(Network *pNetwork, const unsigned char *pData, size_t len) {
+	IoT_Loopback_Ring *pRing;
+
+	if(NULL == pNetwork || (NULL == pData && 0 != len)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pRing = &(pNetwork->tlsDataParams.toClient);
+	if(len > IOT_LOOPBACK_RING_LEN - pRing->used) {
+		return FAILURE;
+	}
+
+	(void) _iot_loopback_ring_put(pRing, pData, len);
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_loopback_inject_connack(Network *pNetwork, bool isSessionPresent, uint8_t returnCode) {
+	unsigned char var[3];
+
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	var[0] = isSessionPresent ? 1 : 0;
+	var[1] = returnCode;
+	/* MQTT 5 adds an empty property list */
+	var[2] = 0;
+
+	return _iot_loopback_send_to_client(pNetwork, 0x20, var, pNetwork->tlsDataParams.isMqtt5 ? 3 : 2, NULL, 0);
+}
+
+IoT_Error_t iot_loopback_inject_suback(Network *pNetwork, uint16_t packetId, uint8_t returnCode) {
+	unsigned char var[4];
+	size_t varLen = 0;
+
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	var[varLen++] = (unsigned char) (packetId >> 8);
+	var[varLen++] = (unsigned char) (packetId & 0xFF);
+	if(pNetwork->tlsDataParams.isMqtt5) {
+		var[varLen++] = 0;
+	}
+	var[varLen++] = returnCode;
+
+	return _iot_loopback_send_to_client(pNetwork, 0x90, var, varLen, NULL, 0);
+}
+
+IoT_Error_t iot_loopback_inject_puback(Network *pNetwork, uint16_t packetId) {
+	unsigned char var[2];
+
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Without reason code and properties, which MQTT 5 allows too */
+	var[0] = (unsigned char) (packetId >> 8);
+	var[1] = (unsigned char) (packetId & 0xFF);
+
+	return _iot_loopback_send_to_client(pNetwork, 0x40, var, 2, NULL, 0);
+}
+
+IoT_Error_t iot_loopback_inject_publish(Network *pNetwork, const char *pTopicName, uint16_t topicNameLen,
+										uint8_t qos, uint16_t packetId, const void *pPayload, size_t payloadLen) {
+	IoT_Loopback_Ring *pRing;
+	unsigned char fixedHeader[5];
+	unsigned char var[3];
+	size_t varLen = 0;
+	size_t remainingLen, headerLen;
+
+	if(NULL == pNetwork || NULL == pTopicName || (NULL == pPayload && 0 != payloadLen)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Written piece by piece straight into the ring, so check the whole packet fits first */
+	pRing = &(pNetwork->tlsDataParams.toClient);
+	remainingLen = 2 + topicNameLen + (qos ? 2 : 0) + (pNetwork->tlsDataParams.isMqtt5 ? 1 : 0) + payloadLen;
+	headerLen = _iot_loopback_encode_fixed_header(fixedHeader, (unsigned char) (0x30 | (qos ? 0x02 : 0)),
+												  remainingLen);
+	if(0 == headerLen || headerLen + remainingLen > IOT_LOOPBACK_RING_LEN - pRing->used) {
+		return FAILURE;
+	}
+
+	(void) _iot_loopback_ring_put(pRing, fixedHeader, headerLen);
+	var[0] = (unsigned char) (topicNameLen >> 8);
+	var[1] = (unsigned char) (topicNameLen & 0xFF);
+	(void) _iot_loopback_ring_put(pRing, var, 2);
+	(void) _iot_loopback_ring_put(pRing, (const unsigned char *) pTopicName, topicNameLen);
+
+	if(qos) {
+		var[varLen++] = (unsigned char) (packetId >> 8);
+		var[varLen++] = (unsigned char) (packetId & 0xFF);
+	}
+	if(pNetwork->tlsDataParams.isMqtt5) {
+		var[varLen++] = 0;
+	}
+	(void) _iot_loopback_ring_put(pRing, var, varLen);
+	(void) _iot_loopback_ring_put(pRing, (const unsigned char *) pPayload, payloadLen);
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_loopback_take(Network *pNetwork, unsigned char *pBuf, size_t len, size_t *pTakenLen) {
+	if(NULL == pNetwork || NULL == pBuf || NULL == pTakenLen) {
+		return NULL_VALUE_ERROR;
+	}
+
+	*pTakenLen = _iot_loopback_ring_get(&(pNetwork->tlsDataParams.toBroker), pBuf, len);
+
+	return SUCCESS;
+}
+
+#endif /* IOT_NETWORK_BACKEND_LOOPBACK */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef IOTSDKC_NETWORK_LOOPBACK_PLATFORM_H_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aws_iot_error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The connection is an in-process loopback
+ *
+ * Certificates and key are not needed, the client doesn't ask for them.
+ */
+#define IOT_NETWORK_LOOPBACK
+
+/* This is the size of each direction of the loopback */
+#ifndef IOT_LOOPBACK_RING_LEN
+#define IOT_LOOPBACK_RING_LEN 4096
+#endif
+
+/**
+ * @brief One direction of the loopback
+ */
+typedef struct {
+	unsigned char buf[IOT_LOOPBACK_RING_LEN];    ///< Bytes in flight, wrapping around at the end
+	size_t head;                         ///< Offset of the oldest byte
+	size_t used;                         ///< Number of bytes in the ring
+} IoT_Loopback_Ring;
+
+/**
+ * @brief Loopback Connection Parameters
+ *
+ * Takes the place of the TLS parameters when the network is built from
+ * platform/linux/loopback instead of platform/linux/mbedtls. The broker
+ * end is driven by the iot_loopback_* functions below.
+ */
+typedef struct _TLSDataParams {
+	IoT_Loopback_Ring toBroker;          ///< Written by the client, read by the broker end
+	IoT_Loopback_Ring toClient;          ///< Written by the broker end, read by the client
+	bool isConnected;                    ///< Between connect and destroy
+	bool isAutoReply;                    ///< The broker end answers the client on its own
+	bool isMqtt5;                        ///< The last CONNECT asked for MQTT 5
+	uint32_t receivedCount[16];          ///< Packets the broker end has taken, by control packet type
+}TLSDataParams;
+
+#define IOTSDKC_NETWORK_LOOPBACK_PLATFORM_H_H
+
+struct Network;
+
+/**
+ * @brief Make the broker end answer the client on its own
+ *
+ * CONNECT gets an accepting CONNACK, SUBSCRIBE a SUBACK granting the requested QoS,
+ * UNSUBSCRIBE an UNSUBACK, QoS 1 PUBLISH a PUBACK and PINGREQ a PINGRESP. Packets
+ * are taken from the client as soon as it writes them. Off by default, then what
+ * the client writes stays until iot_loopback_take.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param isAutoReply - true to answer automatically
+ *
+ * @return IoT_Error_t - successful update or NULL_VALUE_ERROR
+ */
+IoT_Error_t iot_loopback_set_auto_reply(struct Network *pNetwork, bool isAutoReply);
+
+/**
+ * @brief Queue raw bytes for the client to read
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param pData - Bytes, usually one or more whole MQTT packets
+ * @param len - Number of bytes
+ *
+ * @return IoT_Error_t - SUCCESS, NULL_VALUE_ERROR or FAILURE if they don't fit, nothing is queued then
+ */
+IoT_Error_t iot_loopback_inject(struct Network *pNetwork, const unsigned char *pData, size_t len);
+
+/**
+ * @brief Queue a CONNACK for the client
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param isSessionPresent - Value of the session present flag
+ * @param returnCode - Connect return code, or reason code for MQTT 5
+ *
+ * @return IoT_Error_t - see iot_loopback_inject
+ */
+IoT_Error_t iot_loopback_inject_connack(struct Network *pNetwork, bool isSessionPresent, uint8_t returnCode);
+
+/**
+ * @brief Queue a SUBACK with a single return code for the client
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param packetId - Packet identifier of the SUBSCRIBE
+ * @param returnCode - Granted QoS, or 0x80 for failure
+ *
+ * @return IoT_Error_t - see iot_loopback_inject
+ */
+IoT_Error_t iot_loopback_inject_suback(struct Network *pNetwork, uint16_t packetId, uint8_t returnCode);
+
+/**
+ * @brief Queue a PUBACK for the client
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param packetId - Packet identifier of the PUBLISH
+ *
+ * @return IoT_Error_t - see iot_loopback_inject
+ */
+IoT_Error_t iot_loopback_inject_puback(struct Network *pNetwork, uint16_t packetId);
+
+/**
+ * @brief Queue a PUBLISH for the client
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param pTopicName - Topic, not necessarily NUL terminated
+ * @param topicNameLen - Length of the topic
+ * @param qos - 0 or 1
+ * @param packetId - Packet identifier, ignored for QoS 0
+ * @param pPayload - Payload
+ * @param payloadLen - Length of the payload
+ *
+ * @return IoT_Error_t - see iot_loopback_inject
+ */
+IoT_Error_t iot_loopback_inject_publish(struct Network *pNetwork, const char *pTopicName, uint16_t topicNameLen,
+										uint8_t qos, uint16_t packetId, const void *pPayload, size_t payloadLen);
+
+/**
+ * @brief Take what the client has written
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ * @param pBuf - Where to copy the bytes
+ * @param len - Size of pBuf
+ * @param pTakenLen - Number of bytes copied
+ *
+ * @return IoT_Error_t - SUCCESS, or NULL_VALUE_ERROR
+ */
+IoT_Error_t iot_loopback_take(struct Network *pNetwork, unsigned char *pBuf, size_t len, size_t *pTakenLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IOTSDKC_NETWORK_LOOPBACK_PLATFORM_H_H
@@ -0,0 +1,392 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Linux kernel TLS for the mbedTLS network.
+ *
+ * mbedTLS does the handshake, then the record keys and sequence numbers are handed to
+ * the kernel with setsockopt(SOL_TLS). From there on the socket carries plain data:
+ * send, recv, sendmsg with several buffers and sendfile all work on it, and the
+ * records are encrypted and decrypted by the kernel.
+ * Only TLS 1.2 with AES-GCM is handed over, anything else stays with mbedTLS.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _ENABLE_KTLS_SUPPORT_
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <timer_platform.h>
+#include <network_interface.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+#include "network_platform.h"
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/* TLS record content types */
+#define IOT_KTLS_RECORD_TYPE_ALERT 21
+#define IOT_KTLS_RECORD_TYPE_APPLICATION_DATA 23
+
+/* This is the most buffers handed to one sendmsg */
+#define IOT_KTLS_MAX_IOV 8
+
+/*
+ * mbedTLS calls this with the key block of every handshake. For the AES-GCM suites it
+ * holds the client key, the server key, then the 4 byte implicit IVs in the same order.
+ */
+static int _iot_ktls_export_keys(void *p_expkey, const unsigned char *ms, const unsigned char *kb, size_t maclen,
+								 size_t keylen, size_t ivlen, const unsigned char client_random[32],
+								 const unsigned char server_random[32], mbedtls_tls_prf_types tls_prf_type) {
+	TLSDataParams *tlsDataParams = (TLSDataParams *) p_expkey;
+	size_t keyBlockLen = 2 * maclen + 2 * keylen + 2 * ivlen;
+
+	((void) ms);
+	((void) client_random);
+	((void) server_random);
+	((void) tls_prf_type);
+
+	tlsDataParams->isKeyBlockSaved = false;
+	if(0 != maclen || keyBlockLen > sizeof(tlsDataParams->keyBlock)) {
+		/* Not an AEAD suite, the kernel won't take it */
+		return 0;
+	}
+
+	memcpy(tlsDataParams->keyBlock, kb, keyBlockLen);
+	tlsDataParams->keyBlockKeyLen = keylen;
+	tlsDataParams->keyBlockIvLen = ivlen;
+	tlsDataParams->isKeyBlockSaved = true;
+
+	return 0;
+}
+
+void iot_ktls_prepare(Network *pNetwork) {
+	pNetwork->tlsDataParams.isKeyBlockSaved = false;
+	pNetwork->tlsDataParams.isKernelTx = false;
+	pNetwork->tlsDataParams.isKernelRx = false;
+	mbedtls_ssl_conf_export_keys_ext_cb(&(pNetwork->tlsDataParams.conf), _iot_ktls_export_keys,
+										&(pNetwork->tlsDataParams));
+}
+
+/*
+ * Hand one direction to the kernel
+ */
+static bool _iot_ktls_set_crypto_info(int fd, int direction, const unsigned char *pKey, size_t keyLen,
+									  const unsigned char *pSalt, const unsigned char *pSeq) {
+	struct tls12_crypto_info_aes_gcm_128 info128;
+	struct tls12_crypto_info_aes_gcm_256 info256;
+	int ret;
+
+	if(TLS_CIPHER_AES_GCM_128_KEY_SIZE == keyLen) {
+		memset(&info128, 0, sizeof(info128));
+		info128.info.version = TLS_1_2_VERSION;
+		info128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(info128.key, pKey, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+		memcpy(info128.salt, pSalt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+		/* mbedTLS uses the sequence number as explicit nonce, carry on with it */
+		memcpy(info128.iv, pSeq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+		memcpy(info128.rec_seq, pSeq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+		ret = setsockopt(fd, SOL_TLS, direction, &info128, sizeof(info128));
+	} else {
+		memset(&info256, 0, sizeof(info256));
+		info256.info.version = TLS_1_2_VERSION;
+		info256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		memcpy(info256.key, pKey, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+		memcpy(info256.salt, pSalt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+		memcpy(info256.iv, pSeq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+		memcpy(info256.rec_seq, pSeq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+		ret = setsockopt(fd, SOL_TLS, direction, &info256, sizeof(info256));
+	}
+
+	return 0 == ret;
+}
+
+/*
+ * Wait, at most until the timer expires, for the socket to be ready
+ */
+static void _iot_ktls_wait_for_socket(Network *pNetwork, short events, Timer *timer) {
+	struct pollfd pfd;
+
+	pfd.fd = pNetwork->tlsDataParams.server_fd.fd;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	(void) poll(&pfd, 1, (int) left_ms(timer));
+}
+
+/*
+ * Receive application data, with the record type so alerts aren't taken for data
+ */
+static ssize_t _iot_ktls_recv(int fd, unsigned char *pMsg, size_t len) {
+	char cmsgBuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t ret;
+
+	iov.iov_base = pMsg;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgBuf;
+	msg.msg_controllen = sizeof(cmsgBuf);
+
+	ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if(ret > 0) {
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if(NULL != cmsg && SOL_TLS == cmsg->cmsg_level && TLS_GET_RECORD_TYPE == cmsg->cmsg_type &&
+		   IOT_KTLS_RECORD_TYPE_APPLICATION_DATA != *((unsigned char *) CMSG_DATA(cmsg))) {
+			/* An alert or handshake message, the connection is going away */
+			errno = ECONNRESET;
+			return -1;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Read into pMsg until it is full or the timer expires, or only what has arrived
+ */
+static IoT_Error_t _iot_ktls_read_into(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+									   size_t *read_len, bool isAvailableOnly) {
+	int fd = pNetwork->tlsDataParams.server_fd.fd;
+	size_t rxLen = 0;
+	ssize_t ret;
+
+	while(len > 0) {
+		ret = _iot_ktls_recv(fd, pMsg, len);
+		if(ret > 0) {
+			rxLen += (size_t) ret;
+			pMsg += ret;
+			len -= (size_t) ret;
+			if(isAvailableOnly) {
+				break;
+			}
+			continue;
+		} else if(0 == ret || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+			*read_len = rxLen;
+			return NETWORK_SSL_READ_ERROR;
+		}
+
+		// Evaluate timeout after the read to make sure read is done at least once
+		if(pNetwork->tlsConnectParams.isNonBlocking || has_timer_expired(timer)) {
+			break;
+		}
+		_iot_ktls_wait_for_socket(pNetwork, POLLIN, timer);
+	}
+
+	*read_len = rxLen;
+
+	if(0 == len || (isAvailableOnly && 0 < rxLen)) {
+		return SUCCESS;
+	}
+
+	if(0 == rxLen || pNetwork->tlsConnectParams.isNonBlocking) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+
+	return NETWORK_SSL_READ_TIMEOUT_ERROR;
+}
+
+static IoT_Error_t _iot_ktls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len) {
+	return _iot_ktls_read_into(pNetwork, pMsg, len, timer, read_len, false);
+}
+
+static IoT_Error_t _iot_ktls_read_available(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+											size_t *read_len) {
+	return _iot_ktls_read_into(pNetwork, pMsg, len, timer, read_len, true);
+}
+
+static IoT_Error_t _iot_ktls_writev(Network *pNetwork, const NetworkIOVec *pIov, size_t iovCount, Timer *timer,
+									size_t *written_len) {
+	struct iovec iov[IOT_KTLS_MAX_IOV];
+	struct msghdr msg;
+	size_t i, count, skip, total;
+	ssize_t ret;
+	int fd = pNetwork->tlsDataParams.server_fd.fd;
+
+	total = 0;
+	for(i = 0; i < iovCount; i++) {
+		total += pIov[i].len;
+	}
+
+	*written_len = 0;
+	while(*written_len < total) {
+		/* The pieces still to go, after a short write */
+		skip = *written_len;
+		count = 0;
+		for(i = 0; i < iovCount && count < IOT_KTLS_MAX_IOV; i++) {
+			if(skip >= pIov[i].len) {
+				skip -= pIov[i].len;
+				continue;
+			}
+			iov[count].iov_base = (void *) (pIov[i].pBase + skip);
+			iov[count].iov_len = pIov[i].len - skip;
+			skip = 0;
+			count++;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		/* One call for all pieces, the kernel packs them into as few records as it can */
+		ret = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(ret > 0) {
+			*written_len += (size_t) ret;
+			continue;
+		} else if(0 > ret && EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+			IOT_ERROR(" failed\n  ! sendmsg returned errno %d\n\n", errno);
+			return NETWORK_SSL_WRITE_ERROR;
+		}
+
+		if(has_timer_expired(timer)) {
+			return NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+		}
+		_iot_ktls_wait_for_socket(pNetwork, POLLOUT, timer);
+	}
+
+	return SUCCESS;
+}
+
+static IoT_Error_t _iot_ktls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+								   size_t *written_len) {
+	NetworkIOVec iov;
+
+	iov.pBase = pMsg;
+	iov.len = len;
+
+	return _iot_ktls_writev(pNetwork, &iov, 1, timer, written_len);
+}
+
+static IoT_Error_t _iot_ktls_disconnect(Network *pNetwork) {
+	/* close_notify, at warning level */
+	unsigned char alert[2] = { 1, 0 };
+	char cmsgBuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	iov.iov_base = alert;
+	iov.iov_len = sizeof(alert);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgBuf;
+	msg.msg_controllen = sizeof(cmsgBuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*((unsigned char *) CMSG_DATA(cmsg)) = IOT_KTLS_RECORD_TYPE_ALERT;
+
+	/* The connection is going away, whatever happens here */
+	(void) sendmsg(pNetwork->tlsDataParams.server_fd.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	return SUCCESS;
+}
+
+void iot_ktls_offload(Network *pNetwork) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	mbedtls_ssl_context *ssl = &(tlsDataParams->ssl);
+	const char *pCiphersuite = mbedtls_ssl_get_ciphersuite(ssl);
+	const unsigned char *pClientKey, *pServerKey, *pClientSalt, *pServerSalt;
+	size_t keyLen = tlsDataParams->keyBlockKeyLen;
+	int fd = tlsDataParams->server_fd.fd;
+
+	if(!tlsDataParams->isKeyBlockSaved || NULL == pCiphersuite ||
+	   0 != strcmp("TLSv1.2", mbedtls_ssl_get_version(ssl)) ||
+	   (NULL == strstr(pCiphersuite, "-AES-128-GCM-") && NULL == strstr(pCiphersuite, "-AES-256-GCM-")) ||
+	   (TLS_CIPHER_AES_GCM_128_KEY_SIZE != keyLen && TLS_CIPHER_AES_GCM_256_KEY_SIZE != keyLen) ||
+	   TLS_CIPHER_AES_GCM_128_SALT_SIZE != tlsDataParams->keyBlockIvLen) {
+		IOT_WARN("Kernel TLS not used for %s %s", mbedtls_ssl_get_version(ssl),
+				 (NULL != pCiphersuite) ? pCiphersuite : "");
+		return;
+	}
+
+	/* Records mbedTLS already read past would be lost to the kernel */
+	if(0 != mbedtls_ssl_get_bytes_avail(ssl) || 0 != mbedtls_ssl_check_pending(ssl)) {
+		IOT_WARN("Kernel TLS not used, data already buffered by mbedTLS");
+		return;
+	}
+
+	if(0 != setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"))) {
+		IOT_WARN("Kernel TLS not available, errno %d", errno);
+		return;
+	}
+
+	pClientKey = tlsDataParams->keyBlock;
+	pServerKey = pClientKey + keyLen;
+	pClientSalt = pServerKey + keyLen;
+	pServerSalt = pClientSalt + tlsDataParams->keyBlockIvLen;
+
+	/* Each direction falls back to mbedTLS on its own, it is only the kernel's once this succeeds */
+	tlsDataParams->isKernelRx = _iot_ktls_set_crypto_info(fd, TLS_RX, pServerKey, keyLen, pServerSalt, ssl->in_ctr);
+	tlsDataParams->isKernelTx = _iot_ktls_set_crypto_info(fd, TLS_TX, pClientKey, keyLen, pClientSalt, ssl->out_ctr);
+
+	/* The keys aren't needed here any more */
+	memset(tlsDataParams->keyBlock, 0, sizeof(tlsDataParams->keyBlock));
+	tlsDataParams->isKeyBlockSaved = false;
+
+	if(tlsDataParams->isKernelRx) {
+		pNetwork->read = _iot_ktls_read;
+		pNetwork->readAvailable = _iot_ktls_read_available;
+	}
+	if(tlsDataParams->isKernelTx) {
+		pNetwork->write = _iot_ktls_write;
+		pNetwork->writev = _iot_ktls_writev;
+		pNetwork->disconnect = _iot_ktls_disconnect;
+	}
+
+	IOT_DEBUG("Kernel TLS rx %d tx %d for %s", tlsDataParams->isKernelRx, tlsDataParams->isKernelTx, pCiphersuite);
+}
+
+void iot_ktls_detach(Network *pNetwork) {
+	pNetwork->tlsDataParams.isKernelTx = false;
+	pNetwork->tlsDataParams.isKernelRx = false;
+	pNetwork->read = iot_tls_read;
+	pNetwork->readAvailable = iot_tls_read_available;
+	pNetwork->write = iot_tls_write;
+	pNetwork->writev = iot_tls_writev;
+	pNetwork->disconnect = iot_tls_disconnect;
+}
+
+#endif /* _ENABLE_KTLS_SUPPORT_ */
+
+#ifdef __cplusplus
+}
+#endif
@@ -19,6 +19,13 @@ extern "C" {
 
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <timer_platform.h>
 #include <network_interface.h>
 
@@ -31,6 +38,46 @@ extern "C" {
 /* This is the value used for ssl read timeout */
 #define IOT_SSL_READ_TIMEOUT 10
 
+/* This is how long a resolved endpoint address is used before resolving it again */
+#ifndef IOT_TLS_DNS_CACHE_TTL_SEC
+#define IOT_TLS_DNS_CACHE_TTL_SEC 300
+#endif
+
+/* This is how long a connect attempt has before the next address is raced alongside it */
+#ifndef IOT_TLS_CONNECT_ATTEMPT_DELAY_MS
+#define IOT_TLS_CONNECT_ATTEMPT_DELAY_MS 250
+#endif
+
+/* This is the most endpoint addresses tried for one connect */
+#ifndef IOT_TLS_MAX_CONNECT_ADDRESSES
+#define IOT_TLS_MAX_CONNECT_ADDRESSES 8
+#endif
+
+/* This is the largest TLS record asked of the broker unless iot_tls_set_max_fragment_len
+ * says otherwise, 0 to not use the max_fragment_length extension */
+#ifndef IOT_TLS_MAX_FRAGMENT_LEN
+#define IOT_TLS_MAX_FRAGMENT_LEN 0
+#endif
+
+#if defined(MBEDTLS_SSL_IN_CONTENT_LEN)
+#define IOT_TLS_IN_CONTENT_LEN MBEDTLS_SSL_IN_CONTENT_LEN
+#define IOT_TLS_OUT_CONTENT_LEN MBEDTLS_SSL_OUT_CONTENT_LEN
+#else
+#define IOT_TLS_IN_CONTENT_LEN MBEDTLS_SSL_MAX_CONTENT_LEN
+#define IOT_TLS_OUT_CONTENT_LEN MBEDTLS_SSL_MAX_CONTENT_LEN
+#endif
+
+#if IOT_TLS_MAX_FRAGMENT_LEN != 0 && IOT_TLS_MAX_FRAGMENT_LEN != 512 && IOT_TLS_MAX_FRAGMENT_LEN != 1024 && \
+	IOT_TLS_MAX_FRAGMENT_LEN != 2048 && IOT_TLS_MAX_FRAGMENT_LEN != 4096
+#error "IOT_TLS_MAX_FRAGMENT_LEN must be 0, 512, 1024, 2048 or 4096"
+#elif IOT_TLS_MAX_FRAGMENT_LEN > IOT_TLS_IN_CONTENT_LEN
+#error "IOT_TLS_MAX_FRAGMENT_LEN is larger than the mbedTLS input buffer"
+#endif
+
+/* This is what mbedTLS adds around the content of each record buffer:
+ * header, IV, MAC and padding at their largest */
+#define IOT_TLS_RECORD_OVERHEAD (13 + 16 + 48 + 256)
+
 /* This defines the value of the debug buffer that gets allocated.
  * The value can be altered based on memory constraints
  */
@@ -80,97 +127,579 @@ IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDevice
 
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->read = iot_tls_read;
+	pNetwork->readAvailable = iot_tls_read_available;
 	pNetwork->write = iot_tls_write;
+	pNetwork->writev = iot_tls_writev;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
+	pNetwork->getSocket = iot_tls_get_socket;
+
+	pNetwork->tlsConnectParams.pRootCABuffer = NULL;
+	pNetwork->tlsConnectParams.rootCABufferLen = 0;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = NULL;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = 0;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = NULL;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = 0;
+	pNetwork->tlsConnectParams.isNonBlocking = false;
+	pNetwork->tlsConnectParams.isKernelTLS = false;
+	pNetwork->tlsConnectParams.maxFragmentLen = IOT_TLS_MAX_FRAGMENT_LEN;
 
 	pNetwork->tlsDataParams.flags = 0;
+	mbedtls_net_init(&(pNetwork->tlsDataParams.server_fd));
+	mbedtls_ssl_init(&(pNetwork->tlsDataParams.ssl));
+	mbedtls_ssl_session_init(&(pNetwork->tlsDataParams.savedSession));
+	pNetwork->tlsDataParams.isSessionSaved = false;
+	pNetwork->tlsDataParams.isSetupCached = false;
+	pNetwork->tlsDataParams.cachedAddrLen = 0;
+	init_timer(&(pNetwork->tlsDataParams.cachedAddrTimer));
 
 	return SUCCESS;
 }
 
-IoT_Error_t iot_tls_is_connected(Network *pNetwork) {
-	/* Use this to add implementation which can check for physical layer disconnect */
-	return NETWORK_PHYSICAL_LAYER_CONNECTED;
+/*
+ * Free the DRBG, certificates and key kept across connects
+ */
+static void _iot_tls_free_setup(TLSDataParams *tlsDataParams) {
+	if(tlsDataParams->isSetupCached) {
+		mbedtls_x509_crt_free(&(tlsDataParams->clicert));
+		mbedtls_x509_crt_free(&(tlsDataParams->cacert));
+		mbedtls_pk_free(&(tlsDataParams->pkey));
+		mbedtls_ctr_drbg_free(&(tlsDataParams->ctr_drbg));
+		mbedtls_entropy_free(&(tlsDataParams->entropy));
+		tlsDataParams->isSetupCached = false;
+	}
 }
 
-IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
-	int ret = 0;
-	const char *pers = "aws_iot_tls_wrapper";
-	TLSDataParams *tlsDataParams = NULL;
-	char portBuffer[6];
-	char vrfy_buf[512];
-	const char *alpnProtocols[] = { "x-amzn-mqtt-ca", NULL };
+IoT_Error_t iot_tls_set_credential_buffers(Network *pNetwork, const unsigned char *pRootCABuffer,
+										   size_t rootCABufferLen, const unsigned char *pDeviceCertBuffer,
+										   size_t deviceCertBufferLen, const unsigned char *pDevicePrivateKeyBuffer,
+										   size_t devicePrivateKeyBufferLen) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
 
-#ifdef ENABLE_IOT_DEBUG
-	unsigned char buf[MBEDTLS_DEBUG_BUFFER_SIZE];
+	pNetwork->tlsConnectParams.pRootCABuffer = pRootCABuffer;
+	pNetwork->tlsConnectParams.rootCABufferLen = rootCABufferLen;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = pDeviceCertBuffer;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = deviceCertBufferLen;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = pDevicePrivateKeyBuffer;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = devicePrivateKeyBufferLen;
+
+	/* Loaded again on the next connect */
+	_iot_tls_free_setup(&(pNetwork->tlsDataParams));
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_nonblocking(Network *pNetwork, bool isNonBlocking) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pNetwork->tlsConnectParams.isNonBlocking = isNonBlocking;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_kernel_tls(Network *pNetwork, bool isKernelTLS) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+#ifndef _ENABLE_KTLS_SUPPORT_
+	if(isKernelTLS) {
+		return FAILURE;
+	}
+#endif
+
+	pNetwork->tlsConnectParams.isKernelTLS = isKernelTLS;
+
+	return SUCCESS;
+}
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+/*
+ * Map a record length to its max_fragment_length code, false if there is none
+ */
+static bool _iot_tls_max_fragment_len_code(uint16_t maxFragmentLen, unsigned char *pCode) {
+	switch(maxFragmentLen) {
+		case 512:
+			*pCode = MBEDTLS_SSL_MAX_FRAG_LEN_512;
+			return true;
+		case 1024:
+			*pCode = MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+			return true;
+		case 2048:
+			*pCode = MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+			return true;
+		case 4096:
+			*pCode = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+			return true;
+		default:
+			return false;
+	}
+}
 #endif
 
+IoT_Error_t iot_tls_set_max_fragment_len(Network *pNetwork, uint16_t maxFragmentLen) {
 	if(NULL == pNetwork) {
 		return NULL_VALUE_ERROR;
 	}
 
-	if(NULL != params) {
-		_iot_tls_set_connect_params(pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
-									params->pDevicePrivateKeyLocation, params->pDestinationURL,
-									params->DestinationPort, params->timeout_ms, params->ServerVerificationFlag);
+	if(0 != maxFragmentLen) {
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+		unsigned char code;
+
+		if(!_iot_tls_max_fragment_len_code(maxFragmentLen, &code) || maxFragmentLen > IOT_TLS_IN_CONTENT_LEN) {
+			return FAILURE;
+		}
+#else
+		return FAILURE;
+#endif
+	}
+
+	pNetwork->tlsConnectParams.maxFragmentLen = maxFragmentLen;
+
+	return SUCCESS;
+}
+
+/*
+ * Bytes held by a certificate chain, the DER of each certificate is kept
+ */
+static size_t _iot_tls_crt_chain_len(const mbedtls_x509_crt *pCrt) {
+	size_t len = 0;
+
+	for(; NULL != pCrt; pCrt = pCrt->next) {
+		len += pCrt->raw.len;
+	}
+
+	return len;
+}
+
+size_t iot_tls_get_memory_usage(Network *pNetwork) {
+	TLSDataParams *tlsDataParams;
+	size_t bytes = 0;
+
+	if(NULL == pNetwork) {
+		return 0;
 	}
 
 	tlsDataParams = &(pNetwork->tlsDataParams);
 
-	mbedtls_net_init(&(tlsDataParams->server_fd));
-	mbedtls_ssl_init(&(tlsDataParams->ssl));
-	mbedtls_ssl_config_init(&(tlsDataParams->conf));
+	/* Record buffers exist from mbedtls_ssl_setup until destroy */
+	if(NULL != tlsDataParams->ssl.conf) {
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+		bytes += tlsDataParams->ssl.in_buf_len + tlsDataParams->ssl.out_buf_len;
+#else
+		bytes += IOT_TLS_IN_CONTENT_LEN + IOT_TLS_OUT_CONTENT_LEN + 2 * IOT_TLS_RECORD_OVERHEAD;
+#endif
+	}
+
+	if(tlsDataParams->isSetupCached) {
+		bytes += _iot_tls_crt_chain_len(&(tlsDataParams->cacert));
+		bytes += _iot_tls_crt_chain_len(&(tlsDataParams->clicert));
+	}
+
+	return bytes;
+}
+
+IoT_Error_t iot_tls_get_socket(Network *pNetwork, int *pSocket) {
+	if(NULL == pNetwork || NULL == pSocket) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(pNetwork->tlsDataParams.server_fd.fd < 0) {
+		return NETWORK_DISCONNECTED_ERROR;
+	}
+
+	*pSocket = pNetwork->tlsDataParams.server_fd.fd;
+
+	return SUCCESS;
+}
+
+/*
+ * Wait, at most until the timer expires, for the socket to be ready for what mbedTLS asked for
+ */
+static void _iot_tls_wait_for_socket(Network *pNetwork, int sslRet, Timer *timer) {
+	struct pollfd pfd;
+
+	pfd.fd = pNetwork->tlsDataParams.server_fd.fd;
+	pfd.events = (MBEDTLS_ERR_SSL_WANT_READ == sslRet) ? POLLIN : POLLOUT;
+	pfd.revents = 0;
+
+	(void) poll(&pfd, 1, (int) left_ms(timer));
+}
+
+/*
+ * Seed the DRBG and load the certificates and key, from memory if they were given that way
+ */
+static IoT_Error_t _iot_tls_load_setup(Network *pNetwork) {
+	int ret = 0;
+	const char *pers = "aws_iot_tls_wrapper";
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	TLSConnectParams *tlsConnectParams = &(pNetwork->tlsConnectParams);
+
 	mbedtls_ctr_drbg_init(&(tlsDataParams->ctr_drbg));
 	mbedtls_x509_crt_init(&(tlsDataParams->cacert));
 	mbedtls_x509_crt_init(&(tlsDataParams->clicert));
 	mbedtls_pk_init(&(tlsDataParams->pkey));
+	mbedtls_entropy_init(&(tlsDataParams->entropy));
+
+	/* Everything above is safe to free from here on */
+	tlsDataParams->isSetupCached = true;
 
 	IOT_DEBUG("\n  . Seeding the random number generator...");
-	mbedtls_entropy_init(&(tlsDataParams->entropy));
 	if((ret = mbedtls_ctr_drbg_seed(&(tlsDataParams->ctr_drbg), mbedtls_entropy_func, &(tlsDataParams->entropy),
 									(const unsigned char *) pers, strlen(pers))) != 0) {
 		IOT_ERROR(" failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret);
+		_iot_tls_free_setup(tlsDataParams);
 		return NETWORK_MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
 	}
 
 	IOT_DEBUG("  . Loading the CA root certificate ...");
-	ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->cacert), pNetwork->tlsConnectParams.pRootCALocation);
+	if(NULL != tlsConnectParams->pRootCABuffer) {
+		ret = mbedtls_x509_crt_parse(&(tlsDataParams->cacert), tlsConnectParams->pRootCABuffer,
+									 tlsConnectParams->rootCABufferLen);
+	} else {
+		ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->cacert), tlsConnectParams->pRootCALocation);
+	}
 	if(ret < 0) {
 		IOT_ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x while parsing root cert\n\n", -ret);
+		_iot_tls_free_setup(tlsDataParams);
 		return NETWORK_X509_ROOT_CRT_PARSE_ERROR;
 	}
 	IOT_DEBUG(" ok (%d skipped)\n", ret);
 
 	IOT_DEBUG("  . Loading the client cert. and key...");
-	ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->clicert), pNetwork->tlsConnectParams.pDeviceCertLocation);
+	if(NULL != tlsConnectParams->pDeviceCertBuffer) {
+		ret = mbedtls_x509_crt_parse(&(tlsDataParams->clicert), tlsConnectParams->pDeviceCertBuffer,
+									 tlsConnectParams->deviceCertBufferLen);
+	} else {
+		ret = mbedtls_x509_crt_parse_file(&(tlsDataParams->clicert), tlsConnectParams->pDeviceCertLocation);
+	}
 	if(ret != 0) {
 		IOT_ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x while parsing device cert\n\n", -ret);
+		_iot_tls_free_setup(tlsDataParams);
 		return NETWORK_X509_DEVICE_CRT_PARSE_ERROR;
 	}
 
-	ret = mbedtls_pk_parse_keyfile(&(tlsDataParams->pkey), pNetwork->tlsConnectParams.pDevicePrivateKeyLocation, "");
+	if(NULL != tlsConnectParams->pDevicePrivateKeyBuffer) {
+		ret = mbedtls_pk_parse_key(&(tlsDataParams->pkey), tlsConnectParams->pDevicePrivateKeyBuffer,
+								   tlsConnectParams->devicePrivateKeyBufferLen, NULL, 0);
+	} else {
+		ret = mbedtls_pk_parse_keyfile(&(tlsDataParams->pkey), tlsConnectParams->pDevicePrivateKeyLocation, "");
+	}
 	if(ret != 0) {
 		IOT_ERROR(" failed\n  !  mbedtls_pk_parse_key returned -0x%x while parsing private key\n\n", -ret);
-		IOT_DEBUG(" path : %s ", pNetwork->tlsConnectParams.pDevicePrivateKeyLocation);
+		IOT_DEBUG(" path : %s ", tlsConnectParams->pDevicePrivateKeyLocation);
+		_iot_tls_free_setup(tlsDataParams);
 		return NETWORK_PK_PRIVATE_KEY_PARSE_ERROR;
 	}
 	IOT_DEBUG(" ok\n");
+
+	return SUCCESS;
+}
+
+/*
+ * Start a non-blocking connect to one address. The socket is returned in *pFd unless it
+ * failed straight away, which is -1. 1 if it is already connected, 0 if it is in progress
+ */
+static int _iot_tls_start_connect(const struct sockaddr *pAddr, socklen_t addrLen, int *pFd) {
+	int fd, flags;
+
+	*pFd = -1;
+
+	fd = socket(pAddr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if(fd < 0) {
+		return -1;
+	}
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*pFd = fd;
+	if(connect(fd, pAddr, addrLen) == 0) {
+		return 1;
+	}
+	if(EINPROGRESS != errno) {
+		close(fd);
+		*pFd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Is addrs[0..count) already holding this address
+ */
+static bool _iot_tls_is_address_listed(const struct sockaddr_storage *pAddrs, const socklen_t *pAddrLens,
+									   size_t count, const struct sockaddr *pAddr, socklen_t addrLen) {
+	size_t i;
+
+	for(i = 0; i < count; i++) {
+		if(pAddrLens[i] == addrLen && 0 == memcmp(&pAddrs[i], pAddr, addrLen)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Resolve the endpoint and append its addresses to addrs, alternating between the family
+ * getaddrinfo put first and the other one, so a broken IPv6 or IPv4 path costs at most
+ * every other attempt. Returns the new count
+ */
+static size_t _iot_tls_resolve(Network *pNetwork, const char *pPort, struct sockaddr_storage *pAddrs,
+							   socklen_t *pAddrLens, size_t count) {
+	struct addrinfo hints, *addrList, *cur, *pNext[2];
+	size_t turn;
+	int family;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	if(getaddrinfo(pNetwork->tlsConnectParams.pDestinationURL, pPort, &hints, &addrList) != 0) {
+		return count;
+	}
+
+	family = addrList->ai_family;
+	pNext[0] = addrList;
+	pNext[1] = addrList;
+	turn = 0;
+	while(count < IOT_TLS_MAX_CONNECT_ADDRESSES && (NULL != pNext[0] || NULL != pNext[1])) {
+		/* Turn 0 takes the first family, turn 1 anything else */
+		while(NULL != pNext[turn] && (0 == turn) != (family == pNext[turn]->ai_family)) {
+			pNext[turn] = pNext[turn]->ai_next;
+		}
+		if(NULL != pNext[turn]) {
+			cur = pNext[turn];
+			pNext[turn] = cur->ai_next;
+			if(cur->ai_addrlen <= sizeof(struct sockaddr_storage) &&
+			   !_iot_tls_is_address_listed(pAddrs, pAddrLens, count, cur->ai_addr, cur->ai_addrlen)) {
+				memcpy(&pAddrs[count], cur->ai_addr, cur->ai_addrlen);
+				pAddrLens[count] = cur->ai_addrlen;
+				count++;
+			}
+		}
+		turn ^= 1;
+	}
+
+	freeaddrinfo(addrList);
+
+	return count;
+}
+
+/*
+ * Open the TCP connection to the endpoint, from the cached address while it is fresh.
+ *
+ * Addresses are raced rather than tried one after the other: a new attempt starts every
+ * IOT_TLS_CONNECT_ATTEMPT_DELAY_MS, or as soon as one fails, while the earlier ones keep
+ * going. The first to connect wins and the others are closed, so an address that doesn't
+ * answer costs one attempt delay rather than a TCP timeout. A cached address that hasn't
+ * connected within the attempt delay gets the resolved addresses raced alongside it.
+ */
+static IoT_Error_t _iot_tls_net_connect(Network *pNetwork, const char *pPort, Timer *timer) {
+	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
+	struct sockaddr_storage addrs[IOT_TLS_MAX_CONNECT_ADDRESSES];
+	socklen_t addrLens[IOT_TLS_MAX_CONNECT_ADDRESSES];
+	struct pollfd pfds[IOT_TLS_MAX_CONNECT_ADDRESSES];
+	size_t pfdAddr[IOT_TLS_MAX_CONNECT_ADDRESSES];
+	size_t count, next, inFlight, i, winner;
+	bool isResolved;
+	Timer attemptTimer;
+	uint32_t waitMs;
+	int fd, ret, err;
+	socklen_t errLen;
+
+	count = 0;
+	next = 0;
+	inFlight = 0;
+	winner = IOT_TLS_MAX_CONNECT_ADDRESSES;
+	fd = -1;
+	isResolved = false;
+	init_timer(&attemptTimer);
+
+	if(0 != tlsDataParams->cachedAddrLen && !has_timer_expired(&(tlsDataParams->cachedAddrTimer))) {
+		memcpy(&addrs[0], &(tlsDataParams->cachedAddr), tlsDataParams->cachedAddrLen);
+		addrLens[0] = tlsDataParams->cachedAddrLen;
+		count = 1;
+	} else {
+		count = _iot_tls_resolve(pNetwork, pPort, addrs, addrLens, 0);
+		isResolved = true;
+		if(0 == count) {
+			tlsDataParams->cachedAddrLen = 0;
+			return NETWORK_ERR_NET_UNKNOWN_HOST;
+		}
+	}
+
+	while(IOT_TLS_MAX_CONNECT_ADDRESSES == winner && !has_timer_expired(timer)) {
+		/* Time for another attempt? */
+		if(0 == inFlight || has_timer_expired(&attemptTimer)) {
+			if(next == count && !isResolved) {
+				/* The cached address is slow or gone, bring in the others */
+				count = _iot_tls_resolve(pNetwork, pPort, addrs, addrLens, count);
+				isResolved = true;
+			}
+			if(next < count) {
+				ret = _iot_tls_start_connect((struct sockaddr *) &addrs[next], addrLens[next], &fd);
+				if(1 == ret) {
+					winner = next;
+					break;
+				}
+				if(0 == ret) {
+					pfds[inFlight].fd = fd;
+					pfds[inFlight].events = POLLOUT;
+					pfds[inFlight].revents = 0;
+					pfdAddr[inFlight] = next;
+					inFlight++;
+					countdown_ms(&attemptTimer, IOT_TLS_CONNECT_ATTEMPT_DELAY_MS);
+				}
+				fd = -1;
+				next++;
+				continue;
+			}
+		}
+
+		if(0 == inFlight) {
+			/* Every address failed */
+			break;
+		}
+
+		waitMs = left_ms(timer);
+		if((next < count || !isResolved) && left_ms(&attemptTimer) < waitMs) {
+			waitMs = left_ms(&attemptTimer);
+		}
+		if(poll(pfds, inFlight, (int) waitMs) < 0 && EINTR != errno) {
+			break;
+		}
+
+		for(i = 0; i < inFlight;) {
+			if(0 == pfds[i].revents) {
+				i++;
+				continue;
+			}
+			err = 0;
+			errLen = sizeof(err);
+			if(getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &errLen) == 0 && 0 == err) {
+				fd = pfds[i].fd;
+				winner = pfdAddr[i];
+				pfds[i] = pfds[inFlight - 1];
+				inFlight--;
+				break;
+			}
+			/* Refused or unreachable, the next address doesn't have to wait its turn */
+			close(pfds[i].fd);
+			pfds[i] = pfds[inFlight - 1];
+			pfdAddr[i] = pfdAddr[inFlight - 1];
+			inFlight--;
+			init_timer(&attemptTimer);
+		}
+	}
+
+	/* The losers */
+	for(i = 0; i < inFlight; i++) {
+		close(pfds[i].fd);
+	}
+
+	if(IOT_TLS_MAX_CONNECT_ADDRESSES == winner) {
+		tlsDataParams->cachedAddrLen = 0;
+		return has_timer_expired(timer) ? NETWORK_SSL_CONNECT_TIMEOUT_ERROR : NETWORK_ERR_NET_CONNECT_FAILED;
+	}
+
+	if(0 != winner || isResolved) {
+		memcpy(&(tlsDataParams->cachedAddr), &addrs[winner], addrLens[winner]);
+		tlsDataParams->cachedAddrLen = addrLens[winner];
+		countdown_sec(&(tlsDataParams->cachedAddrTimer), IOT_TLS_DNS_CACHE_TTL_SEC);
+	}
+	tlsDataParams->server_fd.fd = fd;
+
+	return SUCCESS;
+}
+
+/*
+ * Drop the saved session, the next handshake is a full one
+ */
+static void _iot_tls_forget_session(TLSDataParams *tlsDataParams) {
+	if(tlsDataParams->isSessionSaved) {
+		mbedtls_ssl_session_free(&(tlsDataParams->savedSession));
+		mbedtls_ssl_session_init(&(tlsDataParams->savedSession));
+		tlsDataParams->isSessionSaved = false;
+	}
+}
+
+IoT_Error_t iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return NETWORK_PHYSICAL_LAYER_CONNECTED;
+}
+
+IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
+	int ret = 0;
+	TLSDataParams *tlsDataParams = NULL;
+	char portBuffer[6];
+	char vrfy_buf[512];
+	const char *alpnProtocols[] = { "x-amzn-mqtt-ca", NULL };
+	Timer connectTimer;
+
+#ifdef ENABLE_IOT_DEBUG
+	unsigned char buf[MBEDTLS_DEBUG_BUFFER_SIZE];
+#endif
+
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(NULL != params) {
+		/* A session and an address are only good for the endpoint they came from */
+		if(params->DestinationPort != pNetwork->tlsConnectParams.DestinationPort ||
+		   NULL == params->pDestinationURL || NULL == pNetwork->tlsConnectParams.pDestinationURL ||
+		   0 != strcmp(params->pDestinationURL, pNetwork->tlsConnectParams.pDestinationURL)) {
+			_iot_tls_forget_session(&(pNetwork->tlsDataParams));
+			pNetwork->tlsDataParams.cachedAddrLen = 0;
+		}
+		/* The credentials may have changed too, wherever they are kept */
+		_iot_tls_free_setup(&(pNetwork->tlsDataParams));
+		_iot_tls_set_connect_params(pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
+									params->pDevicePrivateKeyLocation, params->pDestinationURL,
+									params->DestinationPort, params->timeout_ms, params->ServerVerificationFlag);
+		pNetwork->tlsConnectParams.pRootCABuffer = params->pRootCABuffer;
+		pNetwork->tlsConnectParams.rootCABufferLen = params->rootCABufferLen;
+		pNetwork->tlsConnectParams.pDeviceCertBuffer = params->pDeviceCertBuffer;
+		pNetwork->tlsConnectParams.deviceCertBufferLen = params->deviceCertBufferLen;
+		pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = params->pDevicePrivateKeyBuffer;
+		pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = params->devicePrivateKeyBufferLen;
+	}
+
+	tlsDataParams = &(pNetwork->tlsDataParams);
+
+	mbedtls_net_init(&(tlsDataParams->server_fd));
+	mbedtls_ssl_init(&(tlsDataParams->ssl));
+	mbedtls_ssl_config_init(&(tlsDataParams->conf));
+
+	/* Only the first connect pays for seeding and parsing */
+	if(!tlsDataParams->isSetupCached) {
+		ret = _iot_tls_load_setup(pNetwork);
+		if(SUCCESS != ret) {
+			return (IoT_Error_t) ret;
+		}
+	}
+
 	snprintf(portBuffer, 6, "%d", pNetwork->tlsConnectParams.DestinationPort);
 	IOT_DEBUG("  . Connecting to %s/%s...", pNetwork->tlsConnectParams.pDestinationURL, portBuffer);
-	if((ret = mbedtls_net_connect(&(tlsDataParams->server_fd), pNetwork->tlsConnectParams.pDestinationURL,
-								  portBuffer, MBEDTLS_NET_PROTO_TCP)) != 0) {
-		IOT_ERROR(" failed\n  ! mbedtls_net_connect returned -0x%x\n\n", -ret);
-		switch(ret) {
-			case MBEDTLS_ERR_NET_SOCKET_FAILED:
-				return NETWORK_ERR_NET_SOCKET_FAILED;
-			case MBEDTLS_ERR_NET_UNKNOWN_HOST:
-				return NETWORK_ERR_NET_UNKNOWN_HOST;
-			case MBEDTLS_ERR_NET_CONNECT_FAILED:
-			default:
-				return NETWORK_ERR_NET_CONNECT_FAILED;
-		};
+	init_timer(&connectTimer);
+	countdown_ms(&connectTimer, pNetwork->tlsConnectParams.timeout_ms);
+	ret = _iot_tls_net_connect(pNetwork, portBuffer, &connectTimer);
+	if(SUCCESS != ret) {
+		IOT_ERROR(" failed\n  ! connecting to %s/%s returned %d\n\n", pNetwork->tlsConnectParams.pDestinationURL,
+				  portBuffer, ret);
+		return (IoT_Error_t) ret;
 	}
 
 	ret = mbedtls_net_set_block(&(tlsDataParams->server_fd));
@@ -203,6 +732,23 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 
 	mbedtls_ssl_conf_read_timeout(&(tlsDataParams->conf), pNetwork->tlsConnectParams.timeout_ms);
 
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+	if(0 != pNetwork->tlsConnectParams.maxFragmentLen) {
+		unsigned char mflCode = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+
+		(void) _iot_tls_max_fragment_len_code(pNetwork->tlsConnectParams.maxFragmentLen, &mflCode);
+		if((ret = mbedtls_ssl_conf_max_frag_len(&(tlsDataParams->conf), mflCode)) != 0) {
+			IOT_ERROR(" failed\n  ! mbedtls_ssl_conf_max_frag_len returned -0x%x\n\n", -ret);
+			return SSL_CONNECTION_ERROR;
+		}
+	}
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+	/* Without a ticket the broker can still resume from its session ID cache */
+	mbedtls_ssl_conf_session_tickets(&(tlsDataParams->conf), MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
 	/* Use the AWS IoT ALPN extension for MQTT if port 443 is requested. */
 	if(443 == pNetwork->tlsConnectParams.DestinationPort) {
 		if((ret = mbedtls_ssl_conf_alpn_protocols(&(tlsDataParams->conf), alpnProtocols)) != 0) {
@@ -211,6 +757,12 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 		}
 	}
 
+#ifdef _ENABLE_KTLS_SUPPORT_
+	if(pNetwork->tlsConnectParams.isKernelTLS) {
+		iot_ktls_prepare(pNetwork);
+	}
+#endif
+
 	/* Assign the resulting configuration to the SSL context. */
 	if((ret = mbedtls_ssl_setup(&(tlsDataParams->ssl), &(tlsDataParams->conf))) != 0) {
 		IOT_ERROR(" failed\n  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret);
@@ -220,6 +772,13 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 		IOT_ERROR(" failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret);
 		return SSL_CONNECTION_ERROR;
 	}
+	if(tlsDataParams->isSessionSaved) {
+		/* Offered only, a broker that doesn't know it any more answers with a full handshake */
+		if((ret = mbedtls_ssl_set_session(&(tlsDataParams->ssl), &(tlsDataParams->savedSession))) != 0) {
+			IOT_WARN(" mbedtls_ssl_set_session returned -0x%x, doing a full handshake\n", -ret);
+			_iot_tls_forget_session(tlsDataParams);
+		}
+	}
 	IOT_DEBUG("\n\nSSL state connect : %d ", tlsDataParams->ssl.state);
 	mbedtls_ssl_set_bio(&(tlsDataParams->ssl), &(tlsDataParams->server_fd), mbedtls_net_send, NULL,
 						mbedtls_net_recv_timeout);
@@ -230,6 +789,8 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 	while((ret = mbedtls_ssl_handshake(&(tlsDataParams->ssl))) != 0) {
 		if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
 			IOT_ERROR(" failed\n  ! mbedtls_ssl_handshake returned -0x%x\n", -ret);
+			/* Don't offer the same session to the next attempt */
+			_iot_tls_forget_session(tlsDataParams);
 			if(ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
 				IOT_ERROR("    Unable to verify the server's certificate. "
 							  "Either it is invalid,\n"
@@ -267,6 +828,17 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 		ret = SUCCESS;
 	}
 
+	if(SUCCESS == ret) {
+		/* Keep the session for the next reconnect, replacing the one it may have resumed */
+		if(0 != mbedtls_ssl_get_session(&(tlsDataParams->ssl), &(tlsDataParams->savedSession))) {
+			_iot_tls_forget_session(tlsDataParams);
+		} else {
+			tlsDataParams->isSessionSaved = true;
+		}
+	} else {
+		_iot_tls_forget_session(tlsDataParams);
+	}
+
 #ifdef ENABLE_IOT_DEBUG
 	if (mbedtls_ssl_get_peer_cert(&(tlsDataParams->ssl)) != NULL) {
 		IOT_DEBUG("  . Peer certificate information    ...\n");
@@ -277,6 +849,23 @@ IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
 
 	mbedtls_ssl_conf_read_timeout(&(tlsDataParams->conf), IOT_SSL_READ_TIMEOUT);
 
+	if(SUCCESS == ret && pNetwork->tlsConnectParams.isNonBlocking) {
+		/* From here on reads don't wait, not even the IOT_SSL_READ_TIMEOUT */
+		if(mbedtls_net_set_nonblock(&(tlsDataParams->server_fd)) != 0) {
+			IOT_ERROR(" failed\n  ! net_set_nonblock() failed\n\n");
+			return SSL_CONNECTION_ERROR;
+		}
+		mbedtls_ssl_set_bio(&(tlsDataParams->ssl), &(tlsDataParams->server_fd), mbedtls_net_send, mbedtls_net_recv,
+							NULL);
+	}
+
+#ifdef _ENABLE_KTLS_SUPPORT_
+	if(SUCCESS == ret && pNetwork->tlsConnectParams.isKernelTLS) {
+		/* Falls back to mbedTLS for any direction the kernel can't take */
+		iot_ktls_offload(pNetwork);
+	}
+#endif
+
 	return (IoT_Error_t) ret;
 }
 
@@ -298,6 +887,10 @@ IoT_Error_t iot_tls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Ti
 				isErrorFlag = true;
 				break;
 			}
+			if(pNetwork->tlsConnectParams.isNonBlocking) {
+				/* The socket is full, wait for room rather than spin */
+				_iot_tls_wait_for_socket(pNetwork, ret, timer);
+			}
 		}
 		if(isErrorFlag) {
 			break;
@@ -315,6 +908,30 @@ IoT_Error_t iot_tls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Ti
 	return SUCCESS;
 }
 
+IoT_Error_t iot_tls_writev(Network *pNetwork, const NetworkIOVec *pIov, size_t iovCount, Timer *timer,
+						   size_t *written_len) {
+	size_t i, written;
+	IoT_Error_t rc = SUCCESS;
+
+	*written_len = 0;
+
+	/* mbedTLS has no gather write, but each piece is encrypted straight from the
+	 * caller's memory. Every piece ends up in its own record(s). */
+	for(i = 0; i < iovCount; i++) {
+		if(0 == pIov[i].len) {
+			continue;
+		}
+		written = 0;
+		rc = iot_tls_write(pNetwork, (unsigned char *) pIov[i].pBase, pIov[i].len, timer, &written);
+		*written_len += written;
+		if(SUCCESS != rc || written != pIov[i].len) {
+			break;
+		}
+	}
+
+	return rc;
+}
+
 IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len) {
 	mbedtls_ssl_context *ssl = &(pNetwork->tlsDataParams.ssl);
 	size_t rxLen = 0;
@@ -329,6 +946,9 @@ IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Tim
 			len -= ret;
 		} else if (ret == 0 || (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_TIMEOUT)) {
 			return NETWORK_SSL_READ_ERROR;
+		} else if (pNetwork->tlsConnectParams.isNonBlocking) {
+			// Nothing more has arrived, the caller comes back for the rest
+			break;
 		}
 
 		// Evaluate timeout after the read to make sure read is done at least once
@@ -337,18 +957,57 @@ IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Tim
 		}
 	}
 
+	// Bytes read are handed over even when the rest is missing, they are gone from the TLS layer
+	*read_len = rxLen;
+
 	if (len == 0) {
-		*read_len = rxLen;
 		return SUCCESS;
 	}
 
-	if (rxLen == 0) {
+	if (rxLen == 0 || pNetwork->tlsConnectParams.isNonBlocking) {
 		return NETWORK_SSL_NOTHING_TO_READ;
 	} else {
 		return NETWORK_SSL_READ_TIMEOUT_ERROR;
 	}
 }
 
+IoT_Error_t iot_tls_read_available(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+								   size_t *read_len) {
+	mbedtls_ssl_context *ssl = &(pNetwork->tlsDataParams.ssl);
+	size_t rxLen = 0;
+	int ret;
+
+	while (len > 0) {
+		// This read will timeout after IOT_SSL_READ_TIMEOUT if there's no data to be read
+		ret = mbedtls_ssl_read(ssl, pMsg, len);
+		if (ret > 0) {
+			rxLen += ret;
+			pMsg += ret;
+			len -= ret;
+			// Whatever is left of the record is already decrypted, take it too but don't wait for more
+			if (0 == mbedtls_ssl_get_bytes_avail(ssl)) {
+				break;
+			}
+			continue;
+		} else if (ret == 0 || (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_TIMEOUT)) {
+			return NETWORK_SSL_READ_ERROR;
+		} else if (pNetwork->tlsConnectParams.isNonBlocking) {
+			break;
+		}
+
+		if (has_timer_expired(timer)) {
+			break;
+		}
+	}
+
+	if (rxLen == 0) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	}
+
+	*read_len = rxLen;
+	return SUCCESS;
+}
+
 IoT_Error_t iot_tls_disconnect(Network *pNetwork) {
 	mbedtls_ssl_context *ssl = &(pNetwork->tlsDataParams.ssl);
 	int ret = 0;
@@ -365,15 +1024,27 @@ IoT_Error_t iot_tls_disconnect(Network *pNetwork) {
 IoT_Error_t iot_tls_destroy(Network *pNetwork) {
 	TLSDataParams *tlsDataParams = &(pNetwork->tlsDataParams);
 
+#ifdef _ENABLE_KTLS_SUPPORT_
+	iot_ktls_detach(pNetwork);
+#endif
+
 	mbedtls_net_free(&(tlsDataParams->server_fd));
 
-	mbedtls_x509_crt_free(&(tlsDataParams->clicert));
-	mbedtls_x509_crt_free(&(tlsDataParams->cacert));
-	mbedtls_pk_free(&(tlsDataParams->pkey));
+	/* Certificates, key, DRBG, session and address stay for the next connect */
 	mbedtls_ssl_free(&(tlsDataParams->ssl));
 	mbedtls_ssl_config_free(&(tlsDataParams->conf));
-	mbedtls_ctr_drbg_free(&(tlsDataParams->ctr_drbg));
-	mbedtls_entropy_free(&(tlsDataParams->entropy));
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_free(Network *pNetwork) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	_iot_tls_free_setup(&(pNetwork->tlsDataParams));
+	_iot_tls_forget_session(&(pNetwork->tlsDataParams));
+	pNetwork->tlsDataParams.cachedAddrLen = 0;
 
 	return SUCCESS;
 }
@@ -15,6 +15,8 @@
 
 #ifndef IOTSDKC_NETWORK_MBEDTLS_PLATFORM_H_H
 
+#include <sys/socket.h>
+
 #include "mbedtls/config.h"
 
 #include "mbedtls/platform.h"
@@ -48,10 +50,32 @@ typedef struct _TLSDataParams {
 	mbedtls_x509_crt clicert;
 	mbedtls_pk_context pkey;
 	mbedtls_net_context server_fd;
+	mbedtls_ssl_session savedSession;    ///< Session of the last successful handshake, offered again on the next connect
+	bool isSessionSaved;                 ///< savedSession holds a session that can be resumed
+	bool isSetupCached;                  ///< DRBG, certificates and key are loaded and kept across connects
+	struct sockaddr_storage cachedAddr;  ///< Endpoint address that worked last
+	socklen_t cachedAddrLen;             ///< Length of cachedAddr, 0 when nothing is cached
+	Timer cachedAddrTimer;               ///< Expires when cachedAddr has to be resolved again
+#ifdef _ENABLE_KTLS_SUPPORT_
+	unsigned char keyBlock[2 * 32 + 2 * 4];    ///< Keys and implicit IVs of the last handshake, until the kernel has them
+	size_t keyBlockKeyLen;               ///< Length of each key in keyBlock
+	size_t keyBlockIvLen;                ///< Length of each implicit IV in keyBlock
+	bool isKeyBlockSaved;                ///< keyBlock is from the current handshake
+	bool isKernelTx;                     ///< Records sent are encrypted by the kernel
+	bool isKernelRx;                     ///< Records received are decrypted by the kernel
+#endif
 }TLSDataParams;
 
 #define IOTSDKC_NETWORK_MBEDTLS_PLATFORM_H_H
 
+#ifdef _ENABLE_KTLS_SUPPORT_
+/* Kernel TLS, see network_ktls_wrapper.c */
+struct Network;
+void iot_ktls_prepare(struct Network *pNetwork);
+void iot_ktls_offload(struct Network *pNetwork);
+void iot_ktls_detach(struct Network *pNetwork);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef IOTSDKC_NETWORK_TCP_PLATFORM_H_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The connection is plain TCP
+ *
+ * Certificates and key are not needed, the client doesn't ask for them.
+ * Only for local brokers and benchmarks, nothing sent is encrypted.
+ */
+#define IOT_NETWORK_PLAIN_TCP
+
+/**
+ * @brief TCP Connection Parameters
+ *
+ * Takes the place of the TLS parameters when the network is built from
+ * platform/linux/tcp instead of platform/linux/mbedtls.
+ */
+typedef struct _TLSDataParams {
+	int server_fd;    ///< Socket of the connection, -1 when there is none
+}TLSDataParams;
+
+#define IOTSDKC_NETWORK_TCP_PLATFORM_H_H
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IOTSDKC_NETWORK_TCP_PLATFORM_H_H
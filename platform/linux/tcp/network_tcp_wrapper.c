@@ -0,0 +1,442 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Plain TCP implementation of network_interface.h, for local brokers and for
+ * measuring the MQTT layer without the cost of TLS. Build it instead of
+ * platform/linux/mbedtls, with this directory on the include path and
+ * IOT_NETWORK_BACKEND_TCP defined. Without the define the file is empty, so
+ * it can sit in a source tree that builds another backend.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef IOT_NETWORK_BACKEND_TCP
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <timer_platform.h>
+
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+#include "network_platform.h"
+
+/* This is the most buffers handed to one sendmsg call */
+#ifndef IOT_TCP_MAX_IOV
+#define IOT_TCP_MAX_IOV 8
+#endif
+
+void _iot_tls_set_connect_params(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+								 char *pDevicePrivateKeyLocation, char *pDestinationURL,
+								 uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag) {
+	pNetwork->tlsConnectParams.DestinationPort = destinationPort;
+	pNetwork->tlsConnectParams.pDestinationURL = pDestinationURL;
+	pNetwork->tlsConnectParams.pDeviceCertLocation = pDeviceCertLocation;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyLocation = pDevicePrivateKeyLocation;
+	pNetwork->tlsConnectParams.pRootCALocation = pRootCALocation;
+	pNetwork->tlsConnectParams.timeout_ms = timeout_ms;
+	pNetwork->tlsConnectParams.ServerVerificationFlag = ServerVerificationFlag;
+}
+
+IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+						 char *pDevicePrivateKeyLocation, char *pDestinationURL,
+						 uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag) {
+	_iot_tls_set_connect_params(pNetwork, pRootCALocation, pDeviceCertLocation, pDevicePrivateKeyLocation,
+								pDestinationURL, destinationPort, timeout_ms, ServerVerificationFlag);
+
+	pNetwork->connect = iot_tls_connect;
+	pNetwork->read = iot_tls_read;
+	pNetwork->readAvailable = iot_tls_read_available;
+	pNetwork->write = iot_tls_write;
+	pNetwork->writev = iot_tls_writev;
+	pNetwork->disconnect = iot_tls_disconnect;
+	pNetwork->isConnected = iot_tls_is_connected;
+	pNetwork->destroy = iot_tls_destroy;
+	pNetwork->getSocket = iot_tls_get_socket;
+
+	pNetwork->tlsConnectParams.pRootCABuffer = NULL;
+	pNetwork->tlsConnectParams.rootCABufferLen = 0;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = NULL;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = 0;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = NULL;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = 0;
+	pNetwork->tlsConnectParams.isNonBlocking = false;
+	pNetwork->tlsConnectParams.isKernelTLS = false;
+	pNetwork->tlsConnectParams.maxFragmentLen = 0;
+
+	pNetwork->tlsDataParams.server_fd = -1;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_credential_buffers(Network *pNetwork, const unsigned char *pRootCABuffer,
+										   size_t rootCABufferLen, const unsigned char *pDeviceCertBuffer,
+										   size_t deviceCertBufferLen, const unsigned char *pDevicePrivateKeyBuffer,
+										   size_t devicePrivateKeyBufferLen) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Kept so the parameters look the same as with TLS, never used */
+	pNetwork->tlsConnectParams.pRootCABuffer = pRootCABuffer;
+	pNetwork->tlsConnectParams.rootCABufferLen = rootCABufferLen;
+	pNetwork->tlsConnectParams.pDeviceCertBuffer = pDeviceCertBuffer;
+	pNetwork->tlsConnectParams.deviceCertBufferLen = deviceCertBufferLen;
+	pNetwork->tlsConnectParams.pDevicePrivateKeyBuffer = pDevicePrivateKeyBuffer;
+	pNetwork->tlsConnectParams.devicePrivateKeyBufferLen = devicePrivateKeyBufferLen;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_nonblocking(Network *pNetwork, bool isNonBlocking) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pNetwork->tlsConnectParams.isNonBlocking = isNonBlocking;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_kernel_tls(Network *pNetwork, bool isKernelTLS) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* There are no records to hand over */
+	if(isKernelTLS) {
+		return FAILURE;
+	}
+
+	pNetwork->tlsConnectParams.isKernelTLS = false;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_set_max_fragment_len(Network *pNetwork, uint16_t maxFragmentLen) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* There are no records to make smaller */
+	if(0 != maxFragmentLen) {
+		return FAILURE;
+	}
+
+	pNetwork->tlsConnectParams.maxFragmentLen = 0;
+
+	return SUCCESS;
+}
+
+size_t iot_tls_get_memory_usage(Network *pNetwork) {
+	/* Only the kernel socket buffers, which are not ours to count */
+	return 0;
+}
+
+IoT_Error_t iot_tls_get_socket(Network *pNetwork, int *pSocket) {
+	if(NULL == pNetwork || NULL == pSocket) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(pNetwork->tlsDataParams.server_fd < 0) {
+		return NETWORK_DISCONNECTED_ERROR;
+	}
+
+	*pSocket = pNetwork->tlsDataParams.server_fd;
+
+	return SUCCESS;
+}
+
+/*
+ * Wait, at most until the timer expires, for the socket to be readable or writable
+ */
+static bool _iot_tcp_wait_for_socket(int fd, short events, Timer *timer) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, (int) left_ms(timer)) > 0;
+}
+
+/*
+ * Open a non-blocking TCP socket to one address, -1 if that fails before the timer expires
+ */
+static int _iot_tcp_open_socket(const struct sockaddr *pAddr, socklen_t addrLen, Timer *timer) {
+	int fd, flags, err = 0;
+	int noDelay = 1;
+	socklen_t errLen = sizeof(err);
+
+	fd = socket(pAddr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if(fd < 0) {
+		return -1;
+	}
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if(connect(fd, pAddr, addrLen) != 0) {
+		if(EINPROGRESS != errno || !_iot_tcp_wait_for_socket(fd, POLLOUT, timer) ||
+		   getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen) != 0 || 0 != err) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	/* MQTT packets are small and already written whole, don't hold them back */
+	(void) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	return fd;
+}
+
+IoT_Error_t iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return NETWORK_PHYSICAL_LAYER_CONNECTED;
+}
+
+IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params) {
+	struct addrinfo hints, *addrList, *cur;
+	char portBuffer[6];
+	IoT_Error_t rc = NETWORK_ERR_NET_UNKNOWN_HOST;
+	Timer timer;
+	int fd;
+
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(NULL != params) {
+		_iot_tls_set_connect_params(pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
+									params->pDevicePrivateKeyLocation, params->pDestinationURL,
+									params->DestinationPort, params->timeout_ms, params->ServerVerificationFlag);
+	}
+
+	if(pNetwork->tlsDataParams.server_fd >= 0) {
+		close(pNetwork->tlsDataParams.server_fd);
+		pNetwork->tlsDataParams.server_fd = -1;
+	}
+
+	init_timer(&timer);
+	countdown_ms(&timer, pNetwork->tlsConnectParams.timeout_ms);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	snprintf(portBuffer, 6, "%d", pNetwork->tlsConnectParams.DestinationPort);
+	IOT_DEBUG("  . Connecting to %s/%s...", pNetwork->tlsConnectParams.pDestinationURL, portBuffer);
+	if(getaddrinfo(pNetwork->tlsConnectParams.pDestinationURL, portBuffer, &hints, &addrList) != 0) {
+		IOT_ERROR(" failed\n  ! unknown host %s\n\n", pNetwork->tlsConnectParams.pDestinationURL);
+		return NETWORK_ERR_NET_UNKNOWN_HOST;
+	}
+
+	for(cur = addrList; NULL != cur; cur = cur->ai_next) {
+		fd = _iot_tcp_open_socket(cur->ai_addr, cur->ai_addrlen, &timer);
+		if(fd >= 0) {
+			pNetwork->tlsDataParams.server_fd = fd;
+			rc = SUCCESS;
+			break;
+		}
+		rc = NETWORK_ERR_NET_CONNECT_FAILED;
+		if(has_timer_expired(&timer)) {
+			rc = NETWORK_SSL_CONNECT_TIMEOUT_ERROR;
+			break;
+		}
+	}
+
+	freeaddrinfo(addrList);
+
+	if(SUCCESS != rc) {
+		IOT_ERROR(" failed\n  ! connecting to %s/%s returned %d\n\n", pNetwork->tlsConnectParams.pDestinationURL,
+				  portBuffer, rc);
+		return rc;
+	}
+	IOT_DEBUG(" ok\n");
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_writev(Network *pNetwork, const NetworkIOVec *pIov, size_t iovCount, Timer *timer,
+						   size_t *written_len) {
+	int fd = pNetwork->tlsDataParams.server_fd;
+	struct iovec iov[IOT_TCP_MAX_IOV];
+	struct msghdr msg;
+	size_t i, first, skip, count;
+	size_t written_so_far = 0;
+	size_t total = 0;
+	ssize_t ret;
+
+	for(i = 0; i < iovCount; i++) {
+		total += pIov[i].len;
+	}
+
+	while(written_so_far < total) {
+		/* Pick up where the last partial send stopped */
+		skip = written_so_far;
+		for(first = 0; skip >= pIov[first].len; first++) {
+			skip -= pIov[first].len;
+		}
+		for(count = 0; first + count < iovCount && count < IOT_TCP_MAX_IOV; count++) {
+			iov[count].iov_base = (unsigned char *) pIov[first + count].pBase + skip;
+			iov[count].iov_len = pIov[first + count].len - skip;
+			skip = 0;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if(ret > 0) {
+			written_so_far += (size_t) ret;
+			continue;
+		}
+		if(ret < 0 && EINTR == errno) {
+			continue;
+		}
+		if(ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			/* The socket is full, wait for room rather than spin */
+			if(!has_timer_expired(timer) && _iot_tcp_wait_for_socket(fd, POLLOUT, timer)) {
+				continue;
+			}
+			*written_len = written_so_far;
+			return NETWORK_SSL_WRITE_TIMEOUT_ERROR;
+		}
+		IOT_ERROR(" failed\n  ! sendmsg returned %d\n\n", errno);
+		*written_len = written_so_far;
+		return NETWORK_SSL_WRITE_ERROR;
+	}
+
+	*written_len = written_so_far;
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *written_len) {
+	NetworkIOVec iov;
+
+	iov.pBase = pMsg;
+	iov.len = len;
+
+	return iot_tls_writev(pNetwork, &iov, 1, timer, written_len);
+}
+
+/*
+ * Read into pMsg until it is full or the timer expires, or only what has arrived
+ */
+static IoT_Error_t _iot_tcp_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+								 size_t *read_len, bool isAvailableOnly) {
+	int fd = pNetwork->tlsDataParams.server_fd;
+	size_t rxLen = 0;
+	ssize_t ret;
+
+	while(len > 0) {
+		ret = recv(fd, pMsg, len, 0);
+		if(ret > 0) {
+			rxLen += (size_t) ret;
+			pMsg += ret;
+			len -= (size_t) ret;
+			if(isAvailableOnly) {
+				break;
+			}
+			continue;
+		} else if(0 == ret || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+			/* Closed by the broker, or reset */
+			*read_len = rxLen;
+			return NETWORK_SSL_READ_ERROR;
+		} else if(EINTR == errno) {
+			continue;
+		} else if(pNetwork->tlsConnectParams.isNonBlocking) {
+			// Nothing more has arrived, the caller comes back for the rest
+			break;
+		}
+
+		if(has_timer_expired(timer) || !_iot_tcp_wait_for_socket(fd, POLLIN, timer)) {
+			break;
+		}
+	}
+
+	*read_len = rxLen;
+
+	if(0 == len || (isAvailableOnly && rxLen > 0)) {
+		return SUCCESS;
+	}
+
+	if(0 == rxLen || pNetwork->tlsConnectParams.isNonBlocking || isAvailableOnly) {
+		return NETWORK_SSL_NOTHING_TO_READ;
+	} else {
+		return NETWORK_SSL_READ_TIMEOUT_ERROR;
+	}
+}
+
+IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len) {
+	return _iot_tcp_read(pNetwork, pMsg, len, timer, read_len, false);
+}
+
+IoT_Error_t iot_tls_read_available(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer,
+								   size_t *read_len) {
+	return _iot_tcp_read(pNetwork, pMsg, len, timer, read_len, true);
+}
+
+IoT_Error_t iot_tls_disconnect(Network *pNetwork) {
+	if(pNetwork->tlsDataParams.server_fd >= 0) {
+		/* Lets the broker see the end of the stream, the socket is closed by destroy */
+		(void) shutdown(pNetwork->tlsDataParams.server_fd, SHUT_WR);
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_destroy(Network *pNetwork) {
+	if(pNetwork->tlsDataParams.server_fd >= 0) {
+		close(pNetwork->tlsDataParams.server_fd);
+		pNetwork->tlsDataParams.server_fd = -1;
+	}
+
+	return SUCCESS;
+}
+
+IoT_Error_t iot_tls_free(Network *pNetwork) {
+	if(NULL == pNetwork) {
+		return NULL_VALUE_ERROR;
+	}
+
+	/* Nothing is kept across connects */
+	return SUCCESS;
+}
+
+#endif /* IOT_NETWORK_BACKEND_TCP */
+
+#ifdef __cplusplus
+}
+#endif
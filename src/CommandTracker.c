@@ -0,0 +1,341 @@
+/*
+ * CommandTracker.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ *
+ * Follows a cloud command from the moment a module sends it to its hardware,
+ * through LAN broker delivery, to the module seeing the hardware actually do
+ * the thing (or giving up). Keeps latency histograms along the way.
+ */
+
+/*-----------------------------------------------------------------------------
+--|
+--| Includes
+--|
+-----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h> // Delivery callbacks come in on the LAN MQTT thread
+
+#include "CommandTracker.h"
+#include "Utilities.h"
+
+/*-----------------------------------------------------------------------------
+--|
+--| Defines
+--|
+-----------------------------------------------------------------------------*/
+// Token value meaning "publish hasn't returned a token yet"
+#define NO_TOKEN (-1)
+
+/*-----------------------------------------------------------------------------
+--|
+--| Types
+--|
+-----------------------------------------------------------------------------*/
+typedef struct
+{
+	bool inUse;
+	bool finished; // Waiting in 'result' for CmdTrackerCheckTimeouts to report it
+	uint32_t id;
+	const char *owner;
+	int expected;
+	int token;
+	bool delivered;
+	uint64_t startMs;
+	uint64_t deliveredMs;
+	cmdTrackerDone_fnType doneCb;
+	void *context;
+	cmdResult_structType result;
+} pendingCmd_structType;
+
+typedef struct
+{
+	unsigned bucket[CMD_TRACKER_NUM_BUCKETS];
+	unsigned count;
+	uint32_t minMs;
+	uint32_t maxMs;
+	uint64_t sumMs;
+} latencyHist_structType;
+
+/*-----------------------------------------------------------------------------
+--|
+--| Private Data
+--|
+-----------------------------------------------------------------------------*/
+static pthread_mutex_t trackerLock = PTHREAD_MUTEX_INITIALIZER;
+static pendingCmd_structType pending[CMD_TRACKER_MAX_PENDING];
+static uint32_t nextId = 1;
+
+// paho can report delivery before MQTTClient_publishMessage hands us the
+// token, so remember the last one nobody claimed.
+static int lastUnclaimedToken = NO_TOKEN;
+static uint64_t lastUnclaimedMs = 0;
+
+static latencyHist_structType deliveryHist;
+static latencyHist_structType actuationHist;
+static unsigned outcomeCount[CMD_OUTCOME_UNDELIVERED + 1];
+
+/*------------------------------------------------------------------------------
+--|
+--| Private Function Bodies
+--|
+------------------------------------------------------------------------------*/
+static void histAdd(latencyHist_structType *hist, uint32_t ms)
+{
+	unsigned idx = 0;
+	while ((idx < CMD_TRACKER_NUM_BUCKETS - 1) &&
+			(ms > ((uint32_t)CMD_TRACKER_BUCKET_BASE_MS << idx)))
+		idx++;
+
+	hist->bucket[idx]++;
+	if (hist->count == 0 || ms < hist->minMs)
+		hist->minMs = ms;
+	if (ms > hist->maxMs)
+		hist->maxMs = ms;
+	hist->sumMs += ms;
+	hist->count++;
+}
+
+static void histPrint(const char *name, const latencyHist_structType *hist)
+{
+	printf("  %s: n=%u", name, hist->count);
+	if (hist->count == 0)
+	{
+		printf("\n");
+		return;
+	}
+	printf(" min=%ums avg=%llums max=%ums\n", hist->minMs,
+			(unsigned long long)(hist->sumMs / hist->count), hist->maxMs);
+
+	for (unsigned i = 0; i < CMD_TRACKER_NUM_BUCKETS; i++)
+	{
+		if (hist->bucket[i] == 0)
+			continue;
+		if (i < CMD_TRACKER_NUM_BUCKETS - 1)
+			printf("    <=%6ums : %u\n", CMD_TRACKER_BUCKET_BASE_MS << i,
+					hist->bucket[i]);
+		else
+			printf("    > %6ums : %u\n",
+					CMD_TRACKER_BUCKET_BASE_MS << (CMD_TRACKER_NUM_BUCKETS - 2),
+					hist->bucket[i]);
+	}
+}
+
+// Must hold trackerLock. Fills in the command's result and keeps the slot
+// until CmdTrackerCheckTimeouts reports it. Commands finish on the AWS and LAN
+// callback paths, where the done callback (publishing to AWS) would deadlock.
+static void finishLocked(pendingCmd_structType *cmd,
+		cmdOutcome_enumType outcome, uint64_t nowMs)
+{
+	cmdResult_structType *result = &cmd->result;
+
+	result->id = cmd->id;
+	result->owner = cmd->owner;
+	result->outcome = outcome;
+	result->delivered = cmd->delivered;
+	result->deliveryMs = cmd->delivered ?
+			(uint32_t)(cmd->deliveredMs - cmd->startMs) : 0;
+	result->actuationMs = (uint32_t)(nowMs - cmd->startMs);
+	result->context = cmd->context;
+
+	outcomeCount[outcome]++;
+	if (outcome == CMD_OUTCOME_ACTUATED)
+		histAdd(&actuationHist, result->actuationMs);
+
+	cmd->finished = true;
+}
+
+static bool isPending(const pendingCmd_structType *cmd)
+{
+	return cmd->inUse && !cmd->finished;
+}
+
+static void report(const cmdResult_structType *result,
+		cmdTrackerDone_fnType doneCb)
+{
+	static const char *outcomeNames[] =
+	{ "actuated", "timed out", "superseded", "undelivered" };
+
+	printf("Cmd #%u (%s) %s after %ums (delivery %ums)\n", result->id,
+			result->owner, outcomeNames[result->outcome], result->actuationMs,
+			result->deliveryMs);
+	if (doneCb)
+		doneCb(result);
+	CmdTrackerPrintStats();
+}
+
+static pendingCmd_structType *findById(uint32_t id)
+{
+	for (unsigned i = 0; i < CMD_TRACKER_MAX_PENDING; i++)
+		if (isPending(&pending[i]) && pending[i].id == id)
+			return &pending[i];
+	return NULL;
+}
+
+static void markDeliveredLocked(pendingCmd_structType *cmd, uint64_t whenMs)
+{
+	cmd->delivered = true;
+	cmd->deliveredMs = whenMs;
+	histAdd(&deliveryHist, (uint32_t)(whenMs - cmd->startMs));
+}
+
+/*------------------------------------------------------------------------------
+--|
+--| Public Function Bodies
+--|
+------------------------------------------------------------------------------*/
+extern uint32_t CmdTrackerBegin(const char *owner, int expected,
+		cmdTrackerDone_fnType doneCb, void *context)
+{
+	pendingCmd_structType *slot = NULL;
+	uint32_t id = 0;
+	uint64_t nowMs = MonotonicMs();
+
+	pthread_mutex_lock(&trackerLock);
+	for (unsigned i = 0; i < CMD_TRACKER_MAX_PENDING; i++)
+	{
+		if (isPending(&pending[i]) && strcmp(pending[i].owner, owner) == 0)
+		{
+			// Only one outstanding command per module makes sense (the
+			// door can't be both opening and closing)
+			finishLocked(&pending[i], CMD_OUTCOME_SUPERSEDED, nowMs);
+		}
+		if (!pending[i].inUse && slot == NULL)
+			slot = &pending[i];
+	}
+
+	if (slot)
+	{
+		id = nextId++;
+		if (nextId == 0)
+			nextId = 1;
+		slot->inUse = true;
+		slot->finished = false;
+		slot->id = id;
+		slot->owner = owner;
+		slot->expected = expected;
+		slot->token = NO_TOKEN;
+		slot->delivered = false;
+		slot->startMs = nowMs;
+		slot->deliveredMs = 0;
+		slot->doneCb = doneCb;
+		slot->context = context;
+	}
+	pthread_mutex_unlock(&trackerLock);
+
+	return id;
+}
+
+extern void CmdTrackerSetToken(uint32_t id, int token)
+{
+	pthread_mutex_lock(&trackerLock);
+	pendingCmd_structType *cmd = findById(id);
+	if (cmd)
+	{
+		cmd->token = token;
+		// Delivery already came through before we got the token
+		if (!cmd->delivered && token == lastUnclaimedToken)
+		{
+			markDeliveredLocked(cmd, lastUnclaimedMs);
+			lastUnclaimedToken = NO_TOKEN;
+		}
+	}
+	pthread_mutex_unlock(&trackerLock);
+}
+
+extern void CmdTrackerFailed(uint32_t id)
+{
+	pthread_mutex_lock(&trackerLock);
+	pendingCmd_structType *cmd = findById(id);
+	if (cmd)
+		finishLocked(cmd, CMD_OUTCOME_UNDELIVERED, MonotonicMs());
+	pthread_mutex_unlock(&trackerLock);
+}
+
+extern void CmdTrackerDelivered(int token)
+{
+	bool claimed = false;
+	uint64_t nowMs = MonotonicMs();
+
+	pthread_mutex_lock(&trackerLock);
+	for (unsigned i = 0; i < CMD_TRACKER_MAX_PENDING; i++)
+	{
+		if (isPending(&pending[i]) && !pending[i].delivered &&
+				pending[i].token == token)
+		{
+			markDeliveredLocked(&pending[i], nowMs);
+			claimed = true;
+			break;
+		}
+	}
+	if (!claimed)
+	{
+		lastUnclaimedToken = token;
+		lastUnclaimedMs = nowMs;
+	}
+	pthread_mutex_unlock(&trackerLock);
+}
+
+extern void CmdTrackerConfirm(const char *owner, int observed)
+{
+	pthread_mutex_lock(&trackerLock);
+	for (unsigned i = 0; i < CMD_TRACKER_MAX_PENDING; i++)
+	{
+		if (isPending(&pending[i]) && pending[i].expected == observed &&
+				strcmp(pending[i].owner, owner) == 0)
+		{
+			// Hardware moved, so the command obviously got there even if
+			// the broker ack hasn't shown up yet
+			if (!pending[i].delivered)
+				markDeliveredLocked(&pending[i], MonotonicMs());
+			finishLocked(&pending[i], CMD_OUTCOME_ACTUATED, MonotonicMs());
+			break;
+		}
+	}
+	pthread_mutex_unlock(&trackerLock);
+}
+
+extern void CmdTrackerCheckTimeouts(void)
+{
+	cmdResult_structType finished[CMD_TRACKER_MAX_PENDING];
+	cmdTrackerDone_fnType finishedCb[CMD_TRACKER_MAX_PENDING];
+	unsigned numFinished = 0;
+	uint64_t nowMs = MonotonicMs();
+
+	pthread_mutex_lock(&trackerLock);
+	for (unsigned i = 0; i < CMD_TRACKER_MAX_PENDING; i++)
+	{
+		if (isPending(&pending[i]) &&
+				(nowMs - pending[i].startMs) > CMD_TRACKER_TIMEOUT_MS)
+			finishLocked(&pending[i], CMD_OUTCOME_TIMED_OUT, nowMs);
+
+		// Everything that finished since last time, timed out or not
+		if (pending[i].inUse && pending[i].finished)
+		{
+			finished[numFinished] = pending[i].result;
+			finishedCb[numFinished] = pending[i].doneCb;
+			numFinished++;
+			pending[i].inUse = false;
+		}
+	}
+	pthread_mutex_unlock(&trackerLock);
+
+	for (unsigned i = 0; i < numFinished; i++)
+		report(&finished[i], finishedCb[i]);
+}
+
+extern void CmdTrackerPrintStats(void)
+{
+	pthread_mutex_lock(&trackerLock);
+	printf("Command stats: actuated=%u timedOut=%u superseded=%u "
+			"undelivered=%u\n", outcomeCount[CMD_OUTCOME_ACTUATED],
+			outcomeCount[CMD_OUTCOME_TIMED_OUT],
+			outcomeCount[CMD_OUTCOME_SUPERSEDED],
+			outcomeCount[CMD_OUTCOME_UNDELIVERED]);
+	histPrint("cmd->delivery", &deliveryHist);
+	histPrint("cmd->actuation", &actuationHist);
+	pthread_mutex_unlock(&trackerLock);
+	fflush(stdout);
+}
@@ -0,0 +1,105 @@
+/*
+ * CommandTracker.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ */
+
+#ifndef COMMANDTRACKER_H_
+#define COMMANDTRACKER_H_
+
+/*------------------------------------------------------------------------------
+--|
+--| Includes
+--|
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*------------------------------------------------------------------------------
+--|
+--| Defines
+--|
+------------------------------------------------------------------------------*/
+// How long a module has to confirm a command actually did something. A garage
+// door takes ~15 seconds to travel, so give it plenty of slack.
+#define CMD_TRACKER_TIMEOUT_MS 45000
+// Max commands in flight at once (across all modules)
+#define CMD_TRACKER_MAX_PENDING 8
+// Latency histogram buckets. Bucket i holds latencies <= (250ms << i), the
+// last bucket holds everything slower than that.
+#define CMD_TRACKER_NUM_BUCKETS 10
+#define CMD_TRACKER_BUCKET_BASE_MS 250
+
+/*------------------------------------------------------------------------------
+--|
+--| Types
+--|
+------------------------------------------------------------------------------*/
+// What finally happened to a command. Published to the shadow as an int so
+// the order must not change.
+typedef enum
+{
+	CMD_OUTCOME_ACTUATED, // Module saw the state change the command asked for
+	CMD_OUTCOME_TIMED_OUT, // Nothing happened within CMD_TRACKER_TIMEOUT_MS
+	CMD_OUTCOME_SUPERSEDED, // A newer command for the same module came along
+	CMD_OUTCOME_UNDELIVERED, // LAN broker never accepted the message
+} cmdOutcome_enumType;
+
+// Everything we know about one command once it is finished
+typedef struct
+{
+	uint32_t id; // Correlation ID handed out by CmdTrackerBegin
+	const char *owner; // Module that issued it (e.g. "garage")
+	cmdOutcome_enumType outcome;
+	bool delivered; // LAN broker acked the publish
+	uint32_t deliveryMs; // Command issued -> LAN delivery ack
+	uint32_t actuationMs; // Command issued -> module confirmed / gave up
+	void *context; // Whatever the owner passed to CmdTrackerBegin
+} cmdResult_structType;
+
+// Called once per command after it finishes, from CmdTrackerCheckTimeouts
+typedef void (*cmdTrackerDone_fnType)(const cmdResult_structType *result);
+
+/*------------------------------------------------------------------------------
+--|
+--| Constants
+--|
+------------------------------------------------------------------------------*/
+
+/* None */
+
+/*------------------------------------------------------------------------------
+--|
+--| Function Specifications
+--|
+------------------------------------------------------------------------------*/
+// Start tracking a command. 'expected' is module-defined (garage uses its
+// door state enum) and is matched against CmdTrackerConfirm. Any command
+// still pending for the same owner is finished as superseded.
+// Returns the correlation ID (never 0) or 0 if the table is full.
+extern uint32_t CmdTrackerBegin(const char *owner, int expected,
+		cmdTrackerDone_fnType doneCb, void *context);
+
+// Associate the LAN delivery token of the publish with a command
+extern void CmdTrackerSetToken(uint32_t id, int token);
+
+// Mark a command as undelivered (publish to the LAN broker failed)
+extern void CmdTrackerFailed(uint32_t id);
+
+// LAN broker acknowledged delivery of 'token'
+extern void CmdTrackerDelivered(int token);
+
+// Module observed 'observed'. Finishes the owner's pending command if it
+// matches what the command expected.
+extern void CmdTrackerConfirm(const char *owner, int observed);
+
+// Expire commands that have been pending too long and report every finished
+// command to its done callback. Call periodically, without holding anything
+// the done callbacks need.
+extern void CmdTrackerCheckTimeouts(void);
+
+// Dump outcome counters and latency histograms to stdout
+extern void CmdTrackerPrintStats(void);
+
+#endif /* COMMANDTRACKER_H_ */
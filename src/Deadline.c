@@ -0,0 +1,164 @@
+/*
+ * Deadline.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ *
+ * Min-heap of deadlines ordered by expiry, so finding out nothing is due is a
+ * single compare against the top no matter how many things we are watching.
+ */
+
+/*-----------------------------------------------------------------------------
+--|
+--| Includes
+--|
+-----------------------------------------------------------------------------*/
+#include <stddef.h>
+#include <pthread.h> // Armed from MQTT callbacks, run from the main loop
+
+#include "Deadline.h"
+
+/*-----------------------------------------------------------------------------
+--|
+--| Private Data
+--|
+-----------------------------------------------------------------------------*/
+static pthread_mutex_t deadlineLock = PTHREAD_MUTEX_INITIALIZER;
+static deadline_structType *heap[DEADLINE_MAX_ARMED];
+static unsigned heapSize = 0;
+
+/*------------------------------------------------------------------------------
+--|
+--| Private Function Bodies
+--|
+------------------------------------------------------------------------------*/
+static void place(deadline_structType *deadline, unsigned idx)
+{
+	heap[idx] = deadline;
+	deadline->heapIdx = idx;
+}
+
+static void siftUp(unsigned idx)
+{
+	deadline_structType *deadline = heap[idx];
+	while (idx > 0)
+	{
+		unsigned parent = (idx - 1) / 2;
+		if (heap[parent]->whenMs <= deadline->whenMs)
+			break;
+		place(heap[parent], idx);
+		idx = parent;
+	}
+	place(deadline, idx);
+}
+
+static void siftDown(unsigned idx)
+{
+	deadline_structType *deadline = heap[idx];
+	for (;;)
+	{
+		unsigned child = 2 * idx + 1;
+		if (child >= heapSize)
+			break;
+		if (child + 1 < heapSize && heap[child + 1]->whenMs < heap[child]->whenMs)
+			child++;
+		if (deadline->whenMs <= heap[child]->whenMs)
+			break;
+		place(heap[child], idx);
+		idx = child;
+	}
+	place(deadline, idx);
+}
+
+// Must hold deadlineLock
+static void removeLocked(deadline_structType *deadline)
+{
+	unsigned idx = deadline->heapIdx;
+
+	deadline->armed = false;
+	heapSize--;
+	if (idx == heapSize)
+		return;
+
+	// Plug the hole with the last one and let it find its place
+	deadline_structType *moved = heap[heapSize];
+	place(moved, idx);
+	siftUp(idx);
+	siftDown(moved->heapIdx);
+}
+
+/*------------------------------------------------------------------------------
+--|
+--| Public Function Bodies
+--|
+------------------------------------------------------------------------------*/
+extern void DeadlineInit(deadline_structType *deadline,
+		deadlineExpired_fnType expiredCb, void *context)
+{
+	pthread_mutex_lock(&deadlineLock);
+	if (deadline->armed)
+		removeLocked(deadline);
+	deadline->whenMs = 0;
+	deadline->expiredCb = expiredCb;
+	deadline->context = context;
+	pthread_mutex_unlock(&deadlineLock);
+}
+
+extern bool DeadlineArm(deadline_structType *deadline, uint64_t whenMs)
+{
+	bool retVal = true;
+
+	pthread_mutex_lock(&deadlineLock);
+	if (deadline->armed)
+	{
+		deadline->whenMs = whenMs;
+		siftUp(deadline->heapIdx);
+		siftDown(deadline->heapIdx);
+	}
+	else if (heapSize < DEADLINE_MAX_ARMED)
+	{
+		deadline->whenMs = whenMs;
+		deadline->armed = true;
+		place(deadline, heapSize++);
+		siftUp(deadline->heapIdx);
+	}
+	else
+	{
+		retVal = false;
+	}
+	pthread_mutex_unlock(&deadlineLock);
+
+	return retVal;
+}
+
+extern void DeadlineCancel(deadline_structType *deadline)
+{
+	pthread_mutex_lock(&deadlineLock);
+	if (deadline->armed)
+		removeLocked(deadline);
+	pthread_mutex_unlock(&deadlineLock);
+}
+
+extern void DeadlineRunExpired(uint64_t nowMs)
+{
+	for (;;)
+	{
+		deadlineExpired_fnType expiredCb = NULL;
+		void *context = NULL;
+
+		pthread_mutex_lock(&deadlineLock);
+		if (heapSize == 0 || heap[0]->whenMs > nowMs)
+		{
+			pthread_mutex_unlock(&deadlineLock);
+			return;
+		}
+		expiredCb = heap[0]->expiredCb;
+		context = heap[0]->context;
+		removeLocked(heap[0]);
+		pthread_mutex_unlock(&deadlineLock);
+
+		// Outside the lock so the callback can re-arm
+		if (expiredCb)
+			expiredCb(context);
+	}
+}
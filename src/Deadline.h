@@ -0,0 +1,73 @@
+/*
+ * Deadline.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ */
+
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+/*------------------------------------------------------------------------------
+--|
+--| Includes
+--|
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*------------------------------------------------------------------------------
+--|
+--| Defines
+--|
+------------------------------------------------------------------------------*/
+// Most deadlines armed at once (one or two per module is typical)
+#define DEADLINE_MAX_ARMED 16
+
+/*------------------------------------------------------------------------------
+--|
+--| Types
+--|
+------------------------------------------------------------------------------*/
+// Called from DeadlineRunExpired's thread once the deadline passes. Safe to
+// re-arm from here.
+typedef void (*deadlineExpired_fnType)(void *context);
+
+// One deadline. Owned by the caller, zero-initialize (or DeadlineInit) before
+// use. Fields are private to Deadline.c.
+typedef struct
+{
+	uint64_t whenMs; // Monotonic time it expires
+	deadlineExpired_fnType expiredCb;
+	void *context;
+	bool armed;
+	unsigned heapIdx; // Position in the heap while armed
+} deadline_structType;
+
+/*------------------------------------------------------------------------------
+--|
+--| Constants
+--|
+------------------------------------------------------------------------------*/
+
+/* None */
+
+/*------------------------------------------------------------------------------
+--|
+--| Function Specifications
+--|
+------------------------------------------------------------------------------*/
+extern void DeadlineInit(deadline_structType *deadline,
+		deadlineExpired_fnType expiredCb, void *context);
+
+// (Re)arm to expire at whenMs (monotonic). Moves it if already armed. Returns
+// false if too many deadlines are armed.
+extern bool DeadlineArm(deadline_structType *deadline, uint64_t whenMs);
+
+extern void DeadlineCancel(deadline_structType *deadline);
+
+// Fire everything that expired by nowMs. Only looks at deadlines that are
+// actually due, so it's cheap to call every time round the main loop.
+extern void DeadlineRunExpired(uint64_t nowMs);
+
+#endif /* DEADLINE_H_ */
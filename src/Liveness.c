@@ -0,0 +1,127 @@
+/*
+ * Liveness.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ *
+ * Works out whether a LAN device is alive from how often it normally talks.
+ * Each device's inter-arrival time is tracked as an EWMA of mean and variance
+ * and the dead threshold is derived from that, so a chatty sensor is caught
+ * quickly and a slow one doesn't flap.
+ */
+
+/*-----------------------------------------------------------------------------
+--|
+--| Includes
+--|
+-----------------------------------------------------------------------------*/
+#include <string.h>
+#include <math.h>
+
+#include "Liveness.h"
+
+/*------------------------------------------------------------------------------
+--|
+--| Public Function Bodies
+--|
+------------------------------------------------------------------------------*/
+extern void LivenessInit(liveness_structType *dev)
+{
+	memset(dev, 0, sizeof(*dev));
+}
+
+extern void LivenessPing(liveness_structType *dev, uint64_t nowMs)
+{
+	if (dev->everSeen && !dev->isDead)
+	{
+		// Only learn from gaps while alive. An outage isn't the device's
+		// cadence and would blow the threshold up for a long time.
+		float gap = (float)(nowMs - dev->lastPingMs);
+		if (dev->samples == 0)
+		{
+			dev->meanMs = gap;
+			dev->varMs2 = (gap / 2.0f) * (gap / 2.0f);
+		}
+		else
+		{
+			float err = gap - dev->meanMs;
+			dev->meanMs += LIVENESS_EWMA_GAIN * err;
+			dev->varMs2 = (1.0f - LIVENESS_EWMA_GAIN) *
+					(dev->varMs2 + LIVENESS_EWMA_GAIN * err * err);
+		}
+		dev->samples++;
+	}
+
+	if (dev->isDead)
+	{
+		// Only a run of messages revives it, a gap starts the count over
+		if ((nowMs - dev->lastPingMs) > LivenessThresholdMs(dev))
+			dev->reviveCount = 0;
+		dev->reviveCount++;
+	}
+
+	dev->lastPingMs = nowMs;
+	dev->everSeen = true;
+}
+
+extern void LivenessSetDead(liveness_structType *dev, bool isDead,
+		uint64_t nowMs)
+{
+	if (isDead)
+	{
+		dev->isDead = true;
+		dev->reviveCount = 0;
+		return;
+	}
+	// Restart the silence clock without learning from the gap
+	dev->isDead = false;
+	dev->everSeen = true;
+	dev->lastPingMs = nowMs;
+}
+
+extern uint32_t LivenessThresholdMs(const liveness_structType *dev)
+{
+	if (dev->samples < LIVENESS_MIN_SAMPLES)
+		return LIVENESS_DEFAULT_TIMEOUT_MS;
+
+	float threshold = dev->meanMs +
+			LIVENESS_DEVIATION_MULT * sqrtf(dev->varMs2);
+
+	if (threshold < LIVENESS_MIN_TIMEOUT_MS)
+		return LIVENESS_MIN_TIMEOUT_MS;
+	if (threshold > LIVENESS_MAX_TIMEOUT_MS)
+		return LIVENESS_MAX_TIMEOUT_MS;
+	return (uint32_t)threshold;
+}
+
+extern bool LivenessCheck(liveness_structType *dev, uint64_t nowMs)
+{
+	// Never heard from it. Dead until proven otherwise.
+	if (!dev->everSeen)
+	{
+		dev->isDead = true;
+		return dev->isDead;
+	}
+
+	bool silent = (nowMs - dev->lastPingMs) > LivenessThresholdMs(dev);
+
+	if (!dev->isDead && silent)
+	{
+		dev->isDead = true;
+		dev->reviveCount = 0;
+	}
+	// Hysteresis: one stray message doesn't bring it back, it has to keep
+	// talking
+	else if (dev->isDead && !silent &&
+			dev->reviveCount >= LIVENESS_REVIVE_COUNT)
+	{
+		dev->isDead = false;
+	}
+	// Went quiet again before it got there, the messages so far don't count
+	else if (dev->isDead && silent)
+	{
+		dev->reviveCount = 0;
+	}
+
+	return dev->isDead;
+}
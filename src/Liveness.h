@@ -0,0 +1,87 @@
+/*
+ * Liveness.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ */
+
+#ifndef LIVENESS_H_
+#define LIVENESS_H_
+
+/*------------------------------------------------------------------------------
+--|
+--| Includes
+--|
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+
+/*------------------------------------------------------------------------------
+--|
+--| Defines
+--|
+------------------------------------------------------------------------------*/
+// Until we have seen a few messages we don't know the device's cadence, so
+// fall back to this
+#define LIVENESS_DEFAULT_TIMEOUT_MS 5000
+// Never call a device dead quicker than this, no matter how regular it is
+// (rides out Wi-Fi hiccups)
+#define LIVENESS_MIN_TIMEOUT_MS 2000
+// ...and never wait longer than this
+#define LIVENESS_MAX_TIMEOUT_MS 60000
+// Threshold is mean + K * std deviation of the inter-arrival time
+#define LIVENESS_DEVIATION_MULT 4.0f
+// EWMA gain (1/8, same as TCP's RTT estimator)
+#define LIVENESS_EWMA_GAIN 0.125f
+// Samples needed before the learned threshold is trusted
+#define LIVENESS_MIN_SAMPLES 4
+// Consecutive messages needed before a dead device is considered alive again
+#define LIVENESS_REVIVE_COUNT 2
+
+/*------------------------------------------------------------------------------
+--|
+--| Types
+--|
+------------------------------------------------------------------------------*/
+// Per-device liveness state. Zero-initialize (or LivenessInit) before use.
+typedef struct
+{
+	uint64_t lastPingMs; // Monotonic time of last message
+	float meanMs; // EWMA of inter-arrival time
+	float varMs2; // EWMA of inter-arrival variance
+	unsigned samples;
+	unsigned reviveCount; // Back to back messages seen while dead
+	bool everSeen;
+	bool isDead;
+} liveness_structType;
+
+/*------------------------------------------------------------------------------
+--|
+--| Constants
+--|
+------------------------------------------------------------------------------*/
+
+/* None */
+
+/*------------------------------------------------------------------------------
+--|
+--| Function Specifications
+--|
+------------------------------------------------------------------------------*/
+extern void LivenessInit(liveness_structType *dev);
+
+// Device sent us something at nowMs (monotonic)
+extern void LivenessPing(liveness_structType *dev, uint64_t nowMs);
+
+// Device told us itself (status topic / last will). Trusted as is, no
+// hysteresis.
+extern void LivenessSetDead(liveness_structType *dev, bool isDead,
+		uint64_t nowMs);
+
+// Re-evaluate and return whether the device is dead at nowMs (monotonic)
+extern bool LivenessCheck(liveness_structType *dev, uint64_t nowMs);
+
+// Silence allowed before the device is declared dead, from observed cadence
+extern uint32_t LivenessThresholdMs(const liveness_structType *dev);
+
+#endif /* LIVENESS_H_ */
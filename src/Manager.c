@@ -25,6 +25,9 @@
 
 #include "Manager.h"
 #include "Utilities.h"
+#include "CommandTracker.h"
+#include "PayloadCache.h"
+#include "Deadline.h"
 
 // Include for internal MQTT dubbed "lan MQTT" below
 // (to smart home devices, just the garage sensor at the moment)
@@ -61,14 +64,22 @@ static AWS_IoT_Client AWSMQTTclient;
 static 	MQTTClient LANMQTTclient;
 
 // System-level info for AWS Goes here. Currently just garage health.
-static bool garageIsDead = false;
-static const jsonStruct_t garageSensorHealth = {
+static bool moduleIsDead[module_size];
+static bool moduleHealthReported[module_size];
+static const char *moduleNames[module_size] = {
+		[MODULE_GARAGE] = "Garage sensor",
+};
+static const jsonStruct_t moduleHealth[module_size] = {
+		[MODULE_GARAGE] = {
  		 "garageSensorDead",
- 		 &garageIsDead,
- 		 sizeof(unsigned),
+ 		 &moduleIsDead[MODULE_GARAGE],
+ 		 sizeof(bool),
  		 SHADOW_JSON_BOOL,
  		 NULL,
+		},
   };
+// Modules report health from the LAN MQTT thread and the main loop
+static pthread_mutex_t healthLock = PTHREAD_MUTEX_INITIALIZER;
 
 pthread_mutex_t lock;
 /*
@@ -95,9 +106,10 @@ static int lanMQTTInit();
  -----------------------------------------------------------------------------*/
 
 
-// LAN-MQTT message delivered. We don't currently care. TODO
+// LAN-MQTT message delivered. Lets the command tracker know the broker has
+// our command so it can time the rest of the round trip.
 static void lanMQTTMsgDelivered(void *context, MQTTClient_deliveryToken dt) {
-	printf("Garage Got It\n");
+	CmdTrackerDelivered(dt);
 	return;
 }
 // LAN-MQTT message received
@@ -109,7 +121,13 @@ static int lanMQTTNewMsgReceived(void *context, char *topicName, int topicLen,
 	//const bool MSG_HANDLED = 1;
 
 	bool retVal = MSG_NOT_HANDLED;
-	retVal |= GarageHandleDataFromHW(topicName, message->payload);
+	// Sensors mostly repeat themselves. If this is exactly what we got last
+	// time on this topic there's nothing to parse or diff.
+	if (PayloadCacheIsRepeat(topicName, topicLen, message->payload,
+			(size_t)message->payloadlen))
+		retVal |= GarageHandleRepeatFromHW(topicName, message->payload);
+	else
+		retVal |= GarageHandleDataFromHW(topicName, message->payload);
 
 	// Turns out theres a memory leak without these!
 	MQTTClient_freeMessage(&message);
@@ -125,6 +143,9 @@ static int lanMQTTNewMsgReceived(void *context, char *topicName, int topicLen,
 // report it to AWS IOT.
 static void lanMQTTConnLost(void *context, char *cause) {
 	printf("Reconnecting...\n");
+	// Devices may have changed (or rebooted) while we weren't listening, make
+	// sure the first message after reconnecting is actually parsed
+	PayloadCacheClear();
 	// Quick and dirty. Indefinately attemp to reconnect to MQTT server
 	while (MQTTCLIENT_SUCCESS != lanMQTTInit())
 		sleep(2);
@@ -229,6 +250,8 @@ static int awsMQTTInit()
 	scp.pMyThingName = AWS_IOT_MY_THING_NAME;
 	scp.pMqttClientId = AWS_IOT_MQTT_CLIENT_ID;
 	scp.mqttClientIdLen = (uint16_t) strlen(AWS_IOT_MQTT_CLIENT_ID);
+	// MQTT 5 so the shadow topics, sent on every update, go out as topic aliases
+	scp.MQTTVersion = MQTT_5_0;
 	printf("Shadow Connect");
 	rc = aws_iot_shadow_connect(&AWSMQTTclient, &scp);
 	if (SUCCESS != rc) {
@@ -276,34 +299,42 @@ static void shadowUpdateStatusCallback(const char *pThingName,
 
 	fflush(stdout);
 }
-// Check all modules connected to the broker to make sure they're alive.
-// Report update to AWS IOT. Currently only garage module exists.
-static void checkModuleHealth(unsigned seconds) {
-	// TODO: Consider limiting publishing to if there is a change in health only
-
-	// Update garage status
-	garageIsDead = GarageCheckIfDeadHW();
-	// Let's save a bit of money and not just spam AWS
-	if (seconds % 5 == 0)
-		PublishToAWS(1, &garageSensorHealth);
-
-	return;
-}
 /*------------------------------------------------------------------------------
  --|
  --| Public Function Bodies
  --|
  -----------------------------------------------------------------------------*/
 // Called by anyone who wishes to publish data to hardware on the LAN.
-extern void PublishToLAN(const char *topic, const char*msg)
+extern int PublishToLAN(const char *topic, const char*msg)
 {
 	MQTTClient_message  mqttMsg = MQTTClient_message_initializer;
+	MQTTClient_deliveryToken token = -1;
 	mqttMsg.payloadlen = strlen(msg);
 	mqttMsg.payload = (void*)msg;
 	mqttMsg.qos = QOS;
 
-	MQTTClient_publishMessage(LANMQTTclient, topic, &mqttMsg, NULL);
-	return;
+	if (MQTTClient_publishMessage(LANMQTTclient, topic, &mqttMsg, &token)
+			!= MQTTCLIENT_SUCCESS)
+		return -1;
+	return (int)token;
+}
+// Called by modules whenever they learn something about their hardware's
+// health. Report update to AWS IOT only when health actually changes (plus
+// once at start-up so the shadow isn't left with whatever the last run said).
+extern void ReportModuleHealth(module_enumType module, bool isDead)
+{
+	pthread_mutex_lock(&healthLock);
+	bool changed = !moduleHealthReported[module] ||
+			moduleIsDead[module] != isDead;
+	moduleIsDead[module] = isDead;
+	moduleHealthReported[module] = true;
+	pthread_mutex_unlock(&healthLock);
+
+	if (changed)
+	{
+		printf("%s is %s\n", moduleNames[module], isDead ? "dead" : "alive");
+		PublishToAWS(1, &moduleHealth[module]);
+	}
 }
 // Called by anyone who wishes to publish data to AWS. Connected modules (just
 // garage at the moment) call this function to update their shadow in AWS IOT.
@@ -390,6 +421,9 @@ int main(void) {
 	// Set up the AWS IOT interface
 	IoT_Error_t awsMQTTret = awsMQTTInit();
 
+	// Modules need to be ready before their LAN traffic starts coming in
+	GarageInit();
+
 	// Set up our LAN MQTT interface
 	int lanMQTTret = lanMQTTInit();
 
@@ -413,8 +447,19 @@ int main(void) {
 		
 		MQTTClient_yield();
 		sleep(1);
-		// Periodically check on module health
-		checkModuleHealth(relativeSecs);
+		// Module health comes in as events. This just fires the fallback
+		// deadlines for modules that have gone quiet.
+		DeadlineRunExpired(MonotonicMs());
+		// Give up on commands the hardware never acted on and report the
+		// finished ones. Reporting publishes to AWS, so not under 'lock'.
+		CmdTrackerCheckTimeouts();
+		// Every so often let us know how much parsing the cache saves
+		if (relativeSecs % 300 == 0)
+		{
+			payloadCacheStats_structType cacheStats = PayloadCacheGetStats();
+			printf("LAN payload cache: %u hits, %u misses\n", cacheStats.hits,
+					cacheStats.misses);
+		}
 	}
 
 	// Never reached
@@ -16,6 +16,7 @@
 // Contains the JSON struct modules (just garage at the moment) need to produce
 // in order to talk to AWS IOT (i.e. update the shadow correctly)
 #include "aws_iot_shadow_json.h"
+#include <stdbool.h>
 
 /*------------------------------------------------------------------------------
 --|
@@ -44,6 +45,12 @@ typedef enum
 	MODULE_SUBSCRIBES,// Module subscribes to these topics
 	MODULE_PUBLISHES, // Module publishes these topics to broker
 } topicType_enumType;
+// Modules whose health the manager reports to AWS IOT
+typedef enum
+{
+	MODULE_GARAGE,
+	module_size
+} module_enumType;
 
 /*------------------------------------------------------------------------------
 --|
@@ -62,8 +69,13 @@ typedef enum
 // to update AWS IOT with some data
 extern void PublishToAWS(uint8_t count, ...);
 // All modules (currently just garage) will utilize this function if they want
-// to update their shadow hardware (the real deal) with some data
-extern void PublishToLAN(const char *topic, const char*msg);
+// to update their shadow hardware (the real deal) with some data. Returns the
+// LAN delivery token (handy for tracking the message) or -1 on failure.
+extern int PublishToLAN(const char *topic, const char*msg);
+// All modules (currently just garage) will utilize this function to tell us
+// whether their hardware is dead whenever they find out. Cheap to call on
+// every event, AWS IOT only hears about changes.
+extern void ReportModuleHealth(module_enumType module, bool isDead);
 
 
 #endif /* MANAGER_H_ */
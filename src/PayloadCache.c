@@ -0,0 +1,149 @@
+/*
+ * PayloadCache.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ *
+ * Most LAN sensor messages are the exact same string over and over
+ * ("Door:closed State:nominal"). Remember a fingerprint (length + 64 bit
+ * hash) of the last payload per topic so the manager can skip parsing and
+ * diffing ones we have already seen.
+ */
+
+/*-----------------------------------------------------------------------------
+--|
+--| Includes
+--|
+-----------------------------------------------------------------------------*/
+#include <string.h>
+
+#include "PayloadCache.h"
+
+/*-----------------------------------------------------------------------------
+--|
+--| Defines
+--|
+-----------------------------------------------------------------------------*/
+// 64 bit FNV-1a
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/*-----------------------------------------------------------------------------
+--|
+--| Types
+--|
+-----------------------------------------------------------------------------*/
+typedef struct
+{
+	bool inUse;
+	uint16_t topicLen;
+	uint64_t topicHash;
+	char topic[PAYLOAD_CACHE_MAX_TOPIC_LEN];
+	size_t payloadLen;
+	uint64_t payloadHash;
+} cacheEntry_structType;
+
+/*-----------------------------------------------------------------------------
+--|
+--| Private Data
+--|
+-----------------------------------------------------------------------------*/
+static cacheEntry_structType cache[PAYLOAD_CACHE_NUM_TOPICS];
+// Round-robin victim once the table is full
+static unsigned nextVictim = 0;
+static payloadCacheStats_structType stats;
+
+/*------------------------------------------------------------------------------
+--|
+--| Private Function Bodies
+--|
+------------------------------------------------------------------------------*/
+static uint64_t hash64(const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+	uint64_t hash = FNV64_OFFSET;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV64_PRIME;
+	}
+	return hash;
+}
+
+static cacheEntry_structType *findOrAdd(const char *topic, uint16_t topicLen,
+		uint64_t topicHash)
+{
+	cacheEntry_structType *freeSlot = NULL;
+
+	for (unsigned i = 0; i < PAYLOAD_CACHE_NUM_TOPICS; i++)
+	{
+		if (!cache[i].inUse)
+		{
+			if (!freeSlot)
+				freeSlot = &cache[i];
+			continue;
+		}
+		if (cache[i].topicHash == topicHash && cache[i].topicLen == topicLen
+				&& memcmp(cache[i].topic, topic, topicLen) == 0)
+			return &cache[i];
+	}
+
+	if (!freeSlot)
+	{
+		freeSlot = &cache[nextVictim];
+		nextVictim = (nextVictim + 1) % PAYLOAD_CACHE_NUM_TOPICS;
+	}
+
+	freeSlot->inUse = true;
+	freeSlot->topicLen = topicLen;
+	freeSlot->topicHash = topicHash;
+	memcpy(freeSlot->topic, topic, topicLen);
+	// Nothing seen on this topic yet, so the first payload must not match
+	freeSlot->payloadLen = (size_t)-1;
+	freeSlot->payloadHash = 0;
+	return freeSlot;
+}
+
+/*------------------------------------------------------------------------------
+--|
+--| Public Function Bodies
+--|
+------------------------------------------------------------------------------*/
+extern bool PayloadCacheIsRepeat(const char *topic, int topicLen,
+		const void *payload, size_t payloadLen)
+{
+	size_t len = (topicLen > 0) ? (size_t)topicLen : strlen(topic);
+
+	if (len >= PAYLOAD_CACHE_MAX_TOPIC_LEN)
+	{
+		stats.misses++;
+		return false;
+	}
+
+	cacheEntry_structType *entry = findOrAdd(topic, (uint16_t)len,
+			hash64(topic, len));
+	uint64_t payloadHash = hash64(payload, payloadLen);
+
+	if (entry->payloadLen == payloadLen && entry->payloadHash == payloadHash)
+	{
+		stats.hits++;
+		return true;
+	}
+
+	entry->payloadLen = payloadLen;
+	entry->payloadHash = payloadHash;
+	stats.misses++;
+	return false;
+}
+
+extern void PayloadCacheClear(void)
+{
+	memset(cache, 0, sizeof(cache));
+	nextVictim = 0;
+}
+
+extern payloadCacheStats_structType PayloadCacheGetStats(void)
+{
+	return stats;
+}
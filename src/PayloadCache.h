@@ -0,0 +1,66 @@
+/*
+ * PayloadCache.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ */
+
+#ifndef PAYLOADCACHE_H_
+#define PAYLOADCACHE_H_
+
+/*------------------------------------------------------------------------------
+--|
+--| Includes
+--|
+------------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*------------------------------------------------------------------------------
+--|
+--| Defines
+--|
+------------------------------------------------------------------------------*/
+// Number of LAN topics we remember the last payload for. Modules publish a
+// handful of topics each, so this is plenty for now.
+#define PAYLOAD_CACHE_NUM_TOPICS 16
+// Longest topic we will cache. Longer ones are always treated as new.
+#define PAYLOAD_CACHE_MAX_TOPIC_LEN 64
+
+/*------------------------------------------------------------------------------
+--|
+--| Types
+--|
+------------------------------------------------------------------------------*/
+typedef struct
+{
+	unsigned hits; // Payload identical to the last one on that topic
+	unsigned misses; // Payload changed (or first time we saw the topic)
+} payloadCacheStats_structType;
+
+/*------------------------------------------------------------------------------
+--|
+--| Constants
+--|
+------------------------------------------------------------------------------*/
+
+/* None */
+
+/*------------------------------------------------------------------------------
+--|
+--| Function Specifications
+--|
+------------------------------------------------------------------------------*/
+// Returns true if 'payload' is the same as the last payload seen on 'topic'.
+// Otherwise remembers it as the latest and returns false. topicLen may be 0
+// for a NUL terminated topic (same as paho).
+extern bool PayloadCacheIsRepeat(const char *topic, int topicLen,
+		const void *payload, size_t payloadLen);
+
+// Forget everything (e.g. devices may have rebooted)
+extern void PayloadCacheClear(void);
+
+extern payloadCacheStats_structType PayloadCacheGetStats(void);
+
+#endif /* PAYLOADCACHE_H_ */
@@ -9,63 +9,118 @@
 #define SWITCHS_H_
 
 // *****
-// Shamelessly stolen from https://gist.github.com/HoX/abfe15c40f2d9daebc35
-// Modified to remove regex
+// Originally stolen from https://gist.github.com/HoX/abfe15c40f2d9daebc35
+// (regex removed). That version strcmp'd its way down the list of cases on
+// every message. This one hashes the string once, jumps straight to the
+// matching case with a real C switch and does a single strcmp to confirm.
 // *****
 
 #include <string.h>
+#include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/** Begin a switch for the string x */
-#define switchs(x) \
-    { char *__sw = (x); bool __done = false; bool __cont = false; \
-        do {
+/* Case labels have to be integer constants, and C can't hash a string
+ * literal at compile time, so each module lists its labels with the hash
+ * written out next to them:
+ *
+ *   #define MY_SWITCHS_LABELS(X) \
+ *       X(FOO, "foo", 0x29f37ed7) \
+ *       X(MY_TOPIC, MY_TOPIC, 0x...)
+ *   SWITCHS_LABELS(MY_SWITCHS_LABELS)
+ *
+ * tools/switchs_labels.py checks every hash before the build (and prints the
+ * hash for a new string). Two labels that collide in the same switchs are a
+ * compile error (duplicate case value). */
+
+/** Hash used for both labels and subjects: 32 bit FNV-1a over the lower-cased
+ *  string with the top bit dropped (so labels fit in an enum). Never 0. */
+static inline uint32_t switchsHash(const char *s)
+{
+	uint32_t hash = 2166136261u;
+	for (; *s; s++)
+	{
+		unsigned char c = (unsigned char)*s;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash ^= c;
+		hash *= 16777619u;
+	}
+	hash &= 0x7fffffffu;
+	return hash ? hash : 1;
+}
 
-/** Check if the string matches the cases argument (case sensitive) */
-#define cases(x)    } if ( __cont || !strcmp ( __sw, x ) ) \
-                        { __done = true; __cont = true;
+/** Labels stack (cases(FOO) cases(BAR) ...), so every label is entered by
+ *  falling through from the one above. Say so, or -Wimplicit-fallthrough
+ *  flags each of them. The first label falls through from
+ *  SWITCHS_UNREACHABLE, a case no hash can hit (the top bit is dropped), so
+ *  its marker isn't an unreachable statement either. */
+#if defined(__has_attribute)
+#if __has_attribute(fallthrough)
+#define SWITCHS_FALLTHROUGH __attribute__((fallthrough))
+#endif
+#endif
+#ifndef SWITCHS_FALLTHROUGH
+#define SWITCHS_FALLTHROUGH do { } while (0)
+#endif
+
+/** Subject hash meaning "didn't match any label", sends us to defaults */
+#define SWITCHS_NO_MATCH 0u
+#define SWITCHS_UNREACHABLE 0x80000000u
+
+/** Declare the labels in list (see above): enum SWH_<name> and SWS_<name> */
+#define SWITCHS_LABEL_HASH(name, str, hash) SWH_##name = (hash),
+#define SWITCHS_LABEL_STRING(name, str, hash) static const char SWS_##name[] = str;
+#define SWITCHS_LABELS(list) \
+    enum { list(SWITCHS_LABEL_HASH) }; \
+    list(SWITCHS_LABEL_STRING)
 
-/** Check if the string matches the icases argument (case insensitive) */
-#define icases(x)    } if ( __cont || !strcasecmp ( __sw, x ) ) { \
-                        __done = true; __cont = true;
+/** Begin a switch for the string x */
+#define switchs(x) \
+    { const char *__sw = (x); uint32_t __swh = switchsHash(__sw); \
+        bool __cont = false; \
+        for (;;) { switch (__swh) { case SWITCHS_UNREACHABLE:
+
+/** Check if the string matches label x (case sensitive) */
+#define cases(x)    } SWITCHS_FALLTHROUGH; case SWH_##x: \
+                        if (!__cont && strcmp(__sw, SWS_##x)) \
+                            { __swh = SWITCHS_NO_MATCH; continue; } \
+                        __cont = true; {
+
+/** Check if the string matches label x (case insensitive) */
+#define icases(x)   } SWITCHS_FALLTHROUGH; case SWH_##x: \
+                        if (!__cont && strcasecmp(__sw, SWS_##x)) \
+                            { __swh = SWITCHS_NO_MATCH; continue; } \
+                        __cont = true; {
 
 /** Default behaviour */
-#define defaults    } if ( !__done || __cont ) {
+#define defaults    } SWITCHS_FALLTHROUGH; default: __cont = true; {
 
 /** Close the switchs */
-#define switchs_end } while ( 0 ); }
+#define switchs_end } break; } }
 
 #endif /* SWITCHS_H_ */
 
 /* #include <stdio.h>
 #include "switchs.h"
 
+#define EXAMPLE_SWITCHS_LABELS(X) \
+    X(FOO, "foo", 0x29f37ed7) \
+    X(BAR, "bar", 0x76b77d1a) \
+    X(PI, "pi", 0x484e4bf2)
+SWITCHS_LABELS(EXAMPLE_SWITCHS_LABELS)
+
 int main(int argc, char **argv) {
      switchs(argv[1]) {
-        cases("foo")
-        cases("bar")
+        cases(FOO)
+        cases(BAR)
             printf("foo or bar (case sensitive)\n");
             break;
 
-        icases("pi")
+        icases(PI)
             printf("pi or Pi or pI or PI (case insensitive)\n");
             break;
 
-        cases_re("^D.*",0)
-            printf("Something that start with D (case sensitive)\n");
-            break;
-
-        cases_re("^E.*",REG_ICASE)
-            printf("Something that start with E (case insensitive)\n");
-            break;
-
-        cases("1")
-            printf("1\n");
-
-        cases("2")
-            printf("2\n");
-            break;
-
         defaults
             printf("No match\n");
             break;
@@ -13,8 +13,8 @@
 --| Includes
 --|
 ------------------------------------------------------------------------------*/
-
-/* None */
+#include <stdint.h>
+#include <time.h>
 
 /*------------------------------------------------------------------------------
 --|
@@ -44,5 +44,13 @@
 --| Function Specifications
 --|
 ------------------------------------------------------------------------------*/
+// Milliseconds on a clock that never jumps (unlike time(NULL) when NTP kicks
+// in). Only good for measuring intervals.
+static inline uint64_t MonotonicMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000u) + ((uint64_t)now.tv_nsec / 1000000u);
+}
 
 #endif /* UTILITIES_H_ */
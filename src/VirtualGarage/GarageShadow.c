@@ -15,9 +15,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "../Switchs.h"
 #include "../Utilities.h"
+#include "../CommandTracker.h"
+#include "../Liveness.h"
+#include "../Deadline.h"
 #include "GarageShadow.h"
 
 #include "aws_iot_json_utils.h" // To parse aws data that comes in
@@ -27,15 +31,32 @@
 --| Defines
 --|
 -----------------------------------------------------------------------------*/
-// If nothing from HW for 2 seconds we are dead-in-the-water
-#define TIMEOUT_IN_S 2
-
 // Topic defines (must match what the HW sends out)
 #define PUB_GARAGE_GENERAL "home/garage/general"
 #define PUB_GARAGE_SENSOR "home/garage/sensor"
 #define PUB_GARAGE_DEBUG "home/garage/debug"
+// HW publishes a retained "online" here when it connects and leaves "offline"
+// as its last will, so the broker tells us the moment it drops off
+#define PUB_GARAGE_STATUS "home/garage/status"
 
 #define SUB_GARAGE_CMD "home/garage/command"
+
+// Strings we switchs on (see Switchs.h). Run tools/switchs_labels.py to get
+// the hash for a new one, the build checks them.
+#define GARAGE_SWITCHS_LABELS(X) \
+	X(PUB_GARAGE_GENERAL, PUB_GARAGE_GENERAL, 0x609cf341) \
+	X(PUB_GARAGE_SENSOR, PUB_GARAGE_SENSOR, 0x583c5055) \
+	X(PUB_GARAGE_DEBUG, PUB_GARAGE_DEBUG, 0x2a4d4092) \
+	X(PUB_GARAGE_STATUS, PUB_GARAGE_STATUS, 0x1dd0bb0d) \
+	X(ONLINE, "online", 0x0f73308a) \
+	X(OFFLINE, "offline", 0x6c8b9928) \
+	X(OPENED, "opened", 0x48f069e0) \
+	X(CLOSED, "closed", 0x6bee50c5) \
+	X(BOOTING, "booting", 0x1daa2e2b) \
+	X(CALIBRATING, "calibrating", 0x3f5b0605)
+
+// Name we track our commands under (see CommandTracker.h)
+#define GARAGE_CMD_OWNER "garage"
 /*-----------------------------------------------------------------------------
 --|
 --| Types
@@ -87,11 +108,21 @@ typedef struct
 
 }garageSensorDoorModel_t;
 
+// Outcome of the last cloud command (reported back to the shadow)
+typedef struct
+{
+	unsigned id; // Correlation ID from the command tracker
+	unsigned timestamp; // "timestamp" the cloud sent with the command
+	cmdOutcome_enumType outcome;
+	unsigned latencyMs; // Command received -> door confirmed moving
+} garageCmdModel_t;
+
 // Our virtual representation of the garage monitor HW
 typedef struct
 {
 	garageSensorDebugModel_t debug;
 	garageSensorDoorModel_t sensor;
+	garageCmdModel_t cmd;
 } garageShadow_t;
 
 /*-----------------------------------------------------------------------------
@@ -99,6 +130,8 @@ typedef struct
 --| Private Data
 --|
 -----------------------------------------------------------------------------*/
+SWITCHS_LABELS(GARAGE_SWITCHS_LABELS)
+
 static garageShadow_t virtualGarageShadow = {{0,0,0},{BOOTING,DOOR_UNKNOWN}};
 
  // Data for AWS IOT
@@ -173,13 +206,124 @@ static const jsonStruct_t dbgWcf = {
  		 SHADOW_JSON_UINT32,
  		 NULL,
   };
-// To see if we lost connection with our hw
-static time_t timeOfLastPing = 0;
+static const jsonStruct_t cmdId = {
+ 		 "cmdId",
+ 		 &virtualGarageShadow.cmd.id,
+ 		 sizeof(unsigned),
+ 		 SHADOW_JSON_UINT32,
+ 		 NULL,
+  };
+static const jsonStruct_t cmdTimestamp = {
+ 		 "cmdTimestamp",
+ 		 &virtualGarageShadow.cmd.timestamp,
+ 		 sizeof(unsigned),
+ 		 SHADOW_JSON_UINT32,
+ 		 NULL,
+  };
+static const jsonStruct_t cmdOutcome = {
+ 		 "cmdOutcome",
+ 		 &virtualGarageShadow.cmd.outcome,
+ 		 sizeof(unsigned),
+ 		 SHADOW_JSON_INT32,
+ 		 NULL,
+  };
+static const jsonStruct_t cmdLatency = {
+ 		 "cmdLatencyMs",
+ 		 &virtualGarageShadow.cmd.latencyMs,
+ 		 sizeof(unsigned),
+ 		 SHADOW_JSON_UINT32,
+ 		 NULL,
+  };
+// To see if we lost connection with our hw. Learns how often it talks.
+static liveness_structType garageLiveness;
+// Pinged from the LAN MQTT thread, expired from the main loop
+static pthread_mutex_t garageLivenessLock = PTHREAD_MUTEX_INITIALIZER;
+// Fallback for the HW going quiet without the broker noticing (its last will
+// only goes out once the keepalive runs out)
+static deadline_structType garageDeadline;
 /*------------------------------------------------------------------------------
 --|
 --| Private Function Bodies
 --|
 ------------------------------------------------------------------------------*/
+// Command tracker is done with one of our commands. Let the cloud know how it
+// went.
+static void garageCmdDone(const cmdResult_structType *result)
+{
+	virtualGarageShadow.cmd.id = result->id;
+	virtualGarageShadow.cmd.timestamp = (unsigned)(uintptr_t)result->context;
+	virtualGarageShadow.cmd.outcome = result->outcome;
+	virtualGarageShadow.cmd.latencyMs = result->actuationMs;
+
+	PublishToAWS(4, &cmdId, &cmdTimestamp, &cmdOutcome, &cmdLatency);
+}
+// Must hold garageLivenessLock. Works out if the HW is dead and moves the
+// fallback deadline to when we'd next need to look.
+static bool garageEvaluateLocked(uint64_t nowMs)
+{
+	bool isDead = LivenessCheck(&garageLiveness, nowMs);
+
+	// Once it's dead there is nothing to wait for, it has to talk to us first
+	if (isDead)
+		DeadlineCancel(&garageDeadline);
+	else
+		DeadlineArm(&garageDeadline,
+				garageLiveness.lastPingMs + LivenessThresholdMs(&garageLiveness));
+	return isDead;
+}
+// HW sent us something
+static void garageHeardFrom(void)
+{
+	pthread_mutex_lock(&garageLivenessLock);
+	uint64_t nowMs = MonotonicMs();
+	LivenessPing(&garageLiveness, nowMs);
+	bool isDead = garageEvaluateLocked(nowMs);
+	pthread_mutex_unlock(&garageLivenessLock);
+
+	ReportModuleHealth(MODULE_GARAGE, isDead);
+}
+// HW (or the broker on its behalf) told us whether it's there
+static void garageStatusChanged(bool isDead)
+{
+	pthread_mutex_lock(&garageLivenessLock);
+	uint64_t nowMs = MonotonicMs();
+	LivenessSetDead(&garageLiveness, isDead, nowMs);
+	isDead = garageEvaluateLocked(nowMs);
+	pthread_mutex_unlock(&garageLivenessLock);
+
+	ReportModuleHealth(MODULE_GARAGE, isDead);
+}
+// Haven't heard from the HW in a while
+static void garageDeadlineExpired(void *context)
+{
+	pthread_mutex_lock(&garageLivenessLock);
+	bool isDead = garageEvaluateLocked(MonotonicMs());
+	pthread_mutex_unlock(&garageLivenessLock);
+
+	ReportModuleHealth(MODULE_GARAGE, isDead);
+}
+// Send a command down to the real hardware and start tracking it
+static void sendGarageCmd(const char *cmd, doorState_enumType expected,
+		unsigned cloudTimestamp)
+{
+	uint32_t id = CmdTrackerBegin(GARAGE_CMD_OWNER, expected, garageCmdDone,
+			(void *)(uintptr_t)cloudTimestamp);
+
+	int token = PublishToLAN(SUB_GARAGE_CMD, cmd);
+	if (id == 0)
+		return; // Tracker full, command still goes out untracked
+	if (token < 0)
+	{
+		CmdTrackerFailed(id);
+		return;
+	}
+	CmdTrackerSetToken(id, token);
+
+	// Door is already where the command wants it, so no sensor change is
+	// coming to confirm it
+	if (virtualGarageShadow.sensor.doorState == expected)
+		CmdTrackerConfirm(GARAGE_CMD_OWNER, expected);
+}
 // Update the internal representation fo the debug info
 static bool updateDebugModelGarage(char *message){
 	printf("%s!\n", message);
@@ -298,10 +442,10 @@ static bool updateSensorModelGarage(char *message)
 				// Syntactic sugar (see switchs.h)
 				switchs(token)
 						{
-						icases("opened")
+						icases(OPENED)
 							doorState = DOOR_OPENED;
 							break;
-						icases("closed")
+						icases(CLOSED)
 							doorState = DOOR_CLOSED;
 							break;
 						defaults
@@ -314,10 +458,10 @@ static bool updateSensorModelGarage(char *message)
 				// Syntactic sugar (see switchs.h)
 				switchs(token)
 						{
-						icases("booting")
+						icases(BOOTING)
 							sysState = BOOTING;
 							break;
-						icases("calibrating")
+						icases(CALIBRATING)
 							sysState = CALIBRATING;
 							break;
 						defaults
@@ -338,6 +482,10 @@ static bool updateSensorModelGarage(char *message)
 		(virtualGarageShadow.sensor.sysState != sysState))
 		updateWasNeeded = true;
 
+	// Door moved, which may be what a pending command was waiting for
+	if (virtualGarageShadow.sensor.doorState != doorState)
+		CmdTrackerConfirm(GARAGE_CMD_OWNER, doorState);
+
 	// Update it regardless
 	virtualGarageShadow.sensor.doorState = doorState;
 	virtualGarageShadow.sensor.sysState = sysState;
@@ -366,12 +514,13 @@ extern stringList_structType* GarageGetTopics(topicType_enumType type)
 		retVal->topicList[0] = SUB_GARAGE_CMD;
 		break;
 	case MODULE_PUBLISHES:
-		retVal->numTopics = 3;
+		retVal->numTopics = 4;
 		retVal->topicList = malloc(retVal->numTopics * sizeof(char*));
 
 		retVal->topicList[0] = PUB_GARAGE_GENERAL;
 		retVal->topicList[1] = PUB_GARAGE_SENSOR;
 		retVal->topicList[2] = PUB_GARAGE_DEBUG;
+		retVal->topicList[3] = PUB_GARAGE_STATUS;
 		break;
 	default :
 		// Caller should never do this
@@ -412,6 +561,22 @@ extern int GarageHandleDataFromHW(char *topicName, char *message)
 			icases(PUB_GARAGE_GENERAL)
 				// Ignore for now
 				break;
+			icases(PUB_GARAGE_STATUS)
+				// Not the HW talking (may well be the broker reading out its
+				// will), so this doesn't count as a ping below
+				switchs(message)
+						{
+						icases(ONLINE)
+							garageStatusChanged(false);
+							break;
+						icases(OFFLINE)
+							garageStatusChanged(true);
+							break;
+						defaults
+							// Retained status cleared, nothing to go on
+							break;
+						}switchs_end;
+				return retVal;
 			defaults
 				retVal = MSG_NOT_HANDLED;
 				break;
@@ -438,10 +603,39 @@ extern int GarageHandleDataFromHW(char *topicName, char *message)
 	}
 
 	// Update time of last ping so we know if we died
-	timeOfLastPing = time(NULL);
+	garageHeardFrom();
 	return retVal;
 
 }
+// Handle a message the hardware already sent us (same topic, same payload)
+extern int GarageHandleRepeatFromHW(char *topicName, char *message)
+{
+	// MQTT API dictates we return the  following
+	const int MSG_NOT_HANDLED = 0;
+	const int MSG_HANDLED = 1;
+
+	int retVal = MSG_HANDLED;
+	// Syntactic sugar (see switchs.h)
+	switchs(topicName)
+			{
+			icases(PUB_GARAGE_STATUS)
+				// Same status can still mean something new: "online" again
+				// after the deadline gave up on the HW brings it back
+				retVal = GarageHandleDataFromHW(topicName, message);
+				break;
+			icases(PUB_GARAGE_DEBUG)
+			icases(PUB_GARAGE_SENSOR)
+			icases(PUB_GARAGE_GENERAL)
+				// Shadow can't have changed, but the HW is clearly alive
+				garageHeardFrom();
+				break;
+			defaults
+				retVal = MSG_NOT_HANDLED;
+				break;
+			}switchs_end;
+
+	return retVal;
+}
 // Handle data coming from the cloud to this module
 extern void GarageHandleDataFromAWS(const char *pJsondataFromAWS) {
 	jsmn_parser parser;
@@ -488,25 +682,27 @@ extern void GarageHandleDataFromAWS(const char *pJsondataFromAWS) {
 		// If 'close' command, send it down to the real hardware
 		if (openVal == 0)
 		{
-			PublishToLAN(SUB_GARAGE_CMD, "close");
+			sendGarageCmd("close", DOOR_CLOSED, currentTimestamp);
 			printf("Publishing close\n");
 
 		}
 		// If 'open' command, send it down to the real hardware
 		if (openVal == 1)
 		{
-			PublishToLAN(SUB_GARAGE_CMD, "open");
+			sendGarageCmd("open", DOOR_OPENED, currentTimestamp);
 			printf("Publishing open\n");
 		}
 		cmdTimestamp = currentTimestamp;
 	}
 }
 
-// Returns true if HW hasn't responded in its alloted time
-extern bool GarageCheckIfDeadHW()
+// Health is event driven: the HW's status topic and its messages report it as
+// they come in. The deadline only catches the HW going quiet (how long that
+// takes adapts to how often it normally talks, see Liveness.h).
+extern void GarageInit(void)
 {
-
-	return (difftime(time(NULL), timeOfLastPing)  > TIMEOUT_IN_S);
-
-
+	DeadlineInit(&garageDeadline, garageDeadlineExpired, NULL);
+	// Give the HW (or its retained status) a chance to show up first
+	DeadlineArm(&garageDeadline,
+			MonotonicMs() + LivenessThresholdMs(&garageLiveness));
 }
@@ -49,6 +49,11 @@ extern void GarageHandleDataFromAWS(const char *pJsondataFromAWS);
 // Input from actual hardware
 extern int GarageHandleDataFromHW(char *topicName, char *message);
 
+// Hardware repeated its last message on this topic word for word. Nothing to
+// parse, just note that it is still alive. Status messages are handled in full
+// every time, hence 'message'. Returns same as above.
+extern int GarageHandleRepeatFromHW(char *topicName, char *message);
+
 // This is the function our MQTT manager will call to figure out what we
 // care to receive and publish fromt he MQTT interface. It will handle all of
 // that work for us. This keeps this module from having to know the specifics
@@ -56,8 +61,9 @@ extern int GarageHandleDataFromHW(char *topicName, char *message);
 extern stringList_structType* GarageGetTopics(topicType_enumType type);
 extern void GarageGetTopics_free(stringList_structType *ret);
 
-// Check if HW is alive
-extern bool GarageCheckIfDeadHW();
+// Call once before the LAN connection comes up. Starts watching HW health,
+// which is then reported to the manager as it changes.
+extern void GarageInit(void);
 
 
 #endif /* GARAGESHADOW_GARAGESHADOW_H_ */
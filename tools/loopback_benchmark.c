@@ -0,0 +1,369 @@
+/*
+ * loopback_benchmark.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Lenny
+ *
+ * Microbenchmarks for the MQTT and shadow hot paths over the in-process
+ * loopback network (platform/linux/loopback). No socket and no broker, so
+ * runs are comparable from one build to the next. Reports the time and the
+ * heap allocations of each operation.
+ *
+ * Build it with the SDK sources, the loopback backend and an aws_iot_config.h:
+ *
+ *   gcc -O2 -D_GNU_SOURCE -DIOT_NETWORK_BACKEND_LOOPBACK -I<dir of aws_iot_config.h> \
+ *       -IAWS_IOT_Stuff/AWS_IOT_Includes \
+ *       -Iplatform/linux/loopback -Iplatform/linux/common -Iexternal_libs/jsmn \
+ *       <every .c file in AWS_IOT_Stuff/AWS_IOT_Source> platform/linux/common/timer.c \
+ *       platform/linux/loopback/network_loopback_wrapper.c external_libs/jsmn/jsmn.c \
+ *       tools/loopback_benchmark.c -o loopback_benchmark
+ *
+ *   ./loopback_benchmark [iterations]
+ *
+ * Allocations are counted by wrapping malloc and friends, which needs glibc.
+ */
+
+/*-----------------------------------------------------------------------------
+--|
+--| Includes
+--|
+-----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aws_iot_mqtt_client_interface.h"
+#include "aws_iot_shadow_interface.h"
+#include "network_interface.h"
+
+/*-----------------------------------------------------------------------------
+--|
+--| Defines
+--|
+-----------------------------------------------------------------------------*/
+#define DEFAULT_ITERATIONS 100000
+// Operations between drains of what the client wrote, the ring holds IOT_LOOPBACK_RING_LEN
+#define BATCH_LEN 16
+#define BENCH_TOPIC "bench/topic"
+#define BENCH_PAYLOAD_LEN 100
+#define BENCH_THING "bench"
+#define BENCH_DELTA_TOPIC "$aws/things/" BENCH_THING "/shadow/update/delta"
+#define BENCH_DELTA "{\"version\":7,\"timestamp\":1600000000,\"state\":{\"door\":1},\"metadata\":{\"door\":{\"timestamp\":1600000000}}}"
+
+/*-----------------------------------------------------------------------------
+--|
+--| Types
+--|
+-----------------------------------------------------------------------------*/
+typedef struct {
+	AWS_IoT_Client *pClient;
+	IoT_Publish_Message_Params params;
+	uint32_t received;
+	uint32_t completed;
+} benchContext_structType;
+
+// One operation. Returns non zero if it failed
+typedef int (*benchOp_t)(benchContext_structType *pCtx);
+
+/*-----------------------------------------------------------------------------
+--|
+--| Variables
+--|
+-----------------------------------------------------------------------------*/
+static AWS_IoT_Client mqttClient;
+static AWS_IoT_Client shadowClient;
+static char benchPayload[BENCH_PAYLOAD_LEN];
+static int32_t doorValue;
+
+// Allocation counting, only while an operation runs
+static volatile bool isCounting = false;
+static volatile unsigned long allocCount = 0;
+
+/*-----------------------------------------------------------------------------
+--|
+--| Allocation counting
+--|
+-----------------------------------------------------------------------------*/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+	if (isCounting) {
+		allocCount++;
+	}
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+	if (isCounting) {
+		allocCount++;
+	}
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (isCounting) {
+		allocCount++;
+	}
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+
+/*-----------------------------------------------------------------------------
+--|
+--| Harness
+--|
+-----------------------------------------------------------------------------*/
+static double nowNs(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+// Throw away what the client sent so the ring never fills
+static void drain(AWS_IoT_Client *pClient) {
+	unsigned char scratch[IOT_LOOPBACK_RING_LEN];
+	size_t takenLen;
+
+	(void) iot_loopback_take(&(pClient->networkStack), scratch, sizeof(scratch), &takenLen);
+}
+
+// Runs op iterations times in batches, draining between batches outside the measurement.
+// Each call of op counts as opsPerCall operations
+static void runBenchmark(const char *pName, benchOp_t op, benchContext_structType *pCtx, uint32_t iterations,
+						 uint32_t opsPerCall) {
+	uint32_t done, batchItr;
+	unsigned long allocs = 0;
+	double elapsedNs = 0;
+	double start;
+
+	for (done = 0; done < iterations; done += BATCH_LEN) {
+		drain(pCtx->pClient);
+
+		allocCount = 0;
+		isCounting = true;
+		start = nowNs();
+		for (batchItr = 0; batchItr < BATCH_LEN && done + batchItr < iterations; batchItr++) {
+			if (0 != op(pCtx)) {
+				isCounting = false;
+				printf("%-28s failed after %u\n", pName, done + batchItr);
+				return;
+			}
+		}
+		elapsedNs += nowNs() - start;
+		isCounting = false;
+		allocs += allocCount;
+	}
+
+	printf("%-28s %10.0f ns/op %8.2f allocs/op\n", pName, elapsedNs / ((double) iterations * opsPerCall),
+		   (double) allocs / ((double) iterations * opsPerCall));
+}
+
+/*-----------------------------------------------------------------------------
+--|
+--| Operations
+--|
+-----------------------------------------------------------------------------*/
+static void onMessage(AWS_IoT_Client *pClient, char *pTopicName, uint16_t topicNameLen,
+					  IoT_Publish_Message_Params *pParams, void *pData) {
+	benchContext_structType *pCtx = (benchContext_structType *) pData;
+
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(pTopicName);
+	IOT_UNUSED(topicNameLen);
+	IOT_UNUSED(pParams);
+
+	pCtx->received++;
+}
+
+static void onPublishComplete(AWS_IoT_Client *pClient, uint16_t packetId, IoT_Error_t rc, void *pData) {
+	benchContext_structType *pCtx = (benchContext_structType *) pData;
+
+	IOT_UNUSED(pClient);
+	IOT_UNUSED(packetId);
+	IOT_UNUSED(rc);
+
+	pCtx->completed++;
+}
+
+static void onDoor(const char *pJsonValueBuffer, uint32_t valueLength, jsonStruct_t *pContext) {
+	IOT_UNUSED(pJsonValueBuffer);
+	IOT_UNUSED(valueLength);
+	IOT_UNUSED(pContext);
+}
+
+static int opPublishQos0(benchContext_structType *pCtx) {
+	pCtx->params.qos = QOS0;
+	return SUCCESS != aws_iot_mqtt_publish(pCtx->pClient, BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1, &(pCtx->params));
+}
+
+// Waits for the PUBACK the broker end answers with straight away
+static int opPublishQos1(benchContext_structType *pCtx) {
+	pCtx->params.qos = QOS1;
+	return SUCCESS != aws_iot_mqtt_publish(pCtx->pClient, BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1, &(pCtx->params));
+}
+
+static int opDeliverQos0(benchContext_structType *pCtx) {
+	uint32_t before = pCtx->received;
+
+	(void) iot_loopback_inject_publish(&(pCtx->pClient->networkStack), BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1, 0, 0,
+									   benchPayload, sizeof(benchPayload));
+	return SUCCESS != aws_iot_mqtt_yield(pCtx->pClient, 0) || before == pCtx->received;
+}
+
+// Includes sending the PUBACK
+static int opDeliverQos1(benchContext_structType *pCtx) {
+	uint32_t before = pCtx->received;
+
+	(void) iot_loopback_inject_publish(&(pCtx->pClient->networkStack), BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1, 1,
+									   (uint16_t) (before % 65535 + 1), benchPayload, sizeof(benchPayload));
+	return SUCCESS != aws_iot_mqtt_yield(pCtx->pClient, 0) || before == pCtx->received;
+}
+
+// Fills the in-flight table, then matches a PUBACK to each entry in one yield. One op per PUBACK
+static int opAckMatching(benchContext_structType *pCtx) {
+	uint16_t packetIds[AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH];
+	uint32_t itr, before = pCtx->completed;
+
+	pCtx->params.qos = QOS1;
+	for (itr = 0; itr < AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; itr++) {
+		if (SUCCESS != aws_iot_mqtt_publish_async(pCtx->pClient, BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1,
+												  &(pCtx->params), onPublishComplete, pCtx)) {
+			return 1;
+		}
+		packetIds[itr] = pCtx->params.id;
+	}
+	// Acknowledged newest first, so the match isn't always on the first entry
+	for (itr = AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH; itr > 0; itr--) {
+		(void) iot_loopback_inject_puback(&(pCtx->pClient->networkStack), packetIds[itr - 1]);
+	}
+	if (SUCCESS != aws_iot_mqtt_yield(pCtx->pClient, 0)) {
+		return 1;
+	}
+	return before + AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH != pCtx->completed;
+}
+
+static int opShadowDelta(benchContext_structType *pCtx) {
+	(void) iot_loopback_inject_publish(&(pCtx->pClient->networkStack), BENCH_DELTA_TOPIC,
+									   sizeof(BENCH_DELTA_TOPIC) - 1, 1, 1, BENCH_DELTA, sizeof(BENCH_DELTA) - 1);
+	return SUCCESS != aws_iot_shadow_yield(pCtx->pClient, 0);
+}
+
+/*-----------------------------------------------------------------------------
+--|
+--| Setup
+--|
+-----------------------------------------------------------------------------*/
+static IoT_Error_t setupMqtt(benchContext_structType *pCtx) {
+	IoT_Client_Init_Params initParams = iotClientInitParamsDefault;
+	IoT_Client_Connect_Params connectParams = iotClientConnectParamsDefault;
+	IoT_Error_t rc;
+
+	initParams.pHostURL = "loopback";
+	initParams.port = 1;
+	initParams.enableAutoReconnect = false;
+	rc = aws_iot_mqtt_init(&mqttClient, &initParams);
+	if (SUCCESS != rc) {
+		return rc;
+	}
+
+	connectParams.pClientID = "bench";
+	connectParams.clientIDLen = (uint16_t) strlen("bench");
+	iot_loopback_set_auto_reply(&(mqttClient.networkStack), true);
+	rc = aws_iot_mqtt_connect(&mqttClient, &connectParams);
+	if (SUCCESS != rc) {
+		return rc;
+	}
+
+	memset(pCtx, 0, sizeof(*pCtx));
+	pCtx->pClient = &mqttClient;
+	pCtx->params.payload = benchPayload;
+	pCtx->params.payloadLen = sizeof(benchPayload);
+	return aws_iot_mqtt_subscribe(&mqttClient, BENCH_TOPIC, sizeof(BENCH_TOPIC) - 1, QOS1, onMessage, pCtx);
+}
+
+static IoT_Error_t setupShadow(benchContext_structType *pCtx) {
+	static jsonStruct_t door = { "door", &doorValue, sizeof(int32_t), SHADOW_JSON_INT32, onDoor };
+	ShadowInitParameters_t initParams = ShadowInitParametersDefault;
+	ShadowConnectParameters_t connectParams = ShadowConnectParametersDefault;
+	IoT_Error_t rc;
+
+	initParams.pHost = "loopback";
+	initParams.port = 1;
+	initParams.enableAutoReconnect = false;
+	rc = aws_iot_shadow_init(&shadowClient, &initParams);
+	if (SUCCESS != rc) {
+		return rc;
+	}
+
+	connectParams.pMyThingName = BENCH_THING;
+	connectParams.pMqttClientId = "bench-shadow";
+	connectParams.mqttClientIdLen = (uint16_t) strlen("bench-shadow");
+	iot_loopback_set_auto_reply(&(shadowClient.networkStack), true);
+	rc = aws_iot_shadow_connect(&shadowClient, &connectParams);
+	if (SUCCESS != rc) {
+		return rc;
+	}
+
+	// Every delta carries the same version, dispatch is what's measured
+	aws_iot_shadow_disable_discard_old_delta_msgs();
+
+	memset(pCtx, 0, sizeof(*pCtx));
+	pCtx->pClient = &shadowClient;
+	return aws_iot_shadow_register_delta(&shadowClient, &door);
+}
+
+/*-----------------------------------------------------------------------------
+--|
+--| Main
+--|
+-----------------------------------------------------------------------------*/
+int main(int argc, char **argv) {
+	benchContext_structType ctx;
+	uint32_t iterations = DEFAULT_ITERATIONS;
+	IoT_Error_t rc;
+
+	if (argc > 1) {
+		iterations = (uint32_t) strtoul(argv[1], NULL, 10);
+	}
+	if (0 == iterations) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+	memset(benchPayload, 'x', sizeof(benchPayload));
+
+	rc = setupMqtt(&ctx);
+	if (SUCCESS != rc) {
+		fprintf(stderr, "MQTT setup failed: %d\n", rc);
+		return 1;
+	}
+
+	runBenchmark("publish qos0", opPublishQos0, &ctx, iterations, 1);
+	runBenchmark("publish qos1", opPublishQos1, &ctx, iterations, 1);
+	runBenchmark("deliver qos0", opDeliverQos0, &ctx, iterations, 1);
+	runBenchmark("deliver qos1", opDeliverQos1, &ctx, iterations, 1);
+
+	// Nothing may answer the publishes but the PUBACKs the operation queues itself
+	iot_loopback_set_auto_reply(&(mqttClient.networkStack), false);
+	runBenchmark("ack matching", opAckMatching, &ctx, iterations / AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH + 1,
+				 AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISH);
+	(void) aws_iot_mqtt_disconnect(&mqttClient);
+
+	rc = setupShadow(&ctx);
+	if (SUCCESS != rc) {
+		fprintf(stderr, "Shadow setup failed: %d\n", rc);
+		return 1;
+	}
+
+	runBenchmark("shadow delta dispatch", opShadowDelta, &ctx, iterations, 1);
+	(void) aws_iot_shadow_disconnect(&shadowClient);
+
+	return 0;
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+#
+# switchs_labels.py
+#
+#  Created on: Oct 19, 2026
+#      Author: Lenny
+#
+# Companion to src/Switchs.h. Case labels there carry their hash as a literal
+# (C can't hash a string at compile time), so this runs as a pre-build step
+# and fails the build if any of them is wrong.
+#
+#   switchs_labels.py --check <dir>   check every *_SWITCHS_LABELS list
+#   switchs_labels.py <string>...     print the hash to paste into a list
+
+import os
+import re
+import sys
+
+DEFINE_RE = re.compile(r'^\s*#\s*define\s+(\w+)\s+"((?:[^"\\]|\\.)*)"\s*$')
+LIST_RE = re.compile(r'^\s*#\s*define\s+(\w+_SWITCHS_LABELS)\s*\(\s*X\s*\)')
+LABEL_RE = re.compile(
+    r'X\(\s*(\w+)\s*,\s*(\w+|"(?:[^"\\]|\\.)*")\s*,\s*(0[xX][0-9a-fA-F]+|\d+)[uU]?\s*\)')
+
+
+def switchs_hash(s):
+    # Must match switchsHash() in Switchs.h
+    h = 2166136261
+    for c in s.encode():
+        if ord('A') <= c <= ord('Z'):
+            c += ord('a') - ord('A')
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    h &= 0x7fffffff
+    return h if h else 1
+
+
+def unquote(literal):
+    return bytes(literal[1:-1], 'utf-8').decode('unicode_escape')
+
+
+def check_file(path):
+    errors = []
+    with open(path) as f:
+        lines = f.read().split('\n')
+
+    strings = {}
+    for line in lines:
+        m = DEFINE_RE.match(line)
+        if m:
+            strings[m.group(1)] = unquote('"' + m.group(2) + '"')
+
+    i = 0
+    while i < len(lines):
+        m = LIST_RE.match(lines[i])
+        if not m:
+            i += 1
+            continue
+        listName = m.group(1)
+        seen = {}
+        # Walk the macro's continuation lines
+        while True:
+            lineNo = i + 1
+            for name, value, hashText in LABEL_RE.findall(lines[i]):
+                if value.startswith('"'):
+                    text = unquote(value)
+                elif value in strings:
+                    text = strings[value]
+                else:
+                    errors.append('%s:%d: error: %s: can\'t resolve %s to a '
+                                  'string literal' % (path, lineNo, listName,
+                                                      value))
+                    continue
+                expected = switchs_hash(text)
+                if int(hashText, 0) != expected:
+                    errors.append('%s:%d: error: %s: hash for "%s" should be '
+                                  '0x%08x' % (path, lineNo, name, text,
+                                              expected))
+                if expected in seen and seen[expected] != text.lower():
+                    errors.append('%s:%d: error: %s: "%s" collides with "%s"'
+                                  % (path, lineNo, listName, text,
+                                     seen[expected]))
+                seen[expected] = text.lower()
+            if not lines[i].rstrip().endswith('\\'):
+                break
+            i += 1
+        i += 1
+    return errors
+
+
+def main(argv):
+    if len(argv) == 3 and argv[1] == '--check':
+        errors = []
+        for root, dirs, files in os.walk(argv[2]):
+            for name in sorted(files):
+                if name.endswith(('.c', '.h')):
+                    errors += check_file(os.path.join(root, name))
+        for error in errors:
+            print(error, file=sys.stderr)
+        return 1 if errors else 0
+
+    if len(argv) < 2:
+        print('usage: %s --check <dir> | <string>...' % argv[0],
+              file=sys.stderr)
+        return 2
+
+    for s in argv[1:]:
+        print('0x%08x  "%s"' % (switchs_hash(s), s))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))